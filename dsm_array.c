@@ -110,6 +110,17 @@ init_dsm_segment(size_t blocks_count, size_t block_size)
 		dsm_cfg->blocks_count = blocks_count;
 		init_dsm_table(block_size, 0, dsm_cfg->blocks_count);
 		ret = true;
+
+		/*
+		 * Keep segment till the server shutdown. Otherwise it would be
+		 * destroyed as soon as the last session detaches it and the cache
+		 * would have to be loaded again
+		 */
+#if PG_VERSION_NUM >= 90600
+		dsm_pin_segment(segment);
+#else
+		dsm_keep_segment(segment);
+#endif
 	}
 
 	/*
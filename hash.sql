@@ -15,18 +15,19 @@ CREATE OR REPLACE FUNCTION @extschema@.create_hash_partitions(
 	relation TEXT
 	, attribute TEXT
 	, partitions_count INTEGER
+	, p_partition_data BOOLEAN DEFAULT TRUE
 ) RETURNS INTEGER AS
 $$
 DECLARE
 	v_type TEXT;
 BEGIN
 	relation := @extschema@.validate_relname(relation);
-	attribute := lower(attribute);
+	attribute := @extschema@.normalize_partitioning_key(relation, attribute);
 	PERFORM @extschema@.common_relation_checks(relation, attribute);
 
 	v_type := @extschema@.get_attribute_type_name(relation, attribute);
-	IF v_type::regtype != 'integer'::regtype THEN
-		RAISE EXCEPTION 'Attribute type must be INTEGER';
+	IF NOT @extschema@.is_type_hashable(v_type::regtype) THEN
+		RAISE EXCEPTION 'Attribute type % has no hash function', v_type;
 	END IF;
 
 	/* Create partitions and update pg_pathman configuration */
@@ -40,12 +41,15 @@ BEGIN
 						, relation
 						, partnum);
 
-		EXECUTE format('ALTER TABLE %s_%s ADD CHECK (%s %% %s = %s)'
+		EXECUTE format('ALTER TABLE %s_%s ADD CHECK (@extschema@.get_hash(%s, %s) = %s)'
 					   , relation
 					   , partnum
 					   , attribute
 					   , partitions_count
 					   , partnum);
+
+		INSERT INTO @extschema@.pathman_partition_bounds (partition, parent, hash_idx)
+		VALUES (format('%s_%s', relation, partnum)::regclass, relation::regclass, partnum);
 	END LOOP;
 	INSERT INTO @extschema@.pathman_config (relname, attname, parttype)
 	VALUES (relation, attribute, 1);
@@ -59,12 +63,225 @@ BEGIN
 	PERFORM @extschema@.on_create_partitions(relation::regclass::oid);
 
 	/* Copy data */
-	PERFORM @extschema@.partition_data(relation);
+	IF p_partition_data THEN
+		PERFORM @extschema@.partition_data(relation);
+	END IF;
 
 	RETURN partitions_count;
 END
 $$ LANGUAGE plpgsql;
 
+/*
+ * Doubles the number of HASH partitions. Partition N + k is created for every
+ * partition k so that rows of partition k are split between the two of them.
+ * New rows are routed to the new partitions right away while existing ones are
+ * moved by background worker (see resume_hash_split()); till then queries
+ * scan both partitions. Returns new number of partitions
+ */
+CREATE OR REPLACE FUNCTION @extschema@.split_hash_partitions(
+	relation TEXT)
+RETURNS INTEGER AS
+$$
+DECLARE
+	v_attname TEXT;
+	v_split_pos INTEGER;
+	v_count INTEGER;
+	v_update_trigger BOOLEAN;
+BEGIN
+	relation := @extschema@.validate_relname(relation);
+
+	SELECT attname, hash_split_pos INTO v_attname, v_split_pos
+	FROM @extschema@.pathman_config
+	WHERE relname = relation AND parttype = 1;
+
+	IF v_attname IS NULL THEN
+		RAISE EXCEPTION 'Relation "%" isn''t partitioned by HASH', relation;
+	END IF;
+
+	IF v_split_pos IS NOT NULL THEN
+		RAISE EXCEPTION 'Partitions of relation "%" are already being split', relation;
+	END IF;
+
+	/* Wait for running inserts so that nobody uses the old insert trigger */
+	EXECUTE format('LOCK TABLE %s IN SHARE ROW EXCLUSIVE MODE', relation);
+
+	v_count := COUNT(*) FROM pg_inherits WHERE inhparent = relation::regclass::oid;
+	v_update_trigger := to_regprocedure(format('%s_update_trigger_func()', relation)) IS NOT NULL;
+
+	/* Old partitions are looked up by their numbers while being split */
+	PERFORM @extschema@.fill_hash_partition_bounds(relation::regclass, v_attname);
+	IF (SELECT COUNT(DISTINCT hash_idx) FROM @extschema@.pathman_partition_bounds
+		WHERE parent = relation::regclass AND hash_idx < v_count) != v_count THEN
+		RAISE EXCEPTION 'Unable to determine numbers of partitions of relation "%"', relation;
+	END IF;
+
+	FOR partnum IN v_count..2 * v_count - 1
+	LOOP
+		EXECUTE format('CREATE TABLE %s_%s (LIKE %1$s INCLUDING ALL)'
+						, relation
+						, partnum);
+
+		EXECUTE format('ALTER TABLE %s_%s INHERIT %1$s'
+						, relation
+						, partnum);
+		PERFORM @extschema@.add_global_index_partition(relation::regclass,
+													   format('%s_%s', relation, partnum)::regclass);
+
+		EXECUTE format('ALTER TABLE %s_%s ADD CHECK (@extschema@.get_hash(%s, %s) = %s)'
+					   , relation
+					   , partnum
+					   , v_attname
+					   , 2 * v_count
+					   , partnum);
+
+		INSERT INTO @extschema@.pathman_partition_bounds (partition, parent, hash_idx)
+		VALUES (format('%s_%s', relation, partnum)::regclass, relation::regclass, partnum);
+	END LOOP;
+	UPDATE @extschema@.pathman_config SET hash_split_pos = 0
+	WHERE relname = relation;
+
+	/* Recreate triggers */
+	PERFORM @extschema@.create_hash_insert_trigger(relation, v_attname, 2 * v_count);
+	IF v_update_trigger THEN
+		PERFORM @extschema@.create_hash_update_trigger(relation);
+	END IF;
+
+	/* Notify backend about changes */
+	PERFORM @extschema@.on_update_partitions(relation::regclass::oid);
+
+	/* Move rows to the new partitions */
+	PERFORM @extschema@.resume_hash_split(relation::regclass);
+
+	RETURN 2 * v_count;
+END
+$$ LANGUAGE plpgsql;
+
+/*
+ * Partitions created by old versions of pg_pathman have no rows in
+ * pathman_partition_bounds. Takes their numbers from hash constraints
+ */
+CREATE OR REPLACE FUNCTION @extschema@.fill_hash_partition_bounds(
+	parent_relid REGCLASS
+	, p_attname TEXT)
+RETURNS VOID AS
+$$
+BEGIN
+	INSERT INTO @extschema@.pathman_partition_bounds (partition, parent, hash_idx)
+	SELECT DISTINCT ON (i.inhrelid) i.inhrelid::regclass, parent_relid,
+		   substring(pg_get_constraintdef(c.oid) from '=\s*(\d+)\)+$')::INTEGER
+	FROM pg_inherits i
+	JOIN pg_constraint c ON c.conrelid = i.inhrelid
+	JOIN pg_attribute a ON a.attrelid = c.conrelid
+	WHERE i.inhparent = parent_relid AND c.contype = 'c'
+	  AND c.conkey = ARRAY[a.attnum] AND a.attname = p_attname
+	  AND (pg_get_constraintdef(c.oid) LIKE '%get_hash(%'
+		   OR pg_get_constraintdef(c.oid) LIKE '%\%%')
+	  AND pg_get_constraintdef(c.oid) ~ '=\s*(\d+)\)+$'
+	ORDER BY i.inhrelid, c.oid
+	ON CONFLICT (partition) DO UPDATE SET hash_idx = EXCLUDED.hash_idx
+	WHERE @extschema@.pathman_partition_bounds.hash_idx IS NULL;
+END
+$$ LANGUAGE plpgsql;
+
+/*
+ * Called by background worker when the old partition with number
+ * hash_split_pos doesn't contain rows of the new one anymore. Replaces its
+ * constraint and advances hash_split_pos. Returns the next partition to
+ * process or NULL if split is finished
+ */
+CREATE OR REPLACE FUNCTION @extschema@.complete_hash_partition_split(
+	parent_relid OID)
+RETURNS REGCLASS AS
+$$
+DECLARE
+	v_relation TEXT;
+	v_attname TEXT;
+	v_split_pos INTEGER;
+	v_count INTEGER;
+	v_part REGCLASS;
+	v_conname TEXT;
+BEGIN
+	v_relation := @extschema@.validate_relname(parent_relid::regclass::text);
+
+	SELECT attname, hash_split_pos INTO v_attname, v_split_pos
+	FROM @extschema@.pathman_config WHERE relname = v_relation;
+
+	IF v_split_pos IS NULL THEN
+		RETURN NULL;
+	END IF;
+
+	v_count := COUNT(*) FROM pg_inherits WHERE inhparent = parent_relid;
+	SELECT partition INTO v_part FROM @extschema@.pathman_partition_bounds
+	WHERE parent = parent_relid AND hash_idx = v_split_pos;
+
+	/* Replace the hash constraint */
+	FOR v_conname IN (SELECT c.conname
+					  FROM pg_constraint c
+					  JOIN pg_attribute a ON a.attrelid = c.conrelid
+					  WHERE c.conrelid = v_part AND c.contype = 'c'
+						AND c.conkey = ARRAY[a.attnum] AND a.attname = v_attname
+						AND (pg_get_constraintdef(c.oid) LIKE '%get_hash(%'
+							 OR pg_get_constraintdef(c.oid) LIKE '%\%%'))
+	LOOP
+		EXECUTE format('ALTER TABLE %s DROP CONSTRAINT %I', v_part, v_conname);
+	END LOOP;
+	/*
+	 * Constraint is validated by the worker in a separate transaction (see
+	 * validate_hash_partition_split()), so that the partition isn't locked
+	 * exclusively while it is scanned. If the worker dies in between, the
+	 * constraint is validated after the next partition or by
+	 * resume_hash_split()
+	 */
+	EXECUTE format('ALTER TABLE %s ADD CHECK (@extschema@.get_hash(%s, %s) = %s) NOT VALID'
+				   , v_part
+				   , v_attname
+				   , v_count
+				   , v_split_pos);
+
+	v_split_pos := v_split_pos + 1;
+	IF v_split_pos >= v_count / 2 THEN
+		v_split_pos := NULL;
+	END IF;
+	UPDATE @extschema@.pathman_config SET hash_split_pos = v_split_pos
+	WHERE relname = v_relation;
+
+	/* Notify backend about changes */
+	PERFORM @extschema@.on_update_partitions(parent_relid);
+
+	RETURN partition FROM @extschema@.pathman_partition_bounds
+	WHERE parent = parent_relid AND hash_idx = v_split_pos;
+END
+$$ LANGUAGE plpgsql;
+
+/*
+ * Validates the constraints added by complete_hash_partition_split() to any
+ * partition of the relation, including the ones left by an interrupted
+ * split. It takes SHARE UPDATE EXCLUSIVE lock, so reads and writes aren't
+ * blocked. Returns the number of validated constraints
+ */
+CREATE OR REPLACE FUNCTION @extschema@.validate_hash_partition_split(
+	parent_relid OID)
+RETURNS INTEGER AS
+$$
+DECLARE
+	v_rec RECORD;
+	v_count INTEGER := 0;
+BEGIN
+	FOR v_rec IN (SELECT c.conrelid::regclass AS part, c.conname
+				  FROM pg_constraint c
+				  JOIN pg_inherits i ON i.inhrelid = c.conrelid
+				  WHERE i.inhparent = parent_relid AND c.contype = 'c'
+					AND NOT c.convalidated
+					AND pg_get_constraintdef(c.oid) LIKE '%get_hash(%')
+	LOOP
+		EXECUTE format('ALTER TABLE %s VALIDATE CONSTRAINT %I', v_rec.part, v_rec.conname);
+		v_count := v_count + 1;
+	END LOOP;
+
+	RETURN v_count;
+END
+$$ LANGUAGE plpgsql;
+
 /*
  * Creates hash trigger for specified relation
  */
@@ -81,7 +298,7 @@ DECLARE
 		DECLARE
 			hash INTEGER;
 		BEGIN
-			hash := NEW.%s %% %s;
+			hash := @extschema@.get_hash(%s, %s);
 			%s
 			RETURN NULL;
 		END $body$ LANGUAGE plpgsql;';
@@ -109,7 +326,8 @@ BEGIN
 						 , fields);
 
 	/* format and create new trigger for relation */
-	func := format(func, relation, attr, partitions_count, insert_stmt);
+	func := format(func, relation, @extschema@.get_key_accessor(relation, attr)
+				   , partitions_count, insert_stmt);
 	trigger := format(trigger, @extschema@.get_schema_qualified_name(relation::regclass), relation);
 	EXECUTE func;
 	EXECUTE trigger;
@@ -185,10 +403,10 @@ DECLARE
 		$body$
 		DECLARE old_hash INTEGER; new_hash INTEGER; q TEXT;
 		BEGIN
-			old_hash := OLD.%2$s %% %3$s;
-			new_hash := NEW.%2$s %% %3$s;
+			old_hash := @extschema@.get_hash(%8$s, %3$s);
+			new_hash := @extschema@.get_hash(%2$s, %3$s);
 			IF old_hash = new_hash THEN RETURN NEW; END IF;
-			q := format(''DELETE FROM %1$s_%%s WHERE %4$s'', old_hash);
+			q := format(''DELETE FROM %%I.%%I WHERE %4$s'', TG_TABLE_SCHEMA, TG_TABLE_NAME);
 			EXECUTE q USING %5$s;
 			q := format(''INSERT INTO %1$s_%%s VALUES (%6$s)'', new_hash);
 			EXECUTE q USING %7$s;
@@ -224,10 +442,19 @@ BEGIN
 
 	attr := attname FROM @extschema@.pathman_config WHERE relname = relation;
 	partitions_count := COUNT(*) FROM pg_inherits WHERE inhparent = relation::regclass::oid;
-	EXECUTE format(func, relation, attr, partitions_count, att_val_fmt,
-				   old_fields, att_fmt, new_fields);
+	EXECUTE format(func, relation, @extschema@.get_key_accessor(relation, attr)
+				   , partitions_count, att_val_fmt, old_fields, att_fmt, new_fields
+				   , @extschema@.get_key_accessor(relation, attr, 'OLD'));
 	FOR num IN 0..partitions_count-1
 	LOOP
+		/* Partitions may already have the trigger if they've been split */
+		IF EXISTS (SELECT * FROM pg_trigger
+				   WHERE tgrelid = format('%s_%s', relation, num)::regclass
+					 AND tgname = format('%s_%s_update_trigger'
+										 , @extschema@.get_schema_qualified_name(relation::regclass)
+										 , num)) THEN
+			CONTINUE;
+		END IF;
 		EXECUTE format(trigger
 					   , @extschema@.get_schema_qualified_name(relation::regclass)
 					   , num
@@ -14,25 +14,195 @@
 #include "catalog/pg_class.h"
 #include "catalog/pg_constraint.h"
 #include "catalog/pg_operator.h"
+#include "catalog/pg_inherits.h"
+#include "catalog/pg_extension.h"
+#include "catalog/indexing.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_collation.h"
+#include "commands/extension.h"
+#include "access/genam.h"
+#include "access/heapam.h"
 #include "access/htup_details.h"
+#include "access/sysattr.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/var.h"
+#include "parser/parse_func.h"
+#include "utils/fmgroids.h"
+#include "utils/formatting.h"
 #include "utils/syscache.h"
 #include "utils/builtins.h"
 #include "utils/typcache.h"
 #include "utils/lsyscache.h"
 #include "utils/bytea.h"
+#include "utils/array.h"
+#include "utils/datum.h"
 #include "utils/snapmgr.h"
+#include "utils/timestamp.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
+#include "access/xact.h"
+#include "storage/shmem.h"
 
 
 HTAB   *relations = NULL;
 HTAB   *range_restrictions = NULL;
+HTAB   *list_restrictions = NULL;
 bool	initialization_needed = true;
+bool	pathman_lazy_loading = false;
+int		pathman_max_relations = 1024;
 
-static FmgrInfo *qsort_type_cmp_func;
-static bool globalByVal;
+/* Partition bounds read from pathman_partition_bounds */
+typedef struct PartitionBounds
+{
+	Oid		child_oid;
+	Oid		parent_oid;
+	char   *lower;
+	char   *upper;
+	int		hash_idx;		/* -1 for RANGE partitions */
+	char  **list_values;	/* values of LIST partition */
+	int		list_nvalues;
+} PartitionBounds;
+
+/* Values of LIST partitions collected while loading constraints */
+typedef struct ListValues
+{
+	Datum  *values;
+	int	   *child_idxs;
+	int		count;
+	int		capacity;
+} ListValues;
+
+/* How range bounds are compared while sorting */
+typedef enum
+{
+	BOUND_CMP_GENERIC = 0,
+	BOUND_CMP_INT16,
+	BOUND_CMP_INT32,
+	BOUND_CMP_INT64
+} BoundCmpKind;
+
+typedef struct BoundCmpContext
+{
+	BoundCmpKind kind;
+	bool		by_val;
+	FmgrInfo   *cmp_func;
+} BoundCmpContext;
+
+/* How bounds of composite keys are compared, see prepare_composite_cmp() */
+typedef struct CompositeRangeEntry
+{
+	RangeEntry	re;
+	int64		bounds[RANGE_KEY_BOUNDS(PATHMAN_MAX_KEYS)];
+} CompositeRangeEntry;
+
+typedef struct CompositeCmpContext
+{
+	int			keys_count;
+	bool	   *by_val;
+	FmgrInfo   *cmp_funcs[PATHMAN_MAX_KEYS];
+} CompositeCmpContext;
+
+/* Relations invalidated since the last check (see pathman_relcache_hook()) */
+static HTAB *invalidated_relations = NULL;
+static bool invalidate_all_relations = false;
+
+/* Relations whose cache entries have been changed by current transaction */
+static List *changed_relations = NIL;
+static bool cache_callbacks_registered = false;
+
+/* Number of entries of pmstate->aborted_relids checked by this backend */
+static uint64 checked_aborted_count = 0;
+static bool aborted_count_initialized = false;
+
+/*
+ * State of relation's pg_class row when it was checked last time. Only
+ * relations whose row has been updated (as opposed to updated in place, e.g.
+ * by VACUUM or ANALYZE) or whose parent has changed are checked again
+ */
+typedef struct CheckedRelation
+{
+	Oid			relid;
+	Oid			parent_oid;
+	TransactionId xmin;
+} CheckedRelation;
+
+static HTAB *checked_relations = NULL;
+
+/* Partitions whose zone maps have been refreshed by current transaction */
+typedef struct ZoneMapRefresh
+{
+	Oid			parent_oid;
+	Oid			child_oid;
+} ZoneMapRefresh;
+
+static List *refreshed_zone_maps = NIL;
+static bool zone_maps_callback_registered = false;
 
 static bool validate_range_constraint(Expr *, PartRelationInfo *, Datum *, Datum *);
 static bool validate_hash_constraint(Expr *expr, PartRelationInfo *prel, int *hash);
-static int cmp_range_entries(const void *p1, const void *p2);
+static int64 const_integer_value(Const *c);
+static bool validate_list_constraint(Expr *expr, PartRelationInfo *prel,
+									 Datum **values, int *nvalues);
+static void add_list_value(ListValues *lv, Datum value, int child_idx);
+static bool fill_list_relation(ListRelation *listrel, ListValues *lv,
+							   int nchildren, Oid atttype);
+static void free_list_relation(Oid relid);
+static int cmp_range_entries(const void *p1, const void *p2, void *arg);
+static void prepare_composite_cmp(CompositeCmpContext *ctx, PartRelationInfo *prel,
+								  RangeRelation *rangerel);
+static Datum composite_bound(const CompositeCmpContext *ctx, RangeEntry *re,
+							 int64 *bounds, int key, bool upper);
+static int cmp_composite_bounds(const CompositeCmpContext *ctx,
+								RangeEntry *re1, int64 *bounds1, bool upper1,
+								RangeEntry *re2, int64 *bounds2, bool upper2);
+static int cmp_composite_range_entries(const void *p1, const void *p2, void *arg);
+static void sort_composite_ranges(PartRelationInfo *prel, RangeRelation *rangerel,
+								  int count);
+static bool parse_composite_bound(const char *str, PartRelationInfo *prel,
+								  FmgrInfo *typinput, Oid *typioparam,
+								  Datum *values);
+static void set_key_bounds(int64 *bounds, PartRelationInfo *prel,
+						   RangeRelation *rangerel, Datum *mins, Datum *maxs);
+static void prepare_bound_cmp(BoundCmpContext *ctx, Oid atttype, bool by_val);
+static int cmp_bounds(const void *b1, const void *b2, const BoundCmpContext *ctx);
+static void load_relations(bool reinitialize, Oid relid);
+static void report_skipped_relation(Oid relid, MemoryContext mcxt);
+static void discard_relation_info(Oid relid);
+static Oid get_pathman_config_relid(void);
+static Oid get_pathman_schema(void);
+static void set_range_entry(RangeEntry *re, Oid child_oid, Datum min, Datum max,
+							bool by_val);
+static HTAB *read_partition_bounds(Oid parent_oid, Snapshot snapshot);
+static bool read_child_bounds(Oid child_oid, PartitionBounds *bounds);
+static HTAB *scan_partition_bounds(const char *index_name, AttrNumber attnum,
+								   Oid value, Snapshot snapshot);
+static void cache_xact_callback(XactEvent event, void *arg);
+static void cache_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+								   SubTransactionId parentSubid, void *arg);
+static void publish_aborted_changes(void);
+static void add_aborted_relations(void);
+static void check_invalidated_relation(Oid relid);
+static void check_relation_children(Oid parent_oid);
+static bool check_partition(Oid parent_oid, Oid child_oid);
+static bool check_cached_partition(Oid parent_oid, Oid child_oid,
+					   bool has_bounds, PartitionBounds *bounds);
+static void check_attached_list_partition(PartRelationInfo *prel, Oid parent_oid,
+										  Oid child_oid);
+static Oid find_cached_parent(Oid child_oid);
+static Oid get_inheritance_parent(Oid child_oid);
+static PartRelationInfo *get_loaded_relation_info(Oid relid);
+static void reload_relation_info(Oid relid);
+static int cmp_zone_map_entries(const void *p1, const void *p2);
+static List *get_dirty_zone_maps(PartRelationInfo *prel);
+static bool set_zone_maps_dirty(PartRelationInfo *prel, Oid child_oid, bool dirty);
+static void zone_maps_xact_callback(XactEvent event, void *arg);
+static void load_global_indexes(PartRelationInfo *prel, Oid parent_oid,
+								Snapshot snapshot);
+static Oid config_get_relid(HeapTuple tuple, TupleDesc tupdesc, int attnum);
+static List *find_children(Oid parent_oid, Snapshot snapshot);
+static List *get_check_constraints(Relation con_rel, Oid relid, Snapshot snapshot);
+static bool load_range_constraint(Oid child_oid, PartRelationInfo *prel,
+								  Datum *min, Datum *max);
 
 Size
 pathman_memsize()
@@ -40,6 +210,13 @@ pathman_memsize()
 	Size size;
 
 	size = get_dsm_shared_size() + MAXALIGN(sizeof(PathmanState));
+	size = add_size(size, hash_estimate_size(pathman_max_relations,
+											 sizeof(PartRelationInfo)));
+	size = add_size(size, hash_estimate_size(pathman_max_relations,
+											 sizeof(RangeRelation)));
+	size = add_size(size, hash_estimate_size(pathman_max_relations,
+											 sizeof(ListRelation)));
+	size = add_size(size, concurrent_part_slots_size());
 	return size;
 }
 
@@ -47,11 +224,17 @@ void
 init_shmem_config()
 {
 	bool found;
+	int i;
 
 	/* Check if module was initialized in postmaster */
 	pmstate = ShmemInitStruct("pathman state", sizeof(PathmanState), &found);
 	if (!found)
 	{
+		pg_atomic_init_u32(&pmstate->cache_generation, 0);
+		pmstate->zone_maps_epoch = GetCurrentTimestamp();
+		SpinLockInit(&pmstate->aborted_mutex);
+		pmstate->aborted_count = 0;
+
 		/*
 		 * Initialize locks in postmaster
 		 */
@@ -61,6 +244,9 @@ init_shmem_config()
 			pmstate->load_config_lock = LWLockAssign();
 			pmstate->dsm_init_lock    = LWLockAssign();
 			pmstate->edit_partitions_lock = LWLockAssign();
+			pmstate->part_slots_lock = LWLockAssign();
+			for (i = 0; i < PATHMAN_HASH_PARTITIONS; i++)
+				pmstate->relations_locks[i] = LWLockAssign();
 		}
 #ifdef WIN32
 		else
@@ -75,6 +261,8 @@ init_shmem_config()
 
 	create_relations_hashtable();
 	create_range_restrictions_hashtable();
+	create_list_restrictions_hashtable();
+	init_concurrent_part_slots();
 }
 
 /*
@@ -127,6 +315,8 @@ load_config(void)
 
 	/* Load cache */
 	LWLockAcquire(pmstate->load_config_lock, LW_EXCLUSIVE);
+	if (new_segment_created)
+		pmstate->zone_maps_epoch++;
 	load_relations_hashtable(new_segment_created);
 	LWLockRelease(pmstate->load_config_lock);
 	LWLockRelease(pmstate->dsm_init_lock);
@@ -164,403 +354,2521 @@ get_extension_schema()
 void
 load_relations_hashtable(bool reinitialize)
 {
-	int			ret,
-				i,
-				proc;
-	bool		isnull;
-	List	   *part_oids = NIL;
-	ListCell   *lc;
-	char	   *schema;
-	PartRelationInfo *prel;
-	char		sql[] = "SELECT pg_class.relfilenode, pg_attribute.attnum, cfg.parttype, pg_attribute.atttypid "
-						"FROM %s.pathman_config as cfg "
-						"JOIN pg_class ON pg_class.relfilenode = cfg.relname::regclass::oid "
-						"JOIN pg_attribute ON pg_attribute.attname = lower(cfg.attname) "
-						"AND attrelid = pg_class.relfilenode";
-	char *query;
-
-	SPI_connect();
-	schema = get_extension_schema();
-
-	/* If extension isn't exist then just quit */
-	if (!schema)
-	{
-		SPI_finish();
-		return;
-	}
-
-	/* Put schema name to the query */
-	query = psprintf(sql, schema);
-	ret = SPI_exec(query, 0);
-	proc = SPI_processed;
-
-	if (ret > 0 && SPI_tuptable != NULL)
-	{
-		TupleDesc tupdesc = SPI_tuptable->tupdesc;
-		SPITupleTable *tuptable = SPI_tuptable;
-
-		for (i=0; i<proc; i++)
-		{
-			RelationKey key;
-			HeapTuple tuple = tuptable->vals[i];
-			int oid = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+	load_relations(reinitialize, InvalidOid);
+}
 
-			key.dbid = MyDatabaseId;
-			key.relid = oid;
-			prel = (PartRelationInfo*)
-				hash_search(relations, (const void *) &key, HASH_ENTER, NULL);
+/*
+ * Rebuilds cache entry for a single partitioned relation. Other relations
+ * are left intact
+ */
+void
+load_relation_info(Oid relid)
+{
+	RelationKey key;
+	PartRelationInfo *prel;
+	List	   *dirty = NIL;
+	ListCell   *lc;
 
-			prel->attnum = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 2, &isnull));
-			prel->parttype = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 3, &isnull));
-			prel->atttype = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 4, &isnull));
+	key.dbid = MyDatabaseId;
+	key.relid = relid;
 
-			part_oids = lappend_int(part_oids, oid);
-		}
-	}
-	pfree(query);
+	/* Dirty flags of zone maps are kept in shared memory only */
+	prel = pathman_hash_search(relations, &key, HASH_FIND, NULL);
+	if (prel != NULL && prel->loaded)
+		dirty = get_dirty_zone_maps(prel);
 
-	/* Load children information */
-	foreach(lc, part_oids)
-	{
-		Oid oid = (int) lfirst_int(lc);
+	remove_relation_info(relid);
+	load_relations(false, relid);
 
-		prel = get_pathman_relation_info(oid, NULL);
-		switch(prel->parttype)
-		{
-			case PT_RANGE:
-				if (reinitialize && prel->children.length > 0)
-				{
-					RangeRelation *rangerel = get_pathman_range_relation(oid, NULL);
-					free_dsm_array(&prel->children);
-					free_dsm_array(&rangerel->ranges);
-					prel->children_count = 0;
-				}
-				load_check_constraints(oid, GetCatalogSnapshot(oid));
-				break;
-			case PT_HASH:
-				if (reinitialize && prel->children.length > 0)
-				{
-					free_dsm_array(&prel->children);
-					prel->children_count = 0;
-				}
-				load_check_constraints(oid, GetCatalogSnapshot(oid));
-				break;
-		}
-	}
-	SPI_finish();
+	prel = pathman_hash_search(relations, &key, HASH_FIND, NULL);
+	if (prel != NULL && prel->loaded)
+		foreach(lc, dirty)
+			set_zone_maps_dirty(prel, lfirst_oid(lc), true);
 }
 
+/*
+ * Loads partitions of relation which has been registered without them in
+ * lazy loading mode
+ */
 void
-create_relations_hashtable()
+load_relation_partitions(Oid relid)
 {
-	HASHCTL		ctl;
+	RelationKey key;
+	PartRelationInfo *prel;
+	bool		lock_held = LWLockHeldByMe(pmstate->load_config_lock);
 
-	memset(&ctl, 0, sizeof(ctl));
-	ctl.keysize = sizeof(RelationKey);
-	ctl.entrysize = sizeof(PartRelationInfo);
+	if (!lock_held)
+		LWLockAcquire(pmstate->load_config_lock, LW_EXCLUSIVE);
 
-	/* Already exists, recreate */
-	if (relations != NULL)
-		hash_destroy(relations);
+	/* Someone could have already loaded it */
+	key.dbid = MyDatabaseId;
+	key.relid = relid;
+	prel = pathman_hash_search(relations, &key, HASH_FIND, NULL);
+	if (prel != NULL && !prel->loaded)
+		load_relations(false, relid);
 
-	relations = ShmemInitHash("Partitioning relation info", 1024, 1024, &ctl, HASH_ELEM | HASH_BLOBS);
+	if (!lock_held)
+		LWLockRelease(pmstate->load_config_lock);
 }
 
 /*
- * Load and validate CHECK constraints
+ * Loads structure of partitioned tables listed in pathman_config. If relid is
+ * valid then only that relation is loaded. In lazy loading mode relations are
+ * only registered and their partitions are loaded on first access (see
+ * load_relation_partitions())
  */
-void
-load_check_constraints(Oid parent_oid, Snapshot snapshot)
+static void
+load_relations(bool reinitialize, Oid relid)
 {
-	PartRelationInfo *prel = NULL;
-	RangeRelation *rangerel = NULL;
-	SPIPlanPtr plan;
-	bool	found;
-	int		ret,
-			i,
-			proc;
-	Datum	vals[1];
-	Oid		oids[1] = {INT4OID};
-	bool	nulls[1] = {false};
-	
-	vals[0] = Int32GetDatum(parent_oid);
-	prel = get_pathman_relation_info(parent_oid, NULL);
+	Oid			config_relid;
+	Relation	config_rel;
+	TupleDesc	tupdesc;
+	HeapScanDesc scan;
+	HeapTuple	tuple;
+	Snapshot	snapshot;
+	List	   *part_oids = NIL;
+	List	   *default_oids = NIL;
+	ListCell   *lc,
+			   *lc2;
+	PartRelationInfo *prel;
 
-	/* Skip if already loaded */
-	if (prel->children.length > 0)
-		return;
+	config_relid = get_pathman_config_relid();
 
-	plan = SPI_prepare("select pg_constraint.* "
-					   "from pg_constraint "
-					   "join pg_inherits on inhrelid = conrelid "
-					   "where inhparent = $1 and contype='c';",
-					   1, oids);
-	ret = SPI_execute_snapshot(plan, vals, nulls,
-							   snapshot, InvalidSnapshot, true, false, 0);
+	/* If extension isn't exist then just quit */
+	if (!OidIsValid(config_relid))
+		return;
 
-	proc = SPI_processed;
+	/* Read pathman_config */
+	snapshot = RegisterSnapshot(GetLatestSnapshot());
+	config_rel = heap_open(config_relid, AccessShareLock);
+	tupdesc = RelationGetDescr(config_rel);
+	scan = heap_beginscan(config_rel, snapshot, 0, NULL);
 
-	if (ret > 0 && SPI_tuptable != NULL)
+	while ((tuple = heap_getnext(scan, ForwardScanDirection)) != NULL)
 	{
-		SPITupleTable *tuptable = SPI_tuptable;
-		Oid *children;
-		RangeEntry *ranges = NULL;
-		Datum min;
-		Datum max;
-		int hash;
+		RelationKey key;
+		Oid			oid;
+		AttrNumber	attnums[PATHMAN_MAX_KEYS];
+		char	   *attname;
+		List	   *attnames;
+		Node	   *key_expr = NULL;
+		Datum		value;
+		PartType	parttype;
+		bool		isnull;
+		bool		found;
+		int			nkeys = 0;
+		int			i;
+
+		oid = config_get_relid(tuple, tupdesc, Anum_pathman_config_relname);
+		if (!OidIsValid(oid) || (OidIsValid(relid) && oid != relid))
+			continue;
+
+		value = heap_getattr(tuple, Anum_pathman_config_attname, tupdesc, &isnull);
+		if (isnull)
+			continue;
+		attname = TextDatumGetCString(value);
+		parttype = DatumGetInt32(
+			heap_getattr(tuple, Anum_pathman_config_parttype, tupdesc, &isnull));
 
-		alloc_dsm_array(&prel->children, sizeof(Oid), proc);
-		children = (Oid *) dsm_array_get_pointer(&prel->children);
+		/*
+		 * attname holds either a column, comma separated columns of RANGE
+		 * composite key or the source text of key expression
+		 */
+		if (SplitIdentifierString(pstrdup(attname), ',', &attnames))
+		{
+			if (list_length(attnames) > PATHMAN_MAX_KEYS ||
+				(list_length(attnames) > 1 && parttype != PT_RANGE))
+				continue;
 
-		if (prel->parttype == PT_RANGE)
+			foreach(lc, attnames)
+			{
+				attnums[nkeys] = get_attnum(oid, (char *) lfirst(lc));
+				if (attnums[nkeys] == InvalidAttrNumber)
+					break;
+
+				/* Bounds of composite keys are stored the same way as RangeEntry's */
+				if (list_length(attnames) > 1 &&
+					(get_typlen(get_atttype(oid, attnums[nkeys])) <= 0 ||
+					 get_typlen(get_atttype(oid, attnums[nkeys])) > sizeof(int64)))
+					break;
+				nkeys++;
+			}
+			if (nkeys < list_length(attnames))
+				continue;
+		}
+		else
 		{
-			TypeCacheEntry	   *tce;
-			RelationKey key;
-			key.dbid = MyDatabaseId;
-			key.relid = parent_oid;
+			/* Key expression is computed from a single column */
+			Bitmapset  *varattnos = NULL;
+			MemoryContext mcxt = CurrentMemoryContext;
+			bool		parsed = true;
 
-			rangerel = (RangeRelation *)
-				hash_search(range_restrictions, (void *) &key, HASH_ENTER, &found);
+			/* Other relations don't have to wait until the key is fixed */
+			PG_TRY();
+			{
+				key_expr = parse_stored_partitioning_key(oid, attname);
+			}
+			PG_CATCH();
+			{
+				report_skipped_relation(oid, mcxt);
+				parsed = false;
+			}
+			PG_END_TRY();
+			if (!parsed)
+				continue;
+
+			pull_varattnos(key_expr, 1, &varattnos);
+			attnums[nkeys++] = bms_singleton_member(varattnos) +
+				FirstLowInvalidHeapAttributeNumber;
+			if (IsA(key_expr, Var))
+				key_expr = NULL;
+		}
+		if (attnums[0] <= 0)
+			continue;
 
-			alloc_dsm_array(&rangerel->ranges, sizeof(RangeEntry), proc);
-			ranges = (RangeEntry *) dsm_array_get_pointer(&rangerel->ranges);
+		key.dbid = MyDatabaseId;
+		key.relid = oid;
+		prel = (PartRelationInfo*)
+			pathman_hash_search(relations, &key, HASH_ENTER, &found);
 
-			tce = lookup_type_cache(prel->atttype, 0);
-			rangerel->by_val = tce->typbyval;
+		if (!found)
+		{
+			memset(&prel->children, 0, sizeof(prel->children));
+			memset(&prel->zone_maps, 0, sizeof(prel->zone_maps));
+			prel->children_count = 0;
+			prel->zone_columns_count = 0;
+			prel->gindex_count = 0;
+			prel->loaded = false;
 		}
 
-		for (i=0; i<proc; i++)
+		/* Relations which have already been loaded stay loaded */
+		if (OidIsValid(relid) || !pathman_lazy_loading)
+			prel->loaded = true;
+		else if (reinitialize)
 		{
-			RangeEntry	re;
-			HeapTuple	tuple = tuptable->vals[i];
-			bool		isnull;
-			Datum		val;
-			char	   *conbin;
-			Expr	   *expr;
+			/* Partitions have been lost together with previous segment */
+			memset(&prel->children, 0, sizeof(prel->children));
+			memset(&prel->zone_maps, 0, sizeof(prel->zone_maps));
+			prel->children_count = 0;
+			prel->zone_columns_count = 0;
+			prel->gindex_count = 0;
+			prel->loaded = false;
+		}
+		prel->attnum = attnums[0];
+		prel->parttype = parttype;
+		prel->atttype = key_expr != NULL ? exprType(key_expr) :
+										   get_atttype(oid, attnums[0]);
+		prel->has_key_expr = key_expr != NULL;
+		prel->keys_count = nkeys;
+		for (i = 0; i < nkeys; i++)
+		{
+			prel->key_attnums[i] = attnums[i];
+			prel->key_atttypes[i] = i == 0 ? prel->atttype :
+											 get_atttype(oid, attnums[i]);
+		}
+		value = heap_getattr(tuple, Anum_pathman_config_hash_split_pos, tupdesc, &isnull);
+		prel->split_pos = isnull ? -1 : DatumGetInt32(value);
+
+		part_oids = lappend_oid(part_oids, oid);
+		default_oids = lappend_oid(default_oids,
+			config_get_relid(tuple, tupdesc, Anum_pathman_config_default_partition));
+	}
 
-			Form_pg_constraint con;
+	heap_endscan(scan);
+	heap_close(config_rel, AccessShareLock);
+	UnregisterSnapshot(snapshot);
 
-			con = (Form_pg_constraint) GETSTRUCT(tuple);
+	/* Load children information */
+	forboth(lc, part_oids, lc2, default_oids)
+	{
+		Oid oid = lfirst_oid(lc);
+		RangeRelation *rangerel;
+		MemoryContext mcxt = CurrentMemoryContext;
 
-			val = SysCacheGetAttr(CONSTROID, tuple, Anum_pg_constraint_conbin,
-								  &isnull);
-			if (isnull)
-				elog(ERROR, "null conbin for constraint %u",
-					 HeapTupleGetOid(tuple));
-			conbin = TextDatumGetCString(val);
-			expr = (Expr *) stringToNode(conbin);
-			
+		prel = get_pathman_relation_info(oid, NULL);
+		if (!prel->loaded)
+			continue;
+
+		PG_TRY();
+		{
 			switch(prel->parttype)
 			{
 				case PT_RANGE:
-					if (!validate_range_constraint(expr, prel, &min, &max))
+					if (reinitialize && prel->children.length > 0)
 					{
-						elog(WARNING, "Range constraint for relation %u MUST have exact format: "
-									  "VARIABLE >= CONST AND VARIABLE < CONST. Skipping...",
-							 (Oid) con->conrelid);
-						continue;
+						RangeRelation *rangerel = get_pathman_range_relation(oid, NULL);
+						free_dsm_array(&prel->children);
+						free_dsm_array(&rangerel->ranges);
+						if (prel->keys_count > 1)
+							free_dsm_array(&rangerel->key_bounds);
+						prel->children_count = 0;
 					}
+					load_check_constraints(oid, GetCatalogSnapshot(oid));
 
-					/* If datum is referenced by val then just assign */
-					if (rangerel->by_val)
-					{
-						re.min = min;
-						re.max = max;
-					}
-					/* else copy the memory by pointer */
-					else
+					/* Default partition (if any) */
+					rangerel = get_pathman_range_relation(oid, NULL);
+					if (rangerel != NULL)
+						rangerel->default_oid = lfirst_oid(lc2);
+					break;
+				case PT_HASH:
+					if (reinitialize && prel->children.length > 0)
 					{
-						memcpy(&re.min, DatumGetPointer(min), sizeof(re.min));
-						memcpy(&re.max, DatumGetPointer(max), sizeof(re.max));
+						free_dsm_array(&prel->children);
+						prel->children_count = 0;
 					}
-					re.child_oid = con->conrelid;
-					ranges[i] = re;
+					load_check_constraints(oid, GetCatalogSnapshot(oid));
 					break;
-			
-				case PT_HASH:
-					if (!validate_hash_constraint(expr, prel, &hash))
+				case PT_LIST:
+					if (reinitialize && prel->children.length > 0)
 					{
-						elog(WARNING, "Hash constraint for relation %u MUST have exact format: "
-									  "VARIABLE %% CONST = CONST. Skipping...",
-							 (Oid) con->conrelid);
-						continue;
+						free_list_relation(oid);
+						free_dsm_array(&prel->children);
+						prel->children_count = 0;
 					}
-					children[hash] = con->conrelid;
+					load_check_constraints(oid, GetCatalogSnapshot(oid));
+					break;
 			}
 		}
-		prel->children_count = proc;
-
-		if (prel->parttype == PT_RANGE)
+		PG_CATCH();
 		{
-			TypeCacheEntry	   *tce;
-			bool byVal = rangerel->by_val;
-
-			/* Sort ascending */
-			tce = lookup_type_cache(prel->atttype,
-				TYPECACHE_CMP_PROC | TYPECACHE_CMP_PROC_FINFO);
-			qsort_type_cmp_func = &tce->cmp_proc_finfo;
-			globalByVal = byVal;
-			qsort(ranges, proc, sizeof(RangeEntry), cmp_range_entries);
-
-			/* Copy oids to prel */
-			for(i=0; i < proc; i++)
-				children[i] = ranges[i].child_oid;
-
-			/* Check if some ranges overlap */
-			for(i=0; i < proc-1; i++)
-			{
-				Datum cur_upper = PATHMAN_GET_DATUM(ranges[i].max, byVal);
-				Datum next_lower = PATHMAN_GET_DATUM(ranges[i+1].min, byVal);
-				bool overlap = DatumGetInt32(FunctionCall2(qsort_type_cmp_func, next_lower, cur_upper)) < 0;
-
-				if (overlap)
-				{
-					RelationKey key;
-					key.dbid = MyDatabaseId;
-					key.relid = parent_oid;
-
-					elog(WARNING, "Partitions %u and %u overlap. Disabling pathman for relation %u...",
-						 ranges[i].child_oid, ranges[i+1].child_oid, parent_oid);
-					hash_search(relations, (const void *) &key, HASH_REMOVE, &found);
-				}
-			}
+			report_skipped_relation(oid, mcxt);
+			discard_relation_info(oid);
 		}
+		PG_END_TRY();
 	}
 }
 
-
-/* qsort comparison function for oids */
-static int
-cmp_range_entries(const void *p1, const void *p2)
+/*
+ * Reports the error which prevented relation from being loaded as a warning
+ * and clears error state, so that other relations could be loaded
+ */
+static void
+report_skipped_relation(Oid relid, MemoryContext mcxt)
 {
-	const RangeEntry	*v1 = (const RangeEntry *) p1;
-	const RangeEntry	*v2 = (const RangeEntry *) p2;
+	ErrorData  *edata;
+
+	MemoryContextSwitchTo(mcxt);
+	edata = CopyErrorData();
+	FlushErrorState();
 
-	return FunctionCall2(qsort_type_cmp_func,
-						 PATHMAN_GET_DATUM(v1->min, globalByVal),
-						 PATHMAN_GET_DATUM(v2->min, globalByVal));
+	elog(WARNING, "Partitioning of relation %s can't be loaded: %s. Skipping...",
+		 get_rel_name(relid), edata->message);
+	FreeErrorData(edata);
 }
 
 /*
- * Validates range constraint. It MUST have the exact format:
- * VARIABLE >= CONST AND VARIABLE < CONST
+ * Forgets relation which failed to load. Only the children array is freed:
+ * arrays of bounds could be left half-initialized by the error
  */
-static bool
-validate_range_constraint(Expr *expr, PartRelationInfo *prel, Datum *min, Datum *max)
+static void
+discard_relation_info(Oid relid)
 {
-	TypeCacheEntry *tce;
-	BoolExpr *boolexpr = (BoolExpr *) expr;
-	OpExpr *opexpr;
+	PartRelationInfo *prel;
+	RelationKey key;
 
-	/* it should be an AND operator on top */
-	if ( !(IsA(expr, BoolExpr) && boolexpr->boolop == AND_EXPR) )
-		return false;
+	key.dbid = MyDatabaseId;
+	key.relid = relid;
 
-	/* and it should have exactly two operands */
-	if (list_length(boolexpr->args) != 2)
-		return false;
+	prel = pathman_hash_search(relations, &key, HASH_FIND, NULL);
+	if (prel != NULL && prel->children.length > 0)
+		free_dsm_array(&prel->children);
 
-	tce = lookup_type_cache(prel->atttype, TYPECACHE_EQ_OPR | TYPECACHE_LT_OPR | TYPECACHE_GT_OPR);
+	pathman_hash_search(range_restrictions, &key, HASH_REMOVE, NULL);
+	pathman_hash_search(list_restrictions, &key, HASH_REMOVE, NULL);
+	pathman_hash_search(relations, &key, HASH_REMOVE, NULL);
+}
 
-	/* check that left operand is >= operator */
-	opexpr = (OpExpr *) linitial(boolexpr->args);
-	if (get_op_opfamily_strategy(opexpr->opno, tce->btree_opf) == BTGreaterEqualStrategyNumber)
+/*
+ * Reads partitioning key of the relation from pathman_config and parses it.
+ * Returns NULL if key is a plain column
+ */
+Node *
+load_key_expression(Oid relid)
+{
+	Oid			config_relid = get_pathman_config_relid();
+	Relation	config_rel;
+	TupleDesc	tupdesc;
+	HeapScanDesc scan;
+	HeapTuple	tuple;
+	Snapshot	snapshot;
+	char	   *attname = NULL;
+	List	   *attnames;
+	Node	   *result = NULL;
+
+	if (!OidIsValid(config_relid))
+		return NULL;
+
+	snapshot = RegisterSnapshot(GetLatestSnapshot());
+	config_rel = heap_open(config_relid, AccessShareLock);
+	tupdesc = RelationGetDescr(config_rel);
+	scan = heap_beginscan(config_rel, snapshot, 0, NULL);
+
+	while ((tuple = heap_getnext(scan, ForwardScanDirection)) != NULL)
 	{
-		Node *left = linitial(opexpr->args);
-		Node *right = lsecond(opexpr->args);
-		if ( !IsA(left, Var) || !IsA(right, Const) )
-			return false;
-		if ( ((Var*) left)->varattno != prel->attnum )
-			return false;
-		*min = ((Const*) right)->constvalue;
-	}
-	else
-		return false;
+		Datum		value;
+		bool		isnull;
 
-	/* TODO: rewrite this */
-	/* check that right operand is < operator */
-	opexpr = (OpExpr *) lsecond(boolexpr->args);
-	if (get_op_opfamily_strategy(opexpr->opno, tce->btree_opf) == BTLessStrategyNumber)
-	{
-		Node *left = linitial(opexpr->args);
-		Node *right = lsecond(opexpr->args);
-		if ( !IsA(left, Var) || !IsA(right, Const) )
-			return false;
-		if ( ((Var*) left)->varattno != prel->attnum )
-			return false;
-		*max = ((Const*) right)->constvalue;
+		if (config_get_relid(tuple, tupdesc, Anum_pathman_config_relname) != relid)
+			continue;
+
+		value = heap_getattr(tuple, Anum_pathman_config_attname, tupdesc, &isnull);
+		if (!isnull)
+			attname = TextDatumGetCString(value);
+		break;
 	}
-	else
-		return false;
 
-	return true;
+	heap_endscan(scan);
+	heap_close(config_rel, AccessShareLock);
+	UnregisterSnapshot(snapshot);
+
+	/* Columns are parsed by load_relations() the same way */
+	if (attname != NULL && !SplitIdentifierString(pstrdup(attname), ',', &attnames))
+		result = parse_stored_partitioning_key(relid, attname);
+
+	return result != NULL && !IsA(result, Var) ? result : NULL;
 }
 
 /*
- * Validate hash constraint. It MUST have the exact format
- * VARIABLE % CONST = CONST
+ * Loads zone maps of the relation from pathman_zone_maps. Partitions which
+ * have been dirty before stay dirty, as well as summaries computed in
+ * previous epochs, since writes done since then are unknown
  */
-static bool
-validate_hash_constraint(Expr *expr, PartRelationInfo *prel, int *hash)
+void
+load_zone_maps(Oid parent_oid, Snapshot snapshot)
 {
-	OpExpr *eqexpr;
-	OpExpr *modexpr;
-	TypeCacheEntry *tce;
+	PartRelationInfo *prel;
+	RelationKey key;
+	Oid			ext_schema;
+	Oid			zm_relid;
+	Oid			zm_idxid;
+	Relation	zm_rel;
+	TupleDesc	tupdesc;
+	SysScanDesc scan;
+	ScanKeyData skey[1];
+	HeapTuple	tuple;
+	ZoneMapEntry *entries = NULL;
+	List	   *dirty;
+	int			nentries = 0;
+	int			allocated = 0;
+	Oid			typioparams[PATHMAN_MAX_ZONE_COLUMNS];
+	FmgrInfo	typinputs[PATHMAN_MAX_ZONE_COLUMNS];
 
-	if (!IsA(expr, OpExpr))
-		return false;
-	eqexpr = (OpExpr *) expr;
+	key.dbid = MyDatabaseId;
+	key.relid = parent_oid;
+	prel = pathman_hash_search(relations, &key, HASH_FIND, NULL);
+	if (prel == NULL)
+		return;
 
-	/* Is this an equality operator? */
-	tce = lookup_type_cache(prel->atttype, TYPECACHE_EQ_OPR);
-	if (get_op_opfamily_strategy(eqexpr->opno, tce->btree_opf) != BTEqualStrategyNumber)
-		return false;
+	dirty = get_dirty_zone_maps(prel);
+	if (prel->zone_maps.length > 0)
+		free_dsm_array(&prel->zone_maps);
+	prel->zone_columns_count = 0;
 
-	if (!IsA(linitial(eqexpr->args), OpExpr))
-		return false;
+	ext_schema = get_pathman_schema();
+	if (!OidIsValid(ext_schema))
+		return;
 
-	/* Is this a modulus operator? */
-	modexpr = (OpExpr *) linitial(eqexpr->args);
-	if (modexpr->opno != 530 && modexpr->opno != 439 && modexpr->opno && modexpr->opno != 529)
-		return false;
+	zm_relid = get_relname_relid("pathman_zone_maps", ext_schema);
+	zm_idxid = get_relname_relid("pathman_zone_maps_parent_idx", ext_schema);
+	if (!OidIsValid(zm_relid) || !OidIsValid(zm_idxid))
+		return;
+
+	zm_rel = heap_open(zm_relid, AccessShareLock);
+	tupdesc = RelationGetDescr(zm_rel);
+	ScanKeyInit(&skey[0],
+				Anum_pathman_zone_maps_parent,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(parent_oid));
+	scan = systable_beginscan(zm_rel, zm_idxid, true, snapshot, 1, skey);
 
-	if (list_length(modexpr->args) == 2)
+	while ((tuple = systable_getnext(scan)) != NULL)
 	{
-		Node *left = linitial(modexpr->args);
-		Node *right = lsecond(modexpr->args);
-		Const *mod_result;
+		ZoneMapEntry *zm;
+		Datum		value;
+		Datum		min;
+		Datum		max;
+		bool		isnull;
+		char	   *attname;
+		AttrNumber	attnum;
+		Oid			atttype;
+		Oid			typinput;
+		int16		typlen;
+		bool		typbyval;
+		int			column;
+
+		attname = TextDatumGetCString(
+			heap_getattr(tuple, Anum_pathman_zone_maps_attname, tupdesc, &isnull));
+		attnum = get_attnum(parent_oid, attname);
+		if (attnum <= 0)
+			continue;
+
+		for (column = 0; column < prel->zone_columns_count; column++)
+			if (prel->zone_attnums[column] == attnum)
+				break;
 
-		if ( !IsA(left, Var) || !IsA(right, Const) )
-			return false;
-		if ( ((Var*) left)->varattno != prel->attnum )
-			return false;
-		if (DatumGetInt32(((Const*) right)->constvalue) != prel->children.length)
-			return false;
+		/* New column. Only fixed-length types fit into int64 */
+		if (column == prel->zone_columns_count)
+		{
+			if (column == PATHMAN_MAX_ZONE_COLUMNS)
+				continue;
+
+			atttype = get_atttype(parent_oid, attnum);
+			get_typlenbyval(atttype, &typlen, &typbyval);
+			if (typlen <= 0 || typlen > sizeof(int64))
+				continue;
+
+			prel->zone_attnums[column] = attnum;
+			prel->zone_atttypes[column] = atttype;
+			prel->zone_by_val[column] = typbyval;
+			getTypeInputInfo(atttype, &typinput, &typioparams[column]);
+			fmgr_info(typinput, &typinputs[column]);
+			prel->zone_columns_count++;
+		}
 
-		if ( !IsA(lsecond(eqexpr->args), Const) )
-			return false;
+		if (nentries >= allocated)
+		{
+			allocated = allocated > 0 ? allocated * 2 : 64;
+			entries = entries == NULL ?
+				palloc(sizeof(ZoneMapEntry) * allocated) :
+				repalloc(entries, sizeof(ZoneMapEntry) * allocated);
+		}
+		zm = &entries[nentries];
+		memset(zm, 0, sizeof(ZoneMapEntry));
+		zm->child_oid = DatumGetObjectId(
+			heap_getattr(tuple, Anum_pathman_zone_maps_partition, tupdesc, &isnull));
+		zm->column = column;
+		zm->xmin = HeapTupleHeaderGetXmin(tuple->t_data);
+
+		value = heap_getattr(tuple, Anum_pathman_zone_maps_epoch, tupdesc, &isnull);
+		zm->dirty = isnull || DatumGetInt64(value) != pmstate->zone_maps_epoch ||
+			list_member_oid(dirty, zm->child_oid);
+
+		value = heap_getattr(tuple, Anum_pathman_zone_maps_empty, tupdesc, &isnull);
+		zm->empty = !isnull && DatumGetBool(value);
+		if (!zm->empty)
+		{
+			value = heap_getattr(tuple, Anum_pathman_zone_maps_min, tupdesc, &isnull);
+			if (isnull)
+				continue;
+			min = InputFunctionCall(&typinputs[column], TextDatumGetCString(value),
+									typioparams[column], -1);
+			value = heap_getattr(tuple, Anum_pathman_zone_maps_max, tupdesc, &isnull);
+			if (isnull)
+				continue;
+			max = InputFunctionCall(&typinputs[column], TextDatumGetCString(value),
+									typioparams[column], -1);
 
-		mod_result = lsecond(eqexpr->args);
-		*hash = DatumGetInt32(mod_result->constvalue);
-		return true;
+			if (prel->zone_by_val[column])
+			{
+				zm->min = min;
+				zm->max = max;
+			}
+			else
+			{
+				memcpy(&zm->min, DatumGetPointer(min), sizeof(zm->min));
+				memcpy(&zm->max, DatumGetPointer(max), sizeof(zm->max));
+			}
+		}
+		nentries++;
 	}
 
-	return false;
+	systable_endscan(scan);
+	heap_close(zm_rel, AccessShareLock);
+
+	if (nentries > 0)
+	{
+		qsort(entries, nentries, sizeof(ZoneMapEntry), cmp_zone_map_entries);
+		alloc_dsm_array(&prel->zone_maps, sizeof(ZoneMapEntry), nentries);
+		memcpy(dsm_array_get_pointer(&prel->zone_maps), entries,
+			   sizeof(ZoneMapEntry) * nentries);
+		pfree(entries);
+	}
+	pathman_cache_changed(parent_oid);
 }
 
 /*
- * Create range restrictions table
+ * Binary search of zone map entry of the partition
  */
-void
-create_range_restrictions_hashtable()
+ZoneMapEntry *
+search_zone_map(ZoneMapEntry *entries, int count, int column, Oid child_oid)
 {
-	HASHCTL		ctl;
+	int			lo = 0;
+	int			hi = count - 1;
+
+	while (lo <= hi)
+	{
+		int			mid = (lo + hi) / 2;
+		ZoneMapEntry *zm = &entries[mid];
+
+		if (zm->column == column && zm->child_oid == child_oid)
+			return zm;
+		if (zm->column < column ||
+			(zm->column == column && zm->child_oid < child_oid))
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return NULL;
+}
+
+/*
+ * Returns partitions of the relation which have dirty zone maps
+ */
+static List *
+get_dirty_zone_maps(PartRelationInfo *prel)
+{
+	ZoneMapEntry *entries;
+	List	   *result = NIL;
+	int			i;
+
+	if (prel->zone_maps.length == 0)
+		return NIL;
+
+	entries = (ZoneMapEntry *) dsm_array_get_pointer(&prel->zone_maps);
+	for (i = 0; i < prel->zone_maps.length; i++)
+		if (entries[i].dirty)
+			result = list_append_unique_oid(result, entries[i].child_oid);
+
+	return result;
+}
+
+/*
+ * Sets dirty flag of zone maps of the partition. Returns true if any of them
+ * has been changed. Caller must hold load_config_lock
+ */
+static bool
+set_zone_maps_dirty(PartRelationInfo *prel, Oid child_oid, bool dirty)
+{
+	ZoneMapEntry *entries;
+	bool		changed = false;
+	int			column;
+
+	if (prel->zone_maps.length == 0)
+		return false;
+
+	entries = (ZoneMapEntry *) dsm_array_get_pointer(&prel->zone_maps);
+	for (column = 0; column < prel->zone_columns_count; column++)
+	{
+		ZoneMapEntry *zm = search_zone_map(entries, prel->zone_maps.length,
+										   column, child_oid);
+
+		if (zm != NULL && zm->dirty != dirty)
+		{
+			zm->dirty = dirty;
+			changed = true;
+		}
+	}
+
+	/* Backends keep copies of zone maps (see get_local_relation_info()) */
+	if (changed)
+		pg_atomic_fetch_add_u32(&pmstate->cache_generation, 1);
+
+	return changed;
+}
+
+/*
+ * Invalidates zone maps of the modified partition until the next refresh.
+ * Only the flag in shared memory is set, so that concurrent writers don't
+ * lock each other
+ */
+void
+mark_zone_maps_dirty(Oid child_oid)
+{
+	Oid			parent_oid = get_inheritance_parent(child_oid);
+	RelationKey key;
+	PartRelationInfo *prel;
+	ListCell   *lc;
+	bool		changed = false;
+
+	/* Summaries computed by this transaction don't include these rows */
+	foreach(lc, refreshed_zone_maps)
+	{
+		ZoneMapRefresh *refresh = (ZoneMapRefresh *) lfirst(lc);
+
+		if (refresh->child_oid == child_oid)
+		{
+			refreshed_zone_maps = list_delete_ptr(refreshed_zone_maps, refresh);
+			break;
+		}
+	}
+
+	/* Load partitions in lazy loading mode before taking the lock */
+	if (!OidIsValid(parent_oid) || get_pathman_relation_info(parent_oid, NULL) == NULL)
+		return;
+
+	key.dbid = MyDatabaseId;
+	key.relid = parent_oid;
+
+	LWLockAcquire(pmstate->load_config_lock, LW_SHARED);
+	prel = pathman_hash_search(relations, &key, HASH_FIND, NULL);
+	if (prel != NULL && prel->loaded)
+		changed = set_zone_maps_dirty(prel, child_oid, true);
+	LWLockRelease(pmstate->load_config_lock);
+
+	/* Cached plans may skip the partition */
+	if (changed)
+		CacheInvalidateRelcacheByRelid(parent_oid);
+}
+
+/*
+ * Checks that every zone map of the partition is up to date
+ */
+bool
+zone_maps_valid(Oid parent_oid, Oid child_oid)
+{
+	RelationKey key;
+	PartRelationInfo *prel;
+	bool		result = true;
+	int			column;
+
+	if (get_pathman_relation_info(parent_oid, NULL) == NULL)
+		return false;
+
+	key.dbid = MyDatabaseId;
+	key.relid = parent_oid;
+
+	LWLockAcquire(pmstate->load_config_lock, LW_SHARED);
+	prel = pathman_hash_search(relations, &key, HASH_FIND, NULL);
+	if (prel == NULL || !prel->loaded || prel->zone_maps.length == 0)
+		result = false;
+	else
+	{
+		ZoneMapEntry *entries = (ZoneMapEntry *) dsm_array_get_pointer(&prel->zone_maps);
+
+		for (column = 0; column < prel->zone_columns_count && result; column++)
+		{
+			ZoneMapEntry *zm = search_zone_map(entries, prel->zone_maps.length,
+											   column, child_oid);
+
+			result = zm != NULL && !zm->dirty;
+		}
+	}
+	LWLockRelease(pmstate->load_config_lock);
+
+	return result;
+}
+
+/*
+ * Remembers that zone maps of the partition have been recomputed. Their
+ * dirty flags are cleared when transaction commits, while the partition is
+ * still locked against writers
+ */
+void
+zone_maps_refreshed(Oid parent_oid, Oid child_oid)
+{
+	MemoryContext old_mcxt;
+	ZoneMapRefresh *refresh;
+
+	if (!zone_maps_callback_registered)
+	{
+		RegisterXactCallback(zone_maps_xact_callback, NULL);
+		zone_maps_callback_registered = true;
+	}
+
+	old_mcxt = MemoryContextSwitchTo(TopTransactionContext);
+	refresh = (ZoneMapRefresh *) palloc(sizeof(ZoneMapRefresh));
+	refresh->parent_oid = parent_oid;
+	refresh->child_oid = child_oid;
+	refreshed_zone_maps = lappend(refreshed_zone_maps, refresh);
+	MemoryContextSwitchTo(old_mcxt);
+}
+
+/*
+ * Clears dirty flags of zone maps refreshed by committed transaction. Only
+ * summaries loaded from rows written by the transaction itself are cleared:
+ * those which have been loaded by others in the meantime or written by
+ * aborted subtransactions stay dirty until the next refresh
+ */
+static void
+zone_maps_xact_callback(XactEvent event, void *arg)
+{
+	ListCell   *lc;
+
+	if (event == XACT_EVENT_PRE_COMMIT || event == XACT_EVENT_PRE_PREPARE)
+		return;
+
+	if (event == XACT_EVENT_COMMIT && refreshed_zone_maps != NIL)
+	{
+		LWLockAcquire(pmstate->load_config_lock, LW_SHARED);
+		foreach(lc, refreshed_zone_maps)
+		{
+			ZoneMapRefresh *refresh = (ZoneMapRefresh *) lfirst(lc);
+			RelationKey key;
+			PartRelationInfo *prel;
+			ZoneMapEntry *entries;
+			int			column;
+
+			key.dbid = MyDatabaseId;
+			key.relid = refresh->parent_oid;
+			prel = pathman_hash_search(relations, &key, HASH_FIND, NULL);
+			if (prel == NULL || !prel->loaded || prel->zone_maps.length == 0)
+				continue;
+
+			entries = (ZoneMapEntry *) dsm_array_get_pointer(&prel->zone_maps);
+			for (column = 0; column < prel->zone_columns_count; column++)
+			{
+				ZoneMapEntry *zm = search_zone_map(entries, prel->zone_maps.length,
+												   column, refresh->child_oid);
+
+				if (zm != NULL && zm->dirty &&
+					TransactionIdIsCurrentTransactionId(zm->xmin))
+				{
+					zm->dirty = false;
+					pg_atomic_fetch_add_u32(&pmstate->cache_generation, 1);
+				}
+			}
+		}
+		LWLockRelease(pmstate->load_config_lock);
+	}
+
+	/* List itself is freed together with TopTransactionContext */
+	refreshed_zone_maps = NIL;
+}
+
+/*
+ * Reads columns of the relation which have global indexes
+ */
+static void
+load_global_indexes(PartRelationInfo *prel, Oid parent_oid, Snapshot snapshot)
+{
+	Oid			ext_schema;
+	Oid			gi_relid;
+	Oid			gi_idxid;
+	Relation	gi_rel;
+	TupleDesc	tupdesc;
+	SysScanDesc scan;
+	ScanKeyData key[1];
+	HeapTuple	tuple;
+
+	prel->gindex_count = 0;
+
+	ext_schema = get_pathman_schema();
+	if (!OidIsValid(ext_schema))
+		return;
+
+	gi_relid = get_relname_relid("pathman_global_indexes", ext_schema);
+	gi_idxid = get_relname_relid("pathman_global_indexes_pkey", ext_schema);
+	if (!OidIsValid(gi_relid) || !OidIsValid(gi_idxid))
+		return;
+
+	gi_rel = heap_open(gi_relid, AccessShareLock);
+	tupdesc = RelationGetDescr(gi_rel);
+	ScanKeyInit(&key[0],
+				Anum_pathman_global_indexes_parent,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(parent_oid));
+	scan = systable_beginscan(gi_rel, gi_idxid, true, snapshot, 1, key);
+
+	while ((tuple = systable_getnext(scan)) != NULL &&
+		   prel->gindex_count < PATHMAN_MAX_GLOBAL_INDEXES)
+	{
+		bool		isnull;
+		AttrNumber	attnum;
+
+		attnum = get_attnum(parent_oid, TextDatumGetCString(
+			heap_getattr(tuple, Anum_pathman_global_indexes_attname, tupdesc, &isnull)));
+		if (attnum <= 0)
+			continue;
+
+		prel->gindex_attnums[prel->gindex_count] = attnum;
+		prel->gindex_relids[prel->gindex_count] = DatumGetObjectId(
+			heap_getattr(tuple, Anum_pathman_global_indexes_index, tupdesc, &isnull));
+		prel->gindex_count++;
+	}
+
+	systable_endscan(scan);
+	heap_close(gi_rel, AccessShareLock);
+}
+
+/*
+ * Returns oid of global_index_match() function or InvalidOid if extension
+ * isn't installed in current database
+ */
+Oid
+get_global_index_match_func(void)
+{
+	Oid			ext_schema = get_pathman_schema();
+	Oid			argtypes[3] = { REGCLASSOID, ANYELEMENTOID, REGCLASSOID };
+
+	if (!OidIsValid(ext_schema))
+		return InvalidOid;
+
+	return LookupFuncName(list_make2(makeString(get_namespace_name(ext_schema)),
+									 makeString("global_index_match")),
+						  3, argtypes, true);
+}
+
+/*
+ * Returns oid of key_values_match() function or InvalidOid if extension
+ * isn't installed in current database
+ */
+Oid
+get_key_values_match_func(void)
+{
+	Oid			ext_schema = get_pathman_schema();
+	Oid			argtypes[3] = { REGCLASSOID, REGCLASSOID, ANYARRAYOID };
+
+	if (!OidIsValid(ext_schema))
+		return InvalidOid;
+
+	return LookupFuncName(list_make2(makeString(get_namespace_name(ext_schema)),
+									 makeString("key_values_match")),
+						  3, argtypes, true);
+}
+
+/*
+ * Returns oid of pathman_config table or InvalidOid if extension isn't
+ * installed in current database
+ */
+static Oid
+get_pathman_config_relid(void)
+{
+	Oid			ext_schema = get_pathman_schema();
+
+	if (!OidIsValid(ext_schema))
+		return InvalidOid;
+
+	return get_relname_relid("pathman_config", ext_schema);
+}
+
+/*
+ * Returns namespace of pg_pathman extension or InvalidOid
+ */
+static Oid
+get_pathman_schema(void)
+{
+	Oid			ext_oid;
+	Oid			ext_schema = InvalidOid;
+	Relation	rel;
+	SysScanDesc scan;
+	ScanKeyData key[1];
+	HeapTuple	tuple;
+
+	ext_oid = get_extension_oid("pg_pathman", true);
+	if (!OidIsValid(ext_oid))
+		return InvalidOid;
+
+	rel = heap_open(ExtensionRelationId, AccessShareLock);
+	ScanKeyInit(&key[0],
+				ObjectIdAttributeNumber,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(ext_oid));
+	scan = systable_beginscan(rel, ExtensionOidIndexId, true, NULL, 1, key);
+
+	tuple = systable_getnext(scan);
+	if (HeapTupleIsValid(tuple))
+		ext_schema = ((Form_pg_extension) GETSTRUCT(tuple))->extnamespace;
+
+	systable_endscan(scan);
+	heap_close(rel, AccessShareLock);
+
+	return ext_schema;
+}
+
+/*
+ * Resolves relation name stored in pathman_config. Returns InvalidOid if
+ * the value is NULL or relation doesn't exist
+ */
+static Oid
+config_get_relid(HeapTuple tuple, TupleDesc tupdesc, int attnum)
+{
+	Datum		value;
+	bool		isnull;
+	List	   *names;
+
+	value = heap_getattr(tuple, attnum, tupdesc, &isnull);
+	if (isnull)
+		return InvalidOid;
+
+	names = stringToQualifiedNameList(TextDatumGetCString(value));
+	return RangeVarGetRelid(makeRangeVarFromNameList(names), NoLock, true);
+}
+
+void
+create_relations_hashtable()
+{
+	HASHCTL		ctl;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(RelationKey);
+	ctl.entrysize = sizeof(PartRelationInfo);
+
+	/* Already exists, recreate */
+	if (relations != NULL)
+		hash_destroy(relations);
+
+	ctl.num_partitions = PATHMAN_HASH_PARTITIONS;
+
+	relations = ShmemInitHash("Partitioning relation info",
+							  pathman_max_relations, pathman_max_relations,
+							  &ctl, HASH_ELEM | HASH_BLOBS | HASH_PARTITION);
+}
+
+/*
+ * Load and validate CHECK constraints
+ */
+void
+load_check_constraints(Oid parent_oid, Snapshot snapshot)
+{
+	PartRelationInfo *prel = NULL;
+	RangeRelation *rangerel = NULL;
+	ListRelation *listrel = NULL;
+	ListValues	list_values;
+	Relation	con_rel;
+	List	   *children_list;
+	ListCell   *lc;
+	Oid		   *children;
+	RangeEntry *ranges = NULL;
+	int64	   *key_bounds = NULL;
+	HTAB	   *bounds;
+	Oid			typinput;
+	Oid			typioparam = InvalidOid;
+	FmgrInfo	typinput_finfo;
+	Oid			key_typioparams[PATHMAN_MAX_KEYS];
+	FmgrInfo	key_typinputs[PATHMAN_MAX_KEYS];
+	BoundCmpContext cmp_ctx;
+	CompositeCmpContext composite_ctx;
+	bool		found;
+	int			proc,
+				i,
+				loaded = 0;
+
+	prel = get_pathman_relation_info(parent_oid, NULL);
+
+	/* Skip if already loaded */
+	if (prel->children.length > 0)
+		return;
+
+	load_zone_maps(parent_oid, snapshot);
+	load_global_indexes(prel, parent_oid, snapshot);
+
+	children_list = find_children(parent_oid, snapshot);
+	proc = list_length(children_list);
+
+	alloc_dsm_array(&prel->children, sizeof(Oid), proc);
+	children = (Oid *) dsm_array_get_pointer(&prel->children);
+	memset(children, 0, sizeof(Oid) * proc);
+
+	if (prel->parttype == PT_RANGE)
+	{
+		TypeCacheEntry	   *tce;
+		RelationKey key;
+		key.dbid = MyDatabaseId;
+		key.relid = parent_oid;
+
+		rangerel = (RangeRelation *)
+			pathman_hash_search(range_restrictions, &key, HASH_ENTER, &found);
+
+		alloc_dsm_array(&rangerel->ranges, sizeof(RangeEntry), proc);
+		ranges = (RangeEntry *) dsm_array_get_pointer(&rangerel->ranges);
+
+		tce = lookup_type_cache(prel->atttype, 0);
+		rangerel->by_val = tce->typbyval;
+
+		/* The rest columns of composite key */
+		if (prel->keys_count > 1)
+		{
+			alloc_dsm_array(&rangerel->key_bounds,
+							sizeof(int64) * RANGE_KEY_BOUNDS(prel->keys_count), proc);
+			key_bounds = (int64 *) dsm_array_get_pointer(&rangerel->key_bounds);
+		}
+		for (i = 0; i < prel->keys_count; i++)
+			rangerel->key_by_val[i] = get_typbyval(prel->key_atttypes[i]);
+	}
+	else if (prel->parttype == PT_LIST)
+	{
+		RelationKey key;
+		key.dbid = MyDatabaseId;
+		key.relid = parent_oid;
+
+		listrel = (ListRelation *)
+			pathman_hash_search(list_restrictions, &key, HASH_ENTER, &found);
+		listrel->by_val = get_typbyval(prel->atttype);
+		memset(&list_values, 0, sizeof(list_values));
+	}
+
+	/* Bounds saved by partition management functions */
+	bounds = read_partition_bounds(parent_oid, snapshot);
+	if (bounds != NULL && prel->parttype != PT_HASH)
+	{
+		getTypeInputInfo(prel->atttype, &typinput, &typioparam);
+		fmgr_info(typinput, &typinput_finfo);
+	}
+	if (bounds != NULL && prel->keys_count > 1)
+	{
+		for (i = 0; i < prel->keys_count; i++)
+		{
+			getTypeInputInfo(prel->key_atttypes[i], &typinput, &key_typioparams[i]);
+			fmgr_info(typinput, &key_typinputs[i]);
+		}
+	}
+
+	con_rel = heap_open(ConstraintRelationId, AccessShareLock);
+	foreach(lc, children_list)
+	{
+		Oid			child_oid = lfirst_oid(lc);
+		List	   *exprs;
+		ListCell   *lc2;
+		bool		valid = false;
+		PartitionBounds *pb = NULL;
+
+		if (bounds != NULL)
+			pb = (PartitionBounds *) hash_search(bounds, &child_oid, HASH_FIND, NULL);
+
+		/* Composite keys are described by stored bounds only */
+		if (prel->keys_count > 1)
+		{
+			Datum	mins[PATHMAN_MAX_KEYS];
+			Datum	maxs[PATHMAN_MAX_KEYS];
+
+			if (pb == NULL)
+				continue;
+
+			if (pb->lower == NULL || pb->upper == NULL ||
+				!parse_composite_bound(pb->lower, prel, key_typinputs,
+									   key_typioparams, mins) ||
+				!parse_composite_bound(pb->upper, prel, key_typinputs,
+									   key_typioparams, maxs))
+			{
+				elog(WARNING, "Bounds of relation %u MUST contain a value for "
+							  "every key column. Skipping...",
+					 child_oid);
+				continue;
+			}
+
+			set_range_entry(&ranges[loaded], child_oid, mins[0], maxs[0],
+							rangerel->by_val);
+			set_key_bounds(&key_bounds[loaded * RANGE_KEY_BOUNDS(prel->keys_count)],
+						   prel, rangerel, mins, maxs);
+			loaded++;
+			continue;
+		}
+
+		/* Take stored bounds if there are any */
+		if (pb != NULL && prel->parttype == PT_RANGE &&
+			pb->lower != NULL && pb->upper != NULL)
+		{
+			set_range_entry(&ranges[loaded], child_oid,
+							InputFunctionCall(&typinput_finfo, pb->lower, typioparam, -1),
+							InputFunctionCall(&typinput_finfo, pb->upper, typioparam, -1),
+							rangerel->by_val);
+			loaded++;
+			continue;
+		}
+		else if (pb != NULL && prel->parttype == PT_HASH &&
+				 pb->hash_idx >= 0 && pb->hash_idx < proc)
+		{
+			children[pb->hash_idx] = child_oid;
+			loaded++;
+			continue;
+		}
+		else if (pb != NULL && prel->parttype == PT_LIST &&
+				 pb->list_values != NULL)
+		{
+			for (i = 0; i < pb->list_nvalues; i++)
+				add_list_value(&list_values,
+							   InputFunctionCall(&typinput_finfo, pb->list_values[i],
+												 typioparam, -1),
+							   loaded);
+			children[loaded++] = child_oid;
+			continue;
+		}
+
+		/* Otherwise parse CHECK constraints */
+		exprs = get_check_constraints(con_rel, child_oid, snapshot);
+		foreach(lc2, exprs)
+		{
+			Expr   *expr = (Expr *) lfirst(lc2);
+			Datum	min;
+			Datum	max;
+			int		hash;
+			Datum  *values;
+			int		nvalues;
+
+			if (prel->parttype == PT_RANGE &&
+				validate_range_constraint(expr, prel, &min, &max))
+			{
+				set_range_entry(&ranges[loaded], child_oid, min, max,
+								rangerel->by_val);
+				valid = true;
+				break;
+			}
+			else if (prel->parttype == PT_HASH &&
+					 validate_hash_constraint(expr, prel, &hash))
+			{
+				children[hash] = child_oid;
+				valid = true;
+				break;
+			}
+			else if (prel->parttype == PT_LIST &&
+					 validate_list_constraint(expr, prel, &values, &nvalues))
+			{
+				for (i = 0; i < nvalues; i++)
+					add_list_value(&list_values, values[i], loaded);
+				children[loaded] = child_oid;
+				valid = true;
+				break;
+			}
+		}
+
+		if (valid)
+			loaded++;
+		else if (exprs == NIL)
+			continue;
+		else if (prel->parttype == PT_RANGE)
+			elog(WARNING, "Range constraint for relation %u MUST have exact format: "
+						  "VARIABLE >= CONST AND VARIABLE < CONST. Skipping...",
+				 child_oid);
+		else if (prel->parttype == PT_LIST)
+			elog(WARNING, "List constraint for relation %u MUST have exact format: "
+						  "VARIABLE = ANY(ARRAY[CONST, ...]). Skipping...",
+				 child_oid);
+		else
+			elog(WARNING, "Hash constraint for relation %u MUST have exact format: "
+						  "get_hash(VARIABLE, CONST) = CONST. Skipping...",
+				 child_oid);
+	}
+	heap_close(con_rel, AccessShareLock);
+	prel->children_count = loaded;
+
+	if (bounds != NULL)
+		hash_destroy(bounds);
+
+	/*
+	 * Rows are routed by hash modulo the number of partitions, so every
+	 * partition has to be known
+	 */
+	if (prel->parttype == PT_HASH)
+	{
+		for (i = 0; i < proc; i++)
+			if (!OidIsValid(children[i]))
+				break;
+
+		if (i < proc)
+		{
+			RelationKey key;
+			key.dbid = MyDatabaseId;
+			key.relid = parent_oid;
+
+			elog(WARNING, "Hash partition %d of relation %u is missing. Disabling pathman for relation %u...",
+				 i, parent_oid, parent_oid);
+			free_dsm_array(&prel->children);
+			prel->children_count = 0;
+			pathman_hash_search(relations, &key, HASH_REMOVE, &found);
+			return;
+		}
+		prel->children_count = proc;
+	}
+
+	if (prel->parttype == PT_RANGE)
+	{
+		/* Skipped partitions leave no holes */
+		rangerel->ranges.length = loaded;
+		prel->children.length = loaded;
+
+		/* Sort ascending */
+		if (prel->keys_count > 1)
+		{
+			rangerel->key_bounds.length = loaded;
+			sort_composite_ranges(prel, rangerel, loaded);
+			prepare_composite_cmp(&composite_ctx, prel, rangerel);
+		}
+		else
+		{
+			prepare_bound_cmp(&cmp_ctx, prel->atttype, rangerel->by_val);
+			qsort_arg(ranges, loaded, sizeof(RangeEntry), cmp_range_entries,
+					  &cmp_ctx);
+		}
+
+		/* Copy oids to prel */
+		for(i=0; i < loaded; i++)
+			children[i] = ranges[i].child_oid;
+
+		/* Check if some ranges overlap */
+		for(i=0; i < loaded-1; i++)
+		{
+			int		nbounds = RANGE_KEY_BOUNDS(prel->keys_count);
+
+			if (prel->keys_count > 1 ?
+				cmp_composite_bounds(&composite_ctx,
+									 &ranges[i+1], &key_bounds[(i+1) * nbounds], false,
+									 &ranges[i], &key_bounds[i * nbounds], true) < 0 :
+				cmp_bounds(&ranges[i+1].min, &ranges[i].max, &cmp_ctx) < 0)
+			{
+				RelationKey key;
+				key.dbid = MyDatabaseId;
+				key.relid = parent_oid;
+
+				elog(WARNING, "Partitions %u and %u overlap. Disabling pathman for relation %u...",
+					 ranges[i].child_oid, ranges[i+1].child_oid, parent_oid);
+				if (prel->zone_maps.length > 0)
+					free_dsm_array(&prel->zone_maps);
+				if (prel->keys_count > 1)
+					free_dsm_array(&rangerel->key_bounds);
+				free_dsm_array(&rangerel->ranges);
+				free_dsm_array(&prel->children);
+				prel->children_count = 0;
+				pathman_hash_search(range_restrictions, &key, HASH_REMOVE, &found);
+				pathman_hash_search(relations, &key, HASH_REMOVE, &found);
+				return;
+			}
+		}
+	}
+	else if (prel->parttype == PT_LIST)
+	{
+		/* Skipped partitions leave no holes */
+		prel->children.length = loaded;
+
+		/* The same value in two partitions */
+		if (!fill_list_relation(listrel, &list_values, loaded, prel->atttype))
+		{
+			RelationKey key;
+			key.dbid = MyDatabaseId;
+			key.relid = parent_oid;
+
+			elog(WARNING, "Partitions of relation %u overlap. Disabling pathman for relation %u...",
+				 parent_oid, parent_oid);
+			if (prel->zone_maps.length > 0)
+				free_dsm_array(&prel->zone_maps);
+			free_list_relation(parent_oid);
+			free_dsm_array(&prel->children);
+			prel->children_count = 0;
+			pathman_hash_search(relations, &key, HASH_REMOVE, &found);
+		}
+	}
+}
+
+/*
+ * Appends value of LIST partition to the collected ones
+ */
+static void
+add_list_value(ListValues *lv, Datum value, int child_idx)
+{
+	if (lv->count >= lv->capacity)
+	{
+		lv->capacity = lv->capacity > 0 ? lv->capacity * 2 : 64;
+		if (lv->values == NULL)
+		{
+			lv->values = palloc(sizeof(Datum) * lv->capacity);
+			lv->child_idxs = palloc(sizeof(int) * lv->capacity);
+		}
+		else
+		{
+			lv->values = repalloc(lv->values, sizeof(Datum) * lv->capacity);
+			lv->child_idxs = repalloc(lv->child_idxs, sizeof(int) * lv->capacity);
+		}
+	}
+	lv->values[lv->count] = value;
+	lv->child_idxs[lv->count] = child_idx;
+	lv->count++;
+}
+
+/*
+ * Builds open addressing hash map of LIST values. The map is at least twice
+ * as large as the number of values so probe chains stay short and there is
+ * always a free entry. Returns false if some value belongs to several
+ * partitions
+ */
+static bool
+fill_list_relation(ListRelation *listrel, ListValues *lv, int nchildren,
+				   Oid atttype)
+{
+	TypeCacheEntry *tce;
+	ListEntry  *map;
+	char	   *values;
+	int		   *counts;
+	Size		values_size = 0;
+	Size		offset = 0;
+	uint32		map_size = 8;
+	uint32		mask;
+	int			i;
+
+	tce = lookup_type_cache(atttype, TYPECACHE_HASH_PROC_FINFO);
+
+	while (map_size < 2 * lv->count)
+		map_size <<= 1;
+	mask = map_size - 1;
+
+	if (!listrel->by_val)
+		for (i = 0; i < lv->count; i++)
+			values_size += MAXALIGN(datumGetSize(lv->values[i], false, tce->typlen));
+
+	alloc_dsm_array(&listrel->map, sizeof(ListEntry), map_size);
+	alloc_dsm_array(&listrel->values, 1, values_size);
+	alloc_dsm_array(&listrel->counts, sizeof(int), nchildren);
+	map = (ListEntry *) dsm_array_get_pointer(&listrel->map);
+	values = (char *) dsm_array_get_pointer(&listrel->values);
+	counts = (int *) dsm_array_get_pointer(&listrel->counts);
+
+	for (i = 0; i < map_size; i++)
+		map[i].child_idx = -1;
+	memset(counts, 0, sizeof(int) * nchildren);
+
+	for (i = 0; i < lv->count; i++)
+	{
+		Datum	value = lv->values[i];
+		uint32	hash;
+		uint32	j;
+		int		idx;
+
+		idx = list_partition_lookup(map, map_size, values, listrel->by_val,
+									atttype, value);
+		if (idx == lv->child_idxs[i])
+			continue;
+		else if (idx >= 0)
+			return false;
+
+		hash = DatumGetUInt32(FunctionCall1(&tce->hash_proc_finfo, value));
+		for (j = hash & mask; map[j].child_idx >= 0; j = (j + 1) & mask);
+
+		map[j].hash = hash;
+		map[j].child_idx = lv->child_idxs[i];
+		if (listrel->by_val)
+			map[j].value = (int64) value;
+		else
+		{
+			Size	size = datumGetSize(value, false, tce->typlen);
+
+			memcpy(values + offset, DatumGetPointer(value), size);
+			map[j].value = offset;
+			offset += MAXALIGN(size);
+		}
+		counts[lv->child_idxs[i]]++;
+	}
+
+	return true;
+}
+
+/*
+ * Frees LIST map of relation and removes it from list_restrictions
+ */
+static void
+free_list_relation(Oid relid)
+{
+	ListRelation *listrel;
+	RelationKey key;
+
+	key.dbid = MyDatabaseId;
+	key.relid = relid;
+
+	listrel = pathman_hash_search(list_restrictions, &key, HASH_FIND, NULL);
+	if (listrel == NULL)
+		return;
+
+	free_dsm_array(&listrel->map);
+	free_dsm_array(&listrel->values);
+	free_dsm_array(&listrel->counts);
+	pathman_hash_search(list_restrictions, &key, HASH_REMOVE, NULL);
+}
+
+/*
+ * Fills range entry. Datums which aren't passed by value are copied
+ */
+static void
+set_range_entry(RangeEntry *re, Oid child_oid, Datum min, Datum max, bool by_val)
+{
+	/* If datum is referenced by val then just assign */
+	if (by_val)
+	{
+		re->min = min;
+		re->max = max;
+	}
+	/* else copy the memory by pointer */
+	else
+	{
+		memcpy(&re->min, DatumGetPointer(min), sizeof(re->min));
+		memcpy(&re->max, DatumGetPointer(max), sizeof(re->max));
+	}
+	re->child_oid = child_oid;
+}
+
+/*
+ * Reads bounds of parent's partitions from pathman_partition_bounds. Returns
+ * hashtable of PartitionBounds entries keyed by partition oid or NULL if
+ * there are no stored bounds
+ */
+static HTAB *
+read_partition_bounds(Oid parent_oid, Snapshot snapshot)
+{
+	return scan_partition_bounds("pathman_partition_bounds_parent_idx",
+								 Anum_pathman_partition_bounds_parent,
+								 parent_oid, snapshot);
+}
+
+/*
+ * Reads stored bounds of a single partition. Returns false if there are none
+ */
+static bool
+read_child_bounds(Oid child_oid, PartitionBounds *bounds)
+{
+	HTAB	   *result;
+	PartitionBounds *pb = NULL;
+
+	result = scan_partition_bounds("pathman_partition_bounds_pkey",
+								   Anum_pathman_partition_bounds_partition,
+								   child_oid, GetCatalogSnapshot(child_oid));
+	if (result == NULL)
+		return false;
+
+	pb = (PartitionBounds *) hash_search(result, &child_oid, HASH_FIND, NULL);
+	if (pb != NULL)
+		*bounds = *pb;
+	hash_destroy(result);
+
+	return pb != NULL;
+}
+
+/*
+ * Scans pathman_partition_bounds using specified index on a single column
+ */
+static HTAB *
+scan_partition_bounds(const char *index_name, AttrNumber attnum, Oid value,
+					  Snapshot snapshot)
+{
+	HTAB	   *result = NULL;
+	HASHCTL		ctl;
+	Oid			ext_schema;
+	Oid			bounds_relid;
+	Oid			bounds_idxid;
+	Relation	bounds_rel;
+	TupleDesc	tupdesc;
+	SysScanDesc scan;
+	ScanKeyData key[1];
+	HeapTuple	tuple;
+
+	ext_schema = get_pathman_schema();
+	if (!OidIsValid(ext_schema))
+		return NULL;
+
+	bounds_relid = get_relname_relid("pathman_partition_bounds", ext_schema);
+	bounds_idxid = get_relname_relid(index_name, ext_schema);
+	if (!OidIsValid(bounds_relid) || !OidIsValid(bounds_idxid))
+		return NULL;
+
+	bounds_rel = heap_open(bounds_relid, AccessShareLock);
+	tupdesc = RelationGetDescr(bounds_rel);
+	ScanKeyInit(&key[0],
+				attnum,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(value));
+	scan = systable_beginscan(bounds_rel, bounds_idxid, true, snapshot, 1, key);
+
+	while ((tuple = systable_getnext(scan)) != NULL)
+	{
+		PartitionBounds *pb;
+		Oid			child_oid;
+		Datum		datum;
+		bool		isnull;
+
+		if (result == NULL)
+		{
+			memset(&ctl, 0, sizeof(ctl));
+			ctl.keysize = sizeof(Oid);
+			ctl.entrysize = sizeof(PartitionBounds);
+			ctl.hcxt = CurrentMemoryContext;
+			result = hash_create("pg_pathman partition bounds", 1024, &ctl,
+								 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+		}
+
+		child_oid = DatumGetObjectId(
+			heap_getattr(tuple, Anum_pathman_partition_bounds_partition, tupdesc, &isnull));
+		pb = (PartitionBounds *) hash_search(result, &child_oid, HASH_ENTER, NULL);
+
+		pb->parent_oid = DatumGetObjectId(
+			heap_getattr(tuple, Anum_pathman_partition_bounds_parent, tupdesc, &isnull));
+		datum = heap_getattr(tuple, Anum_pathman_partition_bounds_lower, tupdesc, &isnull);
+		pb->lower = isnull ? NULL : TextDatumGetCString(datum);
+		datum = heap_getattr(tuple, Anum_pathman_partition_bounds_upper, tupdesc, &isnull);
+		pb->upper = isnull ? NULL : TextDatumGetCString(datum);
+		datum = heap_getattr(tuple, Anum_pathman_partition_bounds_hash_idx, tupdesc, &isnull);
+		pb->hash_idx = isnull ? -1 : DatumGetInt32(datum);
+		datum = heap_getattr(tuple, Anum_pathman_partition_bounds_list_values, tupdesc, &isnull);
+		pb->list_values = NULL;
+		pb->list_nvalues = 0;
+		if (!isnull)
+		{
+			Datum  *elems;
+			bool   *elem_nulls;
+			int		i;
+
+			deconstruct_array(DatumGetArrayTypeP(datum), TEXTOID, -1, false, 'i',
+							  &elems, &elem_nulls, &pb->list_nvalues);
+			pb->list_values = palloc(sizeof(char *) * pb->list_nvalues);
+			for (i = 0; i < pb->list_nvalues; i++)
+				pb->list_values[i] = TextDatumGetCString(elems[i]);
+		}
+	}
+
+	systable_endscan(scan);
+	heap_close(bounds_rel, AccessShareLock);
+
+	return result;
+}
+
+/*
+ * Returns children of the parent relation using pg_inherits index
+ */
+static List *
+find_children(Oid parent_oid, Snapshot snapshot)
+{
+	List	   *result = NIL;
+	Relation	inh_rel;
+	SysScanDesc scan;
+	ScanKeyData key[1];
+	HeapTuple	tuple;
+
+	inh_rel = heap_open(InheritsRelationId, AccessShareLock);
+	ScanKeyInit(&key[0],
+				Anum_pg_inherits_inhparent,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(parent_oid));
+	scan = systable_beginscan(inh_rel, InheritsParentIndexId, true,
+							  snapshot, 1, key);
+
+	while ((tuple = systable_getnext(scan)) != NULL)
+		result = lappend_oid(result,
+							 ((Form_pg_inherits) GETSTRUCT(tuple))->inhrelid);
+
+	systable_endscan(scan);
+	heap_close(inh_rel, AccessShareLock);
+
+	return result;
+}
+
+/*
+ * Returns parsed CHECK constraints of the relation using pg_constraint index
+ */
+static List *
+get_check_constraints(Relation con_rel, Oid relid, Snapshot snapshot)
+{
+	List	   *result = NIL;
+	SysScanDesc scan;
+	ScanKeyData key[1];
+	HeapTuple	tuple;
+
+	ScanKeyInit(&key[0],
+				Anum_pg_constraint_conrelid,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(relid));
+	scan = systable_beginscan(con_rel, ConstraintRelidIndexId, true,
+							  snapshot, 1, key);
+
+	while ((tuple = systable_getnext(scan)) != NULL)
+	{
+		Form_pg_constraint con = (Form_pg_constraint) GETSTRUCT(tuple);
+		Datum		val;
+		bool		isnull;
+
+		if (con->contype != CONSTRAINT_CHECK)
+			continue;
+
+		val = heap_getattr(tuple, Anum_pg_constraint_conbin,
+						   RelationGetDescr(con_rel), &isnull);
+		if (isnull)
+			elog(ERROR, "null conbin for constraint %u",
+				 HeapTupleGetOid(tuple));
+
+		result = lappend(result, stringToNode(TextDatumGetCString(val)));
+	}
+
+	systable_endscan(scan);
+
+	return result;
+}
+
+
+/*
+ * Adds new RANGE partitions to the relation info without reloading it from
+ * catalog. New partitions must be sorted in ascending order and must not
+ * overlap existing ones
+ */
+void
+add_range_partitions(Oid parent_oid, Datum *children, Datum *mins, Datum *maxs, int nparts)
+{
+	PartRelationInfo *prel;
+	RangeRelation *rangerel;
+	RangeEntry *old_ranges;
+	RangeEntry *new_ranges;
+	RangeEntry *ranges;
+	Oid		   *oids;
+	BoundCmpContext cmp_ctx;
+	int			old_count;
+	int			total;
+	int			i,
+				j,
+				k;
+
+	prel = get_pathman_relation_info(parent_oid, NULL);
+	rangerel = get_pathman_range_relation(parent_oid, NULL);
+	if (prel == NULL || rangerel == NULL || nparts <= 0)
+		return;
+
+	/* Build entries for new partitions */
+	new_ranges = palloc(sizeof(RangeEntry) * nparts);
+	for (i = 0; i < nparts; i++)
+	{
+		new_ranges[i].child_oid = DatumGetObjectId(children[i]);
+		if (rangerel->by_val)
+		{
+			new_ranges[i].min = mins[i];
+			new_ranges[i].max = maxs[i];
+		}
+		else
+		{
+			memcpy(&new_ranges[i].min, DatumGetPointer(mins[i]), sizeof(new_ranges[i].min));
+			memcpy(&new_ranges[i].max, DatumGetPointer(maxs[i]), sizeof(new_ranges[i].max));
+		}
+	}
+
+	/* Save existing entries */
+	old_count = rangerel->ranges.length;
+	total = old_count + nparts;
+	old_ranges = palloc(sizeof(RangeEntry) * Max(old_count, 1));
+	memcpy(old_ranges, dsm_array_get_pointer(&rangerel->ranges),
+		   sizeof(RangeEntry) * old_count);
+
+	/* Reallocate arrays */
+	if (old_count > 0)
+	{
+		free_dsm_array(&rangerel->ranges);
+		free_dsm_array(&prel->children);
+	}
+	alloc_dsm_array(&rangerel->ranges, sizeof(RangeEntry), total);
+	alloc_dsm_array(&prel->children, sizeof(Oid), total);
+	ranges = (RangeEntry *) dsm_array_get_pointer(&rangerel->ranges);
+	oids = (Oid *) dsm_array_get_pointer(&prel->children);
+
+	/* Merge both sorted arrays */
+	prepare_bound_cmp(&cmp_ctx, prel->atttype, rangerel->by_val);
+	for (i = 0, j = 0, k = 0; k < total; k++)
+	{
+		if (j >= nparts ||
+			(i < old_count &&
+			 cmp_range_entries(&old_ranges[i], &new_ranges[j], &cmp_ctx) < 0))
+			ranges[k] = old_ranges[i++];
+		else
+			ranges[k] = new_ranges[j++];
+		oids[k] = ranges[k].child_oid;
+	}
+	prel->children_count = total;
+	pathman_cache_changed(parent_oid);
+
+	pfree(old_ranges);
+	pfree(new_ranges);
+}
+
+/*
+ * Applies a single attached partition to the relation info. RANGE partition
+ * is merged into the existing ranges; HASH relation is reloaded completely
+ * since its constraints depend on the number of partitions
+ */
+void
+add_partition_info(Oid parent_oid, Oid child_oid)
+{
+	PartRelationInfo *prel;
+	Oid		   *children;
+	Datum		min,
+				max;
+	Datum		child;
+	int			i;
+
+	prel = get_pathman_relation_info(parent_oid, NULL);
+
+	/* Reload would disable partitioning of the whole relation otherwise */
+	if (prel != NULL && prel->parttype == PT_LIST)
+		check_attached_list_partition(prel, parent_oid, child_oid);
+
+	if (prel == NULL || prel->parttype != PT_RANGE || prel->keys_count > 1 ||
+		get_pathman_range_relation(parent_oid, NULL) == NULL)
+	{
+		load_relation_info(parent_oid);
+		return;
+	}
+
+	/* Partition may already be there */
+	children = (Oid *) dsm_array_get_pointer(&prel->children);
+	for (i = 0; i < prel->children_count; i++)
+		if (children[i] == child_oid)
+			return;
+
+	if (load_range_constraint(child_oid, prel, &min, &max))
+	{
+		child = ObjectIdGetDatum(child_oid);
+		add_range_partitions(parent_oid, &child, &min, &max, 1);
+	}
+}
+
+/*
+ * Raises an error if values of LIST partition being attached belong to other
+ * partitions of the relation
+ */
+static void
+check_attached_list_partition(PartRelationInfo *prel, Oid parent_oid,
+							  Oid child_oid)
+{
+	ListRelation *listrel;
+	PartitionBounds bounds;
+	Datum	   *values = NULL;
+	int			nvalues = 0;
+	Oid		   *children;
+	Oid			typinput;
+	Oid			typioparam;
+	int			i;
+	RelationKey key;
+
+	key.dbid = MyDatabaseId;
+	key.relid = parent_oid;
+	listrel = pathman_hash_search(list_restrictions, &key, HASH_FIND, NULL);
+	if (listrel == NULL || listrel->map.length == 0)
+		return;
+
+	if (read_child_bounds(child_oid, &bounds) && bounds.list_values != NULL)
+	{
+		getTypeInputInfo(prel->atttype, &typinput, &typioparam);
+		nvalues = bounds.list_nvalues;
+		values = (Datum *) palloc(sizeof(Datum) * nvalues);
+		for (i = 0; i < nvalues; i++)
+			values[i] = OidInputFunctionCall(typinput, bounds.list_values[i],
+											 typioparam, -1);
+	}
+	else
+	{
+		Relation	con_rel;
+		List	   *exprs;
+		ListCell   *lc;
+
+		con_rel = heap_open(ConstraintRelationId, AccessShareLock);
+		exprs = get_check_constraints(con_rel, child_oid,
+									  GetCatalogSnapshot(child_oid));
+		foreach(lc, exprs)
+			if (validate_list_constraint((Expr *) lfirst(lc), prel,
+										 &values, &nvalues))
+				break;
+		heap_close(con_rel, AccessShareLock);
+	}
+
+	children = (Oid *) dsm_array_get_pointer(&prel->children);
+	for (i = 0; i < nvalues; i++)
+	{
+		int		idx;
+
+		idx = list_partition_lookup((ListEntry *) dsm_array_get_pointer(&listrel->map),
+									listrel->map.length,
+									(char *) dsm_array_get_pointer(&listrel->values),
+									listrel->by_val, prel->atttype, values[i]);
+		if (idx >= 0 && children[idx] != child_oid)
+			elog(ERROR, "Values of partition %u overlap with partition %u of relation %u",
+				 child_oid, children[idx], parent_oid);
+	}
+}
+
+/*
+ * Removes a single partition from the relation info
+ */
+void
+remove_partition_info(Oid parent_oid, Oid child_oid)
+{
+	PartRelationInfo *prel;
+	RangeRelation *rangerel;
+	RangeEntry *ranges;
+	RangeEntry *new_ranges;
+	Oid		   *children;
+	int			count,
+				i,
+				j;
+
+	prel = get_pathman_relation_info(parent_oid, NULL);
+	if (prel == NULL)
+		return;
+
+	if (prel->parttype != PT_RANGE || prel->keys_count > 1)
+	{
+		load_relation_info(parent_oid);
+		return;
+	}
+
+	rangerel = get_pathman_range_relation(parent_oid, NULL);
+	if (rangerel == NULL)
+		return;
+
+	if (rangerel->default_oid == child_oid)
+	{
+		rangerel->default_oid = InvalidOid;
+		pathman_cache_changed(parent_oid);
+	}
+
+	/* Copy all the entries except the removed one */
+	count = rangerel->ranges.length;
+	ranges = (RangeEntry *) dsm_array_get_pointer(&rangerel->ranges);
+	new_ranges = palloc(sizeof(RangeEntry) * Max(count, 1));
+	for (i = 0, j = 0; i < count; i++)
+		if (ranges[i].child_oid != child_oid)
+			new_ranges[j++] = ranges[i];
+
+	/* Nothing to remove */
+	if (j == count)
+	{
+		pfree(new_ranges);
+		return;
+	}
+
+	/* Reallocate arrays */
+	free_dsm_array(&rangerel->ranges);
+	free_dsm_array(&prel->children);
+	alloc_dsm_array(&rangerel->ranges, sizeof(RangeEntry), j);
+	alloc_dsm_array(&prel->children, sizeof(Oid), j);
+	ranges = (RangeEntry *) dsm_array_get_pointer(&rangerel->ranges);
+	children = (Oid *) dsm_array_get_pointer(&prel->children);
+	for (i = 0; i < j; i++)
+	{
+		ranges[i] = new_ranges[i];
+		children[i] = new_ranges[i].child_oid;
+	}
+	prel->children_count = j;
+	pathman_cache_changed(parent_oid);
+
+	pfree(new_ranges);
+}
+
+/*
+ * Reads CHECK constraint of a single RANGE partition
+ */
+static bool
+load_range_constraint(Oid child_oid, PartRelationInfo *prel, Datum *min, Datum *max)
+{
+	Relation	con_rel;
+	List	   *exprs;
+	ListCell   *lc;
+	bool		valid = false;
+
+	con_rel = heap_open(ConstraintRelationId, AccessShareLock);
+	exprs = get_check_constraints(con_rel, child_oid, GetCatalogSnapshot(child_oid));
+	heap_close(con_rel, AccessShareLock);
+
+	foreach(lc, exprs)
+	{
+		if (validate_range_constraint((Expr *) lfirst(lc), prel, min, max))
+		{
+			valid = true;
+			break;
+		}
+	}
+
+	if (!valid)
+		elog(WARNING, "Range constraint for relation %u MUST have exact format: "
+					  "VARIABLE >= CONST AND VARIABLE < CONST. Skipping...",
+			 child_oid);
+	return valid;
+}
+
+/*
+ * Chooses comparison routine for range bounds. Bounds of common integer and
+ * timestamp types are compared natively, others through the btree
+ * comparison function of the type
+ */
+static void
+prepare_bound_cmp(BoundCmpContext *ctx, Oid atttype, bool by_val)
+{
+	TypeCacheEntry *tce;
+
+	ctx->by_val = by_val;
+	ctx->cmp_func = NULL;
+	switch (atttype)
+	{
+		case INT2OID:
+			ctx->kind = BOUND_CMP_INT16;
+			return;
+		case INT4OID:
+		case DATEOID:
+			ctx->kind = BOUND_CMP_INT32;
+			return;
+		case INT8OID:
+			ctx->kind = BOUND_CMP_INT64;
+			return;
+#ifdef HAVE_INT64_TIMESTAMP
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+			ctx->kind = BOUND_CMP_INT64;
+			return;
+#endif
+		default:
+			tce = lookup_type_cache(atttype,
+				TYPECACHE_CMP_PROC | TYPECACHE_CMP_PROC_FINFO);
+			ctx->cmp_func = &tce->cmp_proc_finfo;
+			ctx->kind = BOUND_CMP_GENERIC;
+	}
+}
+
+#define NATIVE_CMP(a, b) ( (a) < (b) ? -1 : ((a) > (b) ? 1 : 0) )
+
+/*
+ * Compares two range bounds as they are stored in RangeEntry. Call
+ * prepare_bound_cmp() first
+ */
+static int
+cmp_bounds(const void *b1, const void *b2, const BoundCmpContext *ctx)
+{
+	switch (ctx->kind)
+	{
+		case BOUND_CMP_INT16:
+			return NATIVE_CMP(DatumGetInt16(*(const Datum *) b1),
+							  DatumGetInt16(*(const Datum *) b2));
+		case BOUND_CMP_INT32:
+			return NATIVE_CMP(DatumGetInt32(*(const Datum *) b1),
+							  DatumGetInt32(*(const Datum *) b2));
+		case BOUND_CMP_INT64:
+			return NATIVE_CMP(*(const int64 *) b1, *(const int64 *) b2);
+		default:
+			return DatumGetInt32(FunctionCall2(ctx->cmp_func,
+				ctx->by_val ? *(const Datum *) b1 : PointerGetDatum(b1),
+				ctx->by_val ? *(const Datum *) b2 : PointerGetDatum(b2)));
+	}
+}
+
+/* qsort_arg comparison function for range entries, arg is BoundCmpContext */
+static int
+cmp_range_entries(const void *p1, const void *p2, void *arg)
+{
+	const RangeEntry	*v1 = (const RangeEntry *) p1;
+	const RangeEntry	*v2 = (const RangeEntry *) p2;
+
+	return cmp_bounds(&v1->min, &v2->min, (const BoundCmpContext *) arg);
+}
+
+/*
+ * Chooses comparison functions for bounds of composite key
+ */
+static void
+prepare_composite_cmp(CompositeCmpContext *ctx, PartRelationInfo *prel,
+					  RangeRelation *rangerel)
+{
+	TypeCacheEntry *tce;
+	int			i;
+
+	ctx->keys_count = prel->keys_count;
+	ctx->by_val = rangerel->key_by_val;
+	for (i = 0; i < prel->keys_count; i++)
+	{
+		tce = lookup_type_cache(prel->key_atttypes[i],
+			TYPECACHE_CMP_PROC | TYPECACHE_CMP_PROC_FINFO);
+		ctx->cmp_funcs[i] = &tce->cmp_proc_finfo;
+	}
+}
+
+/*
+ * Returns lower or upper bound of the key column of composite range entry
+ */
+static Datum
+composite_bound(const CompositeCmpContext *ctx, RangeEntry *re, int64 *bounds,
+				int key, bool upper)
+{
+	int64	   *bound;
+
+	if (key == 0)
+		bound = upper ? &re->max : &re->min;
+	else
+		bound = &bounds[(upper ? ctx->keys_count - 1 : 0) + key - 1];
+
+	return ctx->by_val[key] ? (Datum) *bound : PointerGetDatum(bound);
+}
+
+/*
+ * Compares bounds of composite key lexicographically. Call
+ * prepare_composite_cmp() first
+ */
+static int
+cmp_composite_bounds(const CompositeCmpContext *ctx,
+					 RangeEntry *re1, int64 *bounds1, bool upper1,
+					 RangeEntry *re2, int64 *bounds2, bool upper2)
+{
+	int			cmp;
+	int			i;
+
+	for (i = 0; i < ctx->keys_count; i++)
+	{
+		cmp = DatumGetInt32(FunctionCall2(ctx->cmp_funcs[i],
+										  composite_bound(ctx, re1, bounds1, i, upper1),
+										  composite_bound(ctx, re2, bounds2, i, upper2)));
+		if (cmp != 0)
+			return cmp;
+	}
+
+	return 0;
+}
+
+/*
+ * qsort_arg comparison function for composite range entries, arg is
+ * CompositeCmpContext
+ */
+static int
+cmp_composite_range_entries(const void *p1, const void *p2, void *arg)
+{
+	CompositeRangeEntry *v1 = (CompositeRangeEntry *) p1;
+	CompositeRangeEntry *v2 = (CompositeRangeEntry *) p2;
+
+	return cmp_composite_bounds((const CompositeCmpContext *) arg,
+								&v1->re, v1->bounds, false,
+								&v2->re, v2->bounds, false);
+}
+
+/*
+ * Sorts range entries of composite key together with bounds of the rest
+ * key columns
+ */
+static void
+sort_composite_ranges(PartRelationInfo *prel, RangeRelation *rangerel, int count)
+{
+	RangeEntry *ranges = (RangeEntry *) dsm_array_get_pointer(&rangerel->ranges);
+	int64	   *bounds = (int64 *) dsm_array_get_pointer(&rangerel->key_bounds);
+	int			nbounds = RANGE_KEY_BOUNDS(prel->keys_count);
+	CompositeRangeEntry *entries;
+	CompositeCmpContext ctx;
+	int			i;
+
+	entries = palloc(sizeof(CompositeRangeEntry) * Max(count, 1));
+	for (i = 0; i < count; i++)
+	{
+		entries[i].re = ranges[i];
+		memcpy(entries[i].bounds, &bounds[i * nbounds], sizeof(int64) * nbounds);
+	}
+
+	prepare_composite_cmp(&ctx, prel, rangerel);
+	qsort_arg(entries, count, sizeof(CompositeRangeEntry),
+			  cmp_composite_range_entries, &ctx);
+
+	for (i = 0; i < count; i++)
+	{
+		ranges[i] = entries[i].re;
+		memcpy(&bounds[i * nbounds], entries[i].bounds, sizeof(int64) * nbounds);
+	}
+	pfree(entries);
+}
+
+/*
+ * Parses bound of composite key stored as text array of column values.
+ * Returns false if it doesn't have a value for every key column
+ */
+static bool
+parse_composite_bound(const char *str, PartRelationInfo *prel,
+					  FmgrInfo *typinput, Oid *typioparam, Datum *values)
+{
+	ArrayType  *arr;
+	Datum	   *elems;
+	bool	   *nulls;
+	int			nelems;
+	int			i;
+
+	arr = DatumGetArrayTypeP(OidFunctionCall3(F_ARRAY_IN,
+											  CStringGetDatum(str),
+											  ObjectIdGetDatum(TEXTOID),
+											  Int32GetDatum(-1)));
+	deconstruct_array(arr, TEXTOID, -1, false, 'i', &elems, &nulls, &nelems);
+	if (nelems != prel->keys_count)
+		return false;
+
+	for (i = 0; i < nelems; i++)
+	{
+		if (nulls[i])
+			return false;
+		values[i] = InputFunctionCall(&typinput[i], TextDatumGetCString(elems[i]),
+									  typioparam[i], -1);
+	}
+
+	return true;
+}
+
+/*
+ * Fills bounds of composite key columns but the first one
+ */
+static void
+set_key_bounds(int64 *bounds, PartRelationInfo *prel, RangeRelation *rangerel,
+			   Datum *mins, Datum *maxs)
+{
+	int			n = prel->keys_count - 1;
+	int			i;
+
+	for (i = 1; i < prel->keys_count; i++)
+	{
+		if (rangerel->key_by_val[i])
+		{
+			bounds[i - 1] = mins[i];
+			bounds[n + i - 1] = maxs[i];
+		}
+		else
+		{
+			memcpy(&bounds[i - 1], DatumGetPointer(mins[i]), sizeof(int64));
+			memcpy(&bounds[n + i - 1], DatumGetPointer(maxs[i]), sizeof(int64));
+		}
+	}
+}
+
+/*
+ * Validates range constraint. It MUST have the exact format:
+ * VARIABLE >= CONST AND VARIABLE < CONST
+ */
+static bool
+validate_range_constraint(Expr *expr, PartRelationInfo *prel, Datum *min, Datum *max)
+{
+	TypeCacheEntry *tce;
+	BoolExpr *boolexpr = (BoolExpr *) expr;
+	OpExpr *opexpr;
+
+	/* it should be an AND operator on top */
+	if ( !(IsA(expr, BoolExpr) && boolexpr->boolop == AND_EXPR) )
+		return false;
+
+	/* and it should have exactly two operands */
+	if (list_length(boolexpr->args) != 2)
+		return false;
+
+	tce = lookup_type_cache(prel->atttype, TYPECACHE_EQ_OPR | TYPECACHE_LT_OPR | TYPECACHE_GT_OPR);
+
+	/* check that left operand is >= operator */
+	opexpr = (OpExpr *) linitial(boolexpr->args);
+	if (get_op_opfamily_strategy(opexpr->opno, tce->btree_opf) == BTGreaterEqualStrategyNumber)
+	{
+		Node *left = linitial(opexpr->args);
+		Node *right = lsecond(opexpr->args);
+		if ( !IsA(left, Var) || !IsA(right, Const) )
+			return false;
+		if ( ((Var*) left)->varattno != prel->attnum )
+			return false;
+		*min = ((Const*) right)->constvalue;
+	}
+	else
+		return false;
+
+	/* TODO: rewrite this */
+	/* check that right operand is < operator */
+	opexpr = (OpExpr *) lsecond(boolexpr->args);
+	if (get_op_opfamily_strategy(opexpr->opno, tce->btree_opf) == BTLessStrategyNumber)
+	{
+		Node *left = linitial(opexpr->args);
+		Node *right = lsecond(opexpr->args);
+		if ( !IsA(left, Var) || !IsA(right, Const) )
+			return false;
+		if ( ((Var*) left)->varattno != prel->attnum )
+			return false;
+		*max = ((Const*) right)->constvalue;
+	}
+	else
+		return false;
+
+	return true;
+}
+
+/*
+ * Validate hash constraint. It MUST have the exact format
+ * VARIABLE % CONST = CONST
+ */
+static bool
+validate_hash_constraint(Expr *expr, PartRelationInfo *prel, int *hash)
+{
+	OpExpr *eqexpr;
+	Node   *hashexpr;
+	Node   *left;
+	Node   *right;
+	Const  *hash_result;
+	TypeCacheEntry *tce;
+
+	if (!IsA(expr, OpExpr))
+		return false;
+	eqexpr = (OpExpr *) expr;
+	if (list_length(eqexpr->args) != 2)
+		return false;
+	hashexpr = linitial(eqexpr->args);
+
+	/* Is this an equality operator? */
+	tce = lookup_type_cache(exprType(hashexpr), TYPECACHE_EQ_OPR);
+	if (get_op_opfamily_strategy(eqexpr->opno, tce->btree_opf) != BTEqualStrategyNumber)
+		return false;
+
+	if (IsA(hashexpr, OpExpr))
+	{
+		/* Is this a modulus operator? */
+		OpExpr *modexpr = (OpExpr *) hashexpr;
+
+		/* int4 %, int8 % and int2 % */
+		if (modexpr->opno != 530 && modexpr->opno != 439 && modexpr->opno != 529)
+			return false;
+		if (list_length(modexpr->args) != 2)
+			return false;
+
+		left = linitial(modexpr->args);
+		right = lsecond(modexpr->args);
+	}
+	else if (IsA(hashexpr, FuncExpr))
+	{
+		/* Is this a get_hash() function of pg_pathman? */
+		FuncExpr   *funcexpr = (FuncExpr *) hashexpr;
+		char	   *funcname = get_func_name(funcexpr->funcid);
+
+		if (funcname == NULL || strcmp(funcname, "get_hash") != 0 ||
+			get_func_namespace(funcexpr->funcid) != get_pathman_schema())
+			return false;
+		if (list_length(funcexpr->args) != 2)
+			return false;
+
+		left = linitial(funcexpr->args);
+		right = lsecond(funcexpr->args);
+	}
+	else
+		return false;
+
+	if ( !IsA(left, Var) || !IsA(right, Const) )
+		return false;
+	if ( ((Var*) left)->varattno != prel->attnum )
+		return false;
+	if (const_integer_value((Const *) right) != prel->children.length)
+		return false;
+
+	if ( !IsA(lsecond(eqexpr->args), Const) )
+		return false;
+
+	hash_result = lsecond(eqexpr->args);
+	*hash = (int) const_integer_value(hash_result);
+	if (*hash < 0 || *hash >= prel->children.length)
+		return false;
+	return true;
+}
+
+/*
+ * Returns value of integer constant of the modulus constraint, which is of
+ * the key type for SMALLINT and BIGINT keys
+ */
+static int64
+const_integer_value(Const *c)
+{
+	if (c->constisnull)
+		return -1;
+
+	switch (c->consttype)
+	{
+		case INT2OID:
+			return DatumGetInt16(c->constvalue);
+		case INT8OID:
+			return DatumGetInt64(c->constvalue);
+		default:
+			return DatumGetInt32(c->constvalue);
+	}
+}
+
+/*
+ * Checks that LIST constraint has format VARIABLE = ANY(ARRAY[CONST, ...])
+ * and returns its values
+ */
+static bool
+validate_list_constraint(Expr *expr, PartRelationInfo *prel,
+						 Datum **values, int *nvalues)
+{
+	ScalarArrayOpExpr *arrexpr;
+	Node	   *left;
+	Node	   *right;
+	ArrayType  *arr;
+	TypeCacheEntry *tce;
+	bool	   *nulls;
+	int16		elmlen;
+	bool		elmbyval;
+	char		elmalign;
+	int			i;
+
+	if (!IsA(expr, ScalarArrayOpExpr))
+		return false;
+	arrexpr = (ScalarArrayOpExpr *) expr;
+	if (!arrexpr->useOr || list_length(arrexpr->args) != 2)
+		return false;
+
+	/* Is this an equality operator? */
+	tce = lookup_type_cache(prel->atttype, TYPECACHE_EQ_OPR);
+	if (get_op_opfamily_strategy(arrexpr->opno, tce->btree_opf) != BTEqualStrategyNumber)
+		return false;
+
+	left = linitial(arrexpr->args);
+	right = lsecond(arrexpr->args);
+	if ( !IsA(left, Var) || !IsA(right, Const) )
+		return false;
+	if ( ((Var*) left)->varattno != prel->attnum || ((Const*) right)->constisnull )
+		return false;
+
+	arr = DatumGetArrayTypeP(((Const*) right)->constvalue);
+	if (ARR_ELEMTYPE(arr) != prel->atttype)
+		return false;
+
+	get_typlenbyvalalign(prel->atttype, &elmlen, &elmbyval, &elmalign);
+	deconstruct_array(arr, prel->atttype, elmlen, elmbyval, elmalign,
+					  values, &nulls, nvalues);
+	for (i = 0; i < *nvalues; i++)
+		if (nulls[i])
+			return false;
+
+	return true;
+}
+
+/*
+ * Create range restrictions table
+ */
+void
+create_range_restrictions_hashtable()
+{
+	HASHCTL		ctl;
 
 	memset(&ctl, 0, sizeof(ctl));
 	ctl.keysize = sizeof(RelationKey);
 	ctl.entrysize = sizeof(RangeRelation);
+	ctl.num_partitions = PATHMAN_HASH_PARTITIONS;
 	range_restrictions = ShmemInitHash("pg_pathman range restrictions",
-									   1024, 1024, &ctl, HASH_ELEM | HASH_BLOBS);
+									   pathman_max_relations, pathman_max_relations,
+									   &ctl, HASH_ELEM | HASH_BLOBS | HASH_PARTITION);
+}
+
+/*
+ * Create list restrictions table
+ */
+void
+create_list_restrictions_hashtable()
+{
+	HASHCTL		ctl;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(RelationKey);
+	ctl.entrysize = sizeof(ListRelation);
+	ctl.num_partitions = PATHMAN_HASH_PARTITIONS;
+	list_restrictions = ShmemInitHash("pg_pathman list restrictions",
+									  pathman_max_relations, pathman_max_relations,
+									  &ctl, HASH_ELEM | HASH_BLOBS | HASH_PARTITION);
+}
+
+/*
+ * Searches relations, range_restrictions or list_restrictions hashtable
+ * holding the lock of the corresponding hashtable partition. All of them
+ * have the same key, so they share the locks. The lock only protects the
+ * hashtable itself: entries are modified and removed under exclusive
+ * load_config_lock, so the returned entry may be used only while holding
+ * load_config_lock (see lock_pathman_relation_info())
+ */
+void *
+pathman_hash_search(HTAB *htab, const RelationKey *key, HASHACTION action,
+					bool *found)
+{
+	uint32		hashcode = get_hash_value(htab, (const void *) key);
+	LWLock	   *lock = pmstate->relations_locks[hashcode % PATHMAN_HASH_PARTITIONS];
+	void	   *result;
+
+	LWLockAcquire(lock, action == HASH_FIND ? LW_SHARED : LW_EXCLUSIVE);
+	result = hash_search_with_hash_value(htab, (const void *) key, hashcode,
+										 action, found);
+	LWLockRelease(lock);
+
+	/* Entry is going to be modified, invalidate backend-local caches */
+	if (action != HASH_FIND)
+		pathman_cache_changed(key->relid);
+
+	return result;
+}
+
+/*
+ * Must be called by whoever modifies relations or range_restrictions in
+ * place (under exclusive load_config_lock). Relation is remembered until the
+ * end of transaction, so that the change could be checked by everyone if the
+ * transaction aborts
+ */
+void
+pathman_cache_changed(Oid relid)
+{
+	MemoryContext old_mcxt;
+
+	pg_atomic_fetch_add_u32(&pmstate->cache_generation, 1);
+
+	if (!IsTransactionState())
+		return;
+
+	if (!cache_callbacks_registered)
+	{
+		RegisterXactCallback(cache_xact_callback, NULL);
+		RegisterSubXactCallback(cache_subxact_callback, NULL);
+		cache_callbacks_registered = true;
+	}
+
+	old_mcxt = MemoryContextSwitchTo(TopTransactionContext);
+	changed_relations = list_append_unique_oid(changed_relations, relid);
+	MemoryContextSwitchTo(old_mcxt);
+}
+
+/*
+ * Makes relations changed by current transaction checked by all backends.
+ * Aborted transaction doesn't send invalidations, so only this backend would
+ * notice that its changes of shared cache have been rolled back otherwise
+ */
+static void
+publish_aborted_changes(void)
+{
+	ListCell   *lc;
+
+	SpinLockAcquire(&pmstate->aborted_mutex);
+	foreach(lc, changed_relations)
+	{
+		RelationKey *entry;
+
+		entry = &pmstate->aborted_relids[pmstate->aborted_count % PATHMAN_ABORTED_RELIDS];
+		entry->dbid = MyDatabaseId;
+		entry->relid = lfirst_oid(lc);
+		pmstate->aborted_count++;
+	}
+	SpinLockRelease(&pmstate->aborted_mutex);
+}
+
+static void
+cache_xact_callback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		/* Prepared transaction may be rolled back by another backend */
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PREPARE:
+			publish_aborted_changes();
+			/* FALLTHROUGH */
+		case XACT_EVENT_COMMIT:
+			/* List itself is freed together with TopTransactionContext */
+			changed_relations = NIL;
+			break;
+		default:
+			break;
+	}
+}
+
+/*
+ * Changes made by aborted subtransaction are rolled back as well. Relations
+ * changed by the whole transaction are published since the list isn't kept
+ * per subtransaction; checking some of them needlessly is harmless
+ */
+static void
+cache_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+					   SubTransactionId parentSubid, void *arg)
+{
+	if (event == SUBXACT_EVENT_ABORT_SUB)
+		publish_aborted_changes();
+}
+
+/*
+ * Locks all the partitions of relations hashtables. Used for sequential
+ * scans
+ */
+void
+lock_relations_hashtables(LWLockMode mode)
+{
+	int		i;
+
+	for (i = 0; i < PATHMAN_HASH_PARTITIONS; i++)
+		LWLockAcquire(pmstate->relations_locks[i], mode);
+}
+
+void
+unlock_relations_hashtables(void)
+{
+	int		i;
+
+	for (i = PATHMAN_HASH_PARTITIONS - 1; i >= 0; i--)
+		LWLockRelease(pmstate->relations_locks[i]);
 }
 
 /*
@@ -576,12 +2884,23 @@ remove_relation_info(Oid relid)
 	key.dbid = MyDatabaseId;
 	key.relid = relid;
 
-	prel = get_pathman_relation_info(relid, NULL);
+	/* Don't use get_pathman_relation_info() to avoid loading partitions */
+	prel = pathman_hash_search(relations, &key, HASH_FIND, NULL);
 
 	/* If there is nothing to remove then just return */
 	if (!prel)
 		return;
 
+	/* Partitions haven't been loaded */
+	if (!prel->loaded)
+	{
+		pathman_hash_search(relations, &key, HASH_REMOVE, NULL);
+		return;
+	}
+
+	if (prel->zone_maps.length > 0)
+		free_dsm_array(&prel->zone_maps);
+
 	/* Remove children relations */
 	switch (prel->parttype)
 	{
@@ -591,10 +2910,532 @@ remove_relation_info(Oid relid)
 		case PT_RANGE:
 			rangerel = get_pathman_range_relation(relid, NULL);
 			free_dsm_array(&rangerel->ranges);
+			if (prel->keys_count > 1)
+				free_dsm_array(&rangerel->key_bounds);
+			free_dsm_array(&prel->children);
+			pathman_hash_search(range_restrictions, &key, HASH_REMOVE, NULL);
+			break;
+		case PT_LIST:
+			free_list_relation(relid);
 			free_dsm_array(&prel->children);
-			hash_search(range_restrictions, (const void *) &key, HASH_REMOVE, NULL);
 			break;
 	}
 	prel->children_count = 0;
-	hash_search(relations, (const void *) &key, HASH_REMOVE, 0);
+	pathman_hash_search(relations, &key, HASH_REMOVE, NULL);
+}
+
+/*
+ * Relcache invalidation callback. Catalog can't be accessed here so relation
+ * is just remembered and checked later by process_invalidated_relations()
+ */
+void
+pathman_relcache_hook(Datum arg, Oid relid)
+{
+	HASHCTL		ctl;
+
+	if (!OidIsValid(relid))
+	{
+		invalidate_all_relations = true;
+		return;
+	}
+
+	if (invalidated_relations == NULL)
+	{
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(Oid);
+		invalidated_relations = hash_create("pg_pathman invalidated relations",
+											64, &ctl, HASH_ELEM | HASH_BLOBS);
+	}
+	hash_search(invalidated_relations, &relid, HASH_ENTER, NULL);
+}
+
+/*
+ * Checks relations invalidated since the last call and reloads partitioned
+ * tables whose cached partitions don't match catalog anymore. Works for
+ * manual DDL and rolled back transactions as well
+ */
+void
+process_invalidated_relations(void)
+{
+	HASH_SEQ_STATUS status;
+	List	   *relids = NIL;
+	ListCell   *lc;
+	Oid		   *relid;
+
+	add_aborted_relations();
+
+	if (invalidate_all_relations)
+	{
+		PartRelationInfo *prel;
+
+		invalidate_all_relations = false;
+		if (invalidated_relations != NULL)
+		{
+			hash_destroy(invalidated_relations);
+			invalidated_relations = NULL;
+		}
+
+		/* Check every partitioned table of current database */
+		lock_relations_hashtables(LW_SHARED);
+		hash_seq_init(&status, relations);
+		while ((prel = (PartRelationInfo *) hash_seq_search(&status)) != NULL)
+			if (prel->key.dbid == MyDatabaseId && prel->loaded)
+				relids = lappend_oid(relids, prel->key.relid);
+		unlock_relations_hashtables();
+
+		foreach(lc, relids)
+			check_relation_children(lfirst_oid(lc));
+		return;
+	}
+
+	if (invalidated_relations == NULL)
+		return;
+
+	/* New invalidations may come while we are checking these ones */
+	hash_seq_init(&status, invalidated_relations);
+	while ((relid = (Oid *) hash_seq_search(&status)) != NULL)
+		relids = lappend_oid(relids, *relid);
+	hash_destroy(invalidated_relations);
+	invalidated_relations = NULL;
+
+	foreach(lc, relids)
+		check_invalidated_relation(lfirst_oid(lc));
+}
+
+/*
+ * Adds relations changed by transactions aborted by any backend since the
+ * last call to invalidated ones. If some of them have already been
+ * overwritten in the ring buffer then all relations are checked
+ */
+static void
+add_aborted_relations(void)
+{
+	Oid			aborted[PATHMAN_ABORTED_RELIDS];
+	int			naborted = 0;
+	uint64		count;
+	uint64		i;
+
+	SpinLockAcquire(&pmstate->aborted_mutex);
+	count = pmstate->aborted_count;
+
+	/* New backend only checks relations which are still in the buffer */
+	if (!aborted_count_initialized)
+		checked_aborted_count = count > PATHMAN_ABORTED_RELIDS ?
+			count - PATHMAN_ABORTED_RELIDS : 0;
+
+	if (count - checked_aborted_count > PATHMAN_ABORTED_RELIDS)
+		invalidate_all_relations = true;
+	else
+	{
+		for (i = checked_aborted_count; i < count; i++)
+		{
+			RelationKey *entry = &pmstate->aborted_relids[i % PATHMAN_ABORTED_RELIDS];
+
+			if (entry->dbid == MyDatabaseId)
+				aborted[naborted++] = entry->relid;
+		}
+	}
+	SpinLockRelease(&pmstate->aborted_mutex);
+
+	checked_aborted_count = count;
+	aborted_count_initialized = true;
+
+	for (i = 0; i < naborted; i++)
+		pathman_relcache_hook((Datum) 0, aborted[i]);
+}
+
+/*
+ * Finds out whether invalidated relation is (or was) a partitioned table or
+ * a partition and checks corresponding cache entry
+ */
+static void
+check_invalidated_relation(Oid relid)
+{
+	Oid			parent_oid;
+	PartitionBounds bounds;
+	HeapTuple	tuple;
+	char		relkind;
+	TransactionId xmin;
+	CheckedRelation *checked;
+	HASHCTL		ctl;
+
+	/* Partitioned table itself */
+	if (get_loaded_relation_info(relid) != NULL)
+	{
+		check_relation_children(relid);
+		return;
+	}
+
+	tuple = SearchSysCache1(RELOID, ObjectIdGetDatum(relid));
+
+	/* Relation has been dropped or its creation has been rolled back */
+	if (!HeapTupleIsValid(tuple))
+	{
+		if (checked_relations != NULL)
+			hash_search(checked_relations, &relid, HASH_REMOVE, NULL);
+
+		parent_oid = find_cached_parent(relid);
+		if (OidIsValid(parent_oid))
+			reload_relation_info(parent_oid);
+		return;
+	}
+
+	relkind = ((Form_pg_class) GETSTRUCT(tuple))->relkind;
+	xmin = HeapTupleHeaderGetRawXmin(tuple->t_data);
+	ReleaseSysCache(tuple);
+
+	/* Indexes, sequences, views etc. can't be partitions */
+	if (relkind != RELKIND_RELATION && relkind != RELKIND_FOREIGN_TABLE)
+		return;
+
+	parent_oid = get_inheritance_parent(relid);
+
+	/*
+	 * Neither inheritance nor pg_class row (which keeps the number of CHECK
+	 * constraints) has changed since the last check
+	 */
+	if (checked_relations == NULL)
+	{
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(CheckedRelation);
+		checked_relations = hash_create("pg_pathman checked relations",
+										64, &ctl, HASH_ELEM | HASH_BLOBS);
+	}
+	checked = (CheckedRelation *) hash_search(checked_relations, &relid,
+											  HASH_FIND, NULL);
+	if (checked != NULL && checked->parent_oid == parent_oid &&
+		checked->xmin == xmin)
+		return;
+
+	/* Partition */
+	if (OidIsValid(parent_oid) && get_loaded_relation_info(parent_oid) != NULL)
+	{
+		if (!check_partition(parent_oid, relid))
+			reload_relation_info(parent_oid);
+	}
+	/* Partition which has been detached from its parent */
+	else if (read_child_bounds(relid, &bounds) &&
+			 get_loaded_relation_info(bounds.parent_oid) != NULL)
+		check_relation_children(bounds.parent_oid);
+
+	checked = (CheckedRelation *) hash_search(checked_relations, &relid,
+											  HASH_ENTER, NULL);
+	checked->parent_oid = parent_oid;
+	checked->xmin = xmin;
+}
+
+/*
+ * Reloads relation if its cached partitions differ from pg_inherits
+ */
+static void
+check_relation_children(Oid parent_oid)
+{
+	PartRelationInfo *prel;
+	RangeRelation *rangerel;
+	List	   *children_list;
+	ListCell   *lc;
+	Oid		   *cached;
+	Oid		   *actual;
+	Oid			default_oid = InvalidOid;
+	int			count = 0;
+	bool		valid;
+	RelationKey key;
+
+	if (get_loaded_relation_info(parent_oid) == NULL)
+		return;
+
+	children_list = find_children(parent_oid, GetCatalogSnapshot(parent_oid));
+	actual = palloc(sizeof(Oid) * (list_length(children_list) + 1));
+	cached = palloc(sizeof(Oid) * (list_length(children_list) + 1));
+
+	/* Cached partitions may be freed by concurrent reload otherwise */
+	LWLockAcquire(pmstate->load_config_lock, LW_SHARED);
+	prel = get_loaded_relation_info(parent_oid);
+	if (prel == NULL)
+	{
+		LWLockRelease(pmstate->load_config_lock);
+		return;
+	}
+
+	if (prel->parttype == PT_RANGE)
+	{
+		key.dbid = MyDatabaseId;
+		key.relid = parent_oid;
+		rangerel = pathman_hash_search(range_restrictions, &key, HASH_FIND, NULL);
+		if (rangerel != NULL)
+			default_oid = rangerel->default_oid;
+	}
+
+	foreach(lc, children_list)
+		if (lfirst_oid(lc) != default_oid)
+			actual[count++] = lfirst_oid(lc);
+
+	valid = (count == prel->children_count);
+	if (valid)
+		memcpy(cached, dsm_array_get_pointer(&prel->children), sizeof(Oid) * count);
+	LWLockRelease(pmstate->load_config_lock);
+
+	if (valid)
+	{
+		qsort(cached, count, sizeof(Oid), cmp_oids);
+		qsort(actual, count, sizeof(Oid), cmp_oids);
+		valid = (memcmp(cached, actual, sizeof(Oid) * count) == 0);
+	}
+	pfree(cached);
+	pfree(actual);
+
+	if (!valid)
+		reload_relation_info(parent_oid);
+}
+
+/*
+ * Checks that cached bounds of partition match its stored bounds (or CHECK
+ * constraint if there are none)
+ */
+static bool
+check_partition(Oid parent_oid, Oid child_oid)
+{
+	PartitionBounds bounds;
+	bool		has_bounds;
+	bool		result;
+
+	has_bounds = read_child_bounds(child_oid, &bounds);
+
+	/* Cached partitions may be freed by concurrent reload otherwise */
+	LWLockAcquire(pmstate->load_config_lock, LW_SHARED);
+	result = check_cached_partition(parent_oid, child_oid, has_bounds, &bounds);
+	LWLockRelease(pmstate->load_config_lock);
+
+	return result;
+}
+
+static bool
+check_cached_partition(Oid parent_oid, Oid child_oid, bool has_bounds,
+					   PartitionBounds *bounds)
+{
+	PartRelationInfo *prel;
+	RangeRelation *rangerel;
+	RelationKey key;
+
+	prel = get_loaded_relation_info(parent_oid);
+	if (prel == NULL)
+		return false;
+
+	if (prel->parttype == PT_HASH)
+	{
+		Oid	   *children = (Oid *) dsm_array_get_pointer(&prel->children);
+
+		/* Hash partitions are never changed separately */
+		if (!has_bounds || bounds->hash_idx < 0)
+			return true;
+
+		return bounds->hash_idx < prel->children_count &&
+			children[bounds->hash_idx] == child_oid;
+	}
+	else if (prel->parttype == PT_LIST || prel->keys_count > 1)
+	{
+		Oid	   *children = (Oid *) dsm_array_get_pointer(&prel->children);
+		int		i;
+
+		/* Values of LIST partitions and composite bounds are never changed separately */
+		for (i = 0; i < prel->children_count; i++)
+			if (children[i] == child_oid)
+				return true;
+		return false;
+	}
+	else
+	{
+		RangeEntry	probe;
+		RangeEntry *ranges;
+		BoundCmpContext cmp_ctx;
+		int			lo,
+					hi;
+		RangeEntry *found;
+		Datum		min,
+					max;
+
+		key.dbid = MyDatabaseId;
+		key.relid = parent_oid;
+		rangerel = pathman_hash_search(range_restrictions, &key, HASH_FIND, NULL);
+		if (rangerel == NULL)
+			return false;
+
+		if (rangerel->default_oid == child_oid)
+			return true;
+
+		if (has_bounds && bounds->lower != NULL && bounds->upper != NULL)
+		{
+			Oid			typinput;
+			Oid			typioparam;
+
+			getTypeInputInfo(prel->atttype, &typinput, &typioparam);
+			min = OidInputFunctionCall(typinput, bounds->lower, typioparam, -1);
+			max = OidInputFunctionCall(typinput, bounds->upper, typioparam, -1);
+		}
+		else if (!load_range_constraint(child_oid, prel, &min, &max))
+			return true;
+
+		/* Look for the entry with the same lower bound */
+		set_range_entry(&probe, child_oid, min, max, rangerel->by_val);
+		ranges = (RangeEntry *) dsm_array_get_pointer(&rangerel->ranges);
+		prepare_bound_cmp(&cmp_ctx, prel->atttype, rangerel->by_val);
+		found = NULL;
+		lo = 0;
+		hi = rangerel->ranges.length - 1;
+		while (lo <= hi)
+		{
+			int		mid = lo + (hi - lo) / 2;
+			int		cmp = cmp_range_entries(&probe, &ranges[mid], &cmp_ctx);
+
+			if (cmp == 0)
+			{
+				found = &ranges[mid];
+				break;
+			}
+			else if (cmp < 0)
+				hi = mid - 1;
+			else
+				lo = mid + 1;
+		}
+
+		return found != NULL && found->child_oid == child_oid &&
+			cmp_bounds(&found->max, &probe.max, &cmp_ctx) == 0;
+	}
+}
+
+/*
+ * Looks for the partitioned table which has the relation among its cached
+ * partitions
+ */
+static Oid
+find_cached_parent(Oid child_oid)
+{
+	HASH_SEQ_STATUS status;
+	PartRelationInfo *prel;
+	RangeRelation *rangerel;
+	Oid		   *children;
+	Oid			result = InvalidOid;
+	List	   *range_relids = NIL;
+	ListCell   *lc;
+	int			i;
+	RelationKey key;
+
+	/* Cached partitions may be freed by concurrent reload otherwise */
+	LWLockAcquire(pmstate->load_config_lock, LW_SHARED);
+	lock_relations_hashtables(LW_SHARED);
+	hash_seq_init(&status, relations);
+	while ((prel = (PartRelationInfo *) hash_seq_search(&status)) != NULL)
+	{
+		if (prel->key.dbid != MyDatabaseId || !prel->loaded)
+			continue;
+
+		children = (Oid *) dsm_array_get_pointer(&prel->children);
+		for (i = 0; i < prel->children_count; i++)
+			if (children[i] == child_oid)
+				result = prel->key.relid;
+
+		if (OidIsValid(result))
+		{
+			hash_seq_term(&status);
+			break;
+		}
+
+		if (prel->parttype == PT_RANGE)
+			range_relids = lappend_oid(range_relids, prel->key.relid);
+	}
+	unlock_relations_hashtables();
+
+	/* It could be a default partition */
+	foreach(lc, range_relids)
+	{
+		if (OidIsValid(result))
+			break;
+
+		key.dbid = MyDatabaseId;
+		key.relid = lfirst_oid(lc);
+		rangerel = pathman_hash_search(range_restrictions, &key, HASH_FIND, NULL);
+		if (rangerel != NULL && rangerel->default_oid == child_oid)
+			result = lfirst_oid(lc);
+	}
+	LWLockRelease(pmstate->load_config_lock);
+
+	return result;
+}
+
+/*
+ * Returns the first parent of relation using pg_inherits index
+ */
+static Oid
+get_inheritance_parent(Oid child_oid)
+{
+	Oid			result = InvalidOid;
+	Relation	inh_rel;
+	SysScanDesc scan;
+	ScanKeyData key[1];
+	HeapTuple	tuple;
+
+	inh_rel = heap_open(InheritsRelationId, AccessShareLock);
+	ScanKeyInit(&key[0],
+				Anum_pg_inherits_inhrelid,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(child_oid));
+	scan = systable_beginscan(inh_rel, InheritsRelidSeqnoIndexId, true,
+							  NULL, 1, key);
+
+	tuple = systable_getnext(scan);
+	if (HeapTupleIsValid(tuple))
+		result = ((Form_pg_inherits) GETSTRUCT(tuple))->inhparent;
+
+	systable_endscan(scan);
+	heap_close(inh_rel, AccessShareLock);
+
+	return result;
+}
+
+/*
+ * Returns relation info if partitions of relation have been loaded. Unlike
+ * get_pathman_relation_info() it never loads them
+ */
+static PartRelationInfo *
+get_loaded_relation_info(Oid relid)
+{
+	RelationKey key;
+	PartRelationInfo *prel;
+
+	key.dbid = MyDatabaseId;
+	key.relid = relid;
+	prel = pathman_hash_search(relations, &key, HASH_FIND, NULL);
+
+	return (prel != NULL && prel->loaded) ? prel : NULL;
+}
+
+static void
+reload_relation_info(Oid relid)
+{
+	LWLockAcquire(pmstate->load_config_lock, LW_EXCLUSIVE);
+	load_relation_info(relid);
+	LWLockRelease(pmstate->load_config_lock);
+}
+
+/* qsort comparison function for oids */
+int
+cmp_oids(const void *p1, const void *p2)
+{
+	Oid		v1 = *(const Oid *) p1;
+	Oid		v2 = *(const Oid *) p2;
+
+	return (v1 < v2) ? -1 : ((v1 > v2) ? 1 : 0);
+}
+
+static int
+cmp_zone_map_entries(const void *p1, const void *p2)
+{
+	const ZoneMapEntry *zm1 = (const ZoneMapEntry *) p1;
+	const ZoneMapEntry *zm2 = (const ZoneMapEntry *) p2;
+
+	if (zm1->column != zm2->column)
+		return zm1->column - zm2->column;
+	return cmp_oids(&zm1->child_oid, &zm2->child_oid);
 }
@@ -11,21 +11,115 @@
 /*
  * Pathman config
  *  relname - schema qualified relation name
- *  attname - partitioning key
+ *  attname - partitioning key (comma separated columns for composite RANGE key
+ *      or expression of a single column)
  *  parttype - partitioning type:
  *      1 - HASH
  *      2 - RANGE
+ *      3 - LIST
  *  range_interval - base interval for RANGE partitioning in string representation
+ *  default_partition - schema qualified and quoted name of the partition which
+ *      takes rows that don't fit any RANGE partition (optional)
+ *  hash_split_pos - while HASH partitions are being split the number of the
+ *      first old partition whose rows haven't been moved yet (NULL otherwise)
  */
 CREATE TABLE IF NOT EXISTS @extschema@.pathman_config (
 	id				SERIAL PRIMARY KEY,
 	relname			VARCHAR(127),
 	attname			VARCHAR(127),
 	parttype		INTEGER,
-	range_interval	TEXT
+	range_interval	TEXT,
+	default_partition VARCHAR(127),
+	hash_split_pos	INTEGER
 );
 SELECT pg_catalog.pg_extension_config_dump('@extschema@.pathman_config', '');
 
+/*
+ * Partitions bounds. Kept in sync by partition management functions so that
+ * backends don't have to parse CHECK constraints when loading partitions
+ *  partition - partition
+ *  parent - partitioned table
+ *  lower_bound, upper_bound - RANGE partition bounds (text representation
+ *      in ISO DateStyle; TEXT[] literals of values for composite key)
+ *  hash_idx - HASH partition number
+ *  list_values - values of LIST partition (text representation)
+ */
+CREATE TABLE IF NOT EXISTS @extschema@.pathman_partition_bounds (
+	partition		REGCLASS PRIMARY KEY,
+	parent			REGCLASS NOT NULL,
+	lower_bound		TEXT,
+	upper_bound		TEXT,
+	hash_idx		INTEGER,
+	list_values		TEXT[]
+);
+CREATE INDEX IF NOT EXISTS pathman_partition_bounds_parent_idx
+ON @extschema@.pathman_partition_bounds (parent);
+SELECT pg_catalog.pg_extension_config_dump('@extschema@.pathman_partition_bounds', '');
+
+/*
+ * Zone maps: min and max values of columns other than partitioning key in
+ * every partition. Used to skip partitions when filtering by these columns
+ *  partition - partition
+ *  parent - partitioned table
+ *  attname - column
+ *  min_value, max_value - values of the column (text representation in ISO
+ *      DateStyle, floats with all significant digits)
+ *  is_empty - partition has no values of the column
+ *  epoch - epoch of the summary (see get_zone_maps_epoch()). Summaries of
+ *      previous epochs are out of date, since writes to partitions are only
+ *      tracked in shared memory
+ */
+CREATE TABLE IF NOT EXISTS @extschema@.pathman_zone_maps (
+	partition		REGCLASS NOT NULL,
+	parent			REGCLASS NOT NULL,
+	attname			TEXT NOT NULL,
+	min_value		TEXT,
+	max_value		TEXT,
+	is_empty		BOOLEAN NOT NULL DEFAULT FALSE,
+	epoch			BIGINT,
+	PRIMARY KEY (partition, attname)
+);
+CREATE INDEX IF NOT EXISTS pathman_zone_maps_parent_idx
+ON @extschema@.pathman_zone_maps (parent);
+SELECT pg_catalog.pg_extension_config_dump('@extschema@.pathman_zone_maps', '');
+
+/*
+ * Global indexes: tables mapping values of a column other than partitioning
+ * key to partitions holding them. Kept in sync by triggers on partitions
+ *  parent - partitioned table
+ *  attname - indexed column
+ *  index_relation - table of (value, partition) pairs with unique values
+ */
+CREATE TABLE IF NOT EXISTS @extschema@.pathman_global_indexes (
+	parent			REGCLASS NOT NULL,
+	attname			TEXT NOT NULL,
+	index_relation	REGCLASS NOT NULL,
+	PRIMARY KEY (parent, attname)
+);
+SELECT pg_catalog.pg_extension_config_dump('@extschema@.pathman_global_indexes', '');
+
+/*
+ * Sub-partitioning templates: the way new partitions of RANGE and LIST
+ * partitioned relations are partitioned themselves once created
+ *  parent - partitioned table
+ *  attname - partitioning key of the new partitions
+ *  parttype - partitioning type (1 - HASH, 2 - RANGE, 3 - LIST)
+ *  partitions_count - number of HASH or RANGE partitions
+ *  range_start - first RANGE bound (text representation in ISO DateStyle)
+ *  range_interval - RANGE interval in text representation
+ *  list_values - array literal of LIST values
+ */
+CREATE TABLE IF NOT EXISTS @extschema@.pathman_subpartition_template (
+	parent			REGCLASS PRIMARY KEY,
+	attname			TEXT NOT NULL,
+	parttype		INTEGER NOT NULL,
+	partitions_count INTEGER,
+	range_start		TEXT,
+	range_interval	TEXT,
+	list_values		TEXT
+);
+SELECT pg_catalog.pg_extension_config_dump('@extschema@.pathman_subpartition_template', '');
+
 CREATE OR REPLACE FUNCTION @extschema@.on_create_partitions(relid OID)
 RETURNS VOID AS 'pg_pathman', 'on_partitions_created' LANGUAGE C STRICT;
 
@@ -35,9 +129,93 @@ RETURNS VOID AS 'pg_pathman', 'on_partitions_updated' LANGUAGE C STRICT;
 CREATE OR REPLACE FUNCTION @extschema@.on_remove_partitions(relid OID)
 RETURNS VOID AS 'pg_pathman', 'on_partitions_removed' LANGUAGE C STRICT;
 
+CREATE OR REPLACE FUNCTION @extschema@.on_attach_partition(parent_relid OID, partition_relid OID)
+RETURNS VOID AS 'pg_pathman', 'on_partition_attached' LANGUAGE C STRICT;
+
+CREATE OR REPLACE FUNCTION @extschema@.on_detach_partition(parent_relid OID, partition_relid OID)
+RETURNS VOID AS 'pg_pathman', 'on_partition_detached' LANGUAGE C STRICT;
+
+CREATE OR REPLACE FUNCTION @extschema@.on_zone_maps_updated(relid OID)
+RETURNS VOID AS 'pg_pathman', 'on_zone_maps_updated' LANGUAGE C STRICT;
+
+CREATE OR REPLACE FUNCTION @extschema@.on_zone_map_refreshed(parent_relid OID, partition_relid OID)
+RETURNS VOID AS 'pg_pathman', 'on_zone_map_refreshed' LANGUAGE C STRICT;
+
+/*
+ * Checks if the partition hasn't been modified since its zone maps were
+ * computed
+ */
+CREATE OR REPLACE FUNCTION @extschema@.is_zone_map_valid(relation REGCLASS, partition REGCLASS)
+RETURNS BOOLEAN AS 'pg_pathman', 'is_zone_map_valid' LANGUAGE C STRICT;
+
+/*
+ * Returns current epoch of zone maps. It changes when shared memory is
+ * reinitialized, e.g. on server restart
+ */
+CREATE OR REPLACE FUNCTION @extschema@.get_zone_maps_epoch()
+RETURNS BIGINT AS 'pg_pathman', 'get_zone_maps_epoch' LANGUAGE C STRICT;
+
+/*
+ * Checks if partition may contain the value according to global index
+ */
+CREATE OR REPLACE FUNCTION @extschema@.global_index_match(
+	index_relation REGCLASS
+	, value ANYELEMENT
+	, partition REGCLASS)
+RETURNS BOOLEAN AS 'pg_pathman', 'global_index_match' LANGUAGE C STABLE STRICT;
+
+/*
+ * Checks if partition may contain rows with any of the key values
+ */
+CREATE OR REPLACE FUNCTION @extschema@.key_values_match(
+	parent REGCLASS
+	, partition REGCLASS
+	, key_values ANYARRAY)
+RETURNS BOOLEAN AS 'pg_pathman', 'key_values_match' LANGUAGE C STABLE STRICT;
+
 CREATE OR REPLACE FUNCTION @extschema@.find_or_create_range_partition(relid OID, value ANYELEMENT)
 RETURNS OID AS 'pg_pathman', 'find_or_create_range_partition' LANGUAGE C STRICT;
 
+/*
+ * Returns LIST partition which has the value or NULL
+ */
+CREATE OR REPLACE FUNCTION @extschema@.find_list_partition(relid OID, value ANYELEMENT)
+RETURNS OID AS 'pg_pathman', 'find_list_partition' LANGUAGE C STRICT;
+
+/*
+ * Returns leaf partition for the row if partition is partitioned itself
+ */
+CREATE OR REPLACE FUNCTION @extschema@.find_leaf_partition(relid OID, tuple ANYELEMENT)
+RETURNS OID AS 'pg_pathman', 'find_leaf_partition_sql' LANGUAGE C STRICT;
+
+/*
+ * Returns partitioning key of the row, computes key expression if relation
+ * is partitioned by expression
+ */
+CREATE OR REPLACE FUNCTION @extschema@.get_partitioning_key(
+	relid OID, tuple RECORD, dummy ANYELEMENT)
+RETURNS ANYELEMENT AS 'pg_pathman', 'get_partitioning_key_sql' LANGUAGE C;
+
+/*
+ * Checks if partitioning key is an expression rather than a column. Checks
+ * that expression is immutable and depends on one NOT NULL column
+ */
+CREATE OR REPLACE FUNCTION @extschema@.is_key_expression(relation REGCLASS, key TEXT)
+RETURNS BOOLEAN AS 'pg_pathman', 'is_key_expression' LANGUAGE C STRICT;
+
+/*
+ * Returns key expression in the form it's kept in pathman_config: names of
+ * objects outside of pg_catalog are schema-qualified
+ */
+CREATE OR REPLACE FUNCTION @extschema@.deparse_key_expression(relation REGCLASS, key TEXT)
+RETURNS TEXT AS 'pg_pathman', 'deparse_key_expression' LANGUAGE C STRICT;
+
+/*
+ * Returns type of partitioning key column or expression
+ */
+CREATE OR REPLACE FUNCTION @extschema@.get_key_type(relation REGCLASS, key TEXT)
+RETURNS REGTYPE AS 'pg_pathman', 'get_key_type' LANGUAGE C STRICT;
+
 
 /*
  * Returns min and max values for specified RANGE partition.
@@ -76,6 +254,19 @@ CREATE OR REPLACE FUNCTION @extschema@.check_overlap(
 	parent_relid OID, range_min ANYELEMENT, range_max ANYELEMENT)
 RETURNS BOOLEAN AS 'pg_pathman', 'check_overlap' LANGUAGE C STRICT;
 
+/*
+ * Returns number of HASH partition for the value
+ */
+CREATE OR REPLACE FUNCTION @extschema@.get_hash(
+	value ANYELEMENT, partitions_count INTEGER)
+RETURNS INTEGER AS 'pg_pathman', 'get_hash' LANGUAGE C IMMUTABLE STRICT;
+
+/*
+ * Checks if type could be used as HASH partitioning key
+ */
+CREATE OR REPLACE FUNCTION @extschema@.is_type_hashable(type REGTYPE)
+RETURNS BOOLEAN AS 'pg_pathman', 'is_type_hashable' LANGUAGE C STRICT;
+
 /*
  * Copy rows to partitions
  */
@@ -113,6 +304,64 @@ $$
 LANGUAGE plpgsql;
 
 
+/*
+ * Starts background workers which move data from parent relation to
+ * partitions in batches. Each batch is processed in a separate transaction
+ * so the parent isn't locked for the whole copying process. Every worker
+ * processes its own range of the parent's blocks
+ */
+CREATE OR REPLACE FUNCTION @extschema@.partition_table_concurrently(
+	relation REGCLASS
+	, batch_size INTEGER DEFAULT 1000
+	, sleep_time FLOAT8 DEFAULT 1.0
+	, workers INTEGER DEFAULT 1)
+RETURNS VOID AS 'pg_pathman', 'partition_table_concurrently' LANGUAGE C STRICT;
+
+/*
+ * Starts background worker which moves rows from the default partition to
+ * proper RANGE partitions (creating them if needed)
+ */
+CREATE OR REPLACE FUNCTION @extschema@.drain_default_partition(relation REGCLASS)
+RETURNS BOOLEAN AS 'pg_pathman', 'drain_default_partition' LANGUAGE C STRICT;
+
+/*
+ * Starts background worker which moves rows of the new HASH partitions out of
+ * the old ones (see split_hash_partitions()). Useful if worker has been
+ * stopped or server has been restarted
+ */
+CREATE OR REPLACE FUNCTION @extschema@.resume_hash_split(relation REGCLASS)
+RETURNS BOOLEAN AS 'pg_pathman', 'resume_hash_split' LANGUAGE C STRICT;
+
+/*
+ * Stops concurrent partitioning workers for specified relation
+ */
+CREATE OR REPLACE FUNCTION @extschema@.stop_concurrent_part_task(relation REGCLASS)
+RETURNS BOOLEAN AS 'pg_pathman', 'stop_concurrent_part_task' LANGUAGE C STRICT;
+
+/*
+ * Waits till concurrent partitioning workers of the relation finish
+ */
+CREATE OR REPLACE FUNCTION @extschema@.wait_concurrent_part_task(relation REGCLASS)
+RETURNS VOID AS 'pg_pathman', 'wait_concurrent_part_task' LANGUAGE C STRICT;
+
+/*
+ * Shows running concurrent partitioning workers
+ */
+CREATE OR REPLACE FUNCTION @extschema@.show_concurrent_part_tasks(
+	OUT userid REGROLE
+	, OUT pid INT
+	, OUT dbid OID
+	, OUT relid REGCLASS
+	, OUT processed BIGINT
+	, OUT remaining BIGINT
+	, OUT rate FLOAT8
+	, OUT status TEXT)
+RETURNS SETOF RECORD AS 'pg_pathman', 'show_concurrent_part_tasks' LANGUAGE C STRICT;
+
+CREATE OR REPLACE VIEW @extschema@.pathman_concurrent_part_tasks
+AS SELECT * FROM @extschema@.show_concurrent_part_tasks();
+
+
 /*
  * Disable pathman partitioning for specified relation
  */
@@ -123,6 +372,10 @@ BEGIN
 	relation := @extschema@.validate_relname(relation);
 
 	DELETE FROM @extschema@.pathman_config WHERE relname = relation;
+	DELETE FROM @extschema@.pathman_partition_bounds WHERE parent = relation::regclass;
+	DELETE FROM @extschema@.pathman_zone_maps WHERE parent = relation::regclass;
+	PERFORM @extschema@.drop_global_index(relation, attname)
+	FROM @extschema@.pathman_global_indexes WHERE parent = relation::regclass;
 	EXECUTE format('DROP FUNCTION IF EXISTS %s_insert_trigger_func() CASCADE', relation);
 
 	/* Notify backend about changes */
@@ -131,6 +384,594 @@ END
 $$
 LANGUAGE plpgsql;
 
+/*
+ * Builds zone map on the column of partitioned relation. Planner uses it to
+ * skip partitions which can't contain values of the column satisfying the
+ * query condition
+ */
+CREATE OR REPLACE FUNCTION @extschema@.add_zone_map(
+	relation TEXT
+	, attribute TEXT)
+RETURNS VOID AS
+$$
+DECLARE
+	v_type OID;
+BEGIN
+	relation := @extschema@.validate_relname(relation);
+	attribute := lower(attribute);
+
+	IF NOT EXISTS (SELECT * FROM @extschema@.pathman_config
+				   WHERE relname = relation) THEN
+		RAISE EXCEPTION 'Relation "%" isn''t partitioned by pg_pathman', relation;
+	END IF;
+
+	SELECT atttypid INTO v_type FROM pg_attribute
+	WHERE attrelid = relation::regclass AND attname = attribute
+		  AND attnum > 0 AND NOT attisdropped;
+	IF v_type IS NULL THEN
+		RAISE EXCEPTION 'Relation "%" has no column "%"', relation, attribute;
+	END IF;
+
+	/* Summaries are kept in fixed-size slots of shared memory */
+	IF (SELECT typlen NOT BETWEEN 1 AND 8 FROM pg_type WHERE oid = v_type) THEN
+		RAISE EXCEPTION 'Zone maps on type % aren''t supported', v_type::regtype;
+	END IF;
+
+	IF EXISTS (SELECT * FROM @extschema@.pathman_zone_maps
+			   WHERE parent = relation::regclass AND attname = attribute) THEN
+		RAISE EXCEPTION 'Zone map on column "%" already exists', attribute;
+	END IF;
+
+	IF (SELECT count(DISTINCT attname) FROM @extschema@.pathman_zone_maps
+		WHERE parent = relation::regclass) >= 4 THEN
+		RAISE EXCEPTION 'Relation "%" can''t have more than 4 zone maps', relation;
+	END IF;
+
+	INSERT INTO @extschema@.pathman_zone_maps (partition, parent, attname)
+	SELECT inhrelid::regclass, relation::regclass, attribute
+	FROM pg_inherits WHERE inhparent = relation::regclass;
+
+	PERFORM @extschema@.refresh_zone_maps(relation);
+END
+$$
+LANGUAGE plpgsql;
+
+/*
+ * Drops zone map on the column
+ */
+CREATE OR REPLACE FUNCTION @extschema@.drop_zone_map(
+	relation TEXT
+	, attribute TEXT)
+RETURNS VOID AS
+$$
+DECLARE
+	v_part REGCLASS;
+BEGIN
+	relation := @extschema@.validate_relname(relation);
+	attribute := lower(attribute);
+
+	DELETE FROM @extschema@.pathman_zone_maps
+	WHERE parent = relation::regclass AND attname = attribute;
+
+	/* Partitions don't need to invalidate summaries anymore */
+	IF NOT EXISTS (SELECT * FROM @extschema@.pathman_zone_maps
+				   WHERE parent = relation::regclass) THEN
+		FOR v_part IN (SELECT inhrelid::regclass FROM pg_inherits
+					   WHERE inhparent = relation::regclass)
+		LOOP
+			EXECUTE format('DROP TRIGGER IF EXISTS zone_map_trigger ON %s', v_part);
+		END LOOP;
+	END IF;
+
+	/* Notify backend about changes */
+	PERFORM @extschema@.on_zone_maps_updated(relation::regclass::oid);
+END
+$$
+LANGUAGE plpgsql;
+
+/*
+ * Recomputes zone maps of partitions which have been modified since the last
+ * refresh (or of all partitions if p_force is true). Returns the number of
+ * refreshed partitions. Should be called after data loading or periodically
+ */
+CREATE OR REPLACE FUNCTION @extschema@.refresh_zone_maps(
+	relation TEXT
+	, p_force BOOLEAN DEFAULT FALSE)
+RETURNS INTEGER AS
+$$
+DECLARE
+	v_attnames TEXT[];
+	v_attname TEXT;
+	v_part REGCLASS;
+	v_min TEXT;
+	v_max TEXT;
+	v_epoch BIGINT := @extschema@.get_zone_maps_epoch();
+	v_count INTEGER := 0;
+BEGIN
+	relation := @extschema@.validate_relname(relation);
+
+	SELECT array_agg(DISTINCT attname) INTO v_attnames
+	FROM @extschema@.pathman_zone_maps WHERE parent = relation::regclass;
+	IF v_attnames IS NULL THEN
+		RETURN 0;
+	END IF;
+
+	/* Columns added by add_zone_map() have to be known to the cache */
+	PERFORM @extschema@.on_zone_maps_updated(relation::regclass::oid);
+
+	FOR v_part IN (SELECT inhrelid::regclass FROM pg_inherits
+				   WHERE inhparent = relation::regclass)
+	LOOP
+		IF NOT p_force AND @extschema@.is_zone_map_valid(relation::regclass, v_part) THEN
+			CONTINUE;
+		END IF;
+
+		/* Wait for running writers so that summaries include their rows */
+		EXECUTE format('LOCK TABLE %s IN SHARE MODE', v_part);
+
+		FOREACH v_attname IN ARRAY v_attnames
+		LOOP
+			EXECUTE format('SELECT min(%1$I)::text, max(%1$I)::text FROM ONLY %2$s'
+						   , v_attname
+						   , v_part)
+			INTO v_min, v_max;
+
+			INSERT INTO @extschema@.pathman_zone_maps
+				(partition, parent, attname, min_value, max_value, is_empty, epoch)
+			VALUES (v_part, relation::regclass, v_attname, v_min, v_max, v_min IS NULL, v_epoch)
+			ON CONFLICT (partition, attname) DO UPDATE
+			SET parent = EXCLUDED.parent,
+				min_value = EXCLUDED.min_value,
+				max_value = EXCLUDED.max_value,
+				is_empty = EXCLUDED.is_empty,
+				epoch = EXCLUDED.epoch;
+		END LOOP;
+
+		/* Partition stays dirty until commit, while writers are locked out */
+		PERFORM @extschema@.on_zone_map_refreshed(relation::regclass, v_part);
+
+		/* Modifications of the partition invalidate its summaries */
+		IF NOT EXISTS (SELECT * FROM pg_trigger
+					   WHERE tgrelid = v_part AND tgname = 'zone_map_trigger') THEN
+			EXECUTE format('CREATE TRIGGER zone_map_trigger
+							AFTER INSERT OR UPDATE ON %s
+							FOR EACH STATEMENT
+							EXECUTE PROCEDURE @extschema@.zone_map_trigger_func()'
+						   , v_part);
+		END IF;
+
+		v_count := v_count + 1;
+	END LOOP;
+
+	/* Notify backend about changes */
+	PERFORM @extschema@.on_zone_maps_updated(relation::regclass::oid);
+
+	RETURN v_count;
+END
+$$
+LANGUAGE plpgsql
+SET DateStyle = 'ISO'
+SET extra_float_digits = 3;
+
+/*
+ * Creates global index on the column: table mapping its values to partitions
+ * holding them. Values must be unique across all partitions. Queries looking
+ * for a value scan only the partition it is in. Returns index table name
+ */
+CREATE OR REPLACE FUNCTION @extschema@.add_global_index(
+	relation TEXT
+	, attribute TEXT)
+RETURNS TEXT AS
+$$
+DECLARE
+	v_attname TEXT;
+	v_type TEXT;
+	v_index TEXT;
+	v_part REGCLASS;
+BEGIN
+	relation := @extschema@.validate_relname(relation);
+
+	IF NOT EXISTS (SELECT * FROM @extschema@.pathman_config
+				   WHERE relname = relation) THEN
+		RAISE EXCEPTION 'Relation "%" isn''t partitioned by pg_pathman', relation;
+	END IF;
+
+	/* Column name is case-insensitive unless there is a column of exactly this name */
+	SELECT attname, format_type(atttypid, atttypmod) INTO v_attname, v_type
+	FROM pg_attribute
+	WHERE attrelid = relation::regclass AND attname IN (attribute, lower(attribute))
+		  AND attnum > 0 AND NOT attisdropped
+	ORDER BY attname = attribute DESC
+	LIMIT 1;
+	IF v_type IS NULL THEN
+		RAISE EXCEPTION 'Relation "%" has no column "%"', relation, attribute;
+	END IF;
+	attribute := v_attname;
+
+	IF EXISTS (SELECT * FROM @extschema@.pathman_global_indexes
+			   WHERE parent = relation::regclass AND attname = attribute) THEN
+		RAISE EXCEPTION 'Global index on column "%" already exists', attribute;
+	END IF;
+
+	IF (SELECT count(*) FROM @extschema@.pathman_global_indexes
+		WHERE parent = relation::regclass) >= 4 THEN
+		RAISE EXCEPTION 'Relation "%" can''t have more than 4 global indexes', relation;
+	END IF;
+
+	/* Index maps values to the partitions of relation itself */
+	IF EXISTS (SELECT * FROM pg_inherits
+			   JOIN @extschema@.pathman_config ON relname = inhrelid::regclass::text
+			   WHERE inhparent = relation::regclass) THEN
+		RAISE EXCEPTION 'Global indexes on sub-partitioned relations aren''t supported';
+	END IF;
+
+	/* Wait for running inserts so that their rows get indexed */
+	EXECUTE format('LOCK TABLE %s IN SHARE ROW EXCLUSIVE MODE', relation);
+
+	/*
+	 * Primary key is checked at commit, so that UPDATE may swap values of
+	 * rows while index entries are replaced one by one
+	 */
+	v_index := format('%s_%s_gidx', relation, regexp_replace(lower(attribute), '\W', '_', 'g'));
+	EXECUTE format('CREATE TABLE %s (value %s PRIMARY KEY DEFERRABLE INITIALLY DEFERRED
+									 , partition REGCLASS NOT NULL)'
+				   , v_index
+				   , v_type);
+
+	/* Trigger function keeps index in sync with the partition it's fired on */
+	EXECUTE format('
+		CREATE OR REPLACE FUNCTION %1$s_trigger_func()
+		RETURNS TRIGGER AS $body$
+		BEGIN
+			IF TG_OP = ''TRUNCATE'' THEN
+				DELETE FROM %1$s WHERE partition = TG_RELID;
+				RETURN NULL;
+			END IF;
+			IF TG_OP = ''UPDATE'' AND OLD.%2$I IS NOT DISTINCT FROM NEW.%2$I THEN
+				RETURN NULL;
+			END IF;
+			/* Index may hold the value twice until the end of transaction */
+			IF TG_OP IN (''UPDATE'', ''DELETE'') AND OLD.%2$I IS NOT NULL THEN
+				DELETE FROM %1$s WHERE ctid = (SELECT ctid FROM %1$s
+											   WHERE value = OLD.%2$I AND partition = TG_RELID
+											   LIMIT 1);
+			END IF;
+			IF TG_OP IN (''INSERT'', ''UPDATE'') AND NEW.%2$I IS NOT NULL THEN
+				INSERT INTO %1$s VALUES (NEW.%2$I, TG_RELID);
+			END IF;
+			RETURN NULL;
+		END
+		$body$ LANGUAGE plpgsql;'
+		, v_index
+		, attribute);
+
+	INSERT INTO @extschema@.pathman_global_indexes (parent, attname, index_relation)
+	VALUES (relation::regclass, attribute, v_index::regclass);
+
+	FOR v_part IN (SELECT inhrelid::regclass FROM pg_inherits
+				   WHERE inhparent = relation::regclass)
+	LOOP
+		PERFORM @extschema@.add_global_index_partition(relation::regclass, v_part, attribute);
+	END LOOP;
+
+	/* Notify backend about changes */
+	PERFORM @extschema@.on_update_partitions(relation::regclass::oid);
+
+	RETURN v_index;
+END
+$$
+LANGUAGE plpgsql;
+
+/*
+ * Adds partition to global indexes of its parent (or to the index on
+ * p_attname only): installs the trigger and indexes existing rows
+ */
+CREATE OR REPLACE FUNCTION @extschema@.add_global_index_partition(
+	relation REGCLASS
+	, p_partition REGCLASS
+	, p_attname TEXT DEFAULT NULL)
+RETURNS VOID AS
+$$
+DECLARE
+	v_rec RECORD;
+BEGIN
+	FOR v_rec IN (SELECT attname, index_relation FROM @extschema@.pathman_global_indexes gi
+				  WHERE gi.parent = relation
+					AND gi.attname = coalesce(p_attname, gi.attname))
+	LOOP
+		/* Writers must not modify the partition while it's being indexed */
+		EXECUTE format('LOCK TABLE %s IN SHARE MODE', p_partition);
+
+		EXECUTE format('CREATE TRIGGER %I
+						AFTER INSERT OR UPDATE OR DELETE ON %s
+						FOR EACH ROW EXECUTE PROCEDURE %s_trigger_func()'
+					   , v_rec.attname || '_gidx_trigger'
+					   , p_partition
+					   , v_rec.index_relation);
+
+		/* TRUNCATE doesn't fire row triggers */
+		EXECUTE format('CREATE TRIGGER %I
+						AFTER TRUNCATE ON %s
+						FOR EACH STATEMENT EXECUTE PROCEDURE %s_trigger_func()'
+					   , v_rec.attname || '_gidx_truncate_trigger'
+					   , p_partition
+					   , v_rec.index_relation);
+
+		EXECUTE format('INSERT INTO %s SELECT %I, %L::regclass FROM ONLY %s WHERE %2$I IS NOT NULL'
+					   , v_rec.index_relation
+					   , v_rec.attname
+					   , p_partition
+					   , p_partition);
+	END LOOP;
+END
+$$
+LANGUAGE plpgsql;
+
+/*
+ * Removes partition from global indexes of its parent
+ */
+CREATE OR REPLACE FUNCTION @extschema@.remove_global_index_partition(
+	relation REGCLASS
+	, p_partition REGCLASS)
+RETURNS VOID AS
+$$
+DECLARE
+	v_rec RECORD;
+BEGIN
+	FOR v_rec IN (SELECT attname, index_relation FROM @extschema@.pathman_global_indexes gi
+				  WHERE gi.parent = relation)
+	LOOP
+		EXECUTE format('DROP TRIGGER IF EXISTS %I ON %s'
+					   , v_rec.attname || '_gidx_trigger'
+					   , p_partition);
+		EXECUTE format('DROP TRIGGER IF EXISTS %I ON %s'
+					   , v_rec.attname || '_gidx_truncate_trigger'
+					   , p_partition);
+		EXECUTE format('DELETE FROM %s WHERE partition = %L::regclass'
+					   , v_rec.index_relation
+					   , p_partition);
+	END LOOP;
+END
+$$
+LANGUAGE plpgsql;
+
+/*
+ * Drops global index on the column
+ */
+CREATE OR REPLACE FUNCTION @extschema@.drop_global_index(
+	relation TEXT
+	, attribute TEXT)
+RETURNS VOID AS
+$$
+DECLARE
+	v_attname TEXT;
+	v_index REGCLASS;
+	v_part REGCLASS;
+BEGIN
+	relation := @extschema@.validate_relname(relation);
+
+	SELECT attname, index_relation INTO v_attname, v_index
+	FROM @extschema@.pathman_global_indexes
+	WHERE parent = relation::regclass AND attname IN (attribute, lower(attribute))
+	ORDER BY attname = attribute DESC
+	LIMIT 1;
+	IF v_index IS NULL THEN
+		RAISE EXCEPTION 'Relation "%" has no global index on column "%"', relation, attribute;
+	END IF;
+	attribute := v_attname;
+
+	DELETE FROM @extschema@.pathman_global_indexes
+	WHERE parent = relation::regclass AND attname = attribute;
+
+	FOR v_part IN (SELECT inhrelid::regclass FROM pg_inherits
+				   WHERE inhparent = relation::regclass)
+	LOOP
+		EXECUTE format('DROP TRIGGER IF EXISTS %I ON %s', attribute || '_gidx_trigger', v_part);
+		EXECUTE format('DROP TRIGGER IF EXISTS %I ON %s', attribute || '_gidx_truncate_trigger', v_part);
+	END LOOP;
+	EXECUTE format('DROP FUNCTION %s_trigger_func()', v_index);
+	EXECUTE format('DROP TABLE %s', v_index);
+
+	/* Notify backend about changes */
+	PERFORM @extschema@.on_update_partitions(relation::regclass::oid);
+END
+$$
+LANGUAGE plpgsql;
+
+/*
+ * Saves sub-partitioning template of the relation replacing the previous one
+ */
+CREATE OR REPLACE FUNCTION @extschema@.set_subpartition_template_internal(
+	relation TEXT
+	, attribute TEXT
+	, p_parttype INTEGER
+	, p_count INTEGER
+	, p_range_start TEXT DEFAULT NULL
+	, p_range_interval TEXT DEFAULT NULL
+	, p_list_values TEXT DEFAULT NULL)
+RETURNS VOID AS
+$$
+BEGIN
+	relation := @extschema@.validate_relname(relation);
+
+	IF @extschema@.get_attribute_type_name(relation, attribute) IS NULL THEN
+		RAISE EXCEPTION 'Relation "%" has no column "%"', relation, attribute;
+	END IF;
+
+	IF p_count <= 0 THEN
+		RAISE EXCEPTION 'Partitions count must be greater than zero';
+	END IF;
+
+	DELETE FROM @extschema@.pathman_subpartition_template
+	WHERE parent = relation::regclass;
+
+	INSERT INTO @extschema@.pathman_subpartition_template
+		(parent, attname, parttype, partitions_count, range_start, range_interval, list_values)
+	VALUES (relation::regclass, attribute, p_parttype, p_count,
+			p_range_start, p_range_interval, p_list_values);
+END
+$$
+LANGUAGE plpgsql;
+
+/*
+ * Makes partitions created from now on HASH partitioned
+ */
+CREATE OR REPLACE FUNCTION @extschema@.set_hash_subpartition_template(
+	relation TEXT
+	, attribute TEXT
+	, partitions_count INTEGER)
+RETURNS VOID AS
+$$
+BEGIN
+	IF partitions_count IS NULL THEN
+		RAISE EXCEPTION 'Partitions count must be set';
+	END IF;
+
+	PERFORM @extschema@.set_subpartition_template_internal(relation, attribute, 1,
+														   partitions_count);
+END
+$$
+LANGUAGE plpgsql;
+
+/*
+ * Makes partitions created from now on RANGE partitioned based on datetime
+ * attribute
+ */
+CREATE OR REPLACE FUNCTION @extschema@.set_range_subpartition_template(
+	relation TEXT
+	, attribute TEXT
+	, p_start_value ANYELEMENT
+	, p_interval INTERVAL
+	, p_count INTEGER)
+RETURNS VOID AS
+$$
+BEGIN
+	IF p_count IS NULL THEN
+		RAISE EXCEPTION 'Partitions count must be set';
+	END IF;
+
+	PERFORM @extschema@.set_subpartition_template_internal(relation, attribute, 2,
+														   p_count,
+														   p_start_value::text,
+														   p_interval::text);
+END
+$$
+LANGUAGE plpgsql
+SET DateStyle = 'ISO';
+
+/*
+ * Makes partitions created from now on RANGE partitioned based on numerical
+ * attribute
+ */
+CREATE OR REPLACE FUNCTION @extschema@.set_range_subpartition_template(
+	relation TEXT
+	, attribute TEXT
+	, p_start_value ANYELEMENT
+	, p_interval ANYELEMENT
+	, p_count INTEGER)
+RETURNS VOID AS
+$$
+BEGIN
+	IF p_count IS NULL THEN
+		RAISE EXCEPTION 'Partitions count must be set';
+	END IF;
+
+	PERFORM @extschema@.set_subpartition_template_internal(relation, attribute, 2,
+														   p_count,
+														   p_start_value::text,
+														   p_interval::text);
+END
+$$
+LANGUAGE plpgsql;
+
+/*
+ * Makes partitions created from now on LIST partitioned
+ */
+CREATE OR REPLACE FUNCTION @extschema@.set_list_subpartition_template(
+	relation TEXT
+	, attribute TEXT
+	, p_values ANYARRAY)
+RETURNS VOID AS
+$$
+BEGIN
+	PERFORM @extschema@.set_subpartition_template_internal(relation, attribute, 3,
+														   NULL, NULL, NULL,
+														   p_values::text);
+END
+$$
+LANGUAGE plpgsql
+SET DateStyle = 'ISO';
+
+/*
+ * Removes sub-partitioning template. Existing partitions stay partitioned
+ */
+CREATE OR REPLACE FUNCTION @extschema@.drop_subpartition_template(relation TEXT)
+RETURNS VOID AS
+$$
+BEGIN
+	relation := @extschema@.validate_relname(relation);
+
+	DELETE FROM @extschema@.pathman_subpartition_template
+	WHERE parent = relation::regclass;
+
+	IF NOT FOUND THEN
+		RAISE EXCEPTION 'Relation "%" has no sub-partitioning template', relation;
+	END IF;
+END
+$$
+LANGUAGE plpgsql;
+
+/*
+ * Partitions the new partition of the relation according to the relation's
+ * sub-partitioning template, if any. Partition is expected to be empty
+ */
+CREATE OR REPLACE FUNCTION @extschema@.apply_subpartition_template(
+	p_parent REGCLASS
+	, p_partition REGCLASS)
+RETURNS VOID AS
+$$
+DECLARE
+	v_tmpl RECORD;
+	v_type TEXT;
+BEGIN
+	SELECT * INTO v_tmpl FROM @extschema@.pathman_subpartition_template
+	WHERE parent = p_parent;
+
+	IF NOT FOUND THEN
+		RETURN;
+	END IF;
+
+	v_type := @extschema@.get_attribute_type_name(p_partition::text, v_tmpl.attname);
+
+	IF v_tmpl.parttype = 1 THEN
+		PERFORM @extschema@.create_hash_partitions(p_partition::text
+												   , v_tmpl.attname
+												   , v_tmpl.partitions_count
+												   , false);
+	ELSIF v_tmpl.parttype = 2 THEN
+		EXECUTE format('SELECT @extschema@.create_range_partitions($1, $2, $3::%s, $4::%s, $5, false)'
+					   , v_type
+					   , CASE WHEN @extschema@.is_date(v_type::regtype)
+							  THEN 'INTERVAL' ELSE v_type END)
+		USING p_partition::text, v_tmpl.attname, v_tmpl.range_start,
+			  v_tmpl.range_interval, v_tmpl.partitions_count;
+	ELSE
+		EXECUTE format('SELECT @extschema@.create_list_partitions($1, $2, $3::%s[], false)'
+					   , v_type)
+		USING p_partition::text, v_tmpl.attname, v_tmpl.list_values;
+	END IF;
+END
+$$
+LANGUAGE plpgsql
+SET DateStyle = 'ISO';
+
+/*
+ * Invalidates zone maps of modified partition until the next refresh. The
+ * flag is set in shared memory, so writers don't lock each other
+ */
+CREATE OR REPLACE FUNCTION @extschema@.zone_map_trigger_func()
+RETURNS TRIGGER AS 'pg_pathman', 'zone_map_trigger_func' LANGUAGE C;
+
 
 /*
  * Returns attribute type name for relation
@@ -145,6 +986,13 @@ BEGIN
 	SELECT typname::TEXT INTO p_atttype
 	FROM pg_type JOIN pg_attribute on atttypid = "oid"
 	WHERE attrelid = p_relation::regclass::oid and attname = lower(p_attname);
+
+	/* Partitioning key may be an expression */
+	IF p_atttype IS NULL THEN
+		SELECT typname::TEXT INTO p_atttype
+		FROM pg_type
+		WHERE "oid" = @extschema@.get_key_type(p_relation::regclass, p_attname);
+	END IF;
 END
 $$
 LANGUAGE plpgsql;
@@ -153,6 +1001,45 @@ LANGUAGE plpgsql;
 /*
  * Checks if attribute is nullable
  */
+/*
+ * Column names are case insensitive while expression is kept schema-qualified
+ */
+CREATE OR REPLACE FUNCTION @extschema@.normalize_partitioning_key(
+	p_relation TEXT
+	, p_key TEXT)
+RETURNS TEXT AS
+$$
+BEGIN
+	IF NOT @extschema@.is_key_expression(p_relation::regclass, p_key) THEN
+		RETURN lower(p_key);
+	END IF;
+	RETURN @extschema@.deparse_key_expression(p_relation::regclass, p_key);
+END
+$$
+LANGUAGE plpgsql;
+
+/*
+ * Returns expression which computes partitioning key of NEW (or OLD) row in
+ * trigger functions
+ */
+CREATE OR REPLACE FUNCTION @extschema@.get_key_accessor(
+	p_relation TEXT
+	, p_key TEXT
+	, p_record TEXT DEFAULT 'NEW')
+RETURNS TEXT AS
+$$
+BEGIN
+	IF NOT @extschema@.is_key_expression(p_relation::regclass, p_key) THEN
+		RETURN p_record || '.' || p_key;
+	END IF;
+	RETURN format('@extschema@.get_partitioning_key(%L::regclass::oid, %s, NULL::%s)'
+				  , p_relation
+				  , p_record
+				  , @extschema@.get_attribute_type_name(p_relation, p_key));
+END
+$$
+LANGUAGE plpgsql;
+
 CREATE OR REPLACE FUNCTION @extschema@.is_attribute_nullable(
 	p_relation TEXT
 	, p_attname TEXT
@@ -290,6 +1177,62 @@ BEGIN
 			USING obj.object_identity;
 		END IF;
 	END LOOP;
+
+	/* Remove rows of dropped partitions from global indexes of their parents */
+	FOR obj IN SELECT DISTINCT gi.index_relation
+			   FROM @extschema@.pathman_global_indexes gi
+			   JOIN @extschema@.pathman_partition_bounds pb ON pb.parent = gi.parent
+			   JOIN pg_event_trigger_dropped_objects() events ON events.objid = pb.partition::oid
+			   WHERE events.object_type = 'table'
+				 AND gi.parent::oid NOT IN (SELECT objid FROM pg_event_trigger_dropped_objects())
+	LOOP
+		EXECUTE format('DELETE FROM %s WHERE partition::oid IN (
+							SELECT objid FROM pg_event_trigger_dropped_objects()
+							WHERE object_type = ''table'')'
+					   , obj.index_relation);
+	END LOOP;
+
+	/* Drop global indexes of dropped tables */
+	FOR obj IN SELECT gi.index_relation
+			   FROM @extschema@.pathman_global_indexes gi
+			   JOIN pg_event_trigger_dropped_objects() events ON events.objid = gi.parent::oid
+			   WHERE events.object_type = 'table'
+	LOOP
+		DELETE FROM @extschema@.pathman_global_indexes
+		WHERE index_relation = obj.index_relation;
+		EXECUTE format('DROP FUNCTION IF EXISTS %s_trigger_func() CASCADE', obj.index_relation);
+		EXECUTE format('DROP TABLE IF EXISTS %s', obj.index_relation);
+	END LOOP;
+
+	/* Forget bounds of dropped partitions */
+	DELETE FROM @extschema@.pathman_partition_bounds
+	WHERE partition::oid IN (SELECT objid FROM pg_event_trigger_dropped_objects()
+							 WHERE object_type = 'table')
+	   OR parent::oid IN (SELECT objid FROM pg_event_trigger_dropped_objects()
+						  WHERE object_type = 'table');
+
+	/* Forget sub-partitioning templates of dropped tables */
+	DELETE FROM @extschema@.pathman_subpartition_template
+	WHERE parent::oid IN (SELECT objid FROM pg_event_trigger_dropped_objects()
+						  WHERE object_type = 'table');
+
+	/* Forget zone maps of dropped partitions */
+	DELETE FROM @extschema@.pathman_zone_maps
+	WHERE partition::oid IN (SELECT objid FROM pg_event_trigger_dropped_objects()
+							 WHERE object_type = 'table')
+	   OR parent::oid IN (SELECT objid FROM pg_event_trigger_dropped_objects()
+						  WHERE object_type = 'table');
+
+	/* Forget dropped default partitions */
+	FOR obj IN SELECT cfg.relname FROM pg_event_trigger_dropped_objects() as events
+			   JOIN @extschema@.pathman_config as cfg
+			   ON cfg.default_partition = format('%I.%I', events.schema_name, events.object_name)
+			   WHERE events.object_type = 'table'
+	LOOP
+		UPDATE @extschema@.pathman_config SET default_partition = NULL
+		WHERE relname = obj.relname;
+		PERFORM @extschema@.on_update_partitions(obj.relname::regclass::oid);
+	END LOOP;
 END
 $$
 LANGUAGE plpgsql;
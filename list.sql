@@ -0,0 +1,417 @@
+/* ------------------------------------------------------------------------
+ *
+ * list.sql
+ *      LIST partitioning functions
+ *
+ * Copyright (c) 2015-2016, Postgres Professional
+ *
+ * ------------------------------------------------------------------------
+ */
+
+/*
+ * Creates LIST partitions for specified relation. Every value gets its own
+ * partition; partitions holding several values could be added with
+ * add_list_partition()
+ */
+CREATE OR REPLACE FUNCTION @extschema@.create_list_partitions(
+	relation TEXT
+	, attribute TEXT
+	, p_values ANYARRAY
+	, p_partition_data BOOLEAN DEFAULT TRUE)
+RETURNS INTEGER AS
+$$
+DECLARE
+	v_type TEXT;
+	v_count INTEGER := 0;
+	i INTEGER;
+BEGIN
+	relation := @extschema@.validate_relname(relation);
+	IF @extschema@.is_key_expression(relation::regclass, attribute) THEN
+		RAISE EXCEPTION 'LIST partitioning key must be a column';
+	END IF;
+	attribute := lower(attribute);
+	PERFORM @extschema@.common_relation_checks(relation, attribute);
+
+	v_type := @extschema@.get_attribute_type_name(relation, attribute);
+	IF NOT @extschema@.is_type_hashable(v_type::regtype) THEN
+		RAISE EXCEPTION 'Attribute type % has no hash function', v_type;
+	END IF;
+
+	/* Create sequence for child partitions names */
+	EXECUTE format('DROP SEQUENCE IF EXISTS %s_seq', relation);
+	EXECUTE format('CREATE SEQUENCE %s_seq START 1', relation);
+
+	/* Insert new entry to pathman config */
+	INSERT INTO @extschema@.pathman_config (relname, attname, parttype)
+	VALUES (relation, attribute, 3);
+
+	FOR i IN array_lower(p_values, 1)..array_upper(p_values, 1)
+	LOOP
+		PERFORM @extschema@.create_single_list_partition(relation, ARRAY[p_values[i]]);
+		v_count := v_count + 1;
+	END LOOP;
+
+	/* Create triggers */
+	PERFORM @extschema@.create_list_insert_trigger(relation, attribute);
+
+	/* Notify backend about changes */
+	PERFORM @extschema@.on_create_partitions(relation::regclass::oid);
+
+	/* Copy data */
+	IF p_partition_data THEN
+		PERFORM @extschema@.partition_data(relation);
+	END IF;
+
+	RETURN v_count;
+END
+$$ LANGUAGE plpgsql;
+
+/*
+ * Returns distinct values of new LIST partition in text representation.
+ * Raises an error if some of them belong to existing partitions
+ */
+CREATE OR REPLACE FUNCTION @extschema@.prepare_list_values(
+	p_parent_relname TEXT
+	, p_values ANYARRAY)
+RETURNS TEXT[] AS
+$$
+DECLARE
+	v_attname TEXT;
+	v_type TEXT;
+	v_values TEXT[];
+	v_overlap BOOLEAN;
+BEGIN
+	v_attname := attname FROM @extschema@.pathman_config
+				 WHERE relname = p_parent_relname;
+	v_type := @extschema@.get_attribute_type_name(p_parent_relname, v_attname);
+
+	/*
+	 * Values are stored in text representation, but compared with equality
+	 * operator of the key type since equal values (e.g. numeric 1.0 and 1.00)
+	 * may have different text forms
+	 */
+	EXECUTE format('SELECT array_agg(v::text ORDER BY v) FROM (SELECT DISTINCT v FROM unnest(%L::%s[]) v) s'
+				   , p_values
+				   , v_type)
+	INTO v_values;
+
+	IF v_values IS NULL THEN
+		RAISE EXCEPTION 'Partition must have at least one value';
+	END IF;
+
+	EXECUTE format('SELECT EXISTS (SELECT * FROM @extschema@.pathman_partition_bounds
+								   WHERE parent = $1 AND list_values::%1$s[] && $2::%1$s[])'
+				   , v_type)
+	USING p_parent_relname::regclass, v_values
+	INTO v_overlap;
+
+	IF v_overlap THEN
+		RAISE EXCEPTION 'Specified values overlap with existing partitions';
+	END IF;
+
+	RETURN v_values;
+END
+$$ LANGUAGE plpgsql;
+
+/*
+ * Creates new LIST partition for the values. Returns partition name
+ */
+CREATE OR REPLACE FUNCTION @extschema@.create_single_list_partition(
+	p_parent_relname TEXT
+	, p_values ANYARRAY)
+RETURNS TEXT AS
+$$
+DECLARE
+	v_child_relname TEXT;
+	v_attname TEXT;
+	v_type TEXT;
+	v_values TEXT[];
+BEGIN
+	v_attname := attname FROM @extschema@.pathman_config
+				 WHERE relname = p_parent_relname;
+	v_type := @extschema@.get_attribute_type_name(p_parent_relname, v_attname);
+	v_values := @extschema@.prepare_list_values(p_parent_relname, p_values);
+
+	v_child_relname := format('%s_%s'
+							  , p_parent_relname
+							  , nextval(format('%s_seq', p_parent_relname)));
+
+	EXECUTE format('CREATE TABLE %s (LIKE %s INCLUDING ALL)'
+				   , v_child_relname
+				   , p_parent_relname);
+
+	EXECUTE format('ALTER TABLE %s INHERIT %s'
+				   , v_child_relname
+				   , p_parent_relname);
+	PERFORM @extschema@.add_global_index_partition(p_parent_relname::regclass, v_child_relname::regclass);
+
+	EXECUTE format('ALTER TABLE %s ADD CONSTRAINT %s_check CHECK (%s = ANY(%L::%s[]))'
+				   , v_child_relname
+				   , @extschema@.get_schema_qualified_name(v_child_relname::regclass)
+				   , v_attname
+				   , v_values
+				   , v_type);
+
+	INSERT INTO @extschema@.pathman_partition_bounds (partition, parent, list_values)
+	VALUES (v_child_relname::regclass, p_parent_relname::regclass, v_values);
+	PERFORM @extschema@.apply_subpartition_template(p_parent_relname::regclass
+													, v_child_relname::regclass);
+
+	IF to_regprocedure(format('%s_update_trigger_func()', p_parent_relname)) IS NOT NULL THEN
+		PERFORM @extschema@.create_list_update_trigger(p_parent_relname);
+	END IF;
+
+	RETURN v_child_relname;
+END
+$$ LANGUAGE plpgsql;
+
+/*
+ * Adds LIST partition holding specified values
+ */
+CREATE OR REPLACE FUNCTION @extschema@.add_list_partition(
+	relation TEXT
+	, p_values ANYARRAY)
+RETURNS TEXT AS
+$$
+DECLARE
+	v_part_name TEXT;
+BEGIN
+	relation := @extschema@.validate_relname(relation);
+
+	IF NOT EXISTS (SELECT * FROM @extschema@.pathman_config
+				   WHERE relname = relation AND parttype = 3) THEN
+		RAISE EXCEPTION 'Relation "%" isn''t partitioned by LIST', relation;
+	END IF;
+
+	/* Wait for running inserts so that rows don't miss the new partition */
+	EXECUTE format('LOCK TABLE %s IN SHARE ROW EXCLUSIVE MODE', relation);
+
+	v_part_name := @extschema@.create_single_list_partition(relation, p_values);
+
+	/* Notify backend about changes */
+	PERFORM @extschema@.on_update_partitions(relation::regclass::oid);
+
+	RETURN v_part_name;
+END
+$$ LANGUAGE plpgsql;
+
+/*
+ * Attaches existing table as LIST partition holding specified values
+ */
+CREATE OR REPLACE FUNCTION @extschema@.attach_list_partition(
+	p_relation TEXT
+	, p_partition TEXT
+	, p_values ANYARRAY)
+RETURNS TEXT AS
+$$
+DECLARE
+	v_attname TEXT;
+	v_type TEXT;
+	v_values TEXT[];
+BEGIN
+	p_relation := @extschema@.validate_relname(p_relation);
+
+	v_attname := attname FROM @extschema@.pathman_config
+				 WHERE relname = p_relation AND parttype = 3;
+	IF v_attname IS NULL THEN
+		RAISE EXCEPTION 'Relation "%" isn''t partitioned by LIST', p_relation;
+	END IF;
+
+	/* Wait for running inserts so that rows don't miss the new partition */
+	EXECUTE format('LOCK TABLE %s IN SHARE ROW EXCLUSIVE MODE', p_relation);
+
+	v_type := @extschema@.get_attribute_type_name(p_relation, v_attname);
+	v_values := @extschema@.prepare_list_values(p_relation, p_values);
+
+	IF NOT @extschema@.validate_relations_equality(p_relation::regclass, p_partition::regclass) THEN
+		RAISE EXCEPTION 'Partition must have the exact same structure as parent';
+	END IF;
+
+	/* Set inheritance */
+	EXECUTE format('ALTER TABLE %s INHERIT %s'
+				   , p_partition
+				   , p_relation);
+	PERFORM @extschema@.add_global_index_partition(p_relation::regclass, p_partition::regclass);
+
+	/* Set check constraint */
+	EXECUTE format('ALTER TABLE %s ADD CONSTRAINT %s_check CHECK (%s = ANY(%L::%s[]))'
+				   , p_partition
+				   , @extschema@.get_schema_qualified_name(p_partition::regclass)
+				   , v_attname
+				   , v_values
+				   , v_type);
+
+	INSERT INTO @extschema@.pathman_partition_bounds (partition, parent, list_values)
+	VALUES (p_partition::regclass, p_relation::regclass, v_values);
+
+	IF to_regprocedure(format('%s_update_trigger_func()', p_relation)) IS NOT NULL THEN
+		PERFORM @extschema@.create_list_update_trigger(p_relation);
+	END IF;
+
+	/* Invalidate cache */
+	PERFORM @extschema@.on_attach_partition(p_relation::regclass::oid,
+											p_partition::regclass::oid);
+
+	RETURN p_partition;
+END
+$$ LANGUAGE plpgsql;
+
+/*
+ * Creates LIST partitioning insert trigger
+ */
+CREATE OR REPLACE FUNCTION @extschema@.create_list_insert_trigger(
+	v_relation    TEXT
+	, v_attname   TEXT)
+RETURNS VOID AS
+$$
+DECLARE
+	v_func TEXT := '
+		CREATE OR REPLACE FUNCTION %s_insert_trigger_func()
+		RETURNS TRIGGER
+		AS $body$
+		DECLARE
+			v_part_relid OID;
+		BEGIN
+			v_part_relid := @extschema@.find_list_partition(TG_RELID, NEW.%2$s);
+			IF v_part_relid IS NULL THEN
+				RAISE EXCEPTION ''ERROR: Cannot find partition'';
+			END IF;
+			/* Partition may be partitioned itself */
+			v_part_relid := @extschema@.find_leaf_partition(v_part_relid, NEW);
+			EXECUTE format(''INSERT INTO %%s SELECT $1.*'', v_part_relid::regclass)
+			USING NEW;
+			RETURN NULL;
+		END
+		$body$ LANGUAGE plpgsql;';
+	v_trigger TEXT := '
+		CREATE TRIGGER %s_insert_trigger
+		BEFORE INSERT ON %s
+		FOR EACH ROW EXECUTE PROCEDURE %2$s_insert_trigger_func();';
+BEGIN
+	v_func := format(v_func, v_relation, v_attname);
+	v_trigger := format(v_trigger, @extschema@.get_schema_qualified_name(v_relation::regclass), v_relation);
+
+	EXECUTE v_func;
+	EXECUTE v_trigger;
+END
+$$ LANGUAGE plpgsql;
+
+/*
+ * Creates LIST partitioning update trigger which moves rows to another
+ * partition when partitioning key changes
+ */
+CREATE OR REPLACE FUNCTION @extschema@.create_list_update_trigger(
+	IN relation TEXT)
+RETURNS VOID AS
+$$
+DECLARE
+	func TEXT := '
+		CREATE OR REPLACE FUNCTION %s_update_trigger_func()
+		RETURNS TRIGGER AS
+		$body$
+		DECLARE new_oid OID; q TEXT;
+		BEGIN
+			IF OLD.%2$s IS NOT DISTINCT FROM NEW.%2$s THEN RETURN NEW; END IF;
+			new_oid := @extschema@.find_list_partition(''%1$s''::regclass::oid, NEW.%2$s);
+			IF new_oid IS NULL THEN
+				RAISE EXCEPTION ''ERROR: Cannot find partition'';
+			END IF;
+			IF new_oid = TG_RELID THEN RETURN NEW; END IF;
+			q := format(''DELETE FROM %%I.%%I WHERE %3$s'', TG_TABLE_SCHEMA, TG_TABLE_NAME);
+			EXECUTE q USING %4$s;
+			/* Partition may be partitioned itself */
+			new_oid := @extschema@.find_leaf_partition(new_oid, NEW);
+			q := format(''INSERT INTO %%s VALUES (%5$s)'', new_oid::regclass);
+			EXECUTE q USING %6$s;
+			RETURN NULL;
+		END $body$ LANGUAGE plpgsql';
+	trigger TEXT := 'CREATE TRIGGER %s_update_trigger ' ||
+		'BEFORE UPDATE ON %s ' ||
+		'FOR EACH ROW EXECUTE PROCEDURE %s_update_trigger_func()';
+	old_fields  TEXT;
+	new_fields  TEXT;
+	att_val_fmt TEXT;
+	att_fmt     TEXT;
+	relid       OID;
+	rec         RECORD;
+	attr        TEXT;
+BEGIN
+	relation := @extschema@.validate_relname(relation);
+	relid := relation::regclass::oid;
+	SELECT string_agg('OLD.' || attname, ', '),
+		   string_agg('NEW.' || attname, ', '),
+		   string_agg('CASE WHEN NOT $' || attnum || ' IS NULL THEN ' || attname || ' = $' || attnum ||
+					  ' ELSE ' || attname || ' IS NULL END', ' AND '),
+		   string_agg('$' || attnum, ', ')
+	FROM pg_attribute
+	WHERE attrelid=relid AND attnum>0
+	INTO   old_fields,
+		   new_fields,
+		   att_val_fmt,
+		   att_fmt;
+
+	attr := attname FROM @extschema@.pathman_config WHERE relname = relation;
+	EXECUTE format(func, relation, attr, att_val_fmt, old_fields, att_fmt, new_fields);
+	FOR rec in (SELECT inhrelid FROM pg_inherits WHERE inhparent = relid)
+	LOOP
+		/* New partitions are added to existing ones */
+		IF EXISTS (SELECT * FROM pg_trigger
+				   WHERE tgrelid = rec.inhrelid
+					 AND tgname = format('%s_update_trigger'
+										 , @extschema@.get_schema_qualified_name(rec.inhrelid::regclass))) THEN
+			CONTINUE;
+		END IF;
+		EXECUTE format(trigger
+					   , @extschema@.get_schema_qualified_name(rec.inhrelid::regclass)
+					   , rec.inhrelid::regclass
+					   , relation);
+	END LOOP;
+END
+$$ LANGUAGE plpgsql;
+
+/*
+ * Drops all partitions for specified relation
+ */
+CREATE OR REPLACE FUNCTION @extschema@.drop_list_partitions(
+	relation TEXT
+	, delete_data BOOLEAN DEFAULT FALSE)
+RETURNS INTEGER AS
+$$
+DECLARE
+	v_rec RECORD;
+	v_rows INTEGER;
+	v_part_count INTEGER := 0;
+BEGIN
+	relation := @extschema@.validate_relname(relation);
+
+	/* Drop trigger first */
+	EXECUTE format('DROP FUNCTION IF EXISTS %s_insert_trigger_func() CASCADE'
+				   , relation);
+	DELETE FROM @extschema@.pathman_config WHERE relname = relation;
+
+	FOR v_rec in (SELECT inhrelid::regclass::text AS tbl
+				FROM pg_inherits WHERE inhparent = relation::regclass::oid)
+	LOOP
+		IF NOT delete_data THEN
+			EXECUTE format('WITH part_data AS (DELETE FROM %s RETURNING *)
+							INSERT INTO %s SELECT * FROM part_data'
+						   , v_rec.tbl
+						   , relation);
+			GET DIAGNOSTICS v_rows = ROW_COUNT;
+			RAISE NOTICE '% rows copied from %', v_rows, v_rec.tbl;
+		END IF;
+		EXECUTE format('DROP TABLE %s', v_rec.tbl);
+		v_part_count := v_part_count + 1;
+	END LOOP;
+
+	/* Update trigger went away together with partitions */
+	IF to_regprocedure(format('%s_update_trigger_func()', relation)) IS NOT NULL THEN
+		EXECUTE format('DROP FUNCTION %s_update_trigger_func()', relation);
+	END IF;
+
+	/* Notify backend about changes */
+	PERFORM @extschema@.on_remove_partitions(relation::regclass::oid);
+
+	RETURN v_part_count;
+END
+$$ LANGUAGE plpgsql;
@@ -11,12 +11,20 @@
 #define PATHMAN_H
 
 #include "postgres.h"
+#include "fmgr.h"
 #include "utils/date.h"
 #include "utils/hsearch.h"
 #include "utils/snapshot.h"
+#include "access/htup.h"
+#include "access/tupdesc.h"
+#include "nodes/execnodes.h"
 #include "nodes/pg_list.h"
+#include "port/atomics.h"
 #include "storage/dsm.h"
 #include "storage/lwlock.h"
+#include "storage/spin.h"
+#include "storage/block.h"
+#include "datatype/timestamp.h"
 
 /* Check PostgreSQL version */
 #if PG_VERSION_NUM < 90500
@@ -26,13 +34,72 @@
 #define ALL NIL
 #define INITIAL_BLOCKS_COUNT 8192
 
+/* Number of partitions of shared hashtables, must be a power of 2 */
+#define PATHMAN_HASH_PARTITIONS 16
+
+/* Number of relations changed by aborted transactions kept in shared memory */
+#define PATHMAN_ABORTED_RELIDS 64
+
+/* Maximum number of columns of composite RANGE partitioning key */
+#define PATHMAN_MAX_KEYS 4
+
+/* Maximum number of columns with zone maps per relation */
+#define PATHMAN_MAX_ZONE_COLUMNS 4
+
+/* Maximum number of global indexes per relation */
+#define PATHMAN_MAX_GLOBAL_INDEXES 4
+
+/*
+ * pathman_config table attributes
+ */
+#define Natts_pathman_config					7
+#define Anum_pathman_config_id					1
+#define Anum_pathman_config_relname				2
+#define Anum_pathman_config_attname				3
+#define Anum_pathman_config_parttype			4
+#define Anum_pathman_config_range_interval		5
+#define Anum_pathman_config_default_partition	6
+#define Anum_pathman_config_hash_split_pos		7
+
+/*
+ * pathman_partition_bounds table attributes
+ */
+#define Natts_pathman_partition_bounds				6
+#define Anum_pathman_partition_bounds_partition		1
+#define Anum_pathman_partition_bounds_parent		2
+#define Anum_pathman_partition_bounds_lower			3
+#define Anum_pathman_partition_bounds_upper			4
+#define Anum_pathman_partition_bounds_hash_idx		5
+#define Anum_pathman_partition_bounds_list_values	6
+
+/*
+ * pathman_zone_maps table attributes
+ */
+#define Natts_pathman_zone_maps					7
+#define Anum_pathman_zone_maps_partition		1
+#define Anum_pathman_zone_maps_parent			2
+#define Anum_pathman_zone_maps_attname			3
+#define Anum_pathman_zone_maps_min				4
+#define Anum_pathman_zone_maps_max				5
+#define Anum_pathman_zone_maps_empty			6
+#define Anum_pathman_zone_maps_epoch			7
+
+/*
+ * pathman_global_indexes table attributes
+ */
+#define Natts_pathman_global_indexes			3
+#define Anum_pathman_global_indexes_parent		1
+#define Anum_pathman_global_indexes_attname		2
+#define Anum_pathman_global_indexes_index		3
+
 /*
  * Partitioning type
  */
 typedef enum PartType
 {
 	PT_HASH = 1,
-	PT_RANGE
+	PT_RANGE,
+	PT_LIST
 } PartType;
 
 /*
@@ -62,6 +129,22 @@ typedef struct RelationKey
  *		children - list of children oids
  *		parttype - partitioning type (HASH, LIST or RANGE)
  *		attnum - attribute number of parent relation
+ *		loaded - in lazy loading mode relation is registered on startup
+ *				 while its partitions are loaded on first access
+ *		split_pos - while HASH partitions are being doubled, the first of the
+ *				 old partitions which may still contain rows of the new ones;
+ *				 -1 otherwise
+ *		keys_count - number of key columns. RANGE key may consist of several
+ *				 columns (key_attnums, key_atttypes) which are compared
+ *				 lexicographically; attnum and atttype describe the first one
+ *		has_key_expr - key is an immutable expression of attnum column whose
+ *				 source text is kept in pathman_config.attname; atttype is the
+ *				 type of expression
+ *		zone_columns_count - number of columns other than the key which have
+ *				 zone maps (zone_attnums, zone_atttypes); valid summaries of
+ *				 partitions are kept in zone_maps array
+ *		gindex_count - number of columns with global indexes (gindex_attnums);
+ *				 gindex_relids are tables mapping values to partitions
  */
 typedef struct PartRelationInfo
 {
@@ -71,6 +154,20 @@ typedef struct PartRelationInfo
 	PartType	parttype;
 	Index		attnum;
 	Oid			atttype;
+	bool		loaded;		/* false if partitions haven't been loaded yet */
+	int			split_pos;
+	int			keys_count;
+	Index		key_attnums[PATHMAN_MAX_KEYS];
+	Oid			key_atttypes[PATHMAN_MAX_KEYS];
+	bool		has_key_expr;
+	int			zone_columns_count;
+	Index		zone_attnums[PATHMAN_MAX_ZONE_COLUMNS];
+	Oid			zone_atttypes[PATHMAN_MAX_ZONE_COLUMNS];
+	bool		zone_by_val[PATHMAN_MAX_ZONE_COLUMNS];
+	DsmArray	zone_maps;		/* ZoneMapEntry[] */
+	int			gindex_count;
+	Index		gindex_attnums[PATHMAN_MAX_GLOBAL_INDEXES];
+	Oid			gindex_relids[PATHMAN_MAX_GLOBAL_INDEXES];
 
 } PartRelationInfo;
 
@@ -104,23 +201,194 @@ typedef struct RangeEntry
 	#endif
 } RangeEntry;
 
+/*
+ * Bounds of composite key columns but the first one are kept apart from
+ * RangeEntry in key_bounds array. Each partition has RANGE_KEY_BOUNDS(n)
+ * entries: lower bounds of the columns followed by upper ones
+ */
+#define RANGE_KEY_BOUNDS(keys_count) (2 * ((keys_count) - 1))
+
 typedef struct RangeRelation
 {
 	RelationKey	key;
 	bool        by_val;
 	DsmArray    ranges;
+	Oid			default_oid;	/* default partition or InvalidOid */
+	DsmArray	key_bounds;		/* int64[], composite keys only */
+	bool		key_by_val[PATHMAN_MAX_KEYS];
 } RangeRelation;
 
+/*
+ * Values of LIST partitions. Values are kept in the open addressing hashtable
+ * (linear probing) whose size is a power of 2 and is at least twice as large
+ * as the number of values. Values which aren't passed by value are copied to
+ * values array
+ */
+typedef struct ListEntry
+{
+	uint32		hash;		/* hash of the value */
+	int			child_idx;	/* index in children array, -1 if entry is free */
+	int64		value;		/* value itself or its offset in values array */
+} ListEntry;
+
+typedef struct ListRelation
+{
+	RelationKey	key;
+	bool		by_val;
+	DsmArray	map;		/* ListEntry[] */
+	DsmArray	values;		/* values which aren't passed by value */
+	DsmArray	counts;		/* number of values of each partition */
+} ListRelation;
+
+/*
+ * Zone map of a partition: min and max values of a column which isn't the
+ * partitioning key. Values are stored the same way as RangeEntry's. Entries
+ * are sorted by column and partition oid. Writers set dirty flag of entries
+ * of the modified partition, and planner ignores them until the next refresh
+ */
+typedef struct ZoneMapEntry
+{
+	Oid			child_oid;
+	int			column;			/* index in zone_attnums */
+	bool		empty;			/* partition has no values of the column */
+	bool		dirty;			/* partition has been modified since refresh */
+	TransactionId xmin;			/* transaction which computed the summary */
+	int64		min;
+	int64		max;
+} ZoneMapEntry;
+
 typedef struct PathmanState
 {
 	LWLock	   *load_config_lock;
 	LWLock	   *dsm_init_lock;
 	LWLock	   *edit_partitions_lock;
+	/* Serializes claiming of concurrent partitioning slots */
+	LWLock	   *part_slots_lock;
 	DsmArray	databases;
+
+	/* Locks for partitions of relations, range and list restrictions hashtables */
+	LWLock	   *relations_locks[PATHMAN_HASH_PARTITIONS];
+
+	/* Incremented on every change of relations or restrictions hashtables */
+	pg_atomic_uint32 cache_generation;
+
+	/*
+	 * Summaries saved in pathman_zone_maps are only trusted within the epoch
+	 * they were computed in. Dirty flags are lost together with shared memory,
+	 * so every new segment starts a new epoch. Protected by load_config_lock
+	 */
+	int64		zone_maps_epoch;
+
+	/*
+	 * Relations whose cache entries have been changed by aborted transactions
+	 * (ring buffer, aborted_count is the total number of entries ever added).
+	 * Other backends never receive invalidations of rolled back catalog
+	 * changes, so they check these relations themselves. Protected by
+	 * aborted_mutex
+	 */
+	slock_t		aborted_mutex;
+	uint64		aborted_count;
+	RelationKey	aborted_relids[PATHMAN_ABORTED_RELIDS];
 } PathmanState;
 
 PathmanState *pmstate;
 
+/*
+ * Operator used in restrictions on partitioning key
+ */
+typedef struct LocalOperatorInfo
+{
+	Oid			opno;
+	Oid			consttype;
+	int			key;			/* key column the operator is applied to */
+	int			strategy;		/* btree strategy of operator */
+	FmgrInfo	cmp_func;		/* compares consttype with key type */
+} LocalOperatorInfo;
+
+/*
+ * LocalRelationInfo
+ *		Backend-local copy of partitioning information used by planner
+ *
+ *		children and ranges point to shared memory. All the entries become
+ *		invalid as soon as cache_generation changes
+ */
+typedef struct LocalRelationInfo
+{
+	Oid			relid;			/* hash key */
+	bool		partitioned;	/* false if relation isn't partitioned */
+	PartRelationInfo prel;
+	Node	   *key_expr;		/* key expression or NULL if key is a column */
+	ExprState  *key_exprstate;	/* key_expr prepared for execution on demand */
+	ExprContext *key_econtext;
+	TupleTableSlot *key_slot;	/* holds the key column while evaluating */
+	int16		key_typlen;
+	bool		key_typbyval;
+	Oid		   *children;
+	bool		has_subpartitions;	/* some children are partitioned too */
+	bool		has_ranges;
+	RangeEntry *ranges;
+	int			ranges_count;
+	bool		by_val;
+	Oid			default_oid;
+	int64	   *key_bounds;		/* see RANGE_KEY_BOUNDS() */
+	bool		key_by_val[PATHMAN_MAX_KEYS];
+	bool		has_list;
+	ListEntry  *list_map;
+	int			list_map_size;
+	char	   *list_values;
+	int		   *list_counts;
+	ZoneMapEntry *zone_maps;
+	int			zone_maps_count;
+	Oid			btree_opf;		/* btree opfamily of partitioning key type */
+	Oid			key_btree_opfs[PATHMAN_MAX_KEYS];	/* the same for every key column */
+	Oid			hash_opf;		/* hash opfamily of partitioning key type */
+	List	   *operators;		/* list of LocalOperatorInfo */
+} LocalRelationInfo;
+
+/*
+ * Concurrent partitioning slot. Each slot describes a background worker
+ * which moves data from parent relation to partitions in small batches
+ * (see worker.c). Several workers may share the same relation, each one
+ * processing its own range of heap blocks [start_block, end_block). The
+ * worker with sweep flag set also moves rows left outside of the ranges.
+ * Rows are taken from source_relid, which is either the parent itself, its
+ * default partition or the old HASH partition number hash_idx while HASH
+ * partitions are being split (-1 otherwise). If pending is set then the
+ * worker makes one more pass before it quits.
+ */
+#define PART_WORKER_SLOTS 10
+
+typedef enum
+{
+	CPS_FREE = 0,
+	CPS_WORKING,
+	CPS_STOPPING
+} ConcurrentPartSlotStatus;
+
+typedef struct ConcurrentPartSlot
+{
+	slock_t		mutex;
+	ConcurrentPartSlotStatus worker_status;
+	Oid			userid;
+	pid_t		pid;
+	Oid			dbid;
+	Oid			relid;
+	Oid			source_relid;
+	int			hash_idx;
+	bool		pending;
+	int			batch_size;
+	double		sleep_time;
+	BlockNumber	start_block;
+	BlockNumber	end_block;
+	int			batch_blocks;
+	bool		sweep;
+	uint64		total_rows;
+	double		estimated_rows;
+	TimestampTz	start_time;
+} ConcurrentPartSlot;
+
+extern ConcurrentPartSlot *concurrent_part_slots;
+
 #define PATHMAN_GET_DATUM(value, by_val) ( (by_val) ? (value) : PointerGetDatum(&value) )
 
 typedef int IndexRange;
@@ -169,7 +437,13 @@ void attach_dsm_array_segment(void);
 
 HTAB *relations;
 HTAB *range_restrictions;
+HTAB *list_restrictions;
 bool initialization_needed;
+bool pathman_lazy_loading;
+bool pathman_enable_template_paths;
+int pathman_max_relations;
+bool pathman_prewarm;
+char *pathman_prewarm_databases;
 
 /* initialization functions */
 Size pathman_memsize(void);
@@ -178,17 +452,66 @@ void load_config(void);
 void create_relations_hashtable(void);
 void create_hash_restrictions_hashtable(void);
 void create_range_restrictions_hashtable(void);
+void create_list_restrictions_hashtable(void);
 void load_relations_hashtable(bool reinitialize);
+void load_relation_info(Oid relid);
+void load_relation_partitions(Oid relid);
+void add_partition_info(Oid parent_oid, Oid child_oid);
+void remove_partition_info(Oid parent_oid, Oid child_oid);
+void pathman_relcache_hook(Datum arg, Oid relid);
+void *pathman_hash_search(HTAB *htab, const RelationKey *key,
+						  HASHACTION action, bool *found);
+void pathman_cache_changed(Oid relid);
+void lock_relations_hashtables(LWLockMode mode);
+void unlock_relations_hashtables(void);
+void process_invalidated_relations(void);
 void load_check_constraints(Oid parent_oid, Snapshot snapshot);
+void add_range_partitions(Oid parent_oid, Datum *children, Datum *mins, Datum *maxs, int nparts);
 void remove_relation_info(Oid relid);
+Node *load_key_expression(Oid relid);
+void load_zone_maps(Oid parent_oid, Snapshot snapshot);
+ZoneMapEntry *search_zone_map(ZoneMapEntry *entries, int count, int column,
+							  Oid child_oid);
+void mark_zone_maps_dirty(Oid child_oid);
+bool zone_maps_valid(Oid parent_oid, Oid child_oid);
+void zone_maps_refreshed(Oid parent_oid, Oid child_oid);
+Oid get_global_index_match_func(void);
+Oid get_key_values_match_func(void);
+int cmp_oids(const void *p1, const void *p2);
 
 /* utility functions */
 PartRelationInfo *get_pathman_relation_info(Oid relid, bool *found);
+PartRelationInfo *lock_pathman_relation_info(Oid relid, RangeRelation **rangerel,
+										   ListRelation **listrel);
+LocalRelationInfo *get_local_relation_info(Oid relid);
 RangeRelation *get_pathman_range_relation(Oid relid, bool *found);
+ListRelation *get_pathman_list_relation(Oid relid, bool *found);
 int range_binary_search(const RangeRelation *rangerel, FmgrInfo *cmp_func, Datum value, bool *fountPtr);
 char *get_extension_schema(void);
 FmgrInfo *get_cmp_func(Oid type1, Oid type2);
+int get_hash_part_idx(Datum value, Oid value_type, int partitions_count);
+int list_partition_lookup(const ListEntry *map, int map_size, const char *values,
+						  bool by_val, Oid atttype, Datum value);
+Oid find_leaf_partition(Oid relid, HeapTuple tuple, TupleDesc tupdesc);
+bool get_key_values_partitions(Oid relid, Oid value_type, Datum *values,
+							   bool *nulls, int count, List **partitions);
+bool get_partitioning_key(Oid relid, HeapTuple tuple, TupleDesc tupdesc, Datum *key);
+char *deparse_partitioning_key(Oid relid);
 Oid create_partitions_bg_worker(Oid relid, Datum value, Oid value_type, bool *crashed);
-Oid create_partitions(Oid relid, Datum value, Oid value_type, bool *crashed);
+Oid create_partitions(Oid relid, Datum value, Oid value_type, bool lock_cache,
+					  bool *crashed);
+void lock_partitions_creation(Oid relid);
+void unlock_partitions_creation(Oid relid);
+Node *parse_partitioning_key(Oid relid, const char *key);
+Node *parse_stored_partitioning_key(Oid relid, const char *key);
+
+/* concurrent partitioning */
+Size concurrent_part_slots_size(void);
+void init_concurrent_part_slots(void);
+void start_concurrent_part_workers(Oid relid, int batch_size, double sleep_time, int workers);
+bool start_default_partition_worker(Oid relid, Oid default_oid);
+bool start_hash_split_worker(Oid relid);
+int validate_hash_split_constraints(Oid relid);
+void register_prewarm_worker(void);
 
 #endif   /* PATHMAN_H */
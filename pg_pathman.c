@@ -21,22 +21,37 @@
 #include "optimizer/pathnode.h"
 #include "optimizer/planner.h"
 #include "optimizer/restrictinfo.h"
+#include "optimizer/var.h"
 #include "optimizer/cost.h"
 #include "parser/analyze.h"
 #include "parser/parsetree.h"
 #include "utils/hsearch.h"
+#include "utils/guc.h"
+#include "utils/inval.h"
 #include "utils/tqual.h"
 #include "utils/rel.h"
 #include "utils/elog.h"
 #include "utils/array.h"
+#include "utils/builtins.h"
 #include "utils/date.h"
+#include "utils/datum.h"
 #include "utils/typcache.h"
 #include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/fmgroids.h"
+#if PG_VERSION_NUM >= 90600
+#include "utils/ruleutils.h"
+#endif
+#include "access/hash.h"
 #include "access/heapam.h"
+#include "access/htup_details.h"
 #include "access/nbtree.h"
+#include "access/xact.h"
+#include "executor/executor.h"
 #include "storage/ipc.h"
 #include "catalog/pg_operator.h"
 #include "catalog/pg_type.h"
+#include "nodes/makefuncs.h"
 #include "foreign/fdwapi.h"
 
 PG_MODULE_MAGIC;
@@ -47,13 +62,34 @@ typedef struct
 	Oid new_varno;
 } change_varno_context;
 
-typedef struct
+typedef struct WrapperNode
 {
 	const Node	   *orig;
 	List		   *args;
 	List		   *rangeset;
+
+	/*
+	 * Children are processed in ascending order of indexes, so the current
+	 * range is tracked instead of searching the rangeset for every child.
+	 * Expression built for a child is reused up to cached_until index
+	 */
+	ListCell	   *cursor;
+	int				cached_until;
+	Node		   *cached_expr;
+	bool			cached_always_true;
 } WrapperNode;
 
+/*
+ * Condition on a column of composite RANGE key: column OP value
+ */
+typedef struct KeyCondition
+{
+	int			key;			/* index of key column */
+	int			strategy;		/* btree strategy of operator */
+	Datum		value;
+	FmgrInfo   *cmp_func;		/* compares value with key column */
+} KeyCondition;
+
 /* Original hooks */
 static set_rel_pathlist_hook_type set_rel_pathlist_hook_original = NULL;
 static shmem_startup_hook_type shmem_startup_hook_original = NULL;
@@ -72,19 +108,98 @@ static PlannedStmt * pathman_planner_hook(Query *parse, int cursorOptions, Param
 
 /* Utility functions */
 static void handle_modification_query(Query *parse);
-static void append_child_relation(PlannerInfo *root, RelOptInfo *rel, Index rti,
-				RangeTblEntry *rte, int index, Oid childOID, List *wrappers);
+static List *append_partitions(PlannerInfo *root, RelOptInfo *rel, Index rti,
+	RangeTblEntry *rte, LocalRelationInfo *lrel, List *ranges, List *wrappers,
+	List *rinfos, Index *childRTindex);
+static List *append_subpartitions(PlannerInfo *root, RelOptInfo *rel, Index rti,
+	RangeTblEntry *rte, LocalRelationInfo *sublrel, int index, List *wrappers,
+	List *rinfos, Index *childRTindex);
+static int count_rangeset_partitions(LocalRelationInfo *lrel, List *ranges);
+static bool get_tuple_key_value(Oid relid, AttrNumber attnum, HeapTuple tuple,
+								TupleDesc tupdesc, Datum *value);
+static void prepare_key_expression(LocalRelationInfo *lrel);
+static Node *reset_varnos_mutator(Node *node, void *context);
+static Const *eval_key_expression(LocalRelationInfo *lrel, Datum value);
+static RangeTblEntry *append_child_relation(PlannerInfo *root, RelOptInfo *rel,
+				Index rti, RangeTblEntry *rte, int index, Oid childOID,
+				List *wrappers, List *rinfos, Index childRTindex);
+static void reserve_simple_rel_arrays(PlannerInfo *root, int len);
 static Node *wrapper_make_expression(WrapperNode *wrap, int index, bool *alwaysTrue);
+static void wrapper_reset_cursor(WrapperNode *wrap);
+static Node *wrapper_eval(WrapperNode *wrap, int index, bool *alwaysTrue);
+static int wrapper_seek(WrapperNode *wrap, int index, bool *found, bool *lossy);
 static void disable_inheritance(Query *parse);
+static void add_key_values_sublinks(Query *parse);
+static Node *make_key_values_sublink(Query *parse, Node *qual);
 bool inheritance_disabled;
 
+/* Backend-local cache of partitioning metadata */
+static HTAB *local_relations = NULL;
+static MemoryContext local_cache_context = NULL;
+static uint32 local_cache_generation = 0;
+static int planner_depth = 0;
+
+/* Contexts of dropped local caches which may still be referenced */
+static List *retired_cache_contexts = NIL;
+static bool local_cache_callback_registered = false;
+
+/*
+ * Allocated size of simple_rel_array and simple_rte_array of planner roots
+ * (simple_rel_array_size is the number of used entries)
+ */
+typedef struct RelArraysCapacity
+{
+	PlannerInfo *root;
+	RelOptInfo **rel_array;
+	int			capacity;
+} RelArraysCapacity;
+
+static List *rel_arrays_capacities = NIL;
+static int count_query_partitions(PlannerInfo *root);
+static void check_local_cache(void);
+static void local_cache_xact_callback(XactEvent event, void *arg);
+static void *get_shared_array(DsmArray *array, Size elem_size, bool copy);
+static void fill_local_relation_info(LocalRelationInfo *lrel, Oid relid);
+static void set_shared_partitions(LocalRelationInfo *lrel, PartRelationInfo *prel,
+								  RangeRelation *rangerel, ListRelation *listrel,
+								  bool copy);
+static LocalOperatorInfo *get_local_operator_info(LocalRelationInfo *lrel, int key,
+												  Oid opno, Oid consttype);
+
 /* Expression tree handlers */
-static WrapperNode *walk_expr_tree(Expr *expr, const PartRelationInfo *prel);
-static int make_hash(const PartRelationInfo *prel, int value);
-static void handle_binary_opexpr(const PartRelationInfo *prel, WrapperNode *result, const Var *v, const Const *c);
-static WrapperNode *handle_opexpr(const OpExpr *expr, const PartRelationInfo *prel);
-static WrapperNode *handle_boolexpr(const BoolExpr *expr, const PartRelationInfo *prel);
-static WrapperNode *handle_arrexpr(const ScalarArrayOpExpr *expr, const PartRelationInfo *prel);
+static WrapperNode *walk_expr_tree(Expr *expr, LocalRelationInfo *lrel);
+static int make_hash(const LocalRelationInfo *lrel, Datum value);
+static List *make_hash_rangeset(const LocalRelationInfo *lrel, Datum value);
+static List *make_list_rangeset(const LocalRelationInfo *lrel, Datum value);
+static bool key_values_prunable(const LocalRelationInfo *lrel);
+static List *make_key_value_rangeset(const LocalRelationInfo *lrel, Datum value);
+static Datum range_key_bound(const LocalRelationInfo *lrel, int idx, int key, bool upper);
+static int cmp_key_values(const LocalRelationInfo *lrel, int idx, bool upper,
+						  Datum *values, FmgrInfo **cmp_funcs, int n);
+static int composite_partition_idx(const LocalRelationInfo *lrel, Datum *values);
+static bool get_key_condition(LocalRelationInfo *lrel, Node *clause, KeyCondition *cond);
+static List *make_composite_rangeset(LocalRelationInfo *lrel, List *clauses);
+static List *composite_key_rangeset(const LocalRelationInfo *lrel, Datum *values,
+									FmgrInfo **cmp_funcs, int n, KeyCondition *cond);
+static void handle_binary_opexpr(LocalRelationInfo *lrel, WrapperNode *result, Oid opno, const Const *c);
+static bool is_partitioning_key(const LocalRelationInfo *lrel, Node *node);
+static void handle_key_column_opexpr(LocalRelationInfo *lrel, WrapperNode *result,
+									 Oid opno, const Var *var, const Const *c);
+static bool key_expr_is_monotonic(Node *node);
+static bool handle_zone_map_opexpr(const LocalRelationInfo *lrel, WrapperNode *result,
+								   Oid opno, const Var *var, const Const *c);
+static const ZoneMapEntry *find_zone_map_entry(const LocalRelationInfo *lrel,
+											   int column, Oid child_oid);
+static void add_key_values_filters(PlannerInfo *root, RelOptInfo *rel,
+								   Index rti, LocalRelationInfo *lrel);
+static void add_global_index_filters(PlannerInfo *root, RelOptInfo *rel,
+									 Index rti, LocalRelationInfo *lrel);
+static Const *make_oid_const(Oid oid);
+static void add_partitions_filters(PlannerInfo *root, Index rti, List *filters,
+								   int partition_argno, Oid skip_oid);
+static WrapperNode *handle_opexpr(const OpExpr *expr, LocalRelationInfo *lrel);
+static WrapperNode *handle_boolexpr(const BoolExpr *expr, LocalRelationInfo *lrel);
+static WrapperNode *handle_arrexpr(const ScalarArrayOpExpr *expr, LocalRelationInfo *lrel);
 static void change_varnos_in_restrinct_info(RestrictInfo *rinfo, change_varno_context *context);
 static void change_varnos(Node *node, Oid old_varno, Oid new_varno);
 static bool change_varno_walker(Node *node, change_varno_context *context);
@@ -94,6 +209,19 @@ static void set_plain_rel_pathlist(PlannerInfo *root, RelOptInfo *rel, RangeTblE
 static void set_append_rel_pathlist(PlannerInfo *root, RelOptInfo *rel, Index rti, RangeTblEntry *rte);
 static List *accumulate_append_subpath(List *subpaths, Path *path);
 static void set_pathkeys(PlannerInfo *root, RelOptInfo *childrel, Path *path);
+static bool child_rels_similar(RelOptInfo *template_rel, RelOptInfo *childrel);
+static bool indexes_similar(IndexOptInfo *index1, IndexOptInfo *index2);
+static bool clone_template_paths(PlannerInfo *root, RelOptInfo *template_rel,
+								 RelOptInfo *childrel);
+static Path *clone_template_path(PlannerInfo *root, RelOptInfo *template_rel,
+								 RelOptInfo *childrel, Path *template_path);
+static Path *clone_bitmap_qual(PlannerInfo *root, RelOptInfo *template_rel,
+							   RelOptInfo *childrel, Path *bitmapqual);
+static IndexPath *clone_index_path(PlannerInfo *root, RelOptInfo *template_rel,
+								   RelOptInfo *childrel, IndexPath *ipath);
+static RestrictInfo *map_template_rinfo(Node *template_node, Node *child_node,
+										RestrictInfo *rinfo);
+static int list_position_ptr(List *list, void *datum);
 
 
 /*
@@ -130,9 +258,22 @@ _PG_init(void)
 	}
 #endif
 
+	DefineCustomIntVariable("pg_pathman.max_relations",
+							"Maximum number of partitioned tables in all databases.",
+							NULL,
+							&pathman_max_relations,
+							1024,
+							1,
+							INT_MAX / 2,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
 	/* Request additional shared resources */
 	RequestAddinShmemSpace(pathman_memsize());
-	RequestAddinLWLocks(3);
+	RequestAddinLWLocks(4 + PATHMAN_HASH_PARTITIONS);
 
 	set_rel_pathlist_hook_original = set_rel_pathlist_hook;
 	set_rel_pathlist_hook = pathman_set_rel_pathlist_hook;
@@ -142,6 +283,53 @@ _PG_init(void)
 	post_parse_analyze_hook = pathman_post_parse_analysis_hook;
 	planner_hook_original = planner_hook;
 	planner_hook = pathman_planner_hook;
+	CacheRegisterRelcacheCallback(pathman_relcache_hook, (Datum) 0);
+
+	DefineCustomBoolVariable("pg_pathman.lazy_loading",
+							 "Load partitions of a relation on its first access.",
+							 NULL,
+							 &pathman_lazy_loading,
+							 false,
+							 PGC_SIGHUP,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("pg_pathman.enable_template_paths",
+							 "Reuse access path of a partition for similar partitions.",
+							 NULL,
+							 &pathman_enable_template_paths,
+							 true,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("pg_pathman.prewarm",
+							 "Load the cache by a background worker on server start.",
+							 NULL,
+							 &pathman_prewarm,
+							 false,
+							 PGC_POSTMASTER,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomStringVariable("pg_pathman.prewarm_databases",
+							   "Databases to load the cache for on server start.",
+							   "Comma-separated list; all databases if empty.",
+							   &pathman_prewarm_databases,
+							   "",
+							   PGC_POSTMASTER,
+							   0,
+							   NULL,
+							   NULL,
+							   NULL);
+
+	register_prewarm_worker();
 }
 
 void
@@ -153,14 +341,28 @@ _PG_fini(void)
 	planner_hook = planner_hook_original;
 }
 
+/*
+ * Returns relation info. In lazy loading mode partitions are loaded on the
+ * first access. Unless load_config_lock is held, the result only tells
+ * whether relation is partitioned; use lock_pathman_relation_info() to read it
+ */
 PartRelationInfo *
 get_pathman_relation_info(Oid relid, bool *found)
 {
 	RelationKey key;
+	PartRelationInfo *prel;
 
 	key.dbid = MyDatabaseId;
 	key.relid = relid;
-	return hash_search(relations, (const void *) &key, HASH_FIND, found);
+	prel = pathman_hash_search(relations, &key, HASH_FIND, found);
+
+	if (prel != NULL && !prel->loaded)
+	{
+		load_relation_partitions(relid);
+		prel = pathman_hash_search(relations, &key, HASH_FIND, found);
+	}
+
+	return prel;
 }
 
 RangeRelation *
@@ -168,314 +370,1578 @@ get_pathman_range_relation(Oid relid, bool *found)
 {
 	RelationKey key;
 
+	/* Make sure partitions are loaded */
+	get_pathman_relation_info(relid, NULL);
+
 	key.dbid = MyDatabaseId;
 	key.relid = relid;
-	return hash_search(range_restrictions, (const void *) &key, HASH_FIND, found);
+	return pathman_hash_search(range_restrictions, &key, HASH_FIND, found);
 }
 
-FmgrInfo *
-get_cmp_func(Oid type1, Oid type2)
+ListRelation *
+get_pathman_list_relation(Oid relid, bool *found)
 {
-	FmgrInfo   *cmp_func;
-	Oid			cmp_proc_oid;
-	TypeCacheEntry	*tce;
+	RelationKey key;
 
-	cmp_func = palloc(sizeof(FmgrInfo));
-	tce = lookup_type_cache(type1,
-							TYPECACHE_EQ_OPR | TYPECACHE_LT_OPR | TYPECACHE_GT_OPR |
-							TYPECACHE_CMP_PROC | TYPECACHE_CMP_PROC_FINFO);
-	cmp_proc_oid = get_opfamily_proc(tce->btree_opf,
-									 type1,
-									 type2,
-									 BTORDER_PROC);
-	fmgr_info(cmp_proc_oid, cmp_func);
-	return cmp_func;
+	/* Make sure partitions are loaded */
+	get_pathman_relation_info(relid, NULL);
+
+	key.dbid = MyDatabaseId;
+	key.relid = relid;
+	return pathman_hash_search(list_restrictions, &key, HASH_FIND, found);
 }
 
 /*
- * Post parse analysis hook. It makes sure the config is loaded before executing
- * any statement, including utility commands
+ * Returns relation info with load_config_lock held in shared mode. Entries
+ * and their partitions are modified and freed under exclusive lock only, so
+ * they stay valid until the caller releases the lock. Returns NULL (and
+ * doesn't hold the lock) if relation isn't partitioned
  */
-void
-pathman_post_parse_analysis_hook(ParseState *pstate, Query *query)
+PartRelationInfo *
+lock_pathman_relation_info(Oid relid, RangeRelation **rangerel,
+						   ListRelation **listrel)
 {
-	if (initialization_needed)
-		load_config();
+	RelationKey key;
+	PartRelationInfo *prel;
 
-	if (post_parse_analyze_hook_original)
-		post_parse_analyze_hook_original(pstate, query);
+	key.dbid = MyDatabaseId;
+	key.relid = relid;
+
+	for (;;)
+	{
+		/* Load partitions in lazy loading mode */
+		if (get_pathman_relation_info(relid, NULL) == NULL)
+			return NULL;
+
+		LWLockAcquire(pmstate->load_config_lock, LW_SHARED);
+		prel = pathman_hash_search(relations, &key, HASH_FIND, NULL);
+		if (prel == NULL)
+		{
+			LWLockRelease(pmstate->load_config_lock);
+			return NULL;
+		}
+		if (prel->loaded)
+			break;
+
+		/* Partitions have been unloaded concurrently, try again */
+		LWLockRelease(pmstate->load_config_lock);
+	}
+
+	if (rangerel != NULL)
+		*rangerel = pathman_hash_search(range_restrictions, &key, HASH_FIND, NULL);
+	if (listrel != NULL)
+		*listrel = pathman_hash_search(list_restrictions, &key, HASH_FIND, NULL);
+
+	return prel;
 }
 
 /*
- * Planner hook. It disables inheritance for tables that have been partitioned
- * by pathman to prevent standart PostgreSQL partitioning mechanism from
- * handling that tables.
+ * Returns backend-local copy of relation's partitioning info or NULL if
+ * relation isn't partitioned. Copies are built on the first access and are
+ * kept until the shared cache generation changes (see check_local_cache()),
+ * so planner doesn't have to search shared hashtables for every query
  */
-PlannedStmt *
-pathman_planner_hook(Query *parse, int cursorOptions, ParamListInfo boundParams)
+LocalRelationInfo *
+get_local_relation_info(Oid relid)
 {
-	PlannedStmt	  *result;
-	ListCell	  *lc;
+	LocalRelationInfo *lrel;
+	LocalRelationInfo	tmp;
+	bool		found;
 
-	inheritance_disabled = false;
-	switch(parse->commandType)
-	{
-		case CMD_SELECT:
-			disable_inheritance(parse);
-			break;
-		case CMD_UPDATE:
-		case CMD_DELETE:
-			handle_modification_query(parse);
-			break;
-		default:
-			break;
-	}
+	if (local_relations == NULL)
+		check_local_cache();
 
-	/* If query contains CTE (WITH statement) then handle subqueries too */
-	foreach(lc, parse->cteList)
+	lrel = hash_search(local_relations, (const void *) &relid, HASH_FIND, NULL);
+	if (lrel == NULL)
 	{
-		CommonTableExpr *cte = (CommonTableExpr*) lfirst(lc);
-
-		if (IsA(cte->ctequery, Query))
-			disable_inheritance((Query *)cte->ctequery);
+		/* Build the entry first so that error wouldn't leave it half-filled */
+		fill_local_relation_info(&tmp, relid);
+		lrel = hash_search(local_relations, (const void *) &relid, HASH_ENTER, &found);
+		*lrel = tmp;
 	}
 
-	/* Invoke original hook */
-	if (planner_hook_original)
-		result = planner_hook_original(parse, cursorOptions, boundParams);
-	else
-		result = standard_planner(parse, cursorOptions, boundParams);
-
-	return result;
+	return lrel->partitioned ? lrel : NULL;
 }
 
 /*
- * Disables inheritance for partitioned by pathman relations. It must be done to
- * prevent PostgresSQL from full search.
+ * Drops backend-local cache if shared cache has been changed since it was
+ * built. Entries may be referenced during planning, so only the outermost
+ * planner call does it. Executor may still use entries of the dropped cache
+ * (e.g. when the cache is checked again while rows are routed), so its
+ * memory is kept till the end of transaction
  */
 static void
-disable_inheritance(Query *parse)
+check_local_cache(void)
 {
-	RangeTblEntry *rte;
-	ListCell	  *lc;
-	PartRelationInfo *prel;
-	bool found;
+	uint32		generation = pg_atomic_read_u32(&pmstate->cache_generation);
+	HASHCTL		ctl;
 
-	foreach(lc, parse->rtable)
+	if (local_relations != NULL && generation == local_cache_generation)
+		return;
+
+	if (local_cache_context != NULL)
 	{
-		rte = (RangeTblEntry*) lfirst(lc);
-		switch(rte->rtekind)
+		if (IsTransactionState())
 		{
-			case RTE_RELATION:
-				if (rte->inh)
-				{
-					/* Look up this relation in pathman relations */
-					prel = get_pathman_relation_info(rte->relid, &found);
-					if (prel != NULL && found)
-					{
-						rte->inh = false;
-						/*
-						 * Sometimes user uses the ONLY statement and in this case
-						 * rte->inh is also false. We should differ the case
-						 * when user uses ONLY statement from case when we
-						 * make rte->inh false intentionally.
-						 */
-						inheritance_disabled = true;
-					}
-				}
-				break;
-			case RTE_SUBQUERY:
-				/* Recursively disable inheritance for subqueries */
-				disable_inheritance(rte->subquery);
-				break;
-			default:
-				break;
+			MemoryContext old_mcxt;
+
+			if (!local_cache_callback_registered)
+			{
+				RegisterXactCallback(local_cache_xact_callback, NULL);
+				local_cache_callback_registered = true;
+			}
+
+			old_mcxt = MemoryContextSwitchTo(TopMemoryContext);
+			retired_cache_contexts = lappend(retired_cache_contexts,
+											 local_cache_context);
+			MemoryContextSwitchTo(old_mcxt);
 		}
+		else
+			MemoryContextDelete(local_cache_context);
 	}
+
+	local_cache_context = AllocSetContextCreate(CacheMemoryContext,
+												"pg_pathman local cache",
+												ALLOCSET_DEFAULT_MINSIZE,
+												ALLOCSET_DEFAULT_INITSIZE,
+												ALLOCSET_DEFAULT_MAXSIZE);
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(Oid);
+	ctl.entrysize = sizeof(LocalRelationInfo);
+	ctl.hcxt = local_cache_context;
+	local_relations = hash_create("pg_pathman local relations", 64, &ctl,
+								  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	local_cache_generation = generation;
 }
 
 /*
- * Checks if query is affects only one partition. If true then substitute
+ * Frees local caches dropped during transaction
  */
 static void
-handle_modification_query(Query *parse)
+local_cache_xact_callback(XactEvent event, void *arg)
+{
+	ListCell   *lc;
+
+	if (event == XACT_EVENT_PRE_COMMIT || event == XACT_EVENT_PRE_PREPARE)
+		return;
+
+	foreach(lc, retired_cache_contexts)
+		MemoryContextDelete((MemoryContext) lfirst(lc));
+	list_free(retired_cache_contexts);
+	retired_cache_contexts = NIL;
+}
+
+static void
+fill_local_relation_info(LocalRelationInfo *lrel, Oid relid)
 {
+	RelationKey key;
 	PartRelationInfo *prel;
-	List	   *ranges,
-			   *wrappers = NIL;
-	RangeTblEntry *rte;
-	WrapperNode *wrap;
-	bool found;
+	RangeRelation *rangerel;
+	ListRelation *listrel;
+	bool		lock_held = LWLockHeldByMe(pmstate->load_config_lock);
+	int			i;
 
-	Assert(parse->commandType == CMD_UPDATE ||
-		   parse->commandType == CMD_DELETE);
-	Assert(parse->resultRelation > 0);
+	memset(lrel, 0, sizeof(LocalRelationInfo));
+	lrel->relid = relid;
+	lrel->default_oid = InvalidOid;
 
-	rte = rt_fetch(parse->resultRelation, parse->rtable);
-	prel = get_pathman_relation_info(rte->relid, &found);
+	key.dbid = MyDatabaseId;
+	key.relid = relid;
 
-	if (!found)
-		return;
+	for (;;)
+	{
+		/* Load partitions in lazy loading mode */
+		if (get_pathman_relation_info(relid, NULL) == NULL)
+			return;
+
+		/* Shared cache is modified under exclusive lock only */
+		if (!lock_held)
+			LWLockAcquire(pmstate->load_config_lock, LW_SHARED);
+
+		prel = pathman_hash_search(relations, &key, HASH_FIND, NULL);
+		if (prel == NULL || prel->loaded)
+			break;
 
-	/* Parse syntax tree and extract partition ranges */
-	ranges = list_make1_int(make_irange(0, prel->children_count - 1, false));
-	wrap = walk_expr_tree((Expr *) eval_const_expressions(NULL, parse->jointree->quals), prel);
-	wrappers = lappend(wrappers, wrap);
-	ranges = irange_list_intersect(ranges, wrap->rangeset);
+		/* Partitions have been unloaded concurrently, try again */
+		if (!lock_held)
+			LWLockRelease(pmstate->load_config_lock);
+	}
 
-	/* If only one partition is affected then substitute parent table with partition */
-	if (irange_list_length(ranges) == 1)
+	if (prel != NULL)
 	{
-		IndexRange irange = (IndexRange) linitial_oid(ranges);
-		if (irange_lower(irange) == irange_upper(irange))
+		rangerel = pathman_hash_search(range_restrictions, &key, HASH_FIND, NULL);
+		listrel = pathman_hash_search(list_restrictions, &key, HASH_FIND, NULL);
+		set_shared_partitions(lrel, prel, rangerel, listrel, true);
+
+		/* Partitions may be partitioned by pg_pathman themselves */
+		for (i = 0; i < prel->children_count && !lrel->has_subpartitions; i++)
 		{
-			Oid *children = (Oid *) dsm_array_get_pointer(&prel->children);
-			rte->relid = children[irange_lower(irange)];
-			rte->inh = false;
+			RelationKey child_key;
+
+			child_key.dbid = MyDatabaseId;
+			child_key.relid = lrel->children[i];
+			lrel->has_subpartitions =
+				pathman_hash_search(relations, &child_key, HASH_FIND, NULL) != NULL;
 		}
 	}
 
-	return;
+	if (!lock_held)
+		LWLockRelease(pmstate->load_config_lock);
+
+	if (lrel->partitioned)
+	{
+		TypeCacheEntry *tce = lookup_type_cache(lrel->prel.atttype,
+												TYPECACHE_BTREE_OPFAMILY |
+												TYPECACHE_HASH_OPFAMILY);
+
+		lrel->btree_opf = tce->btree_opf;
+		lrel->hash_opf = tce->hash_opf;
+		lrel->key_btree_opfs[0] = tce->btree_opf;
+		for (i = 1; i < lrel->prel.keys_count; i++)
+			lrel->key_btree_opfs[i] = lookup_type_cache(lrel->prel.key_atttypes[i],
+											TYPECACHE_BTREE_OPFAMILY)->btree_opf;
+
+		/* Expression tree isn't kept in shared memory, parse it from config */
+		if (lrel->prel.has_key_expr)
+		{
+			MemoryContext old_mcxt = MemoryContextSwitchTo(local_cache_context);
+
+			lrel->key_expr = load_key_expression(relid);
+			MemoryContextSwitchTo(old_mcxt);
+			if (lrel->key_expr == NULL)
+				elog(ERROR, "Partitioning key expression of relation %s is missing",
+					 get_rel_name(relid));
+		}
+	}
 }
 
 /*
- * Shared memory startup hook
+ * Points relation info to partitions kept in shared memory. The caller has to
+ * hold load_config_lock while they're used, since shared arrays may be freed
+ * as soon as it's released. Entries of the local cache outlive the lock, so
+ * they get copies of the arrays instead
  */
 static void
-pathman_shmem_startup(void)
+set_shared_partitions(LocalRelationInfo *lrel, PartRelationInfo *prel,
+					  RangeRelation *rangerel, ListRelation *listrel, bool copy)
 {
-	/* Allocate shared memory objects */
-	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
-	init_dsm_config();
-	init_shmem_config();
-	LWLockRelease(AddinShmemInitLock);
+	lrel->partitioned = true;
+	lrel->prel = *prel;
+	lrel->children = (Oid *) get_shared_array(&prel->children, sizeof(Oid), copy);
 
-	/* Invoke original hook if needed */
-	if (shmem_startup_hook_original != NULL)
-		shmem_startup_hook_original();
+	if (prel->parttype == PT_RANGE && rangerel != NULL)
+	{
+		lrel->has_ranges = true;
+		lrel->ranges = (RangeEntry *) get_shared_array(&rangerel->ranges,
+													   sizeof(RangeEntry), copy);
+		lrel->ranges_count = rangerel->ranges.length;
+		lrel->by_val = rangerel->by_val;
+		lrel->default_oid = rangerel->default_oid;
+		if (prel->keys_count > 1)
+		{
+			lrel->key_bounds = (int64 *) get_shared_array(&rangerel->key_bounds,
+								sizeof(int64) * RANGE_KEY_BOUNDS(prel->keys_count), copy);
+			memcpy(lrel->key_by_val, rangerel->key_by_val, sizeof(lrel->key_by_val));
+		}
+	}
+
+	if (prel->parttype == PT_LIST && listrel != NULL)
+	{
+		lrel->has_list = true;
+		lrel->list_map = (ListEntry *) get_shared_array(&listrel->map,
+														sizeof(ListEntry), copy);
+		lrel->list_map_size = listrel->map.length;
+		lrel->list_values = (char *) get_shared_array(&listrel->values, 1, copy);
+		lrel->list_counts = (int *) get_shared_array(&listrel->counts,
+													 sizeof(int), copy);
+		lrel->by_val = listrel->by_val;
+	}
+
+	if (prel->zone_maps.length > 0)
+	{
+		lrel->zone_maps = (ZoneMapEntry *) get_shared_array(&prel->zone_maps,
+															sizeof(ZoneMapEntry), copy);
+		lrel->zone_maps_count = prel->zone_maps.length;
+	}
 }
 
 /*
- * Main hook. All the magic goes here
+ * Returns shared array or its copy in local cache memory
  */
-void
-pathman_set_rel_pathlist_hook(PlannerInfo *root, RelOptInfo *rel, Index rti, RangeTblEntry *rte)
+static void *
+get_shared_array(DsmArray *array, Size elem_size, bool copy)
 {
-	PartRelationInfo *prel = NULL;
-	RelOptInfo **new_rel_array;
-	RangeTblEntry **new_rte_array;
-	int len;
-	bool found;
+	Size		size = elem_size * array->length;
+	void	   *result;
 
-	/* This works only for SELECT queries */
-	if (root->parse->commandType != CMD_SELECT || !inheritance_disabled)
-		return;
+	if (!copy)
+		return dsm_array_get_pointer(array);
 
-	/* Lookup partitioning information for parent relation */
-	prel = get_pathman_relation_info(rte->relid, &found);
+	result = MemoryContextAlloc(local_cache_context, Max(size, 1));
+	if (size > 0)
+		memcpy(result, dsm_array_get_pointer(array), size);
 
-	if (prel != NULL && found)
-	{
-		ListCell   *lc;
-		int			i;
-		Oid		   *dsm_arr;
-		List	   *ranges,
-				   *wrappers;
+	return result;
+}
 
-		rte->inh = true;
-		dsm_arr = (Oid *) dsm_array_get_pointer(&prel->children);
-		ranges = list_make1_int(make_irange(0, prel->children_count - 1, false));
+/*
+ * Returns strategy of operator and comparison function for constants of
+ * given type applied to the key column. Both are resolved once per relation
+ */
+static LocalOperatorInfo *
+get_local_operator_info(LocalRelationInfo *lrel, int key, Oid opno, Oid consttype)
+{
+	LocalOperatorInfo *opinfo;
+	MemoryContext old_mcxt;
+	Oid			cmp_proc_oid;
+	int			strategy;
+	ListCell   *lc;
 
-		/* Make wrappers over restrictions and collect final rangeset */
-		wrappers = NIL;
-		foreach(lc, rel->baserestrictinfo)
-		{
-			WrapperNode *wrap;
+	foreach(lc, lrel->operators)
+	{
+		opinfo = (LocalOperatorInfo *) lfirst(lc);
+		if (opinfo->opno == opno && opinfo->consttype == consttype &&
+			opinfo->key == key)
+			return opinfo;
+	}
 
-			RestrictInfo *rinfo = (RestrictInfo*) lfirst(lc);
+	strategy = get_op_opfamily_strategy(opno, lrel->key_btree_opfs[key]);
+	cmp_proc_oid = get_opfamily_proc(lrel->key_btree_opfs[key],
+									 consttype,
+									 lrel->prel.key_atttypes[key],
+									 BTORDER_PROC);
 
-			wrap = walk_expr_tree(rinfo->clause, prel);
-			wrappers = lappend(wrappers, wrap);
-			ranges = irange_list_intersect(ranges, wrap->rangeset);
-		}
+	/* Types without btree opclass still may be HASH or LIST partitioned */
+	if (strategy == 0 && lrel->prel.parttype != PT_RANGE &&
+		OidIsValid(lrel->hash_opf) &&
+		get_op_opfamily_strategy(opno, lrel->hash_opf) == HTEqualStrategyNumber)
+		strategy = BTEqualStrategyNumber;
+
+	old_mcxt = MemoryContextSwitchTo(local_cache_context);
+	opinfo = (LocalOperatorInfo *) palloc0(sizeof(LocalOperatorInfo));
+	opinfo->opno = opno;
+	opinfo->consttype = consttype;
+	opinfo->key = key;
+	opinfo->strategy = strategy;
+	if (OidIsValid(cmp_proc_oid))
+		fmgr_info_cxt(cmp_proc_oid, &opinfo->cmp_func, local_cache_context);
+	lrel->operators = lappend(lrel->operators, opinfo);
+	MemoryContextSwitchTo(old_mcxt);
+
+	return opinfo;
+}
 
-		/*
-		 * Expand simple_rte_array and simple_rel_array
-		 */
+/*
+ * Returns number of HASH partition for the value. The hash function of the
+ * type's default hash opclass is used, except for integer keys which keep
+ * the modulus scheme partitions of previous versions were created with
+ */
+int
+get_hash_part_idx(Datum value, Oid value_type, int partitions_count)
+{
+	TypeCacheEntry *tce;
+	uint32		hash;
 
-		 if (ranges)
-		 {
-			len = irange_list_length(ranges);
+	switch (value_type)
+	{
+		case INT2OID:
+			return DatumGetInt16(value) % partitions_count;
+		case INT4OID:
+			return DatumGetInt32(value) % partitions_count;
+		case INT8OID:
+			return (int) (DatumGetInt64(value) % partitions_count);
+	}
 
-			/* Expand simple_rel_array and simple_rte_array */
-			new_rel_array = (RelOptInfo **)
-				palloc0((root->simple_rel_array_size + len) * sizeof(RelOptInfo *));
+	tce = lookup_type_cache(value_type, TYPECACHE_HASH_PROC_FINFO);
+	if (!OidIsValid(tce->hash_proc))
+		elog(ERROR, "Type %s has no default hash function",
+			 format_type_be(value_type));
 
-			/* simple_rte_array is an array equivalent of the rtable list */
-			new_rte_array = (RangeTblEntry **)
-				palloc0((root->simple_rel_array_size + len) * sizeof(RangeTblEntry *));
+	hash = DatumGetUInt32(FunctionCall1(&tce->hash_proc_finfo, value));
+	return hash % (uint32) partitions_count;
+}
 
-			/* Copy relations to the new arrays */
-	        for (i = 0; i < root->simple_rel_array_size; i++)
-	        {
-	                new_rel_array[i] = root->simple_rel_array[i];
-	                new_rte_array[i] = root->simple_rte_array[i];
-	        }
+/*
+ * Looks for LIST partition which contains the value. Returns its index in
+ * children array or -1
+ */
+int
+list_partition_lookup(const ListEntry *map, int map_size, const char *values,
+					  bool by_val, Oid atttype, Datum value)
+{
+	TypeCacheEntry *tce;
+	uint32		hash;
+	uint32		mask = map_size - 1;
+	uint32		i;
 
-			/* Free old arrays */
-			pfree(root->simple_rel_array);
-			pfree(root->simple_rte_array);
+	if (map_size == 0)
+		return -1;
 
-			root->simple_rel_array_size += len;
-			root->simple_rel_array = new_rel_array;
-			root->simple_rte_array = new_rte_array;
-		}
+	tce = lookup_type_cache(atttype, TYPECACHE_HASH_PROC_FINFO |
+									 TYPECACHE_EQ_OPR_FINFO);
+	hash = DatumGetUInt32(FunctionCall1(&tce->hash_proc_finfo, value));
 
-		/*
-		 * Iterate all indexes in rangeset and append corresponding child
-		 * relations.
-		 */
-		foreach(lc, ranges)
-		{
-			IndexRange	irange = lfirst_irange(lc);
-			Oid			childOid;
+	/* Map is never full so there is always a free entry to stop at */
+	for (i = hash & mask; map[i].child_idx >= 0; i = (i + 1) & mask)
+	{
+		Datum	stored;
 
-			for (i = irange_lower(irange); i <= irange_upper(irange); i++)
-			{
-				childOid = dsm_arr[i];
-				append_child_relation(root, rel, rti, rte, i, childOid, wrappers);
-			}
-		}
+		if (map[i].hash != hash)
+			continue;
 
-		/* Clear old path list */
-		list_free(rel->pathlist);
-		rel->pathlist = NIL;
-		set_append_rel_pathlist(root, rel, rti, rte);
+		stored = by_val ? (Datum) map[i].value :
+						  PointerGetDatum(values + map[i].value);
+		if (DatumGetBool(FunctionCall2(&tce->eq_opr_finfo, stored, value)))
+			return map[i].child_idx;
 	}
 
-	/* Invoke original hook if needed */
-	if (set_rel_pathlist_hook_original != NULL)
-	{
-		set_rel_pathlist_hook_original(root, rel, rti, rte);
-	}
+	return -1;
 }
 
-static void
-append_child_relation(PlannerInfo *root, RelOptInfo *rel, Index rti,
-	RangeTblEntry *rte, int index, Oid childOid, List *wrappers)
+/*
+ * Returns index of RANGE partition which has the value or -1
+ */
+static int
+range_partition_idx(const LocalRelationInfo *lrel, Datum value)
 {
-	RangeTblEntry *childrte;
-	RelOptInfo    *childrel;
-	Index		childRTindex;
-	AppendRelInfo *appinfo;
-	Node *node;
-	ListCell *lc, *lc2;
-	Relation	newrelation;
+	TypeCacheEntry *tce;
+	int			startidx = 0,
+				endidx = lrel->ranges_count - 1;
 
-	newrelation = heap_open(childOid, NoLock);
+	tce = lookup_type_cache(lrel->prel.atttype, TYPECACHE_CMP_PROC_FINFO);
+	while (startidx <= endidx)
+	{
+		int			i = startidx + (endidx - startidx) / 2;
+		RangeEntry *re = &lrel->ranges[i];
 
-	/*
-	 * Create RangeTblEntry for child relation.
+		if (DatumGetInt32(FunctionCall2(&tce->cmp_proc_finfo, value,
+										PATHMAN_GET_DATUM(re->min, lrel->by_val))) < 0)
+			endidx = i - 1;
+		else if (DatumGetInt32(FunctionCall2(&tce->cmp_proc_finfo, value,
+											 PATHMAN_GET_DATUM(re->max, lrel->by_val))) >= 0)
+			startidx = i + 1;
+		else
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * Takes value of the parent's column from the tuple. Columns are matched by
+ * name since tuple may come from a relation with other column numbers.
+ * Returns false if there is no such column or value is NULL
+ */
+static bool
+get_tuple_key_value(Oid relid, AttrNumber attnum, HeapTuple tuple,
+					TupleDesc tupdesc, Datum *value)
+{
+	char	   *attname = get_attname(relid, attnum);
+	bool		isnull;
+	int			i;
+
+	for (i = 0; i < tupdesc->natts; i++)
+		if (!tupdesc->attrs[i]->attisdropped &&
+			namestrcmp(&tupdesc->attrs[i]->attname, attname) == 0)
+			break;
+	if (i == tupdesc->natts)
+		return false;
+
+	*value = heap_getattr(tuple, i + 1, tupdesc, &isnull);
+	return !isnull;
+}
+
+/*
+ * Prepares key expression for execution. The column it depends on is
+ * passed in the scan tuple, so that the expression is initialized only once
+ * per relation rather than for every routed row
+ */
+static void
+prepare_key_expression(LocalRelationInfo *lrel)
+{
+	MemoryContext old_mcxt = MemoryContextSwitchTo(local_cache_context);
+	Relation	rel = heap_open(lrel->relid, NoLock);
+	Expr	   *expr = expression_planner((Expr *) copyObject(lrel->key_expr));
+
+	lrel->key_slot = MakeSingleTupleTableSlot(CreateTupleDescCopy(RelationGetDescr(rel)));
+	heap_close(rel, NoLock);
+
+	lrel->key_econtext = CreateStandaloneExprContext();
+	lrel->key_exprstate = ExecInitExpr(expr, NULL);
+	get_typlenbyval(exprType(lrel->key_expr), &lrel->key_typlen, &lrel->key_typbyval);
+	MemoryContextSwitchTo(old_mcxt);
+}
+
+/*
+ * Computes key expression for the value of the column it depends on.
+ * Returns constant holding the key, which is NULL if expression yields NULL
+ */
+static Const *
+eval_key_expression(LocalRelationInfo *lrel, Datum value)
+{
+	TupleTableSlot *slot;
+	ExprContext *econtext;
+	MemoryContext old_mcxt;
+	Datum		result;
+	bool		isnull;
+
+	if (lrel->key_exprstate == NULL)
+		prepare_key_expression(lrel);
+
+	slot = lrel->key_slot;
+	ExecClearTuple(slot);
+	memset(slot->tts_isnull, true, slot->tts_tupleDescriptor->natts * sizeof(bool));
+	slot->tts_values[lrel->prel.attnum - 1] = value;
+	slot->tts_isnull[lrel->prel.attnum - 1] = false;
+	ExecStoreVirtualTuple(slot);
+
+	econtext = lrel->key_econtext;
+	econtext->ecxt_scantuple = slot;
+	old_mcxt = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+	result = ExecEvalExpr(lrel->key_exprstate, econtext, &isnull, NULL);
+	MemoryContextSwitchTo(old_mcxt);
+
+	/* Result may be allocated in per-tuple memory which is reset right away */
+	if (!isnull)
+		result = datumCopy(result, lrel->key_typbyval, lrel->key_typlen);
+	ResetExprContext(econtext);
+
+	return makeConst(exprType(lrel->key_expr), exprTypmod(lrel->key_expr),
+					 exprCollation(lrel->key_expr), lrel->key_typlen,
+					 result, isnull, lrel->key_typbyval);
+}
+
+/*
+ * Computes partitioning key of the tuple for the relation partitioned by key
+ * expression or takes value of the key column otherwise. Returns false if
+ * the key is NULL
+ */
+bool
+get_partitioning_key(Oid relid, HeapTuple tuple, TupleDesc tupdesc, Datum *key)
+{
+	LocalRelationInfo *lrel;
+	Const	   *c;
+
+	if (planner_depth == 0)
+		check_local_cache();
+
+	lrel = get_local_relation_info(relid);
+	if (lrel == NULL)
+		elog(ERROR, "Relation %s isn't partitioned by pg_pathman",
+			 get_rel_name(relid));
+
+	if (!get_tuple_key_value(relid, lrel->prel.attnum, tuple, tupdesc, key))
+		return false;
+	if (lrel->key_expr == NULL)
+		return true;
+
+	c = eval_key_expression(lrel, *key);
+	*key = c->constvalue;
+	return !c->constisnull;
+}
+
+/*
+ * Returns partitioning key of the relation as SQL text which could be used in
+ * queries to the relation
+ */
+char *
+deparse_partitioning_key(Oid relid)
+{
+	LocalRelationInfo *lrel;
+
+	if (planner_depth == 0)
+		check_local_cache();
+
+	lrel = get_local_relation_info(relid);
+	if (lrel == NULL)
+		elog(ERROR, "Relation %s isn't partitioned by pg_pathman",
+			 get_rel_name(relid));
+
+	if (lrel->key_expr != NULL)
+		return deparse_expression(lrel->key_expr,
+								  deparse_context_for(get_rel_name(relid), relid),
+								  false, false);
+
+	return (char *) quote_identifier(get_attname(relid, lrel->prel.attnum));
+}
+
+/*
+ * Descends from the partition to the leaf partition which the tuple belongs
+ * to if the partition is partitioned itself. Stops at the level which has no
+ * partition for the tuple, so that its insert trigger would handle it.
+ *
+ * This is called by executor, so partitions are looked up in the shared
+ * cache under load_config_lock rather than in backend-local copies, which
+ * may only be rebuilt before planning
+ */
+Oid
+find_leaf_partition(Oid relid, HeapTuple tuple, TupleDesc tupdesc)
+{
+	for (;;)
+	{
+		PartRelationInfo *prel;
+		RangeRelation *rangerel;
+		ListRelation *listrel;
+		PartRelationInfo info;
+		LocalRelationInfo lrel;
+		Datum		values[PATHMAN_MAX_KEYS];
+		Oid			child_oid = InvalidOid;
+		int			idx = -1;
+		int			i;
+
+		/* Key is computed without the lock: key expression may fail */
+		prel = lock_pathman_relation_info(relid, NULL, NULL);
+		if (prel == NULL)
+			break;
+		info = *prel;
+		LWLockRelease(pmstate->load_config_lock);
+
+		for (i = 0; i < info.keys_count; i++)
+			if (!get_tuple_key_value(relid, info.key_attnums[i], tuple,
+									 tupdesc, &values[i]))
+				break;
+		if (i < info.keys_count)
+			break;
+		if (info.has_key_expr &&
+			!get_partitioning_key(relid, tuple, tupdesc, &values[0]))
+			break;
+
+		prel = lock_pathman_relation_info(relid, &rangerel, &listrel);
+		if (prel == NULL)
+			break;
+
+		memset(&lrel, 0, sizeof(lrel));
+		set_shared_partitions(&lrel, prel, rangerel, listrel, false);
+
+		/* Key type could have changed while the lock was released */
+		if (lrel.prel.children_count > 0 && lrel.prel.atttype == info.atttype &&
+			lrel.prel.keys_count == info.keys_count)
+		{
+			switch (lrel.prel.parttype)
+			{
+				case PT_HASH:
+					idx = get_hash_part_idx(values[0], lrel.prel.atttype,
+											lrel.prel.children_count);
+					break;
+				case PT_RANGE:
+					if (lrel.has_ranges && lrel.prel.keys_count > 1)
+						idx = composite_partition_idx(&lrel, values);
+					else if (lrel.has_ranges)
+						idx = range_partition_idx(&lrel, values[0]);
+					break;
+				case PT_LIST:
+					if (lrel.has_list)
+						idx = list_partition_lookup(lrel.list_map, lrel.list_map_size,
+													lrel.list_values, lrel.by_val,
+													lrel.prel.atttype, values[0]);
+					break;
+			}
+			if (idx >= 0)
+				child_oid = lrel.children[idx];
+		}
+		LWLockRelease(pmstate->load_config_lock);
+
+		if (!OidIsValid(child_oid))
+			break;
+		relid = child_oid;
+	}
+
+	return relid;
+}
+
+/*
+ * Collects partitions which may contain rows with any of the key values.
+ * Default partition isn't included. Returns false if partitions of the
+ * relation can't be found this way
+ */
+bool
+get_key_values_partitions(Oid relid, Oid value_type, Datum *values,
+						  bool *nulls, int count, List **partitions)
+{
+	LocalRelationInfo *lrel;
+	List	   *ranges = NIL;
+	ListCell   *lc;
+	int			i;
+
+	/* Entries are only kept intact while planning */
+	if (planner_depth == 0)
+		check_local_cache();
+
+	lrel = get_local_relation_info(relid);
+	if (lrel == NULL || lrel->prel.atttype != value_type ||
+		!key_values_prunable(lrel))
+		return false;
+
+	for (i = 0; i < count; i++)
+	{
+		/* NULL never matches */
+		if (nulls[i])
+			continue;
+
+		ranges = irange_list_union(ranges, make_key_value_rangeset(lrel, values[i]));
+	}
+
+	*partitions = NIL;
+	foreach(lc, ranges)
+	{
+		IndexRange	irange = lfirst_irange(lc);
+
+		for (i = irange_lower(irange); i <= irange_upper(irange); i++)
+			*partitions = lappend_oid(*partitions, lrel->children[i]);
+	}
+
+	return true;
+}
+
+FmgrInfo *
+get_cmp_func(Oid type1, Oid type2)
+{
+	FmgrInfo   *cmp_func;
+	Oid			cmp_proc_oid;
+	TypeCacheEntry	*tce;
+
+	cmp_func = palloc(sizeof(FmgrInfo));
+	tce = lookup_type_cache(type1,
+							TYPECACHE_EQ_OPR | TYPECACHE_LT_OPR | TYPECACHE_GT_OPR |
+							TYPECACHE_CMP_PROC | TYPECACHE_CMP_PROC_FINFO);
+	cmp_proc_oid = get_opfamily_proc(tce->btree_opf,
+									 type1,
+									 type2,
+									 BTORDER_PROC);
+	fmgr_info(cmp_proc_oid, cmp_func);
+	return cmp_func;
+}
+
+/*
+ * Post parse analysis hook. It makes sure the config is loaded before executing
+ * any statement, including utility commands
+ */
+void
+pathman_post_parse_analysis_hook(ParseState *pstate, Query *query)
+{
+	if (initialization_needed)
+		load_config();
+
+	/* Catch up with DDL done bypassing pg_pathman functions and rollbacks */
+	if (IsTransactionState())
+		process_invalidated_relations();
+
+	if (post_parse_analyze_hook_original)
+		post_parse_analyze_hook_original(pstate, query);
+}
+
+/*
+ * Planner hook. It disables inheritance for tables that have been partitioned
+ * by pathman to prevent standart PostgreSQL partitioning mechanism from
+ * handling that tables.
+ */
+PlannedStmt *
+pathman_planner_hook(Query *parse, int cursorOptions, ParamListInfo boundParams)
+{
+	PlannedStmt	  *result;
+	ListCell	  *lc;
+	List		  *saved_capacities = rel_arrays_capacities;
+
+	/* Local cache entries must stay intact until planning is finished */
+	if (planner_depth == 0)
+		check_local_cache();
+
+	planner_depth++;
+	rel_arrays_capacities = NIL;
+	PG_TRY();
+	{
+		inheritance_disabled = false;
+		switch(parse->commandType)
+		{
+			case CMD_SELECT:
+				disable_inheritance(parse);
+				break;
+			case CMD_UPDATE:
+			case CMD_DELETE:
+				handle_modification_query(parse);
+				break;
+			default:
+				break;
+		}
+
+		/* If query contains CTE (WITH statement) then handle subqueries too */
+		foreach(lc, parse->cteList)
+		{
+			CommonTableExpr *cte = (CommonTableExpr*) lfirst(lc);
+
+			if (IsA(cte->ctequery, Query))
+				disable_inheritance((Query *)cte->ctequery);
+		}
+
+		/* Invoke original hook */
+		if (planner_hook_original)
+			result = planner_hook_original(parse, cursorOptions, boundParams);
+		else
+			result = standard_planner(parse, cursorOptions, boundParams);
+	}
+	PG_CATCH();
+	{
+		planner_depth--;
+		rel_arrays_capacities = saved_capacities;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+	planner_depth--;
+	rel_arrays_capacities = saved_capacities;
+
+	return result;
+}
+
+/*
+ * Disables inheritance for partitioned by pathman relations. It must be done to
+ * prevent PostgresSQL from full search.
+ */
+static void
+disable_inheritance(Query *parse)
+{
+	RangeTblEntry *rte;
+	ListCell	  *lc;
+
+	foreach(lc, parse->rtable)
+	{
+		rte = (RangeTblEntry*) lfirst(lc);
+		switch(rte->rtekind)
+		{
+			case RTE_RELATION:
+				if (rte->inh)
+				{
+					/* Look up this relation in pathman relations */
+					if (get_local_relation_info(rte->relid) != NULL)
+					{
+						rte->inh = false;
+						/*
+						 * Sometimes user uses the ONLY statement and in this case
+						 * rte->inh is also false. We should differ the case
+						 * when user uses ONLY statement from case when we
+						 * make rte->inh false intentionally.
+						 */
+						inheritance_disabled = true;
+					}
+				}
+				break;
+			case RTE_SUBQUERY:
+				/* Recursively disable inheritance for subqueries */
+				disable_inheritance(rte->subquery);
+				break;
+			default:
+				break;
+		}
+	}
+
+	if (inheritance_disabled)
+		add_key_values_sublinks(parse);
+}
+
+/*
+ * Planner turns IN (SELECT ...) conditions into semi-joins, so partitions
+ * can't be pruned by their results (see add_key_values_filters()). For
+ * uncorrelated subqueries on the partitioning key the same condition in the
+ * form of key = ANY(ARRAY(SELECT ...)) is added, which is computed once
+ * before partitions are scanned
+ */
+static void
+add_key_values_sublinks(Query *parse)
+{
+	Node	   *quals = parse->jointree->quals;
+	List	   *args;
+	List	   *added = NIL;
+	ListCell   *lc;
+
+	if (quals == NULL)
+		return;
+
+	if (and_clause(quals))
+		args = ((BoolExpr *) quals)->args;
+	else
+		args = list_make1(quals);
+
+	foreach(lc, args)
+	{
+		Node	   *sublink = make_key_values_sublink(parse, (Node *) lfirst(lc));
+
+		if (sublink != NULL)
+			added = lappend(added, sublink);
+	}
+
+	if (added != NIL)
+		parse->jointree->quals = (Node *) make_ands_explicit(lcons(quals, added));
+}
+
+/*
+ * Returns key = ANY(ARRAY(SELECT ...)) condition for the key IN (SELECT ...)
+ * one or NULL if partitions couldn't be pruned by it
+ */
+static Node *
+make_key_values_sublink(Query *parse, Node *qual)
+{
+	SubLink	   *sublink = (SubLink *) qual;
+	SubLink	   *arraylink;
+	OpExpr	   *opexpr;
+	Param	   *param;
+	Node	   *key;
+	Query	   *subselect;
+	Relids		varnos;
+	RangeTblEntry *rte;
+	LocalRelationInfo *lrel;
+	ScalarArrayOpExpr *result;
+
+	if (!IsA(sublink, SubLink) || sublink->subLinkType != ANY_SUBLINK ||
+		!IsA(sublink->testexpr, OpExpr))
+		return NULL;
+
+	opexpr = (OpExpr *) sublink->testexpr;
+	if (list_length(opexpr->args) != 2 || !IsA(lsecond(opexpr->args), Param))
+		return NULL;
+	key = (Node *) linitial(opexpr->args);
+	param = (Param *) lsecond(opexpr->args);
+	if (param->paramkind != PARAM_SUBLINK)
+		return NULL;
+
+	/* Key belongs to the single partitioned relation of this query level */
+	varnos = pull_varnos(key);
+	if (bms_num_members(varnos) != 1 || contain_vars_of_level(key, 1))
+		return NULL;
+	rte = rt_fetch(bms_singleton_member(varnos), parse->rtable);
+	if (rte->rtekind != RTE_RELATION)
+		return NULL;
+	lrel = get_local_relation_info(rte->relid);
+	if (lrel == NULL || !key_values_prunable(lrel) || lrel->has_subpartitions ||
+		!is_partitioning_key(lrel, key) ||
+		param->paramtype != lrel->prel.atttype ||
+		!OidIsValid(get_array_type(param->paramtype)) ||
+		get_local_operator_info(lrel, 0, opexpr->opno,
+								lrel->prel.atttype)->strategy != BTEqualStrategyNumber)
+		return NULL;
+
+	/* Subquery is executed once, so it must not depend on outer rows */
+	subselect = (Query *) sublink->subselect;
+	if (contain_vars_of_level((Node *) subselect, 1) ||
+		contain_volatile_functions((Node *) subselect))
+		return NULL;
+
+	arraylink = makeNode(SubLink);
+	arraylink->subLinkType = ARRAY_SUBLINK;
+	arraylink->subLinkId = 0;
+	arraylink->testexpr = NULL;
+	arraylink->operName = NIL;
+	arraylink->subselect = (Node *) copyObject(subselect);
+	arraylink->location = -1;
+
+	result = makeNode(ScalarArrayOpExpr);
+	result->opno = opexpr->opno;
+	result->opfuncid = opexpr->opfuncid;
+	result->useOr = true;
+	result->inputcollid = opexpr->inputcollid;
+	result->args = list_make2(copyObject(key), arraylink);
+	result->location = -1;
+
+	return (Node *) result;
+}
+
+/*
+ * Checks if query is affects only one partition. If true then substitute
+ */
+static void
+handle_modification_query(Query *parse)
+{
+	LocalRelationInfo *lrel;
+	List	   *ranges;
+	RangeTblEntry *rte;
+	WrapperNode *wrap;
+	Expr	   *quals;
+
+	Assert(parse->commandType == CMD_UPDATE ||
+		   parse->commandType == CMD_DELETE);
+	Assert(parse->resultRelation > 0);
+
+	rte = rt_fetch(parse->resultRelation, parse->rtable);
+	lrel = get_local_relation_info(rte->relid);
+
+	if (lrel == NULL)
+		return;
+
+	quals = (Expr *) eval_const_expressions(NULL, parse->jointree->quals);
+
+	/*
+	 * Partitions partitioned themselves are handled the same way, so that
+	 * query goes straight to the leaf partition if there is the only one
+	 */
+	while (lrel != NULL)
+	{
+		IndexRange	irange;
+
+		/* Parse syntax tree and extract partition ranges */
+		ranges = list_make1_int(make_irange(0, lrel->prel.children_count - 1, false));
+		wrap = walk_expr_tree(quals, lrel);
+		ranges = irange_list_intersect(ranges, wrap->rangeset);
+
+		/*
+		 * If only one partition is affected then substitute parent table with
+		 * partition. It's not possible if there is default partition as it
+		 * may contain rows as well
+		 */
+		if (OidIsValid(lrel->default_oid) || irange_list_length(ranges) != 1)
+			return;
+
+		irange = (IndexRange) linitial_oid(ranges);
+		if (irange_lower(irange) != irange_upper(irange))
+			return;
+
+		rte->relid = lrel->children[irange_lower(irange)];
+		lrel = get_local_relation_info(rte->relid);
+
+		/* Standard inheritance expands the partition unless it's a leaf */
+		rte->inh = (lrel != NULL);
+	}
+}
+
+/*
+ * Shared memory startup hook
+ */
+static void
+pathman_shmem_startup(void)
+{
+	/* Allocate shared memory objects */
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	init_dsm_config();
+	init_shmem_config();
+	LWLockRelease(AddinShmemInitLock);
+
+	/* Invoke original hook if needed */
+	if (shmem_startup_hook_original != NULL)
+		shmem_startup_hook_original();
+}
+
+/*
+ * Main hook. All the magic goes here
+ */
+void
+pathman_set_rel_pathlist_hook(PlannerInfo *root, RelOptInfo *rel, Index rti, RangeTblEntry *rte)
+{
+	LocalRelationInfo *lrel;
+	int len;
+
+	/* This works only for SELECT queries */
+	if (root->parse->commandType != CMD_SELECT || !inheritance_disabled)
+		return;
+
+	/* Lookup partitioning information for parent relation */
+	lrel = get_local_relation_info(rte->relid);
+
+	if (lrel != NULL)
+	{
+		ListCell   *lc;
+		List	   *ranges,
+				   *wrappers,
+				   *clauses = NIL,
+				   *child_rtes;
+		Index		childRTindex;
+
+		rte->inh = true;
+		ranges = list_make1_int(make_irange(0, lrel->prel.children_count - 1, false));
+
+		/* Make wrappers over restrictions and collect final rangeset */
+		wrappers = NIL;
+		foreach(lc, rel->baserestrictinfo)
+		{
+			WrapperNode *wrap;
+
+			RestrictInfo *rinfo = (RestrictInfo*) lfirst(lc);
+
+			wrap = walk_expr_tree(rinfo->clause, lrel);
+			wrappers = lappend(wrappers, wrap);
+			clauses = lappend(clauses, rinfo->clause);
+			ranges = irange_list_intersect(ranges, wrap->rangeset);
+		}
+
+		/* Conditions on several columns of composite key are combined */
+		if (lrel->prel.keys_count > 1)
+			ranges = irange_list_intersect(ranges,
+										   make_composite_rangeset(lrel, clauses));
+
+		/*
+		 * Make room for children in simple_rel_array and simple_rte_array.
+		 * Sub-partitions may be pruned, so unused entries are given back
+		 * after children are appended
+		 */
+		len = count_rangeset_partitions(lrel, ranges);
+		if (len > 0)
+			reserve_simple_rel_arrays(root, len);
+
+		childRTindex = list_length(root->parse->rtable) + 1;
+		child_rtes = append_partitions(root, rel, rti, rte, lrel, ranges,
+									   wrappers, rel->baserestrictinfo,
+									   &childRTindex);
+		if (len > 0)
+			root->simple_rel_array_size = childRTindex;
+
+		/* Add children to the range table at once */
+		root->parse->rtable = list_concat(root->parse->rtable, child_rtes);
+
+		add_key_values_filters(root, rel, rti, lrel);
+		add_global_index_filters(root, rel, rti, lrel);
+
+		/* Clear old path list */
+		list_free(rel->pathlist);
+		rel->pathlist = NIL;
+		set_append_rel_pathlist(root, rel, rti, rte);
+	}
+
+	/* Invoke original hook if needed */
+	if (set_rel_pathlist_hook_original != NULL)
+	{
+		set_rel_pathlist_hook_original(root, rel, rti, rte);
+	}
+}
+
+/*
+ * Adds one-time filters to scans of partitions for IN conditions on the key
+ * with values known only at execution time, such as parameters of prepared
+ * statement or ARRAY(SELECT ...) subquery. Partitions of the values are found
+ * once per query and the rest partitions aren't scanned at all. IN (SELECT ...)
+ * is turned into a semi-join before this hook is called, so it's handled by
+ * add_key_values_sublinks() in advance
+ */
+static void
+add_key_values_filters(PlannerInfo *root, RelOptInfo *rel, Index rti,
+					   LocalRelationInfo *lrel)
+{
+	List	   *filters = NIL;
+	ListCell   *lc;
+	Oid			match_func = InvalidOid;
+
+	/* Values are matched with partitions of the relation itself */
+	if (!key_values_prunable(lrel) || lrel->has_subpartitions)
+		return;
+
+	foreach(lc, rel->baserestrictinfo)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+		ScalarArrayOpExpr *expr = (ScalarArrayOpExpr *) rinfo->clause;
+		Node	   *arraynode;
+
+		if (!IsA(expr, ScalarArrayOpExpr) || !expr->useOr ||
+			!is_partitioning_key(lrel, (Node *) linitial(expr->args)))
+			continue;
+
+		/* Constant arrays are already handled by handle_arrexpr() */
+		arraynode = (Node *) lsecond(expr->args);
+		if (IsA(arraynode, Const) || contain_var_clause(arraynode) ||
+			contain_volatile_functions(arraynode) ||
+			get_element_type(exprType(arraynode)) != lrel->prel.atttype ||
+			get_local_operator_info(lrel, 0, expr->opno,
+									lrel->prel.atttype)->strategy != BTEqualStrategyNumber)
+			continue;
+
+		if (!OidIsValid(match_func))
+		{
+			match_func = get_key_values_match_func();
+			if (!OidIsValid(match_func))
+				return;
+		}
+
+		/* Partition argument is set by add_partitions_filters() */
+		filters = lappend(filters,
+			makeFuncExpr(match_func, BOOLOID,
+						 list_make3(make_oid_const(lrel->relid),
+									make_oid_const(InvalidOid),
+									copyObject(arraynode)),
+						 InvalidOid, InvalidOid, COERCE_EXPLICIT_CALL));
+	}
+
+	/* Default partition may have rows of any value */
+	add_partitions_filters(root, rti, filters, 1, lrel->default_oid);
+}
+
+/*
+ * Adds one-time filters to scans of partitions for equality conditions on the
+ * columns with global indexes. Index is searched at execution time, so only
+ * the partition holding the value is scanned and cached plans stay valid when
+ * rows are added or moved between partitions
+ */
+static void
+add_global_index_filters(PlannerInfo *root, RelOptInfo *rel, Index rti,
+						 LocalRelationInfo *lrel)
+{
+	List	   *filters = NIL;
+	ListCell   *lc;
+	Oid			match_func = InvalidOid;
+
+	/* Index maps values to partitions of the relation itself */
+	if (lrel->prel.gindex_count == 0 || lrel->has_subpartitions)
+		return;
+
+	foreach(lc, rel->baserestrictinfo)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+		OpExpr	   *expr = (OpExpr *) rinfo->clause;
+		Node	   *firstarg;
+		Node	   *secondarg;
+		Var		   *var;
+		Const	   *c;
+		TypeCacheEntry *tce;
+		int			i;
+
+		if (!IsA(expr, OpExpr) || list_length(expr->args) != 2)
+			continue;
+
+		firstarg = (Node *) linitial(expr->args);
+		secondarg = (Node *) lsecond(expr->args);
+		if (IsA(firstarg, Var) && IsA(secondarg, Const))
+		{
+			var = (Var *) firstarg;
+			c = (Const *) secondarg;
+		}
+		else if (IsA(secondarg, Var) && IsA(firstarg, Const))
+		{
+			var = (Var *) secondarg;
+			c = (Const *) firstarg;
+		}
+		else
+			continue;
+
+		for (i = 0; i < lrel->prel.gindex_count; i++)
+			if (lrel->prel.gindex_attnums[i] == var->varattno)
+				break;
+		if (i == lrel->prel.gindex_count || c->constisnull)
+			continue;
+
+		tce = lookup_type_cache(var->vartype, TYPECACHE_BTREE_OPFAMILY);
+		if (!OidIsValid(tce->btree_opf) ||
+			get_op_opfamily_strategy(expr->opno, tce->btree_opf) != BTEqualStrategyNumber)
+			continue;
+
+		if (!OidIsValid(match_func))
+		{
+			match_func = get_global_index_match_func();
+			if (!OidIsValid(match_func))
+				return;
+		}
+
+		/* Partition argument is set by add_partitions_filters() */
+		filters = lappend(filters,
+			makeFuncExpr(match_func, BOOLOID,
+						 list_make3(make_oid_const(lrel->prel.gindex_relids[i]),
+									copyObject(c),
+									make_oid_const(InvalidOid)),
+						 InvalidOid, InvalidOid, COERCE_EXPLICIT_CALL));
+	}
+
+	add_partitions_filters(root, rti, filters, 2, InvalidOid);
+}
+
+/*
+ * Makes regclass constant used as argument of partitions filters
+ */
+static Const *
+make_oid_const(Oid oid)
+{
+	return makeConst(REGCLASSOID, -1, InvalidOid, sizeof(Oid),
+					 ObjectIdGetDatum(oid), false, true);
+}
+
+/*
+ * Adds filters as one-time filters to scans of partitions of rti except
+ * skip_oid. Argument partition_argno of the filters is a placeholder which
+ * is set to oid of every partition
+ */
+static void
+add_partitions_filters(PlannerInfo *root, Index rti, List *filters,
+					   int partition_argno, Oid skip_oid)
+{
+	ListCell   *lc;
+
+	if (filters == NIL)
+		return;
+
+	foreach(lc, root->append_rel_list)
+	{
+		AppendRelInfo *appinfo = (AppendRelInfo *) lfirst(lc);
+		Oid			child_oid;
+		RelOptInfo *childrel;
+		ListCell   *lc2;
+
+		if (appinfo->parent_relid != rti)
+			continue;
+
+		child_oid = root->simple_rte_array[appinfo->child_relid]->relid;
+		if (child_oid == skip_oid)
+			continue;
+
+		childrel = root->simple_rel_array[appinfo->child_relid];
+		foreach(lc2, filters)
+		{
+			FuncExpr   *filter = (FuncExpr *) copyObject(lfirst(lc2));
+
+			((Const *) list_nth(filter->args, partition_argno))->constvalue =
+				ObjectIdGetDatum(child_oid);
+			childrel->baserestrictinfo =
+				lappend(childrel->baserestrictinfo,
+						make_restrictinfo((Expr *) filter, true, false, true,
+										  bms_make_singleton(appinfo->child_relid),
+										  NULL, NULL));
+		}
+	}
+
+	/* Makes planner put gating Result nodes over the scans */
+	root->hasPseudoConstantQuals = true;
+}
+
+/*
+ * Makes room for len more entries in simple_rel_array and simple_rte_array.
+ * On the first call for a planner root space is reserved for partitions of
+ * all partitioned relations of the query, so that arrays are reallocated
+ * once rather than for every partitioned relation
+ */
+static void
+reserve_simple_rel_arrays(PlannerInfo *root, int len)
+{
+	RelArraysCapacity *cap = NULL;
+	ListCell   *lc;
+	int			old_size = root->simple_rel_array_size;
+	int			new_size = old_size + len;
+	int			new_capacity;
+
+	foreach(lc, rel_arrays_capacities)
+	{
+		RelArraysCapacity *c = (RelArraysCapacity *) lfirst(lc);
+
+		if (c->root == root && c->rel_array == root->simple_rel_array)
+		{
+			cap = c;
+			break;
+		}
+	}
+
+	if (cap == NULL)
+	{
+		cap = (RelArraysCapacity *) palloc(sizeof(RelArraysCapacity));
+		cap->root = root;
+		cap->capacity = old_size;
+		rel_arrays_capacities = lappend(rel_arrays_capacities, cap);
+
+		new_capacity = old_size + count_query_partitions(root);
+	}
+	else
+		new_capacity = cap->capacity * 2;
+
+	if (new_size > cap->capacity)
+	{
+		new_capacity = Max(new_capacity, new_size);
+
+		root->simple_rel_array = (RelOptInfo **)
+			repalloc(root->simple_rel_array, new_capacity * sizeof(RelOptInfo *));
+		root->simple_rte_array = (RangeTblEntry **)
+			repalloc(root->simple_rte_array, new_capacity * sizeof(RangeTblEntry *));
+		MemSet(root->simple_rel_array + old_size, 0,
+			   (new_capacity - old_size) * sizeof(RelOptInfo *));
+		MemSet(root->simple_rte_array + old_size, 0,
+			   (new_capacity - old_size) * sizeof(RangeTblEntry *));
+
+		cap->capacity = new_capacity;
+	}
+
+	cap->rel_array = root->simple_rel_array;
+	root->simple_rel_array_size = new_size;
+}
+
+/*
+ * Returns the maximum number of partitions which can be added by pg_pathman
+ * to the planner root
+ */
+static int
+count_query_partitions(PlannerInfo *root)
+{
+	LocalRelationInfo *lrel;
+	RangeTblEntry *rte;
+	int			count = 0;
+	int			i;
+
+	for (i = 1; i < root->simple_rel_array_size; i++)
+	{
+		rte = root->simple_rte_array[i];
+		if (root->simple_rel_array[i] == NULL || rte == NULL ||
+			rte->rtekind != RTE_RELATION)
+			continue;
+
+		lrel = get_local_relation_info(rte->relid);
+		if (lrel != NULL)
+			count += lrel->prel.children_count +
+				(OidIsValid(lrel->default_oid) ? 1 : 0);
+	}
+
+	return count;
+}
+
+/*
+ * Returns the maximum number of relations appended for the rangeset.
+ * Partitions partitioned by pg_pathman themselves count as all of their
+ * partitions plus their own heap
+ */
+static int
+count_rangeset_partitions(LocalRelationInfo *lrel, List *ranges)
+{
+	LocalRelationInfo *sublrel;
+	ListCell   *lc;
+	int			count = OidIsValid(lrel->default_oid) ? 1 : 0;
+	int			i;
+
+	if (!lrel->has_subpartitions)
+		return count + irange_list_length(ranges);
+
+	foreach(lc, ranges)
+	{
+		IndexRange	irange = lfirst_irange(lc);
+
+		for (i = irange_lower(irange); i <= irange_upper(irange); i++)
+		{
+			sublrel = get_local_relation_info(lrel->children[i]);
+			if (sublrel != NULL)
+				count += 1 + count_rangeset_partitions(sublrel,
+					list_make1_irange(make_irange(0, sublrel->prel.children_count - 1, false)));
+			else
+				count++;
+		}
+	}
+
+	return count;
+}
+
+/*
+ * Iterates all indexes in rangeset and appends corresponding child relations.
+ * Partitions which are partitioned by pg_pathman themselves are appended
+ * together with their own partitions, so the whole tree becomes a single
+ * append relation (the same way standard inheritance expands it). wrappers
+ * are built over parent's restrictions rinfos. Returns RTEs of children
+ */
+static List *
+append_partitions(PlannerInfo *root, RelOptInfo *rel, Index rti,
+	RangeTblEntry *rte, LocalRelationInfo *lrel, List *ranges, List *wrappers,
+	List *rinfos, Index *childRTindex)
+{
+	List	   *child_rtes = NIL;
+	ListCell   *lc;
+	int			i;
+
+	foreach(lc, wrappers)
+		wrapper_reset_cursor((WrapperNode *) lfirst(lc));
+	foreach(lc, ranges)
+	{
+		IndexRange	irange = lfirst_irange(lc);
+		Oid			childOid;
+		LocalRelationInfo *sublrel = NULL;
+
+		for (i = irange_lower(irange); i <= irange_upper(irange); i++)
+		{
+			childOid = lrel->children[i];
+			if (lrel->has_subpartitions)
+				sublrel = get_local_relation_info(childOid);
+
+			if (sublrel != NULL)
+			{
+				/*
+				 * Partition's own heap may have rows inserted before it was
+				 * partitioned, so it's scanned like standard inheritance does
+				 */
+				child_rtes = lappend(child_rtes,
+									 append_child_relation(root, rel, rti, rte, i,
+														   childOid, wrappers, rinfos,
+														   (*childRTindex)++));
+				child_rtes = list_concat(child_rtes,
+										 append_subpartitions(root, rel, rti, rte,
+															  sublrel, i, wrappers,
+															  rinfos, childRTindex));
+			}
+			else
+				child_rtes = lappend(child_rtes,
+									 append_child_relation(root, rel, rti, rte, i,
+														   childOid, wrappers, rinfos,
+														   (*childRTindex)++));
+		}
+	}
+
+	/*
+	 * Default partition must always be scanned. It gets all the
+	 * restrictions as it is always lossy
+	 */
+	if (OidIsValid(lrel->default_oid))
+		child_rtes = lappend(child_rtes,
+							 append_child_relation(root, rel, rti, rte, -1,
+												   lrel->default_oid, wrappers,
+												   rinfos, (*childRTindex)++));
+
+	return child_rtes;
+}
+
+/*
+ * Appends partitions of the partition with given index which is partitioned
+ * itself. Parent's restrictions evaluated for the partition are used to prune
+ * its partitions
+ */
+static List *
+append_subpartitions(PlannerInfo *root, RelOptInfo *rel, Index rti,
+	RangeTblEntry *rte, LocalRelationInfo *sublrel, int index, List *wrappers,
+	List *rinfos, Index *childRTindex)
+{
+	List	   *ranges,
+			   *subwrappers = NIL,
+			   *subrinfos = NIL,
+			   *subclauses = NIL;
+	ListCell   *lc,
+			   *lc2;
+
+	ranges = list_make1_irange(make_irange(0, sublrel->prel.children_count - 1, false));
+	forboth(lc, wrappers, lc2, rinfos)
+	{
+		bool		alwaysTrue;
+		Node	   *clause;
+		WrapperNode *wrap;
+
+		clause = wrapper_make_expression((WrapperNode *) lfirst(lc), index, &alwaysTrue);
+		if (alwaysTrue)
+			continue;
+
+		wrap = walk_expr_tree((Expr *) clause, sublrel);
+		subwrappers = lappend(subwrappers, wrap);
+		subrinfos = lappend(subrinfos, lfirst(lc2));
+		subclauses = lappend(subclauses, clause);
+		ranges = irange_list_intersect(ranges, wrap->rangeset);
+	}
+
+	if (sublrel->prel.keys_count > 1)
+		ranges = irange_list_intersect(ranges,
+									   make_composite_rangeset(sublrel, subclauses));
+
+	return append_partitions(root, rel, rti, rte, sublrel, ranges, subwrappers,
+							 subrinfos, childRTindex);
+}
+
+/*
+ * Creates RTE and RelOptInfo of child relation with given range table index.
+ * RTE is returned to be added to the range table by caller
+ */
+static RangeTblEntry *
+append_child_relation(PlannerInfo *root, RelOptInfo *rel, Index rti,
+	RangeTblEntry *rte, int index, Oid childOid, List *wrappers, List *rinfos,
+	Index childRTindex)
+{
+	RangeTblEntry *childrte;
+	RelOptInfo    *childrel;
+	AppendRelInfo *appinfo;
+	Node *node;
+	ListCell *lc, *lc2;
+	Relation	newrelation;
+
+	newrelation = heap_open(childOid, NoLock);
+
+	/*
+	 * Create RangeTblEntry for child relation.
 	 * This code partially based on expand_inherited_rtentry() function.
 	 */
 	childrte = copyObject(rte);
@@ -483,8 +1949,6 @@ append_child_relation(PlannerInfo *root, RelOptInfo *rel, Index rti,
 	childrte->relkind = newrelation->rd_rel->relkind;
 	childrte->inh = false;
 	childrte->requiredPerms = 0;
-	root->parse->rtable = lappend(root->parse->rtable, childrte);
-	childRTindex = list_length(root->parse->rtable);
 	root->simple_rte_array[childRTindex] = childrte;
 
 	/* Create RelOptInfo */
@@ -504,7 +1968,7 @@ append_child_relation(PlannerInfo *root, RelOptInfo *rel, Index rti,
 
 	/* Copy restrictions */
 	childrel->baserestrictinfo = NIL;
-	forboth(lc, wrappers, lc2, rel->baserestrictinfo)
+	forboth(lc, wrappers, lc2, rinfos)
 	{
 		bool alwaysTrue;
 		WrapperNode *wrap = (WrapperNode *) lfirst(lc);
@@ -542,81 +2006,155 @@ append_child_relation(PlannerInfo *root, RelOptInfo *rel, Index rti,
 	root->total_table_pages += (double) childrel->pages;
 
 	heap_close(newrelation, NoLock);
+
+	return childrte;
 }
 
-/* Convert wrapper into expression for given index */
+/*
+ * Convert wrapper into expression for given index. Indexes (except negative
+ * one) must be passed in ascending order after wrapper_reset_cursor()
+ */
 static Node *
 wrapper_make_expression(WrapperNode *wrap, int index, bool *alwaysTrue)
 {
-	bool	lossy, found;
+	Node   *result;
 
 	*alwaysTrue = false;
-	/*
-	 * TODO: use faster algorithm using knowledge that we enumerate indexes
-	 * sequntially.
-	 */
-	found = irange_list_find(wrap->rangeset, index, &lossy);
-	/* Return NULL for always true and always false. */
-	if (!found)
-		return NULL;
-	if (!lossy)
+
+	/* Negative index stands for default partition, keep original clause */
+	if (index < 0)
+		return copyObject(wrap->orig);
+
+	/* Expression may be shared by several children, so copy it */
+	result = wrapper_eval(wrap, index, alwaysTrue);
+	return result ? copyObject(result) : NULL;
+}
+
+/*
+ * Prepares wrapper tree for sequential evaluation
+ */
+static void
+wrapper_reset_cursor(WrapperNode *wrap)
+{
+	ListCell   *lc;
+
+	wrap->cursor = list_head(wrap->rangeset);
+	wrap->cached_until = -1;
+	wrap->cached_expr = NULL;
+	wrap->cached_always_true = false;
+
+	foreach(lc, wrap->args)
+		wrapper_reset_cursor((WrapperNode *) lfirst(lc));
+}
+
+/*
+ * Moves cursor to the range containing index or following it. Returns the
+ * last index for which found and lossy stay the same
+ */
+static int
+wrapper_seek(WrapperNode *wrap, int index, bool *found, bool *lossy)
+{
+	IndexRange	irange;
+
+	while (wrap->cursor != NULL &&
+		   irange_upper(lfirst_irange(wrap->cursor)) < index)
+		wrap->cursor = lnext(wrap->cursor);
+
+	*found = false;
+	*lossy = false;
+
+	if (wrap->cursor == NULL)
+		return INT_MAX;
+
+	irange = lfirst_irange(wrap->cursor);
+	if (irange_lower(irange) > index)
+		return irange_lower(irange) - 1;
+
+	*found = true;
+	*lossy = irange_is_lossy(irange);
+	return irange_upper(irange);
+}
+
+/*
+ * Returns expression for given index without copying. Result is cached
+ * while index stays in the same ranges of wrapper and all its args
+ */
+static Node *
+wrapper_eval(WrapperNode *wrap, int index, bool *alwaysTrue)
+{
+	Node	   *result = NULL;
+	bool		lossy,
+				found;
+	int			until;
+
+	if (index <= wrap->cached_until)
 	{
-		*alwaysTrue = true;
-		return NULL;
+		*alwaysTrue = wrap->cached_always_true;
+		return wrap->cached_expr;
 	}
 
-	if (IsA(wrap->orig, BoolExpr))
+	*alwaysTrue = false;
+	until = wrapper_seek(wrap, index, &found, &lossy);
+
+	/* Return NULL for always true and always false. */
+	if (!found)
+		result = NULL;
+	else if (!lossy)
+		*alwaysTrue = true;
+	else if (IsA(wrap->orig, BoolExpr) &&
+			 (((const BoolExpr *) wrap->orig)->boolop == OR_EXPR ||
+			  ((const BoolExpr *) wrap->orig)->boolop == AND_EXPR))
 	{
 		const BoolExpr *expr = (const BoolExpr *) wrap->orig;
-		BoolExpr *result;
+		ListCell   *lc;
+		List	   *args = NIL;
 
-		if (expr->boolop == OR_EXPR || expr->boolop == AND_EXPR)
+		foreach (lc, wrap->args)
 		{
-			ListCell *lc;
-			List *args = NIL;
-
-			foreach (lc, wrap->args)
-			{
-				Node   *arg;
-				bool	childAlwaysTrue;
-
-				arg = wrapper_make_expression((WrapperNode *)lfirst(lc), index, &childAlwaysTrue);
-#ifdef USE_ASSERT_CHECKING
-				/*
-				 * We shouldn't get there for always true clause under OR and
-				 * always false clause under AND.
-				 */
-				if (expr->boolop == OR_EXPR)
-					Assert(!childAlwaysTrue);
-				if (expr->boolop == AND_EXPR)
-					Assert(arg || childAlwaysTrue);
-#endif
-				if (arg)
-					args = lappend(args, arg);
-			}
+			WrapperNode *argwrap = (WrapperNode *) lfirst(lc);
+			Node	   *arg;
+			bool		childAlwaysTrue;
 
-			Assert(list_length(args) >= 1);
+			arg = wrapper_eval(argwrap, index, &childAlwaysTrue);
+			until = Min(until, argwrap->cached_until);
+#ifdef USE_ASSERT_CHECKING
+			/*
+			 * We shouldn't get there for always true clause under OR and
+			 * always false clause under AND.
+			 */
+			if (expr->boolop == OR_EXPR)
+				Assert(!childAlwaysTrue);
+			if (expr->boolop == AND_EXPR)
+				Assert(arg || childAlwaysTrue);
+#endif
+			if (arg)
+				args = lappend(args, arg);
+		}
 
-			/* Remove redundant OR/AND when child is single. */
-			if (list_length(args) == 1)
-				return (Node *) linitial(args);
+		Assert(list_length(args) >= 1);
 
-			result = makeNode(BoolExpr);
-			result->xpr.type = T_BoolExpr;
-			result->args = args;
-			result->boolop = expr->boolop;
-			result->location = expr->location;
-			return (Node *)result;
-		}
+		/* Remove redundant OR/AND when child is single. */
+		if (list_length(args) == 1)
+			result = (Node *) linitial(args);
 		else
 		{
-			return copyObject(wrap->orig);
+			BoolExpr   *boolexpr = makeNode(BoolExpr);
+
+			boolexpr->xpr.type = T_BoolExpr;
+			boolexpr->args = args;
+			boolexpr->boolop = expr->boolop;
+			boolexpr->location = expr->location;
+			result = (Node *) boolexpr;
 		}
 	}
 	else
-	{
-		return copyObject(wrap->orig);
-	}
+		result = (Node *) wrap->orig;
+
+	wrap->cached_until = until;
+	wrap->cached_expr = result;
+	wrap->cached_always_true = *alwaysTrue;
+
+	return result;
 }
 
 /*
@@ -708,7 +2246,7 @@ change_varnos_in_restrinct_info(RestrictInfo *rinfo, change_varno_context *conte
  * Recursive function to walk through conditions tree
  */
 static WrapperNode *
-walk_expr_tree(Expr *expr, const PartRelationInfo *prel)
+walk_expr_tree(Expr *expr, LocalRelationInfo *lrel)
 {
 	BoolExpr		   *boolexpr;
 	OpExpr			   *opexpr;
@@ -720,20 +2258,20 @@ walk_expr_tree(Expr *expr, const PartRelationInfo *prel)
 		/* AND, OR, NOT expressions */
 		case T_BoolExpr:
 			boolexpr = (BoolExpr *) expr;
-			return handle_boolexpr(boolexpr, prel);
+			return handle_boolexpr(boolexpr, lrel);
 		/* =, !=, <, > etc. */
 		case T_OpExpr:
 			opexpr = (OpExpr *) expr;
-			return handle_opexpr(opexpr, prel);
+			return handle_opexpr(opexpr, lrel);
 		/* IN expression */
 		case T_ScalarArrayOpExpr:
 			arrexpr = (ScalarArrayOpExpr *) expr;
-			return handle_arrexpr(arrexpr, prel);
+			return handle_arrexpr(arrexpr, lrel);
 		default:
 			result = (WrapperNode *)palloc(sizeof(WrapperNode));
 			result->orig = (const Node *)expr;
 			result->args = NIL;
-			result->rangeset = list_make1_irange(make_irange(0, prel->children_count - 1, true));
+			result->rangeset = list_make1_irange(make_irange(0, lrel->prel.children_count - 1, true));
 			return result;
 	}
 }
@@ -742,46 +2280,79 @@ walk_expr_tree(Expr *expr, const PartRelationInfo *prel)
  *	This function determines which partitions should appear in query plan
  */
 static void
-handle_binary_opexpr(const PartRelationInfo *prel, WrapperNode *result,
-					 const Var *v, const Const *c)
+handle_binary_opexpr(LocalRelationInfo *lrel, WrapperNode *result,
+					 Oid opno, const Const *c)
 {
-	HashRelationKey		key;
-	RangeRelation	   *rangerel;
+	LocalOperatorInfo  *opinfo;
 	Datum				value;
 	int					i,
-						int_value,
 						strategy;
 	bool				is_less,
 						is_greater;
-	FmgrInfo		    cmp_func;
-	Oid					cmp_proc_oid;
-	const OpExpr	   *expr = (const OpExpr *)result->orig;
-	TypeCacheEntry	   *tce;
+	FmgrInfo		   *cmp_func;
 
 	/* Determine operator type */
-	tce = lookup_type_cache(v->vartype,
-		TYPECACHE_EQ_OPR | TYPECACHE_LT_OPR | TYPECACHE_GT_OPR | TYPECACHE_CMP_PROC | TYPECACHE_CMP_PROC_FINFO);
-	strategy = get_op_opfamily_strategy(expr->opno, tce->btree_opf);
-	cmp_proc_oid = get_opfamily_proc(tce->btree_opf,
-									 c->consttype,
-									 prel->atttype,
-									 BTORDER_PROC);
-	fmgr_info(cmp_proc_oid, &cmp_func);
+	opinfo = get_local_operator_info(lrel, 0, opno, c->consttype);
+	strategy = opinfo->strategy;
+	cmp_func = &opinfo->cmp_func;
 
-	switch (prel->parttype)
+	switch (lrel->prel.parttype)
 	{
 		case PT_HASH:
-			if (strategy == BTEqualStrategyNumber)
+			/* Hash value depends on type, so it must be the key's one */
+			if (strategy == BTEqualStrategyNumber && !c->constisnull &&
+				c->consttype == lrel->prel.atttype)
 			{
-				int_value = DatumGetInt32(c->constvalue);
-				key.hash = make_hash(prel, int_value);
-				result->rangeset = list_make1_irange(make_irange(key.hash, key.hash, true));
+				result->rangeset = make_hash_rangeset(lrel, c->constvalue);
 				return;
 			}
+			break;
+		case PT_LIST:
+			if (lrel->has_list && !c->constisnull &&
+				c->consttype == lrel->prel.atttype)
+			{
+				if (strategy == BTEqualStrategyNumber)
+				{
+					result->rangeset = make_list_rangeset(lrel, c->constvalue);
+					return;
+				}
+
+				/*
+				 * Operator <> holds for all the rows of partitions which don't
+				 * have the value and excludes partition which has only it
+				 */
+				if (OidIsValid(get_negator(opno)) &&
+					get_local_operator_info(lrel, 0, get_negator(opno),
+											c->consttype)->strategy == BTEqualStrategyNumber)
+				{
+					int		count = lrel->prel.children_count;
+
+					i = list_partition_lookup(lrel->list_map, lrel->list_map_size,
+											  lrel->list_values, lrel->by_val,
+											  lrel->prel.atttype, c->constvalue);
+					if (i < 0)
+					{
+						result->rangeset = list_make1_irange(make_irange(0, count - 1, false));
+						return;
+					}
+
+					result->rangeset = NIL;
+					if (i > 0)
+						result->rangeset = lappend_irange(result->rangeset,
+														  make_irange(0, i - 1, false));
+					if (lrel->list_counts[i] > 1)
+						result->rangeset = lappend_irange(result->rangeset,
+														  make_irange(i, i, true));
+					if (i < count - 1)
+						result->rangeset = lappend_irange(result->rangeset,
+														  make_irange(i + 1, count - 1, false));
+					return;
+				}
+			}
+			break;
 		case PT_RANGE:
 			value = c->constvalue;
-			rangerel = get_pathman_range_relation(prel->key.relid, NULL);
-			if (rangerel != NULL)
+			if (lrel->has_ranges)
 			{
 				RangeEntry *re;
 				bool		lossy = false;
@@ -792,12 +2363,12 @@ handle_binary_opexpr(const PartRelationInfo *prel, WrapperNode *result,
 				int			startidx = 0,
 							cmp_min,
 							cmp_max,
-							endidx = rangerel->ranges.length - 1;
-				RangeEntry *ranges = dsm_array_get_pointer(&rangerel->ranges);
-				bool byVal = rangerel->by_val;
+							endidx = lrel->ranges_count - 1;
+				RangeEntry *ranges = lrel->ranges;
+				bool byVal = lrel->by_val;
 
 				/* Check boundaries */
-				if (rangerel->ranges.length == 0)
+				if (lrel->ranges_count == 0)
 				{
 					result->rangeset = NIL;
 					return;
@@ -805,10 +2376,10 @@ handle_binary_opexpr(const PartRelationInfo *prel, WrapperNode *result,
 				else
 				{
 					/* Corner cases */
-					cmp_min = FunctionCall2(&cmp_func, value,
+					cmp_min = FunctionCall2(cmp_func, value,
 											PATHMAN_GET_DATUM(ranges[0].min, byVal)),
-					cmp_max = FunctionCall2(&cmp_func, value,
-											PATHMAN_GET_DATUM(ranges[rangerel->ranges.length - 1].max, byVal));
+					cmp_max = FunctionCall2(cmp_func, value,
+											PATHMAN_GET_DATUM(ranges[lrel->ranges_count - 1].max, byVal));
 
 					if ((cmp_min < 0 &&
 						 (strategy == BTLessEqualStrategyNumber ||
@@ -846,10 +2417,10 @@ handle_binary_opexpr(const PartRelationInfo *prel, WrapperNode *result,
 				while (true)
 				{
 					i = startidx + (endidx - startidx) / 2;
-					Assert(i >= 0 && i < rangerel->ranges.length);
+					Assert(i >= 0 && i < lrel->ranges_count);
 					re = &ranges[i];
-					cmp_min = FunctionCall2(&cmp_func, value, PATHMAN_GET_DATUM(re->min, byVal));
-					cmp_max = FunctionCall2(&cmp_func, value, PATHMAN_GET_DATUM(re->max, byVal));
+					cmp_min = FunctionCall2(cmp_func, value, PATHMAN_GET_DATUM(re->min, byVal));
+					cmp_max = FunctionCall2(cmp_func, value, PATHMAN_GET_DATUM(re->max, byVal));
 
 					is_less = (cmp_min < 0 || (cmp_min == 0 && strategy == BTLessStrategyNumber));
 					is_greater = (cmp_max > 0 || (cmp_max >= 0 && strategy != BTLessStrategyNumber));
@@ -875,69 +2446,558 @@ handle_binary_opexpr(const PartRelationInfo *prel, WrapperNode *result,
 						return;
 					}
 
-					if (is_less)
-						endidx = i - 1;
-					else if (is_greater)
-						startidx = i + 1;
+					if (is_less)
+						endidx = i - 1;
+					else if (is_greater)
+						startidx = i + 1;
+
+					/* For debug's sake */
+					Assert(++counter < 100);
+				}
+
+				Assert(found);
+
+				/* Filter partitions */
+				switch(strategy)
+				{
+					case BTLessStrategyNumber:
+					case BTLessEqualStrategyNumber:
+						if (lossy)
+						{
+							result->rangeset = list_make1_irange(make_irange(i, i, true));
+							if (i > 0)
+								result->rangeset = lcons_irange(
+									make_irange(0, i - 1, false), result->rangeset);
+						}
+						else
+						{
+							result->rangeset = list_make1_irange(
+								make_irange(0, i, false));
+						}
+						return;
+					case BTEqualStrategyNumber:
+						result->rangeset = list_make1_irange(make_irange(i, i, true));
+						return;
+					case BTGreaterEqualStrategyNumber:
+					case BTGreaterStrategyNumber:
+						if (lossy)
+						{
+							result->rangeset = list_make1_irange(make_irange(i, i, true));
+							if (i < lrel->prel.children_count - 1)
+								result->rangeset = lappend_irange(result->rangeset,
+									make_irange(i + 1, lrel->prel.children_count - 1, false));
+						}
+						else
+						{
+							result->rangeset = list_make1_irange(
+								make_irange(i, lrel->prel.children_count - 1, false));
+						}
+						return;
+				}
+				result->rangeset = list_make1_irange(make_irange(startidx, endidx, true));
+				return;
+			}
+	}
+
+	result->rangeset = list_make1_irange(make_irange(0, lrel->prel.children_count - 1, true));
+}
+
+static Node *
+reset_varnos_mutator(Node *node, void *context)
+{
+	if (node == NULL)
+		return NULL;
+	if (IsA(node, Var))
+	{
+		Var		   *var = (Var *) copyObject(node);
+
+		var->varno = 1;
+		var->varnoold = 1;
+		return (Node *) var;
+	}
+	return expression_tree_mutator(node, reset_varnos_mutator, context);
+}
+
+/*
+ * Checks if the node is partitioning key of the relation, i.e. the key column
+ * or the same expression as the key expression
+ */
+static bool
+is_partitioning_key(const LocalRelationInfo *lrel, Node *node)
+{
+	if (lrel->key_expr == NULL)
+		return IsA(node, Var) && ((Var *) node)->varattno == lrel->prel.attnum;
+
+	if (nodeTag(node) != nodeTag(lrel->key_expr))
+		return false;
+
+	/* Key expression is stored with the relation being the first range entry */
+	return equal(reset_varnos_mutator(node, NULL), lrel->key_expr);
+}
+
+/*
+ * Checks if key expression never decreases when the column it is computed
+ * from increases. Only date_trunc() and casts it may be applied to are known
+ */
+static bool
+key_expr_is_monotonic(Node *node)
+{
+	if (IsA(node, Var))
+		return true;
+	if (IsA(node, RelabelType))
+		return key_expr_is_monotonic((Node *) ((RelabelType *) node)->arg);
+	if (IsA(node, FuncExpr))
+	{
+		FuncExpr   *func = (FuncExpr *) node;
+
+		switch (func->funcid)
+		{
+			case F_DATE_TIMESTAMP:
+				return key_expr_is_monotonic(linitial(func->args));
+			case F_TIMESTAMP_TRUNC:
+				return IsA(linitial(func->args), Const) &&
+					key_expr_is_monotonic(lsecond(func->args));
+		}
+	}
+	return false;
+}
+
+/*
+ * Handles condition on the column which key expression is computed from. The
+ * condition on the column implies condition on the key: equality always does,
+ * and comparisons do if the expression is monotonic. Resulting ranges are
+ * lossy since partitions don't guarantee the condition on the column
+ */
+static void
+handle_key_column_opexpr(LocalRelationInfo *lrel, WrapperNode *result,
+						 Oid opno, const Var *var, const Const *c)
+{
+	TypeCacheEntry *tce;
+	Const	   *key;
+	Oid			key_opno = InvalidOid;
+	int			strategy;
+	List	   *ranges = NIL;
+	ListCell   *lc;
+
+	result->rangeset = list_make1_irange(make_irange(0, lrel->prel.children_count - 1, true));
+	if (c->constisnull || c->consttype != var->vartype)
+		return;
+
+	tce = lookup_type_cache(var->vartype, TYPECACHE_BTREE_OPFAMILY |
+										  TYPECACHE_HASH_OPFAMILY);
+	strategy = get_op_opfamily_strategy(opno, tce->btree_opf);
+	if (strategy == 0 && OidIsValid(tce->hash_opf) &&
+		get_op_opfamily_strategy(opno, tce->hash_opf) == HTEqualStrategyNumber)
+		strategy = BTEqualStrategyNumber;
+
+	switch (strategy)
+	{
+		case BTEqualStrategyNumber:
+			break;
+		case BTLessStrategyNumber:
+		case BTLessEqualStrategyNumber:
+			if (!key_expr_is_monotonic(lrel->key_expr))
+				return;
+			strategy = BTLessEqualStrategyNumber;
+			break;
+		case BTGreaterStrategyNumber:
+		case BTGreaterEqualStrategyNumber:
+			if (!key_expr_is_monotonic(lrel->key_expr))
+				return;
+			strategy = BTGreaterEqualStrategyNumber;
+			break;
+		default:
+			return;
+	}
+
+	if (OidIsValid(lrel->btree_opf))
+		key_opno = get_opfamily_member(lrel->btree_opf, lrel->prel.atttype,
+									   lrel->prel.atttype, strategy);
+	if (!OidIsValid(key_opno) && strategy == BTEqualStrategyNumber &&
+		OidIsValid(lrel->hash_opf))
+		key_opno = get_opfamily_member(lrel->hash_opf, lrel->prel.atttype,
+									   lrel->prel.atttype, HTEqualStrategyNumber);
+	if (!OidIsValid(key_opno))
+		return;
+
+	key = eval_key_expression(lrel, c->constvalue);
+	if (key->constisnull)
+		return;
+
+	handle_binary_opexpr(lrel, result, key_opno, key);
+
+	foreach(lc, result->rangeset)
+	{
+		IndexRange	irange = lfirst_irange(lc);
+
+		ranges = lappend_irange(ranges, make_irange(irange_lower(irange),
+													irange_upper(irange), true));
+	}
+	result->rangeset = ranges;
+}
+
+/*
+ * Calculates hash value
+ */
+static int
+make_hash(const LocalRelationInfo *lrel, Datum value)
+{
+	return get_hash_part_idx(value, lrel->prel.atttype,
+							 lrel->prel.children_count);
+}
+
+/*
+ * Returns partitions which may contain rows with the value. While partitions
+ * are being split (see split_hash_partitions()) rows of partition N + k may
+ * still be stored in partition k unless k has already been processed
+ */
+static List *
+make_hash_rangeset(const LocalRelationInfo *lrel, Datum value)
+{
+	int		hash = make_hash(lrel, value);
+	int		half = lrel->prel.children_count / 2;
+	List   *rangeset = list_make1_irange(make_irange(hash, hash, true));
+
+	if (lrel->prel.split_pos >= 0 && hash >= half &&
+		hash - half >= lrel->prel.split_pos)
+		rangeset = irange_list_union(rangeset,
+						list_make1_irange(make_irange(hash - half, hash - half, true)));
+
+	return rangeset;
+}
+
+/*
+ * Returns LIST partition which has the value. Clause can be omitted if the
+ * partition has no other values
+ */
+static List *
+make_list_rangeset(const LocalRelationInfo *lrel, Datum value)
+{
+	int		idx = list_partition_lookup(lrel->list_map, lrel->list_map_size,
+										lrel->list_values, lrel->by_val,
+										lrel->prel.atttype, value);
+
+	if (idx < 0)
+		return NIL;
+
+	return list_make1_irange(make_irange(idx, idx, lrel->list_counts[idx] > 1));
+}
+
+/*
+ * Checks if partitions holding single values of the key can be found
+ */
+static bool
+key_values_prunable(const LocalRelationInfo *lrel)
+{
+	switch (lrel->prel.parttype)
+	{
+		case PT_HASH:
+			return true;
+		case PT_RANGE:
+			return lrel->has_ranges && lrel->prel.keys_count == 1;
+		case PT_LIST:
+			return lrel->has_list;
+	}
+
+	return false;
+}
+
+/*
+ * Returns partitions which may contain rows with the key value
+ */
+static List *
+make_key_value_rangeset(const LocalRelationInfo *lrel, Datum value)
+{
+	int		idx;
+
+	switch (lrel->prel.parttype)
+	{
+		case PT_HASH:
+			return make_hash_rangeset(lrel, value);
+		case PT_LIST:
+			return make_list_rangeset(lrel, value);
+		case PT_RANGE:
+			idx = range_partition_idx(lrel, value);
+			if (idx >= 0)
+				return list_make1_irange(make_irange(idx, idx, true));
+			break;
+	}
+
+	return NIL;
+}
+
+/*
+ * Returns lower or upper bound of the key column of RANGE partition
+ */
+static Datum
+range_key_bound(const LocalRelationInfo *lrel, int idx, int key, bool upper)
+{
+	RangeEntry *re = &lrel->ranges[idx];
+	int64	   *bound;
+
+	if (key == 0)
+		return upper ? PATHMAN_GET_DATUM(re->max, lrel->by_val) :
+					   PATHMAN_GET_DATUM(re->min, lrel->by_val);
+
+	bound = &lrel->key_bounds[idx * RANGE_KEY_BOUNDS(lrel->prel.keys_count) +
+							  (upper ? lrel->prel.keys_count - 1 : 0) + key - 1];
+	return PATHMAN_GET_DATUM(*bound, lrel->key_by_val[key]);
+}
+
+/*
+ * Compares values of the first n key columns with lower or upper bound of
+ * partition lexicographically
+ */
+static int
+cmp_key_values(const LocalRelationInfo *lrel, int idx, bool upper,
+			   Datum *values, FmgrInfo **cmp_funcs, int n)
+{
+	int			cmp;
+	int			i;
+
+	for (i = 0; i < n; i++)
+	{
+		cmp = DatumGetInt32(FunctionCall2(cmp_funcs[i], values[i],
+										  range_key_bound(lrel, idx, i, upper)));
+		if (cmp != 0)
+			return cmp;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns index of partition of composite key which has the values or -1
+ */
+static int
+composite_partition_idx(const LocalRelationInfo *lrel, Datum *values)
+{
+	FmgrInfo   *cmp_funcs[PATHMAN_MAX_KEYS];
+	int			n = lrel->prel.keys_count;
+	int			startidx = 0,
+				endidx = lrel->ranges_count - 1;
+	int			i;
+
+	for (i = 0; i < n; i++)
+		cmp_funcs[i] = &lookup_type_cache(lrel->prel.key_atttypes[i],
+										  TYPECACHE_CMP_PROC_FINFO)->cmp_proc_finfo;
+
+	while (startidx <= endidx)
+	{
+		i = startidx + (endidx - startidx) / 2;
+
+		if (cmp_key_values(lrel, i, false, values, cmp_funcs, n) < 0)
+			endidx = i - 1;
+		else if (cmp_key_values(lrel, i, true, values, cmp_funcs, n) >= 0)
+			startidx = i + 1;
+		else
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * Recognizes clause "key_column OP const" (or "const OP key_column") with
+ * btree operator on a column of composite key
+ */
+static bool
+get_key_condition(LocalRelationInfo *lrel, Node *clause, KeyCondition *cond)
+{
+	OpExpr	   *expr = (OpExpr *) clause;
+	LocalOperatorInfo *opinfo;
+	Node	   *left,
+			   *right;
+	Var		   *var;
+	Const	   *c;
+	Oid			opno;
+	int			i;
+
+	if (!IsA(clause, OpExpr) || list_length(expr->args) != 2)
+		return false;
+
+	left = (Node *) linitial(expr->args);
+	right = (Node *) lsecond(expr->args);
+	opno = expr->opno;
+	if (IsA(left, Var) && IsA(right, Const))
+	{
+		var = (Var *) left;
+		c = (Const *) right;
+	}
+	else if (IsA(right, Var) && IsA(left, Const))
+	{
+		/* Let it be "key_column OP' const" */
+		opno = get_commutator(opno);
+		if (!OidIsValid(opno))
+			return false;
+		var = (Var *) right;
+		c = (Const *) left;
+	}
+	else
+		return false;
+
+	if (c->constisnull)
+		return false;
+
+	for (i = 0; i < lrel->prel.keys_count; i++)
+		if (var->varattno == lrel->prel.key_attnums[i])
+			break;
+	if (i == lrel->prel.keys_count)
+		return false;
+
+	opinfo = get_local_operator_info(lrel, i, opno, c->consttype);
+	if (opinfo->strategy == 0 || !OidIsValid(opinfo->cmp_func.fn_oid))
+		return false;
+
+	cond->key = i;
+	cond->strategy = opinfo->strategy;
+	cond->value = c->constvalue;
+	cond->cmp_func = &opinfo->cmp_func;
+	return true;
+}
+
+/*
+ * Returns partitions of composite key which may satisfy the clauses (which
+ * are implicitly ANDed). Equalities on the first key columns and one more
+ * condition on the next column select a contiguous run of partitions since
+ * bounds are compared lexicographically. Partitions are always lossy
+ */
+static List *
+make_composite_rangeset(LocalRelationInfo *lrel, List *clauses)
+{
+	KeyCondition *eq[PATHMAN_MAX_KEYS];
+	Datum		values[PATHMAN_MAX_KEYS];
+	FmgrInfo   *cmp_funcs[PATHMAN_MAX_KEYS];
+	List	   *conds = NIL;
+	List	   *ranges;
+	ListCell   *lc;
+	int			n;
+
+	if (!lrel->has_ranges)
+		return list_make1_irange(make_irange(0, lrel->prel.children_count - 1, true));
+	if (lrel->ranges_count == 0)
+		return NIL;
+
+	memset(eq, 0, sizeof(eq));
+	foreach(lc, clauses)
+	{
+		KeyCondition *cond = palloc(sizeof(KeyCondition));
+
+		if (!get_key_condition(lrel, (Node *) lfirst(lc), cond))
+		{
+			pfree(cond);
+			continue;
+		}
+
+		conds = lappend(conds, cond);
+		if (cond->strategy == BTEqualStrategyNumber && eq[cond->key] == NULL)
+			eq[cond->key] = cond;
+	}
 
-					/* For debug's sake */
-					Assert(++counter < 100);
-				}
+	/* Equalities on the key prefix */
+	for (n = 0; n < lrel->prel.keys_count && eq[n] != NULL; n++)
+	{
+		values[n] = eq[n]->value;
+		cmp_funcs[n] = eq[n]->cmp_func;
+	}
 
-				Assert(found);
+	ranges = list_make1_irange(make_irange(0, lrel->ranges_count - 1, true));
+	if (n > 0)
+		ranges = composite_key_rangeset(lrel, values, cmp_funcs, n, NULL);
 
-				/* Filter partitions */
-				switch(strategy)
-				{
-					case BTLessStrategyNumber:
-					case BTLessEqualStrategyNumber:
-						if (lossy)
-						{
-							result->rangeset = list_make1_irange(make_irange(i, i, true));
-							if (i > 0)
-								result->rangeset = lcons_irange(
-									make_irange(0, i - 1, false), result->rangeset);
-						}
-						else
-						{
-							result->rangeset = list_make1_irange(
-								make_irange(0, i, false));
-						}
-						return;
-					case BTEqualStrategyNumber:
-						result->rangeset = list_make1_irange(make_irange(i, i, true));
-						return;
-					case BTGreaterEqualStrategyNumber:
-					case BTGreaterStrategyNumber:
-						if (lossy)
-						{
-							result->rangeset = list_make1_irange(make_irange(i, i, true));
-							if (i < prel->children_count - 1)
-								result->rangeset = lappend_irange(result->rangeset,
-									make_irange(i + 1, prel->children_count - 1, false));
-						}
-						else
-						{
-							result->rangeset = list_make1_irange(
-								make_irange(i, prel->children_count - 1, false));
-						}
-						return;
-				}
-				result->rangeset = list_make1_irange(make_irange(startidx, endidx, true));
-				return;
-			}
+	/* Conditions on the column next to the prefix */
+	foreach(lc, conds)
+	{
+		KeyCondition *cond = (KeyCondition *) lfirst(lc);
+
+		if (cond->key == n)
+			ranges = irange_list_intersect(ranges,
+						composite_key_rangeset(lrel, values, cmp_funcs, n, cond));
 	}
 
-	result->rangeset = list_make1_irange(make_irange(0, prel->children_count - 1, true));
+	list_free_deep(conds);
+	return ranges;
 }
 
 /*
- * Calculates hash value
+ * Returns run of partitions which may contain rows having the values in the
+ * first n key columns and satisfying cond on the next column (if any)
  */
-static int
-make_hash(const PartRelationInfo *prel, int value)
+static List *
+composite_key_rangeset(const LocalRelationInfo *lrel, Datum *values,
+					   FmgrInfo **cmp_funcs, int n, KeyCondition *cond)
 {
-	return value % prel->children_count;
+	bool		lower_cond = cond != NULL &&
+		(cond->strategy == BTGreaterStrategyNumber ||
+		 cond->strategy == BTGreaterEqualStrategyNumber);
+	bool		upper_cond = cond != NULL &&
+		(cond->strategy == BTLessStrategyNumber ||
+		 cond->strategy == BTLessEqualStrategyNumber);
+	int			count = lrel->ranges_count;
+	int			startidx,
+				endidx,
+				lower,
+				i,
+				cmp;
+	bool		below,
+				above;
+
+	/* The first partition which doesn't lie entirely below the rows */
+	startidx = 0;
+	endidx = count;
+	while (startidx < endidx)
+	{
+		i = startidx + (endidx - startidx) / 2;
+
+		cmp = cmp_key_values(lrel, i, true, values, cmp_funcs, n);
+		if (cmp != 0 || n == lrel->prel.keys_count)
+			below = (cmp >= 0);
+		else if (lower_cond)
+		{
+			cmp = DatumGetInt32(FunctionCall2(cond->cmp_func, cond->value,
+											  range_key_bound(lrel, i, n, true)));
+			below = cmp > 0 ||
+				(cmp == 0 && (cond->strategy == BTGreaterStrategyNumber ||
+							  n == lrel->prel.keys_count - 1));
+		}
+		else
+			below = false;
+
+		if (below)
+			startidx = i + 1;
+		else
+			endidx = i;
+	}
+	lower = startidx;
+
+	/* The first partition after them which lies entirely above the rows */
+	endidx = count;
+	while (startidx < endidx)
+	{
+		i = startidx + (endidx - startidx) / 2;
+
+		cmp = cmp_key_values(lrel, i, false, values, cmp_funcs, n);
+		if (cmp != 0 || n == lrel->prel.keys_count)
+			above = (cmp < 0);
+		else if (upper_cond)
+		{
+			cmp = DatumGetInt32(FunctionCall2(cond->cmp_func, cond->value,
+											  range_key_bound(lrel, i, n, false)));
+			above = cmp < 0 ||
+				(cmp == 0 && cond->strategy == BTLessStrategyNumber);
+		}
+		else
+			above = false;
+
+		if (above)
+			endidx = i;
+		else
+			startidx = i + 1;
+	}
+
+	if (lower > startidx - 1)
+		return NIL;
+	return list_make1_irange(make_irange(lower, startidx - 1, true));
 }
 
 /*
@@ -1005,7 +3065,7 @@ range_binary_search(const RangeRelation *rangerel, FmgrInfo *cmp_func, Datum val
  * Operator expression handler
  */
 static WrapperNode *
-handle_opexpr(const OpExpr *expr, const PartRelationInfo *prel)
+handle_opexpr(const OpExpr *expr, LocalRelationInfo *lrel)
 {
 	WrapperNode	*result = (WrapperNode *)palloc(sizeof(WrapperNode));
 	Node		*firstarg = NULL,
@@ -1014,34 +3074,174 @@ handle_opexpr(const OpExpr *expr, const PartRelationInfo *prel)
 	result->orig = (const Node *)expr;
 	result->args = NIL;
 
+	/* Single column of composite key only prunes if it's the first one */
+	if (lrel->prel.keys_count > 1)
+	{
+		result->rangeset = make_composite_rangeset(lrel, list_make1((Node *) expr));
+		return result;
+	}
+
 	if (list_length(expr->args) == 2)
 	{
 		firstarg = (Node *) linitial(expr->args);
 		secondarg = (Node *) lsecond(expr->args);
 
-		if (IsA(firstarg, Var) && IsA(secondarg, Const) &&
-			((Var *)firstarg)->varattno == prel->attnum)
+		if (IsA(secondarg, Const) && is_partitioning_key(lrel, firstarg))
 		{
-			handle_binary_opexpr(prel, result, (Var *)firstarg, (Const *)secondarg);
+			handle_binary_opexpr(lrel, result, expr->opno, (Const *)secondarg);
 			return result;
 		}
-		else if (IsA(secondarg, Var) && IsA(firstarg, Const) &&
-				 ((Var *)secondarg)->varattno == prel->attnum)
+		else if (IsA(firstarg, Const) && is_partitioning_key(lrel, secondarg))
+		{
+			handle_binary_opexpr(lrel, result, expr->opno, (Const *)firstarg);
+			return result;
+		}
+
+		/* Condition on the column key expression is computed from */
+		if (lrel->key_expr != NULL && IsA(firstarg, Var) && IsA(secondarg, Const) &&
+			((Var *)firstarg)->varattno == lrel->prel.attnum)
+		{
+			handle_key_column_opexpr(lrel, result, expr->opno,
+									 (Var *)firstarg, (Const *)secondarg);
+			return result;
+		}
+		else if (lrel->key_expr != NULL && IsA(secondarg, Var) && IsA(firstarg, Const) &&
+				 ((Var *)secondarg)->varattno == lrel->prel.attnum &&
+				 OidIsValid(get_commutator(expr->opno)))
 		{
-			handle_binary_opexpr(prel, result, (Var *)secondarg, (Const *)firstarg);
+			handle_key_column_opexpr(lrel, result, get_commutator(expr->opno),
+									 (Var *)secondarg, (Const *)firstarg);
 			return result;
 		}
+
+		/* Condition on the column with zone maps */
+		if (IsA(firstarg, Var) && IsA(secondarg, Const) &&
+			handle_zone_map_opexpr(lrel, result, expr->opno,
+								   (Var *)firstarg, (Const *)secondarg))
+			return result;
+		else if (IsA(secondarg, Var) && IsA(firstarg, Const) &&
+				 OidIsValid(get_commutator(expr->opno)) &&
+				 handle_zone_map_opexpr(lrel, result, get_commutator(expr->opno),
+										(Var *)secondarg, (Const *)firstarg))
+			return result;
 	}
 
-	result->rangeset = list_make1_irange(make_irange(0, prel->children_count - 1, true));
+	result->rangeset = list_make1_irange(make_irange(0, lrel->prel.children_count - 1, true));
 	return result;
 }
 
+/*
+ * Handles comparison of the column with zone maps and a constant. Partitions
+ * which min and max values of the column can't satisfy the condition are
+ * excluded; partitions without valid summaries are always scanned. Returns
+ * false if the condition can't be checked against zone maps
+ */
+static bool
+handle_zone_map_opexpr(const LocalRelationInfo *lrel, WrapperNode *result,
+					   Oid opno, const Var *var, const Const *c)
+{
+	const PartRelationInfo *prel = &lrel->prel;
+	TypeCacheEntry *tce;
+	FmgrInfo	cmp_func;
+	Oid			cmp_proc_oid;
+	Oid			atttype;
+	bool		by_val;
+	int			column;
+	int			strategy;
+	int			start = -1;
+	int			i;
+
+	for (column = 0; column < prel->zone_columns_count; column++)
+		if (prel->zone_attnums[column] == var->varattno)
+			break;
+	if (column == prel->zone_columns_count || c->constisnull)
+		return false;
+
+	atttype = prel->zone_atttypes[column];
+	by_val = prel->zone_by_val[column];
+	tce = lookup_type_cache(atttype, TYPECACHE_BTREE_OPFAMILY);
+	if (!OidIsValid(tce->btree_opf))
+		return false;
+
+	strategy = get_op_opfamily_strategy(opno, tce->btree_opf);
+	cmp_proc_oid = get_opfamily_proc(tce->btree_opf,
+									 atttype,
+									 c->consttype,
+									 BTORDER_PROC);
+	if (strategy == 0 || !OidIsValid(cmp_proc_oid))
+		return false;
+	fmgr_info(cmp_proc_oid, &cmp_func);
+
+	result->rangeset = NIL;
+	for (i = 0; i < prel->children_count; i++)
+	{
+		const ZoneMapEntry *zm = find_zone_map_entry(lrel, column, lrel->children[i]);
+		bool		match = true;
+
+		if (zm != NULL && zm->empty)
+			match = false;
+		else if (zm != NULL)
+		{
+			int		cmp_min = DatumGetInt32(FunctionCall2(&cmp_func,
+								PATHMAN_GET_DATUM(zm->min, by_val), c->constvalue));
+			int		cmp_max = DatumGetInt32(FunctionCall2(&cmp_func,
+								PATHMAN_GET_DATUM(zm->max, by_val), c->constvalue));
+
+			switch (strategy)
+			{
+				case BTLessStrategyNumber:
+					match = cmp_min < 0;
+					break;
+				case BTLessEqualStrategyNumber:
+					match = cmp_min <= 0;
+					break;
+				case BTEqualStrategyNumber:
+					match = cmp_min <= 0 && cmp_max >= 0;
+					break;
+				case BTGreaterEqualStrategyNumber:
+					match = cmp_max >= 0;
+					break;
+				case BTGreaterStrategyNumber:
+					match = cmp_max > 0;
+					break;
+			}
+		}
+
+		/* Partitions don't guarantee the condition so ranges are lossy */
+		if (match && start < 0)
+			start = i;
+		else if (!match && start >= 0)
+		{
+			result->rangeset = lappend_irange(result->rangeset,
+											  make_irange(start, i - 1, true));
+			start = -1;
+		}
+	}
+	if (start >= 0)
+		result->rangeset = lappend_irange(result->rangeset,
+										  make_irange(start, prel->children_count - 1, true));
+
+	return true;
+}
+
+/*
+ * Returns zone map entry of the partition or NULL if there is no summary or
+ * partition has been modified since it was computed
+ */
+static const ZoneMapEntry *
+find_zone_map_entry(const LocalRelationInfo *lrel, int column, Oid child_oid)
+{
+	const ZoneMapEntry *zm = search_zone_map(lrel->zone_maps, lrel->zone_maps_count,
+											 column, child_oid);
+
+	return (zm != NULL && !zm->dirty) ? zm : NULL;
+}
+
 /*
  * Boolean expression handler
  */
 static WrapperNode *
-handle_boolexpr(const BoolExpr *expr, const PartRelationInfo *prel)
+handle_boolexpr(const BoolExpr *expr, LocalRelationInfo *lrel)
 {
 	WrapperNode	*result = (WrapperNode *)palloc(sizeof(WrapperNode));
 	ListCell	*lc;
@@ -1050,7 +3250,7 @@ handle_boolexpr(const BoolExpr *expr, const PartRelationInfo *prel)
 	result->args = NIL;
 
 	if (expr->boolop == AND_EXPR)
-		result->rangeset = list_make1_irange(make_irange(0, prel->children_count - 1, false));
+		result->rangeset = list_make1_irange(make_irange(0, lrel->prel.children_count - 1, false));
 	else
 		result->rangeset = NIL;
 
@@ -1058,7 +3258,7 @@ handle_boolexpr(const BoolExpr *expr, const PartRelationInfo *prel)
 	{
 		WrapperNode *arg;
 
-		arg = walk_expr_tree((Expr *)lfirst(lc), prel);
+		arg = walk_expr_tree((Expr *)lfirst(lc), lrel);
 		result->args = lappend(result->args, arg);
 		switch(expr->boolop)
 		{
@@ -1069,11 +3269,16 @@ handle_boolexpr(const BoolExpr *expr, const PartRelationInfo *prel)
 				result->rangeset = irange_list_intersect(result->rangeset, arg->rangeset);
 				break;
 			default:
-				result->rangeset = list_make1_irange(make_irange(0, prel->children_count - 1, false));
+				result->rangeset = list_make1_irange(make_irange(0, lrel->prel.children_count - 1, false));
 				break;
 		}
 	}
 
+	/* Conditions on several columns of composite key are combined */
+	if (expr->boolop == AND_EXPR && lrel->prel.keys_count > 1)
+		result->rangeset = irange_list_intersect(result->rangeset,
+									make_composite_rangeset(lrel, expr->args));
+
 	return result;
 }
 
@@ -1081,19 +3286,23 @@ handle_boolexpr(const BoolExpr *expr, const PartRelationInfo *prel)
  * Scalar array expression
  */
 static WrapperNode *
-handle_arrexpr(const ScalarArrayOpExpr *expr, const PartRelationInfo *prel)
+handle_arrexpr(const ScalarArrayOpExpr *expr, LocalRelationInfo *lrel)
 {
 	WrapperNode *result = (WrapperNode *)palloc(sizeof(WrapperNode));
 	Node		*varnode = (Node *) linitial(expr->args);
 	Node		*arraynode = (Node *) lsecond(expr->args);
-	int			 hash;
 
 	result->orig = (const Node *)expr;
 	result->args = NIL;
 
-	if (varnode == NULL || !IsA(varnode, Var))
+	/* Only IN (...) on the key is pruned */
+	if (varnode == NULL || !is_partitioning_key(lrel, varnode) ||
+		!expr->useOr || !key_values_prunable(lrel) ||
+		get_element_type(exprType(arraynode)) != lrel->prel.atttype ||
+		get_local_operator_info(lrel, 0, expr->opno,
+								lrel->prel.atttype)->strategy != BTEqualStrategyNumber)
 	{
-		result->rangeset = list_make1_irange(make_irange(0, prel->children_count - 1, true));
+		result->rangeset = list_make1_irange(make_irange(0, lrel->prel.children_count - 1, true));
 		return result;
 	}
 
@@ -1123,9 +3332,12 @@ handle_arrexpr(const ScalarArrayOpExpr *expr, const PartRelationInfo *prel)
 		/* Construct OIDs list */
 		for (i = 0; i < num_elems; i++)
 		{
-			hash = make_hash(prel, elem_values[i]);
+			/* NULL never matches */
+			if (elem_nulls[i])
+				continue;
+
 			result->rangeset = irange_list_union(result->rangeset,
-						list_make1_irange(make_irange(hash, hash, true)));
+						make_key_value_rangeset(lrel, elem_values[i]));
 		}
 
 		/* Free resources */
@@ -1135,7 +3347,7 @@ handle_arrexpr(const ScalarArrayOpExpr *expr, const PartRelationInfo *prel)
 		return result;
 	}
 
-	result->rangeset = list_make1_irange(make_irange(0, prel->children_count - 1, true));
+	result->rangeset = list_make1_irange(make_irange(0, lrel->prel.children_count - 1, true));
 	return result;
 }
 
@@ -1217,6 +3429,7 @@ set_append_rel_pathlist(PlannerInfo *root, RelOptInfo *rel,
 	List	   *live_childrels = NIL;
 	List	   *subpaths = NIL;
 	bool		subpaths_valid = true;
+	RelOptInfo *template_rel = NULL;
 	ListCell   *l;
 
 	/*
@@ -1251,7 +3464,18 @@ set_append_rel_pathlist(PlannerInfo *root, RelOptInfo *rel,
 		}
 		else
 		{
-			set_plain_rel_pathlist(root, childrel, childRTE);
+			/*
+			 * Partitions usually have the same structure, so paths built for
+			 * the previous partition can be reused if restrictions and size
+			 * are similar as well. Only costs have to be estimated again
+			 */
+			if (!pathman_enable_template_paths || template_rel == NULL ||
+				!child_rels_similar(template_rel, childrel) ||
+				!clone_template_paths(root, template_rel, childrel))
+			{
+				set_plain_rel_pathlist(root, childrel, childRTE);
+				template_rel = childrel;
+			}
 		}
 		set_cheapest(childrel);
 
@@ -1288,6 +3512,319 @@ set_append_rel_pathlist(PlannerInfo *root, RelOptInfo *rel,
 
 }
 
+/*
+ * Checks whether paths of the template partition are applicable to another
+ * partition: restrictions and indexes must be the same. Sizes must be close,
+ * otherwise paths which lost to others on the template (e.g. index scan of
+ * almost empty partition) might be the best ones for the partition
+ */
+static bool
+child_rels_similar(RelOptInfo *template_rel, RelOptInfo *childrel)
+{
+	ListCell   *lc1,
+			   *lc2;
+
+	if (template_rel->max_attr != childrel->max_attr ||
+		!bms_is_empty(childrel->lateral_relids) ||
+		list_length(template_rel->baserestrictinfo) != list_length(childrel->baserestrictinfo) ||
+		list_length(template_rel->indexlist) != list_length(childrel->indexlist) ||
+		childrel->pages > 2 * template_rel->pages ||
+		template_rel->pages > 2 * childrel->pages)
+		return false;
+
+	forboth(lc1, template_rel->baserestrictinfo, lc2, childrel->baserestrictinfo)
+	{
+		Node *clause;
+
+		/* One-time filters don't affect scan paths */
+		if (((RestrictInfo *) lfirst(lc1))->pseudoconstant &&
+			((RestrictInfo *) lfirst(lc2))->pseudoconstant)
+			continue;
+
+		clause = copyObject(((RestrictInfo *) lfirst(lc1))->clause);
+
+		change_varnos(clause, template_rel->relid, childrel->relid);
+		if (!equal(clause, ((RestrictInfo *) lfirst(lc2))->clause))
+			return false;
+	}
+
+	forboth(lc1, template_rel->indexlist, lc2, childrel->indexlist)
+		if (!indexes_similar((IndexOptInfo *) lfirst(lc1),
+							 (IndexOptInfo *) lfirst(lc2)))
+			return false;
+
+	return true;
+}
+
+static bool
+indexes_similar(IndexOptInfo *index1, IndexOptInfo *index2)
+{
+	int		i;
+
+	/* Expressions and predicates would have to be compared as well */
+	if (index1->indexprs != NIL || index2->indexprs != NIL ||
+		index1->indpred != NIL || index2->indpred != NIL)
+		return false;
+
+	if (index1->relam != index2->relam ||
+		index1->ncolumns != index2->ncolumns ||
+		index1->unique != index2->unique)
+		return false;
+
+	for (i = 0; i < index1->ncolumns; i++)
+		if (index1->indexkeys[i] != index2->indexkeys[i] ||
+			index1->opfamily[i] != index2->opfamily[i])
+			return false;
+
+	return true;
+}
+
+/*
+ * Rebuilds every path of the template partition for another partition and
+ * lets add_path() choose among them by the partition's own costs. Returns
+ * false if some path can't be reproduced, in which case paths have to be
+ * generated from scratch
+ */
+static bool
+clone_template_paths(PlannerInfo *root, RelOptInfo *template_rel,
+					 RelOptInfo *childrel)
+{
+	List	   *paths = NIL;
+	ListCell   *lc;
+
+	/* Join clauses of parameterized paths aren't mapped to the partition */
+	if (template_rel->pathlist == NIL || template_rel->ppilist != NIL)
+		return false;
+
+	foreach(lc, template_rel->pathlist)
+	{
+		Path	   *path = clone_template_path(root, template_rel, childrel,
+											   (Path *) lfirst(lc));
+
+		if (path == NULL)
+			return false;
+		paths = lappend(paths, path);
+	}
+
+	foreach(lc, paths)
+		add_path(childrel, (Path *) lfirst(lc));
+
+	return true;
+}
+
+/*
+ * Builds the same kind of path as the template one for another partition.
+ * Returns NULL if path can't be reproduced
+ */
+static Path *
+clone_template_path(PlannerInfo *root, RelOptInfo *template_rel,
+					RelOptInfo *childrel, Path *template_path)
+{
+	Path	   *path;
+
+	if (template_path->param_info != NULL)
+		return NULL;
+
+	switch (template_path->pathtype)
+	{
+		case T_SeqScan:
+#if PG_VERSION_NUM >= 90600
+			path = create_seqscan_path(root, childrel, NULL, 0);
+#else
+			path = create_seqscan_path(root, childrel, NULL);
+#endif
+			set_pathkeys(root, childrel, path);
+			return path;
+
+		case T_IndexScan:
+		case T_IndexOnlyScan:
+			return (Path *) clone_index_path(root, template_rel, childrel,
+											 (IndexPath *) template_path);
+
+		case T_BitmapHeapScan:
+			{
+				BitmapHeapPath *bpath = (BitmapHeapPath *) template_path;
+				Path	   *bitmapqual;
+
+				bitmapqual = clone_bitmap_qual(root, template_rel, childrel,
+											   bpath->bitmapqual);
+				if (bitmapqual == NULL)
+					return NULL;
+
+				return (Path *) create_bitmap_heap_path(root, childrel, bitmapqual,
+														NULL, 1.0);
+			}
+
+		case T_TidScan:
+			{
+				List	   *tidquals = copyObject(((TidPath *) template_path)->tidquals);
+
+				change_varnos((Node *) tidquals, template_rel->relid, childrel->relid);
+				return (Path *) create_tidscan_path(root, childrel, tidquals, NULL);
+			}
+
+		default:
+			return NULL;
+	}
+}
+
+/*
+ * Builds the same tree of bitmap index scans as the template one for another
+ * partition. Returns NULL if some scan can't be reproduced
+ */
+static Path *
+clone_bitmap_qual(PlannerInfo *root, RelOptInfo *template_rel,
+				  RelOptInfo *childrel, Path *bitmapqual)
+{
+	List	   *bitmapquals = NIL;
+	List	   *template_quals;
+	ListCell   *lc;
+
+	if (IsA(bitmapqual, IndexPath))
+		return (Path *) clone_index_path(root, template_rel, childrel,
+										 (IndexPath *) bitmapqual);
+	else if (IsA(bitmapqual, BitmapAndPath))
+		template_quals = ((BitmapAndPath *) bitmapqual)->bitmapquals;
+	else if (IsA(bitmapqual, BitmapOrPath))
+		template_quals = ((BitmapOrPath *) bitmapqual)->bitmapquals;
+	else
+		return NULL;
+
+	foreach(lc, template_quals)
+	{
+		Path	   *qual = clone_bitmap_qual(root, template_rel, childrel,
+											 (Path *) lfirst(lc));
+
+		if (qual == NULL)
+			return NULL;
+		bitmapquals = lappend(bitmapquals, qual);
+	}
+
+	if (IsA(bitmapqual, BitmapAndPath))
+		return (Path *) create_bitmap_and_path(root, childrel, bitmapquals);
+	return (Path *) create_bitmap_or_path(root, childrel, bitmapquals);
+}
+
+/*
+ * Builds index path (plain or bitmap one) on the same index of another
+ * partition. Returns NULL if path can't be reproduced
+ */
+static IndexPath *
+clone_index_path(PlannerInfo *root, RelOptInfo *template_rel,
+				 RelOptInfo *childrel, IndexPath *ipath)
+{
+	IndexOptInfo *index;
+	List	   *indexclauses = NIL;
+	ListCell   *lc;
+	int			pos;
+
+	/* Clauses must map to index columns one-to-one */
+	if (ipath->indexorderbys != NIL ||
+		list_length(ipath->indexclauses) != list_length(ipath->indexqualcols))
+		return NULL;
+
+	/* Indexes follow in the same order */
+	pos = list_position_ptr(template_rel->indexlist, ipath->indexinfo);
+	if (pos < 0)
+		return NULL;
+	index = (IndexOptInfo *) list_nth(childrel->indexlist, pos);
+
+	foreach(lc, ipath->indexclauses)
+	{
+		RestrictInfo *rinfo;
+
+		rinfo = map_template_rinfo((Node *) template_rel->baserestrictinfo,
+								   (Node *) childrel->baserestrictinfo,
+								   (RestrictInfo *) lfirst(lc));
+		if (rinfo == NULL)
+			return NULL;
+		indexclauses = lappend(indexclauses, rinfo);
+	}
+
+	return create_index_path(root, index,
+							 indexclauses,
+							 list_copy(ipath->indexqualcols),
+							 NIL,
+							 NIL,
+							 ipath->path.pathkeys,
+							 ipath->indexscandir,
+							 ipath->path.pathtype == T_IndexOnlyScan,
+							 NULL,
+							 1.0);
+}
+
+/*
+ * Finds the restriction of partition which corresponds to the template one.
+ * Restrictions follow in the same order and arms of OR clauses (which bitmap
+ * scans use) have the same structure, so both trees are walked together
+ */
+static RestrictInfo *
+map_template_rinfo(Node *template_node, Node *child_node, RestrictInfo *rinfo)
+{
+	List	   *template_list;
+	List	   *child_list;
+	ListCell   *lc1,
+			   *lc2;
+
+	if (template_node == NULL || child_node == NULL)
+		return NULL;
+
+	if (template_node == (Node *) rinfo)
+		return IsA(child_node, RestrictInfo) ? (RestrictInfo *) child_node : NULL;
+
+	if (IsA(template_node, RestrictInfo) && IsA(child_node, RestrictInfo))
+		return map_template_rinfo((Node *) ((RestrictInfo *) template_node)->orclause,
+								  (Node *) ((RestrictInfo *) child_node)->orclause,
+								  rinfo);
+
+	if (IsA(template_node, BoolExpr) && IsA(child_node, BoolExpr))
+	{
+		template_list = ((BoolExpr *) template_node)->args;
+		child_list = ((BoolExpr *) child_node)->args;
+	}
+	else if (IsA(template_node, List) && IsA(child_node, List))
+	{
+		template_list = (List *) template_node;
+		child_list = (List *) child_node;
+	}
+	else
+		return NULL;
+
+	if (list_length(template_list) != list_length(child_list))
+		return NULL;
+
+	forboth(lc1, template_list, lc2, child_list)
+	{
+		RestrictInfo *found = map_template_rinfo((Node *) lfirst(lc1),
+												 (Node *) lfirst(lc2),
+												 rinfo);
+
+		if (found != NULL)
+			return found;
+	}
+
+	return NULL;
+}
+
+/*
+ * Returns position of pointer in the list or -1 if it isn't there
+ */
+static int
+list_position_ptr(List *list, void *datum)
+{
+	ListCell   *lc;
+	int			i = 0;
+
+	foreach(lc, list)
+	{
+		if (lfirst(lc) == datum)
+			return i;
+		i++;
+	}
+
+	return -1;
+}
+
 void
 set_pathkeys(PlannerInfo *root, RelOptInfo *childrel, Path *path)
 {
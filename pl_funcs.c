@@ -14,23 +14,72 @@
 #include "utils/snapmgr.h"
 #include "access/nbtree.h"
 #include "access/xact.h"
+#include "access/htup_details.h"
+#include "access/sysattr.h"
+#include "catalog/namespace.h"
 #include "catalog/pg_type.h"
+#include "commands/trigger.h"
 #include "executor/spi.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/clauses.h"
+#include "optimizer/var.h"
+#include "parser/parser.h"
+#include "parser/parse_collate.h"
+#include "parser/parse_expr.h"
+#include "parser/parse_relation.h"
 #include "storage/lmgr.h"
+#include "tcop/tcopprot.h"
+#include "utils/syscache.h"
+#include "utils/inval.h"
+#include "utils/datum.h"
+#include "utils/memutils.h"
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "utils/rel.h"
+#include "utils/relcache.h"
+#include "catalog/pg_am.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "utils/builtins.h"
+#include "utils/ruleutils.h"
+#include "utils/timestamp.h"
 
 
 /* declarations */
 PG_FUNCTION_INFO_V1( on_partitions_created );
 PG_FUNCTION_INFO_V1( on_partitions_updated );
 PG_FUNCTION_INFO_V1( on_partitions_removed );
+PG_FUNCTION_INFO_V1( on_partition_attached );
+PG_FUNCTION_INFO_V1( on_partition_detached );
+PG_FUNCTION_INFO_V1( on_zone_maps_updated );
+PG_FUNCTION_INFO_V1( on_zone_map_refreshed );
+PG_FUNCTION_INFO_V1( is_zone_map_valid );
+PG_FUNCTION_INFO_V1( get_zone_maps_epoch );
+PG_FUNCTION_INFO_V1( zone_map_trigger_func );
 PG_FUNCTION_INFO_V1( find_or_create_range_partition);
+PG_FUNCTION_INFO_V1( find_list_partition );
+PG_FUNCTION_INFO_V1( find_leaf_partition_sql );
+PG_FUNCTION_INFO_V1( get_partitioning_key_sql );
+PG_FUNCTION_INFO_V1( is_key_expression );
+PG_FUNCTION_INFO_V1( deparse_key_expression );
+PG_FUNCTION_INFO_V1( get_key_type );
 PG_FUNCTION_INFO_V1( get_range_by_idx );
 PG_FUNCTION_INFO_V1( get_partition_range );
 PG_FUNCTION_INFO_V1( acquire_partitions_lock );
 PG_FUNCTION_INFO_V1( release_partitions_lock );
 PG_FUNCTION_INFO_V1( check_overlap );
+PG_FUNCTION_INFO_V1( get_hash );
+PG_FUNCTION_INFO_V1( is_type_hashable );
+PG_FUNCTION_INFO_V1( global_index_match );
+PG_FUNCTION_INFO_V1( key_values_match );
 PG_FUNCTION_INFO_V1( get_min_range_value );
 PG_FUNCTION_INFO_V1( get_max_range_value );
+PG_FUNCTION_INFO_V1( partition_table_concurrently );
+PG_FUNCTION_INFO_V1( drain_default_partition );
+PG_FUNCTION_INFO_V1( resume_hash_split );
+PG_FUNCTION_INFO_V1( stop_concurrent_part_task );
+PG_FUNCTION_INFO_V1( wait_concurrent_part_task );
+PG_FUNCTION_INFO_V1( show_concurrent_part_tasks );
 
 /*
  * Callbacks
@@ -38,11 +87,13 @@ PG_FUNCTION_INFO_V1( get_max_range_value );
 Datum
 on_partitions_created(PG_FUNCTION_ARGS)
 {
+	Oid		relid;
+
 	LWLockAcquire(pmstate->load_config_lock, LW_EXCLUSIVE);
 
-	/* Reload config */
-	/* TODO: reload just the specified relation */
-	load_relations_hashtable(false);
+	/* Load config for the specified relation only */
+	relid = DatumGetObjectId(PG_GETARG_DATUM(0));
+	load_relation_info(relid);
 
 	LWLockRelease(pmstate->load_config_lock);
 
@@ -61,14 +112,43 @@ on_partitions_updated(PG_FUNCTION_ARGS)
 	if (prel != NULL)
 	{
 		LWLockAcquire(pmstate->load_config_lock, LW_EXCLUSIVE);
-		remove_relation_info(relid);
-		load_relations_hashtable(false);
+		load_relation_info(relid);
 		LWLockRelease(pmstate->load_config_lock);
 	}
 
 	PG_RETURN_NULL();
 }
 
+/*
+ * Single partition has been attached to (or detached from) the parent.
+ * Apply the change to cache without reloading the whole relation
+ */
+Datum
+on_partition_attached(PG_FUNCTION_ARGS)
+{
+	Oid		parent_oid = DatumGetObjectId(PG_GETARG_DATUM(0));
+	Oid		child_oid = DatumGetObjectId(PG_GETARG_DATUM(1));
+
+	LWLockAcquire(pmstate->load_config_lock, LW_EXCLUSIVE);
+	add_partition_info(parent_oid, child_oid);
+	LWLockRelease(pmstate->load_config_lock);
+
+	PG_RETURN_NULL();
+}
+
+Datum
+on_partition_detached(PG_FUNCTION_ARGS)
+{
+	Oid		parent_oid = DatumGetObjectId(PG_GETARG_DATUM(0));
+	Oid		child_oid = DatumGetObjectId(PG_GETARG_DATUM(1));
+
+	LWLockAcquire(pmstate->load_config_lock, LW_EXCLUSIVE);
+	remove_partition_info(parent_oid, child_oid);
+	LWLockRelease(pmstate->load_config_lock);
+
+	PG_RETURN_NULL();
+}
+
 Datum
 on_partitions_removed(PG_FUNCTION_ARGS)
 {
@@ -85,6 +165,84 @@ on_partitions_removed(PG_FUNCTION_ARGS)
 	PG_RETURN_NULL();
 }
 
+/*
+ * Zone maps of the relation have been added, refreshed or dropped
+ */
+Datum
+on_zone_maps_updated(PG_FUNCTION_ARGS)
+{
+	Oid					relid = DatumGetObjectId(PG_GETARG_DATUM(0));
+	PartRelationInfo   *prel;
+	Snapshot			snapshot;
+
+	prel = get_pathman_relation_info(relid, NULL);
+	if (prel != NULL)
+	{
+		snapshot = RegisterSnapshot(GetLatestSnapshot());
+		LWLockAcquire(pmstate->load_config_lock, LW_EXCLUSIVE);
+		load_zone_maps(relid, snapshot);
+		LWLockRelease(pmstate->load_config_lock);
+		UnregisterSnapshot(snapshot);
+
+		/* Cached plans may skip partitions which aren't described anymore */
+		CacheInvalidateRelcacheByRelid(relid);
+	}
+
+	PG_RETURN_NULL();
+}
+
+/*
+ * Zone maps of the partition have been recomputed by current transaction
+ */
+Datum
+on_zone_map_refreshed(PG_FUNCTION_ARGS)
+{
+	zone_maps_refreshed(PG_GETARG_OID(0), PG_GETARG_OID(1));
+
+	PG_RETURN_NULL();
+}
+
+/*
+ * Returns true if the partition hasn't been modified since its zone maps
+ * were computed
+ */
+Datum
+is_zone_map_valid(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(zone_maps_valid(PG_GETARG_OID(0), PG_GETARG_OID(1)));
+}
+
+/*
+ * Returns current epoch of zone maps, see PathmanState
+ */
+Datum
+get_zone_maps_epoch(PG_FUNCTION_ARGS)
+{
+	int64		epoch;
+
+	LWLockAcquire(pmstate->load_config_lock, LW_SHARED);
+	epoch = pmstate->zone_maps_epoch;
+	LWLockRelease(pmstate->load_config_lock);
+
+	PG_RETURN_INT64(epoch);
+}
+
+/*
+ * Statement trigger on partitions with zone maps
+ */
+Datum
+zone_map_trigger_func(PG_FUNCTION_ARGS)
+{
+	TriggerData *trigdata = (TriggerData *) fcinfo->context;
+
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		elog(ERROR, "zone_map_trigger_func() must be called as trigger");
+
+	mark_zone_maps_dirty(RelationGetRelid(trigdata->tg_relation));
+
+	PG_RETURN_POINTER(NULL);
+}
+
 /*
  * Returns partition oid for specified parent relid and value.
  * In case when partition isn't exist try to create one.
@@ -103,16 +261,23 @@ find_or_create_range_partition(PG_FUNCTION_ARGS)
 	PartRelationInfo *prel;
 	Oid				 cmp_proc_oid;
 	FmgrInfo		 cmp_func;
+	Oid				 child_oid = InvalidOid;
+	Oid				 default_oid = InvalidOid;
+	RelationKey		 key;
+	bool			 crashed = false;
 
 	tce = lookup_type_cache(value_type,
 		TYPECACHE_EQ_OPR | TYPECACHE_LT_OPR | TYPECACHE_GT_OPR |
 		TYPECACHE_CMP_PROC | TYPECACHE_CMP_PROC_FINFO);
 
-	prel = get_pathman_relation_info(relid, NULL);
-	rangerel = get_pathman_range_relation(relid, NULL);
-
-	if (!prel || !rangerel)
+	prel = lock_pathman_relation_info(relid, &rangerel, NULL);
+	if (!prel)
 		PG_RETURN_NULL();
+	if (!rangerel)
+	{
+		LWLockRelease(pmstate->load_config_lock);
+		PG_RETURN_NULL();
+	}
 
 	cmp_proc_oid = get_opfamily_proc(tce->btree_opf,
 									 value_type,
@@ -122,63 +287,381 @@ find_or_create_range_partition(PG_FUNCTION_ARGS)
 
 	ranges = dsm_array_get_pointer(&rangerel->ranges);
 	pos = range_binary_search(rangerel, &cmp_func, value, &found);
+	if (found)
+		child_oid = ranges[pos].child_oid;
+	else
+		default_oid = rangerel->default_oid;
+	LWLockRelease(pmstate->load_config_lock);
 
 	/*
-	 * If found then just return oid. Else create new partitions
+	 * If found then just return oid. Else create new partitions (or fill the
+	 * gap if value is between first and last partitions)
 	 */
 	if (found)
-		PG_RETURN_OID(ranges[pos].child_oid);
+		PG_RETURN_OID(child_oid);
 	/*
-	 * If not found and value is between first and last partitions
-	*/
-	if (!found && pos >= 0)
-		PG_RETURN_NULL();
-	else
+	 * If relation has default partition then put the row there and let
+	 * background worker create partitions and move the row
+	 */
+	else if (OidIsValid(default_oid))
 	{
-		Oid		child_oid;
-		bool	crashed = false;
+		start_default_partition_worker(relid, default_oid);
+		PG_RETURN_OID(default_oid);
+	}
 
-		/* Lock config before appending new partitions */
-		LWLockAcquire(pmstate->load_config_lock, LW_EXCLUSIVE);
+	/*
+	 * Wait for concurrent partitioning worker which may be creating
+	 * partitions of the relation. It must be taken before LWLocks
+	 */
+	lock_partitions_creation(relid);
 
-		/* Restrict concurrent partition creation */
-		LWLockAcquire(pmstate->edit_partitions_lock, LW_EXCLUSIVE);
+	/* Restrict concurrent partition creation */
+	LWLockAcquire(pmstate->edit_partitions_lock, LW_EXCLUSIVE);
 
-		/*
-		 * Check if someone else has already created partition.
-		 */
+	/*
+	 * Check if someone else has already created partition. Relation may
+	 * have been unpartitioned while the lock was released as well
+	 */
+	key.dbid = MyDatabaseId;
+	key.relid = relid;
+	found = false;
+	LWLockAcquire(pmstate->load_config_lock, LW_SHARED);
+	rangerel = pathman_hash_search(range_restrictions, &key, HASH_FIND, NULL);
+	if (rangerel != NULL)
+	{
 		ranges = dsm_array_get_pointer(&rangerel->ranges);
 		pos = range_binary_search(rangerel, &cmp_func, value, &found);
 		if (found)
+			child_oid = ranges[pos].child_oid;
+	}
+	LWLockRelease(pmstate->load_config_lock);
+
+	/*
+	 * Start background worker to create new partitions. Config isn't locked
+	 * meanwhile, since the worker updates the cache itself and new partitions
+	 * may be partitioned by the sub-partitioning template, which reloads
+	 * their config
+	 */
+	if (rangerel != NULL && !found)
+	{
+		child_oid = create_partitions_bg_worker(relid, value, value_type,
+												&crashed);
+
+		/* Repeat binary search */
+		if (!crashed)
 		{
-			LWLockRelease(pmstate->edit_partitions_lock);
+			LWLockAcquire(pmstate->load_config_lock, LW_SHARED);
+			rangerel = pathman_hash_search(range_restrictions, &key, HASH_FIND, NULL);
+			if (rangerel != NULL)
+				pos = range_binary_search(rangerel, &cmp_func, value, &found);
+			if (!found)
+				child_oid = InvalidOid;
 			LWLockRelease(pmstate->load_config_lock);
-			PG_RETURN_OID(ranges[pos].child_oid);
 		}
+	}
 
-		/* Start background worker to create new partitions */
-		child_oid = create_partitions_bg_worker(relid, value, value_type, &crashed);
+	/* Release locks */
+	LWLockRelease(pmstate->edit_partitions_lock);
+	unlock_partitions_creation(relid);
 
-		// SPI_connect();
-		// child_oid = create_partitions(relid, value, value_type, &crashed);
-		// SPI_finish();
-		// elog(WARNING, "Worker finished");
+	if (OidIsValid(child_oid) && !crashed)
+		PG_RETURN_OID(child_oid);
 
-		/* Release locks */
-		if (!crashed)
+	PG_RETURN_NULL();
+}
+
+/*
+ * Returns LIST partition for specified parent relid and value or NULL if
+ * there is no such partition
+ */
+Datum
+find_list_partition(PG_FUNCTION_ARGS)
+{
+	Oid					relid = PG_GETARG_OID(0);
+	Datum				value = PG_GETARG_DATUM(1);
+	Oid					value_type = get_fn_expr_argtype(fcinfo->flinfo, 1);
+	PartRelationInfo   *prel;
+	ListRelation	   *listrel;
+	Oid				   *children;
+	Oid					child_oid = InvalidOid;
+	int					idx;
+
+	prel = lock_pathman_relation_info(relid, NULL, &listrel);
+	if (!prel)
+		PG_RETURN_NULL();
+
+	if (listrel && prel->parttype == PT_LIST)
+	{
+		if (value_type != prel->atttype)
+			elog(ERROR, "Value type must be the same as partitioning key type");
+
+		idx = list_partition_lookup(dsm_array_get_pointer(&listrel->map),
+									listrel->map.length,
+									dsm_array_get_pointer(&listrel->values),
+									listrel->by_val, prel->atttype, value);
+		if (idx >= 0)
 		{
-			LWLockRelease(pmstate->edit_partitions_lock);
-			LWLockRelease(pmstate->load_config_lock);
+			children = (Oid *) dsm_array_get_pointer(&prel->children);
+			child_oid = children[idx];
 		}
+	}
+	LWLockRelease(pmstate->load_config_lock);
 
-		/* Repeat binary search */
-		ranges = dsm_array_get_pointer(&rangerel->ranges);
-		pos = range_binary_search(rangerel, &cmp_func, value, &found);
-		if (found)
-			PG_RETURN_OID(child_oid);
+	if (!OidIsValid(child_oid))
+		PG_RETURN_NULL();
+	PG_RETURN_OID(child_oid);
+}
+
+/*
+ * Returns leaf partition for the row if specified partition is partitioned
+ * itself, otherwise the partition
+ */
+Datum
+find_leaf_partition_sql(PG_FUNCTION_ARGS)
+{
+	Oid				relid = PG_GETARG_OID(0);
+	HeapTupleHeader	td = PG_GETARG_HEAPTUPLEHEADER(1);
+	TupleDesc		tupdesc;
+	HeapTupleData	tuple;
+	Oid				result;
+
+	tupdesc = lookup_rowtype_tupdesc(HeapTupleHeaderGetTypeId(td),
+									 HeapTupleHeaderGetTypMod(td));
+	tuple.t_len = HeapTupleHeaderGetDatumLength(td);
+	ItemPointerSetInvalid(&tuple.t_self);
+	tuple.t_tableOid = InvalidOid;
+	tuple.t_data = td;
+
+	result = find_leaf_partition(relid, &tuple, tupdesc);
+	ReleaseTupleDesc(tupdesc);
+
+	PG_RETURN_OID(result);
+}
+
+/*
+ * Returns partitioning key of the row, which is computed for relations
+ * partitioned by key expression
+ */
+Datum
+get_partitioning_key_sql(PG_FUNCTION_ARGS)
+{
+	Oid				relid;
+	HeapTupleHeader	td;
+	TupleDesc		tupdesc;
+	HeapTupleData	tuple;
+	Datum			key;
+	bool			found;
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
+		PG_RETURN_NULL();
+
+	relid = PG_GETARG_OID(0);
+	td = PG_GETARG_HEAPTUPLEHEADER(1);
+	tupdesc = lookup_rowtype_tupdesc(HeapTupleHeaderGetTypeId(td),
+									 HeapTupleHeaderGetTypMod(td));
+	tuple.t_len = HeapTupleHeaderGetDatumLength(td);
+	ItemPointerSetInvalid(&tuple.t_self);
+	tuple.t_tableOid = InvalidOid;
+	tuple.t_data = td;
+
+	found = get_partitioning_key(relid, &tuple, tupdesc, &key);
+	ReleaseTupleDesc(tupdesc);
+
+	if (!found)
+		PG_RETURN_NULL();
+	PG_RETURN_DATUM(key);
+}
+
+/*
+ * Parses partitioning key of the relation, which is either a column name or
+ * an immutable expression of a single column. Returns the key expression
+ * with the relation as the first range table entry. Only the parser is
+ * invoked, so this is safe while the config is being loaded
+ */
+Node *
+parse_partitioning_key(Oid relid, const char *key)
+{
+	char	   *sql = psprintf("SELECT %s", key);
+	List	   *parsetree;
+	SelectStmt *stmt;
+	ParseState *pstate;
+	RangeTblEntry *rte;
+	Relation	rel;
+	Node	   *expr;
+	Bitmapset  *varattnos = NULL;
+
+	parsetree = raw_parser(sql);
+	if (list_length(parsetree) != 1 || !IsA(linitial(parsetree), SelectStmt))
+		elog(ERROR, "Partitioning key '%s' is not an expression", key);
+
+	stmt = (SelectStmt *) linitial(parsetree);
+	if (stmt->op != SETOP_NONE ||
+		list_length(stmt->targetList) != 1 ||
+		stmt->fromClause != NIL || stmt->whereClause != NULL ||
+		stmt->groupClause != NIL || stmt->havingClause != NULL ||
+		stmt->windowClause != NIL || stmt->sortClause != NIL ||
+		stmt->distinctClause != NIL || stmt->intoClause != NULL ||
+		stmt->limitCount != NULL || stmt->limitOffset != NULL ||
+		stmt->lockingClause != NIL || stmt->withClause != NULL)
+		elog(ERROR, "Partitioning key '%s' is not an expression", key);
+
+	pstate = make_parsestate(NULL);
+	pstate->p_sourcetext = sql;
+
+	/* Config may be loaded under LWLock, so don't wait for relation lock */
+	rel = heap_open(relid, NoLock);
+	PG_TRY();
+	{
+		rte = addRangeTableEntryForRelation(pstate, rel, NULL, false, true);
+		addRTEtoQuery(pstate, rte, false, true, true);
+
+		expr = transformExpr(pstate, ((ResTarget *) linitial(stmt->targetList))->val,
+							 EXPR_KIND_SELECT_TARGET);
+		if (pstate->p_hasAggs || pstate->p_hasWindowFuncs ||
+			pstate->p_hasSubLinks || expression_returns_set(expr))
+			elog(ERROR, "Partitioning key '%s' is not an expression", key);
+		assign_expr_collations(pstate, expr);
 	}
+	PG_CATCH();
+	{
+		/* Callers may go on after the error (see load_relations()) */
+		heap_close(rel, NoLock);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+	heap_close(rel, NoLock);
 
-	PG_RETURN_NULL();
+	free_parsestate(pstate);
+
+	expr = eval_const_expressions(NULL, expr);
+	if (contain_mutable_functions(expr))
+		elog(ERROR, "Partitioning key expression must be immutable");
+
+	pull_varattnos(expr, 1, &varattnos);
+	if (bms_membership(varattnos) != BMS_SINGLETON ||
+		bms_singleton_member(varattnos) + FirstLowInvalidHeapAttributeNumber <= 0)
+		elog(ERROR, "Partitioning key expression must refer to exactly one column");
+
+	return expr;
+}
+
+/*
+ * Makes pg_catalog the only schema in search path, so that names of other
+ * objects are schema-qualified by deparsing and have to be qualified while
+ * parsing. Key expressions are kept in pathman_config in this form to be
+ * independent of the search_path of whoever loads the config
+ */
+static void
+push_catalog_search_path(void)
+{
+	OverrideSearchPath *path = GetOverrideSearchPath(CurrentMemoryContext);
+
+	path->schemas = NIL;
+	path->addCatalog = true;
+	path->addTemp = false;
+	PushOverrideSearchPath(path);
+}
+
+/*
+ * Parses partitioning key kept in pathman_config (see deparse_key_expression())
+ */
+Node *
+parse_stored_partitioning_key(Oid relid, const char *key)
+{
+	Node	   *expr;
+
+	push_catalog_search_path();
+	PG_TRY();
+	{
+		expr = parse_partitioning_key(relid, key);
+	}
+	PG_CATCH();
+	{
+		PopOverrideSearchPath();
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+	PopOverrideSearchPath();
+
+	return expr;
+}
+
+/*
+ * Returns source text of key expression to be kept in pathman_config. Names
+ * of functions, operators and types outside of pg_catalog are qualified
+ */
+Datum
+deparse_key_expression(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	char	   *key = text_to_cstring(PG_GETARG_TEXT_P(1));
+	Node	   *expr = parse_partitioning_key(relid, key);
+	char	   *result;
+
+	push_catalog_search_path();
+	PG_TRY();
+	{
+		result = deparse_expression(expr,
+									deparse_context_for(get_rel_name(relid), relid),
+									false, false);
+	}
+	PG_CATCH();
+	{
+		PopOverrideSearchPath();
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+	PopOverrideSearchPath();
+
+	PG_RETURN_TEXT_P(cstring_to_text(result));
+}
+
+/*
+ * Returns true if partitioning key is an expression rather than a column.
+ * Checks that expression is immutable and its column is NOT NULL
+ */
+Datum
+is_key_expression(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	char	   *key = text_to_cstring(PG_GETARG_TEXT_P(1));
+	Node	   *expr = parse_partitioning_key(relid, key);
+	Bitmapset  *varattnos = NULL;
+	AttrNumber	attnum;
+	HeapTuple	atttup;
+	bool		notnull;
+
+	if (IsA(expr, Var))
+		PG_RETURN_BOOL(false);
+
+	/* Rows are routed by the column, so it can't be NULL as well */
+	pull_varattnos(expr, 1, &varattnos);
+	attnum = bms_singleton_member(varattnos) + FirstLowInvalidHeapAttributeNumber;
+	atttup = SearchSysCache2(ATTNUM, ObjectIdGetDatum(relid),
+							 Int16GetDatum(attnum));
+	if (!HeapTupleIsValid(atttup))
+		elog(ERROR, "Cache lookup failed for attribute %d of relation %u",
+			 attnum, relid);
+	notnull = ((Form_pg_attribute) GETSTRUCT(atttup))->attnotnull;
+	ReleaseSysCache(atttup);
+
+	if (!notnull)
+		elog(ERROR, "Partitioning key '%s' must be NOT NULL",
+			 get_attname(relid, attnum));
+
+	PG_RETURN_BOOL(true);
+}
+
+/*
+ * Returns type of partitioning key, which may be a column or an expression
+ */
+Datum
+get_key_type(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	char	   *key = text_to_cstring(PG_GETARG_TEXT_P(1));
+
+	PG_RETURN_OID(exprType(parse_partitioning_key(relid, key)));
 }
 
 /*
@@ -203,24 +686,25 @@ get_partition_range(PG_FUNCTION_ARGS)
 	TypeCacheEntry	   *tce;
 	ArrayType		   *arr;
 
-	prel = get_pathman_relation_info(parent_oid, NULL);
-	
-	rangerel = get_pathman_range_relation(parent_oid, NULL);
-
-	if (!prel || !rangerel)
+	prel = lock_pathman_relation_info(parent_oid, &rangerel, NULL);
+	if (!prel)
 		PG_RETURN_NULL();
 
-	ranges = dsm_array_get_pointer(&rangerel->ranges);
-	tce = lookup_type_cache(prel->atttype, 0);
+	if (rangerel)
+	{
+		ranges = dsm_array_get_pointer(&rangerel->ranges);
+		tce = lookup_type_cache(prel->atttype, 0);
 
-	/* Looking for specified partition */
-	for(i=0; i<rangerel->ranges.length; i++)
-		if (ranges[i].child_oid == child_oid)
-		{
-			found = true;
-			break;
-		}
+		/* Looking for specified partition */
+		for(i=0; i<rangerel->ranges.length; i++)
+			if (ranges[i].child_oid == child_oid)
+			{
+				found = true;
+				break;
+			}
+	}
 
+	/* Array is built while bounds are still locked */
 	if (found)
 	{
 		bool byVal = rangerel->by_val;
@@ -231,8 +715,11 @@ get_partition_range(PG_FUNCTION_ARGS)
 
 		arr = construct_array(elems, nelems, prel->atttype,
 							  tce->typlen, tce->typbyval, tce->typalign);
-		PG_RETURN_ARRAYTYPE_P(arr);
 	}
+	LWLockRelease(pmstate->load_config_lock);
+
+	if (found)
+		PG_RETURN_ARRAYTYPE_P(arr);
 
 	PG_RETURN_NULL();
 }
@@ -256,13 +743,18 @@ get_range_by_idx(PG_FUNCTION_ARGS)
 	RangeEntry		*re;
 	Datum			*elems;
 	TypeCacheEntry	*tce;
+	ArrayType		*arr;
 
-	prel = get_pathman_relation_info(parent_oid, NULL);
-
-	rangerel = get_pathman_range_relation(parent_oid, NULL);
+	prel = lock_pathman_relation_info(parent_oid, &rangerel, NULL);
+	if (!prel)
+		PG_RETURN_NULL();
 
-	if (!prel || !rangerel || idx >= (int)rangerel->ranges.length)
+	if (!rangerel || idx >= (int)rangerel->ranges.length ||
+		rangerel->ranges.length == 0)
+	{
+		LWLockRelease(pmstate->load_config_lock);
 		PG_RETURN_NULL();
+	}
 
 	tce = lookup_type_cache(prel->atttype, 0);
 	ranges = dsm_array_get_pointer(&rangerel->ranges);
@@ -275,9 +767,11 @@ get_range_by_idx(PG_FUNCTION_ARGS)
 	elems[0] = PATHMAN_GET_DATUM(re->min, rangerel->by_val);
 	elems[1] = PATHMAN_GET_DATUM(re->max, rangerel->by_val);
 
-	PG_RETURN_ARRAYTYPE_P(
-		construct_array(elems, 2, prel->atttype,
-						tce->typlen, tce->typbyval, tce->typalign));
+	arr = construct_array(elems, 2, prel->atttype,
+						  tce->typlen, tce->typbyval, tce->typalign);
+	LWLockRelease(pmstate->load_config_lock);
+
+	PG_RETURN_ARRAYTYPE_P(arr);
 }
 
 /*
@@ -291,14 +785,28 @@ get_min_range_value(PG_FUNCTION_ARGS)
 	RangeRelation	*rangerel;
 	RangeEntry		*ranges;
 
-	prel = get_pathman_relation_info(parent_oid, NULL);
-	rangerel = get_pathman_range_relation(parent_oid, NULL);
+	Datum			 result;
+	int16			 typlen;
+	bool			 typbyval;
 
-	if (!prel || !rangerel || prel->parttype != PT_RANGE || rangerel->ranges.length == 0)
+	prel = lock_pathman_relation_info(parent_oid, &rangerel, NULL);
+	if (!prel)
 		PG_RETURN_NULL();
 
+	if (!rangerel || prel->parttype != PT_RANGE || rangerel->ranges.length == 0)
+	{
+		LWLockRelease(pmstate->load_config_lock);
+		PG_RETURN_NULL();
+	}
+
+	/* Bound may be freed once the lock is released */
+	get_typlenbyval(prel->atttype, &typlen, &typbyval);
 	ranges = dsm_array_get_pointer(&rangerel->ranges);
-	PG_RETURN_DATUM(PATHMAN_GET_DATUM(ranges[0].min, rangerel->by_val));
+	result = datumCopy(PATHMAN_GET_DATUM(ranges[0].min, rangerel->by_val),
+					   typbyval, typlen);
+	LWLockRelease(pmstate->load_config_lock);
+
+	PG_RETURN_DATUM(result);
 }
 
 /*
@@ -312,14 +820,341 @@ get_max_range_value(PG_FUNCTION_ARGS)
 	RangeRelation	 *rangerel;
 	RangeEntry		 *ranges;
 
-	prel = get_pathman_relation_info(parent_oid, NULL);
-	rangerel = get_pathman_range_relation(parent_oid, NULL);
+	Datum			 result;
+	int16			 typlen;
+	bool			 typbyval;
 
-	if (!prel || !rangerel || prel->parttype != PT_RANGE || rangerel->ranges.length == 0)
+	prel = lock_pathman_relation_info(parent_oid, &rangerel, NULL);
+	if (!prel)
 		PG_RETURN_NULL();
 
+	if (!rangerel || prel->parttype != PT_RANGE || rangerel->ranges.length == 0)
+	{
+		LWLockRelease(pmstate->load_config_lock);
+		PG_RETURN_NULL();
+	}
+
+	/* Bound may be freed once the lock is released */
+	get_typlenbyval(prel->atttype, &typlen, &typbyval);
 	ranges = dsm_array_get_pointer(&rangerel->ranges);
-	PG_RETURN_DATUM(PATHMAN_GET_DATUM(ranges[rangerel->ranges.length-1].max, rangerel->by_val));
+	result = datumCopy(PATHMAN_GET_DATUM(ranges[rangerel->ranges.length-1].max,
+										 rangerel->by_val),
+					   typbyval, typlen);
+	LWLockRelease(pmstate->load_config_lock);
+
+	PG_RETURN_DATUM(result);
+}
+
+/*
+ * Returns number of HASH partition for the value
+ */
+Datum
+get_hash(PG_FUNCTION_ARGS)
+{
+	Datum	value = PG_GETARG_DATUM(0);
+	Oid		value_type = get_fn_expr_argtype(fcinfo->flinfo, 0);
+	int		partitions_count = PG_GETARG_INT32(1);
+
+	if (partitions_count <= 0)
+		elog(ERROR, "Partitions count must be greater than zero");
+
+	PG_RETURN_INT32(get_hash_part_idx(value, value_type, partitions_count));
+}
+
+/*
+ * Checks if type has default hash function and thus may be used as HASH
+ * partitioning key
+ */
+Datum
+is_type_hashable(PG_FUNCTION_ARGS)
+{
+	Oid				typid = PG_GETARG_OID(0);
+	TypeCacheEntry *tce = lookup_type_cache(typid, TYPECACHE_HASH_PROC);
+
+	PG_RETURN_BOOL(OidIsValid(tce->hash_proc));
+}
+
+/*
+ * Lookups done by one-time filters of partitions scans. They are kept in
+ * memory context of the query which has done them, so that every lookup is
+ * done once per query
+ */
+typedef struct QueryLookups
+{
+	List		   *lookups;
+	MemoryContext	mcxt;
+} QueryLookups;
+
+typedef struct QueryLookupsReset
+{
+	MemoryContextCallback cb;
+	QueryLookups   *cache;
+	MemoryContext	mcxt;
+} QueryLookupsReset;
+
+static void
+reset_query_lookups(void *arg)
+{
+	QueryLookupsReset *reset = (QueryLookupsReset *) arg;
+
+	/* Cache may already belong to another query */
+	if (reset->cache->mcxt == reset->mcxt)
+	{
+		reset->cache->lookups = NIL;
+		reset->cache->mcxt = NULL;
+	}
+}
+
+/*
+ * Returns lookups done by the query owning memory context mcxt. New lookups
+ * are to be allocated in mcxt and appended to cache->lookups
+ */
+static List *
+get_query_lookups(QueryLookups *cache, MemoryContext mcxt)
+{
+	if (cache->mcxt != mcxt)
+	{
+		QueryLookupsReset *reset;
+
+		reset = (QueryLookupsReset *) MemoryContextAlloc(mcxt, sizeof(QueryLookupsReset));
+		reset->cache = cache;
+		reset->mcxt = mcxt;
+		reset->cb.func = reset_query_lookups;
+		reset->cb.arg = (void *) reset;
+		MemoryContextRegisterResetCallback(mcxt, &reset->cb);
+
+		cache->lookups = NIL;
+		cache->mcxt = mcxt;
+	}
+
+	return cache->lookups;
+}
+
+/*
+ * Global index lookup done by the current query
+ */
+typedef struct GlobalIndexLookup
+{
+	Oid			index_relid;
+	Oid			value_type;
+	Datum		value;
+	bool		valid;		/* false if index couldn't be used */
+	Oid			partition;	/* InvalidOid if there is no such value */
+} GlobalIndexLookup;
+
+static QueryLookups global_index_lookups = {NIL, NULL};
+
+/*
+ * Finds partition holding the value using the global index table. Sets
+ * valid to false if the index can't be searched for the value of this type
+ * or holds it more than once
+ */
+static Oid
+global_index_lookup(Oid index_relid, Datum value, Oid value_type, bool *valid)
+{
+	Relation	heap_rel;
+	Relation	index_rel;
+	List	   *indexes;
+	IndexScanDesc scan;
+	ScanKeyData key;
+	HeapTuple	tuple;
+	Oid			eq_opr;
+	Oid			result = InvalidOid;
+
+	*valid = false;
+
+	/* Index may have been dropped concurrently */
+	heap_rel = try_relation_open(index_relid, AccessShareLock);
+	if (heap_rel == NULL)
+		return InvalidOid;
+
+	indexes = RelationGetIndexList(heap_rel);
+	if (list_length(indexes) != 1)
+	{
+		heap_close(heap_rel, AccessShareLock);
+		return InvalidOid;
+	}
+	index_rel = index_open(linitial_oid(indexes), AccessShareLock);
+
+	eq_opr = get_opfamily_member(index_rel->rd_opfamily[0],
+								 index_rel->rd_opcintype[0],
+								 value_type,
+								 BTEqualStrategyNumber);
+	if (index_rel->rd_rel->relam == BTREE_AM_OID && OidIsValid(eq_opr))
+	{
+		ScanKeyEntryInitialize(&key, 0, 1, BTEqualStrategyNumber, value_type,
+							   index_rel->rd_indcollation[0], get_opcode(eq_opr),
+							   value);
+		scan = index_beginscan(heap_rel, index_rel, GetActiveSnapshot(), 1, 0);
+		index_rescan(scan, &key, 1, NULL, 0);
+
+		tuple = index_getnext(scan, ForwardScanDirection);
+		if (tuple != NULL)
+		{
+			bool	isnull;
+			Datum	partition = heap_getattr(tuple, 2, RelationGetDescr(heap_rel),
+											 &isnull);
+
+			if (!isnull)
+				result = DatumGetObjectId(partition);
+
+			/*
+			 * Primary key of the index is deferred, so the value may be held
+			 * by two partitions until the end of transaction which swaps it
+			 */
+			if (index_getnext(scan, ForwardScanDirection) != NULL)
+				result = InvalidOid;
+			else
+				*valid = true;
+		}
+		else
+			*valid = true;
+		index_endscan(scan);
+	}
+
+	index_close(index_rel, AccessShareLock);
+	heap_close(heap_rel, AccessShareLock);
+
+	return result;
+}
+
+/*
+ * Checks if partition may contain the value of the column with global index.
+ * Planner uses it as one-time filter of partitions scans, so the index is
+ * searched once per query and the rest partitions aren't scanned at all
+ */
+Datum
+global_index_match(PG_FUNCTION_ARGS)
+{
+	Oid			index_relid = PG_GETARG_OID(0);
+	Datum		value = PG_GETARG_DATUM(1);
+	Oid			value_type = get_fn_expr_argtype(fcinfo->flinfo, 1);
+	Oid			partition = PG_GETARG_OID(2);
+	MemoryContext mcxt = fcinfo->flinfo->fn_mcxt;
+	GlobalIndexLookup *lookup = NULL;
+	ListCell   *lc;
+	int16		typlen;
+	bool		typbyval;
+
+	get_typlenbyval(value_type, &typlen, &typbyval);
+	foreach(lc, get_query_lookups(&global_index_lookups, mcxt))
+	{
+		GlobalIndexLookup *l = (GlobalIndexLookup *) lfirst(lc);
+
+		if (l->index_relid == index_relid && l->value_type == value_type &&
+			datumIsEqual(l->value, value, typbyval, typlen))
+		{
+			lookup = l;
+			break;
+		}
+	}
+
+	if (lookup == NULL)
+	{
+		MemoryContext old_mcxt = MemoryContextSwitchTo(mcxt);
+
+		lookup = (GlobalIndexLookup *) palloc(sizeof(GlobalIndexLookup));
+		lookup->index_relid = index_relid;
+		lookup->value_type = value_type;
+		lookup->value = datumCopy(value, typbyval, typlen);
+		lookup->partition = global_index_lookup(index_relid, value, value_type,
+												&lookup->valid);
+		global_index_lookups.lookups = lappend(global_index_lookups.lookups, lookup);
+		MemoryContextSwitchTo(old_mcxt);
+	}
+
+	/* Partition has to be scanned if index couldn't be used */
+	PG_RETURN_BOOL(!lookup->valid || lookup->partition == partition);
+}
+
+/*
+ * Partitions found for the key values by the current query
+ */
+typedef struct KeyValuesLookup
+{
+	Oid			parent;
+	ArrayType  *values;
+	bool		valid;		/* false if partitions couldn't be found */
+	Oid		   *partitions;	/* sorted */
+	int			count;
+} KeyValuesLookup;
+
+static QueryLookups key_values_lookups = {NIL, NULL};
+
+/*
+ * Checks if partition may contain rows with any of the key values. Planner
+ * uses it as one-time filter of partitions scans when the values are known
+ * only at execution time. Partitions are found once for the values, so each
+ * partition is checked with a single binary search
+ */
+Datum
+key_values_match(PG_FUNCTION_ARGS)
+{
+	Oid			parent = PG_GETARG_OID(0);
+	Oid			partition = PG_GETARG_OID(1);
+	ArrayType  *values = PG_GETARG_ARRAYTYPE_P(2);
+	MemoryContext mcxt = fcinfo->flinfo->fn_mcxt;
+	KeyValuesLookup *lookup = NULL;
+	ListCell   *lc;
+
+	foreach(lc, get_query_lookups(&key_values_lookups, mcxt))
+	{
+		KeyValuesLookup *l = (KeyValuesLookup *) lfirst(lc);
+
+		if (l->parent == parent && VARSIZE(l->values) == VARSIZE(values) &&
+			memcmp(l->values, values, VARSIZE(values)) == 0)
+		{
+			lookup = l;
+			break;
+		}
+	}
+
+	if (lookup == NULL)
+	{
+		MemoryContext old_mcxt = MemoryContextSwitchTo(mcxt);
+		List	   *partitions;
+		int16		elmlen;
+		bool		elmbyval;
+		char		elmalign;
+		int			num_elems;
+		Datum	   *elem_values;
+		bool	   *elem_nulls;
+
+		lookup = (KeyValuesLookup *) palloc(sizeof(KeyValuesLookup));
+		lookup->parent = parent;
+		lookup->values = (ArrayType *) palloc(VARSIZE(values));
+		memcpy(lookup->values, values, VARSIZE(values));
+		lookup->partitions = NULL;
+		lookup->count = 0;
+
+		get_typlenbyvalalign(ARR_ELEMTYPE(values), &elmlen, &elmbyval, &elmalign);
+		deconstruct_array(values, ARR_ELEMTYPE(values), elmlen, elmbyval,
+						  elmalign, &elem_values, &elem_nulls, &num_elems);
+		lookup->valid = get_key_values_partitions(parent, ARR_ELEMTYPE(values),
+												  elem_values, elem_nulls,
+												  num_elems, &partitions);
+		if (lookup->valid && partitions != NIL)
+		{
+			lookup->partitions = (Oid *) palloc(sizeof(Oid) * list_length(partitions));
+			foreach(lc, partitions)
+				lookup->partitions[lookup->count++] = lfirst_oid(lc);
+			qsort(lookup->partitions, lookup->count, sizeof(Oid), cmp_oids);
+			list_free(partitions);
+		}
+		pfree(elem_values);
+		pfree(elem_nulls);
+
+		key_values_lookups.lookups = lappend(key_values_lookups.lookups, lookup);
+		MemoryContextSwitchTo(old_mcxt);
+	}
+
+	/* Partition has to be scanned if partitions couldn't be found */
+	if (!lookup->valid)
+		PG_RETURN_BOOL(true);
+
+	PG_RETURN_BOOL(lookup->count > 0 &&
+				   bsearch(&partition, lookup->partitions, lookup->count,
+						   sizeof(Oid), cmp_oids) != NULL);
 }
 
 /*
@@ -341,12 +1176,17 @@ check_overlap(PG_FUNCTION_ARGS)
 	FmgrInfo		  cmp_func_2;
 	int i;
 	bool byVal;
+	bool overlap = false;
 
-	prel = get_pathman_relation_info(parent_oid, NULL);
-	rangerel = get_pathman_range_relation(parent_oid, NULL);
+	prel = lock_pathman_relation_info(parent_oid, &rangerel, NULL);
+	if (!prel)
+		PG_RETURN_NULL();
 
-	if (!prel || !rangerel || prel->parttype != PT_RANGE)
+	if (!rangerel || prel->parttype != PT_RANGE)
+	{
+		LWLockRelease(pmstate->load_config_lock);
 		PG_RETURN_NULL();
+	}
 
 	/* comparison functions */
 	cmp_func_1 = *get_cmp_func(p1_type, prel->atttype);
@@ -354,18 +1194,18 @@ check_overlap(PG_FUNCTION_ARGS)
 
 	byVal = rangerel->by_val;
 	ranges = (RangeEntry *) dsm_array_get_pointer(&rangerel->ranges);
-	for (i=0; i<rangerel->ranges.length; i++)
+	for (i=0; i<rangerel->ranges.length && !overlap; i++)
 	{
 		int c1 = FunctionCall2(&cmp_func_1, p1,
 								PATHMAN_GET_DATUM(ranges[i].max, byVal));
 		int c2 = FunctionCall2(&cmp_func_2, p2,
 								PATHMAN_GET_DATUM(ranges[i].min, byVal));
 
-		if (c1 < 0 && c2 > 0)
-			PG_RETURN_BOOL(true);
+		overlap = (c1 < 0 && c2 > 0);
 	}
+	LWLockRelease(pmstate->load_config_lock);
 
-	PG_RETURN_BOOL(false);
+	PG_RETURN_BOOL(overlap);
 }
 
 /*
@@ -384,3 +1224,207 @@ release_partitions_lock(PG_FUNCTION_ARGS)
 	LWLockRelease(pmstate->edit_partitions_lock);
 	PG_RETURN_NULL();
 }
+
+/*
+ * Starts concurrent partitioning workers for the relation
+ */
+Datum
+partition_table_concurrently(PG_FUNCTION_ARGS)
+{
+	Oid		relid = PG_GETARG_OID(0);
+	int		batch_size = PG_GETARG_INT32(1);
+	double	sleep_time = PG_GETARG_FLOAT8(2);
+	int		workers = PG_GETARG_INT32(3);
+
+	if (get_pathman_relation_info(relid, NULL) == NULL)
+		elog(ERROR, "Relation %u isn't partitioned by pg_pathman", relid);
+
+	if (batch_size < 1 || batch_size > 10000)
+		elog(ERROR, "Batch size must be between 1 and 10000");
+
+	if (sleep_time < 0.5)
+		elog(ERROR, "Sleep time must be not less than 0.5");
+
+	start_concurrent_part_workers(relid, batch_size, sleep_time, workers);
+
+	elog(NOTICE, "Worker started. You can stop it with the following command: "
+				 "select stop_concurrent_part_task('%s');",
+		 get_rel_name(relid));
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Starts worker which moves rows from the default partition to proper
+ * partitions. Returns false if relation has no default partition
+ */
+Datum
+drain_default_partition(PG_FUNCTION_ARGS)
+{
+	Oid				relid = PG_GETARG_OID(0);
+	RangeRelation  *rangerel;
+	Oid				default_oid = InvalidOid;
+
+	if (lock_pathman_relation_info(relid, &rangerel, NULL) == NULL)
+		PG_RETURN_BOOL(false);
+	if (rangerel != NULL)
+		default_oid = rangerel->default_oid;
+	LWLockRelease(pmstate->load_config_lock);
+
+	if (!OidIsValid(default_oid))
+		PG_RETURN_BOOL(false);
+
+	if (!start_default_partition_worker(relid, default_oid))
+		elog(ERROR, "Unable to start background worker for pg_pathman");
+
+	PG_RETURN_BOOL(true);
+}
+
+/*
+ * Starts background worker which moves rows to the new HASH partitions
+ * while partitions are being split. If rows have been moved but the worker
+ * has died before validating constraints then validates them right here.
+ * Returns false if there is nothing to do
+ */
+Datum
+resume_hash_split(PG_FUNCTION_ARGS)
+{
+	Oid		relid = PG_GETARG_OID(0);
+
+	if (start_hash_split_worker(relid))
+		PG_RETURN_BOOL(true);
+
+	PG_RETURN_BOOL(validate_hash_split_constraints(relid) > 0);
+}
+
+/*
+ * Asks concurrent partitioning workers to stop after current batch
+ */
+Datum
+stop_concurrent_part_task(PG_FUNCTION_ARGS)
+{
+	Oid		relid = PG_GETARG_OID(0);
+	bool	found = false;
+	int		i;
+
+	for (i = 0; i < PART_WORKER_SLOTS; i++)
+	{
+		ConcurrentPartSlot *slot = &concurrent_part_slots[i];
+
+		SpinLockAcquire(&slot->mutex);
+		if (slot->worker_status == CPS_WORKING &&
+			slot->dbid == MyDatabaseId &&
+			slot->relid == relid)
+		{
+			slot->worker_status = CPS_STOPPING;
+			found = true;
+		}
+		SpinLockRelease(&slot->mutex);
+	}
+
+	PG_RETURN_BOOL(found);
+}
+
+/*
+ * Waits till concurrent partitioning workers of the relation (including the
+ * one which drains default partition or splits HASH partitions) finish
+ */
+Datum
+wait_concurrent_part_task(PG_FUNCTION_ARGS)
+{
+	Oid		relid = PG_GETARG_OID(0);
+	bool	busy = true;
+	int		i;
+
+	while (busy)
+	{
+		busy = false;
+		for (i = 0; i < PART_WORKER_SLOTS; i++)
+		{
+			ConcurrentPartSlot *slot = &concurrent_part_slots[i];
+
+			SpinLockAcquire(&slot->mutex);
+			if (slot->worker_status != CPS_FREE &&
+				slot->dbid == MyDatabaseId &&
+				slot->relid == relid)
+				busy = true;
+			SpinLockRelease(&slot->mutex);
+		}
+
+		if (busy)
+		{
+			CHECK_FOR_INTERRUPTS();
+			pg_usleep(10000L);
+		}
+	}
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Returns the state of concurrent partitioning workers
+ */
+Datum
+show_concurrent_part_tasks(PG_FUNCTION_ARGS)
+{
+	FuncCallContext	   *funcctx;
+	int				   *cur_idx;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext	oldcontext;
+		TupleDesc		tupdesc;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+		funcctx->user_fctx = palloc0(sizeof(int));
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	cur_idx = (int *) funcctx->user_fctx;
+
+	while (*cur_idx < PART_WORKER_SLOTS)
+	{
+		ConcurrentPartSlot *slot = &concurrent_part_slots[(*cur_idx)++];
+		ConcurrentPartSlot	copy;
+		Datum				values[8];
+		bool				nulls[8] = { false };
+		long				secs;
+		int					usecs;
+		double				elapsed;
+		HeapTuple			htup;
+
+		SpinLockAcquire(&slot->mutex);
+		memcpy(&copy, slot, sizeof(ConcurrentPartSlot));
+		SpinLockRelease(&slot->mutex);
+
+		if (copy.worker_status == CPS_FREE)
+			continue;
+
+		TimestampDifference(copy.start_time, GetCurrentTimestamp(), &secs, &usecs);
+		elapsed = secs + usecs / 1000000.0;
+
+		values[0] = ObjectIdGetDatum(copy.userid);
+		values[1] = Int32GetDatum(copy.pid);
+		values[2] = ObjectIdGetDatum(copy.dbid);
+		values[3] = ObjectIdGetDatum(copy.relid);
+		values[4] = Int64GetDatum(copy.total_rows);
+		values[5] = Int64GetDatum(copy.estimated_rows > copy.total_rows ?
+								  (int64) (copy.estimated_rows - copy.total_rows) : 0);
+		values[6] = Float8GetDatum(elapsed > 0 ? copy.total_rows / elapsed : 0);
+		values[7] = CStringGetTextDatum(copy.worker_status == CPS_WORKING ?
+										"working" : "stopping");
+
+		htup = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(htup));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
@@ -16,7 +16,8 @@ CREATE OR REPLACE FUNCTION @extschema@.create_range_partitions(
 	, p_attribute TEXT
 	, p_start_value ANYELEMENT
 	, p_interval INTERVAL
-	, p_count INTEGER DEFAULT NULL)
+	, p_count INTEGER DEFAULT NULL
+	, p_partition_data BOOLEAN DEFAULT TRUE)
 RETURNS INTEGER AS
 $$
 DECLARE
@@ -26,7 +27,7 @@ DECLARE
 	i INTEGER;
 BEGIN
 	p_relation := @extschema@.validate_relname(p_relation);
-	p_attribute := lower(p_attribute);
+	p_attribute := @extschema@.normalize_partitioning_key(p_relation, p_attribute);
 	PERFORM @extschema@.common_relation_checks(p_relation, p_attribute);
 
 	/* Try to determine partitions count if not set */
@@ -52,7 +53,7 @@ BEGIN
 	END IF;
 
 	/* Check boundaries */
-	EXECUTE format('SELECT @extschema@.check_boundaries(''%s'', ''%s'', ''%s'', ''%s''::%s)'
+	EXECUTE format('SELECT @extschema@.check_boundaries(%L, %L, %L, %L::%s)'
 				   , p_relation
 				   , p_attribute
 				   , p_start_value
@@ -83,7 +84,9 @@ BEGIN
 	PERFORM @extschema@.on_create_partitions(p_relation::regclass::oid);
 
 	/* Copy data */
-	PERFORM @extschema@.partition_data(p_relation);
+	IF p_partition_data THEN
+		PERFORM @extschema@.partition_data(p_relation);
+	END IF;
 
 	RETURN p_count;
 
@@ -101,7 +104,8 @@ CREATE OR REPLACE FUNCTION @extschema@.create_range_partitions(
 	, p_attribute TEXT
 	, p_start_value ANYELEMENT
 	, p_interval ANYELEMENT
-	, p_count INTEGER DEFAULT NULL)
+	, p_count INTEGER DEFAULT NULL
+	, p_partition_data BOOLEAN DEFAULT TRUE)
 RETURNS INTEGER AS
 $$
 DECLARE
@@ -111,7 +115,7 @@ DECLARE
 	i INTEGER;
 BEGIN
 	p_relation := @extschema@.validate_relname(p_relation);
-	p_attribute := lower(p_attribute);
+	p_attribute := @extschema@.normalize_partitioning_key(p_relation, p_attribute);
 	PERFORM @extschema@.common_relation_checks(p_relation, p_attribute);
 
 	IF p_count <= 0 THEN
@@ -169,7 +173,9 @@ BEGIN
 	PERFORM @extschema@.on_create_partitions(p_relation::regclass::oid);
 
 	/* Copy data */
-	PERFORM @extschema@.partition_data(p_relation);
+	IF p_partition_data THEN
+		PERFORM @extschema@.partition_data(p_relation);
+	END IF;
 
 	RETURN p_count;
 
@@ -187,7 +193,8 @@ CREATE OR REPLACE FUNCTION @extschema@.create_partitions_from_range(
 	, p_attribute TEXT
 	, p_start_value ANYELEMENT
 	, p_end_value ANYELEMENT
-	, p_interval ANYELEMENT)
+	, p_interval ANYELEMENT
+	, p_partition_data BOOLEAN DEFAULT TRUE)
 RETURNS INTEGER AS
 $$
 DECLARE
@@ -197,7 +204,7 @@ DECLARE
 	i INTEGER := 0;
 BEGIN
 	p_relation := @extschema@.validate_relname(p_relation);
-	p_attribute := lower(p_attribute);
+	p_attribute := @extschema@.normalize_partitioning_key(p_relation, p_attribute);
 	PERFORM @extschema@.common_relation_checks(p_relation, p_attribute);
 
 	IF p_interval <= 0 THEN
@@ -233,7 +240,9 @@ BEGIN
 	PERFORM @extschema@.on_create_partitions(p_relation::regclass::oid);
 
 	/* Copy data */
-	PERFORM @extschema@.partition_data(p_relation);
+	IF p_partition_data THEN
+		PERFORM @extschema@.partition_data(p_relation);
+	END IF;
 
 	RETURN i;
 
@@ -251,7 +260,8 @@ CREATE OR REPLACE FUNCTION @extschema@.create_partitions_from_range(
 	, p_attribute TEXT
 	, p_start_value ANYELEMENT
 	, p_end_value ANYELEMENT
-	, p_interval INTERVAL)
+	, p_interval INTERVAL
+	, p_partition_data BOOLEAN DEFAULT TRUE)
 RETURNS INTEGER AS
 $$
 DECLARE
@@ -261,7 +271,7 @@ DECLARE
 	i INTEGER := 0;
 BEGIN
 	p_relation := @extschema@.validate_relname(p_relation);
-	p_attribute := lower(p_attribute);
+	p_attribute := @extschema@.normalize_partitioning_key(p_relation, p_attribute);
 	PERFORM @extschema@.common_relation_checks(p_relation, p_attribute);
 
 	EXECUTE format('DROP SEQUENCE IF EXISTS %s_seq', p_relation);
@@ -292,7 +302,9 @@ BEGIN
 	PERFORM @extschema@.on_create_partitions(p_relation::regclass::oid);
 
 	/* Copy data */
-	PERFORM @extschema@.partition_data(p_relation);
+	IF p_partition_data THEN
+		PERFORM @extschema@.partition_data(p_relation);
+	END IF;
 
 	RETURN i;
 
@@ -374,6 +386,31 @@ END
 $$
 LANGUAGE plpgsql;
 
+/*
+ * Saves bounds of RANGE partition to pathman_partition_bounds. Bounds are
+ * stored in ISO DateStyle so that they can be read in any session
+ */
+CREATE OR REPLACE FUNCTION @extschema@.set_range_partition_bounds(
+	p_parent REGCLASS
+	, p_partition REGCLASS
+	, p_start_value ANYELEMENT
+	, p_end_value ANYELEMENT)
+RETURNS VOID AS
+$$
+BEGIN
+	INSERT INTO @extschema@.pathman_partition_bounds
+		(partition, parent, lower_bound, upper_bound)
+	VALUES (p_partition, p_parent, p_start_value::text, p_end_value::text)
+	ON CONFLICT (partition) DO UPDATE
+	SET parent = EXCLUDED.parent
+		, lower_bound = EXCLUDED.lower_bound
+		, upper_bound = EXCLUDED.upper_bound
+		, hash_idx = NULL;
+END
+$$
+LANGUAGE plpgsql
+SET DateStyle = 'ISO';
+
 /*
  * Creates new RANGE partition. Returns partition name
  */
@@ -423,6 +460,7 @@ BEGIN
     EXECUTE format('ALTER TABLE %s INHERIT %s'
                    , v_child_relname
                    , p_parent_relname);
+    PERFORM @extschema@.add_global_index_partition(p_parent_relname::regclass, v_child_relname::regclass);
 
     v_cond := @extschema@.get_range_condition(v_attname, p_start_value, p_end_value);
     v_sql := format('ALTER TABLE %s ADD CONSTRAINT %s_check CHECK (%s)'
@@ -431,6 +469,12 @@ BEGIN
                     , v_cond);
 
     EXECUTE v_sql;
+    PERFORM @extschema@.set_range_partition_bounds(p_parent_relname::regclass
+                                                   , v_child_relname::regclass
+                                                   , p_start_value
+                                                   , p_end_value);
+    PERFORM @extschema@.apply_subpartition_template(p_parent_relname::regclass
+                                                    , v_child_relname::regclass);
     -- RAISE NOTICE 'partition % created', v_child_relname;
     RETURN v_child_relname;
 END
@@ -509,6 +553,10 @@ BEGIN
 				   , p_partition
 				   , @extschema@.get_schema_qualified_name(p_partition::regclass)
 				   , v_cond);
+	PERFORM @extschema@.set_range_partition_bounds(v_parent_relid::regclass
+												   , v_child_relid::regclass
+												   , p_range[1]
+												   , p_value);
 
 	/* Tell backend to reload configuration */
 	PERFORM @extschema@.on_update_partitions(v_parent_relid::oid);
@@ -622,6 +670,10 @@ BEGIN
 				   , p_part1_relid::regclass::text
 				   , @extschema@.get_schema_qualified_name(p_part1_relid::regclass)
 				   , v_cond);
+	PERFORM @extschema@.set_range_partition_bounds(p_parent_relid::regclass
+												   , p_part1_relid::regclass
+												   , least(p_range[1], p_range[3])
+												   , greatest(p_range[2], p_range[4]));
 
 	/* Copy data from second partition to the first one */
 	RAISE NOTICE 'Copying data...';
@@ -665,7 +717,8 @@ BEGIN
 	USING p_relation, v_atttype, v_interval;
 
 	/* Invalidate cache */
-	PERFORM @extschema@.on_update_partitions(p_relation::regclass::oid);
+	PERFORM @extschema@.on_attach_partition(p_relation::regclass::oid,
+											v_part_name::regclass::oid);
 
 	/* Release lock */
 	PERFORM @extschema@.release_partitions_lock();
@@ -735,7 +788,8 @@ BEGIN
 	USING p_relation, v_atttype, v_interval;
 
 	/* Invalidate cache */
-	PERFORM @extschema@.on_update_partitions(p_relation::regclass::oid);
+	PERFORM @extschema@.on_attach_partition(p_relation::regclass::oid,
+											v_part_name::regclass::oid);
 
 	/* Release lock */
 	PERFORM @extschema@.release_partitions_lock();
@@ -811,7 +865,8 @@ BEGIN
 
 	/* Create new partition */
 	v_part_name := @extschema@.create_single_range_partition(p_relation, p_start_value, p_end_value);
-	PERFORM @extschema@.on_update_partitions(p_relation::regclass::oid);
+	PERFORM @extschema@.on_attach_partition(p_relation::regclass::oid,
+											v_part_name::regclass::oid);
 
 	/* Release lock */
 	PERFORM @extschema@.release_partitions_lock();
@@ -837,6 +892,7 @@ $$
 DECLARE
 	v_part_name TEXT;
 	v_parent TEXT;
+	v_part_relid OID;
 	v_count INTEGER;
 BEGIN
 	/* Prevent concurrent partition management */
@@ -851,8 +907,9 @@ BEGIN
 	END IF;
 
 	/* Drop table and update cache */
+	v_part_relid := p_partition::regclass::oid;
 	EXECUTE format('DROP TABLE %s', p_partition);
-	PERFORM @extschema@.on_update_partitions(v_parent::regclass::oid);
+	PERFORM @extschema@.on_detach_partition(v_parent::regclass::oid, v_part_relid);
 
 	/* Release lock */
 	PERFORM @extschema@.release_partitions_lock();
@@ -898,6 +955,7 @@ BEGIN
 	EXECUTE format('ALTER TABLE %s INHERIT %s'
 				   , p_partition
 				   , p_relation);
+	PERFORM @extschema@.add_global_index_partition(p_relation::regclass, p_partition::regclass);
 
 	/* Set check constraint */
 	v_attname := attname FROM @extschema@.pathman_config WHERE relname = p_relation;
@@ -906,9 +964,14 @@ BEGIN
 				   , p_partition
 				   , @extschema@.get_schema_qualified_name(p_partition::regclass)
 				   , v_cond);
+	PERFORM @extschema@.set_range_partition_bounds(p_relation::regclass
+												   , p_partition::regclass
+												   , p_start_value
+												   , p_end_value);
 
 	/* Invalidate cache */
-	PERFORM @extschema@.on_update_partitions(p_relation::regclass::oid);
+	PERFORM @extschema@.on_attach_partition(p_relation::regclass::oid,
+											p_partition::regclass::oid);
 
 	/* Release lock */
 	PERFORM @extschema@.release_partitions_lock();
@@ -948,9 +1011,17 @@ BEGIN
 	EXECUTE format('ALTER TABLE %s DROP CONSTRAINT %s_check'
 				   , p_partition
 				   , @extschema@.get_schema_qualified_name(p_partition::regclass));
+	DELETE FROM @extschema@.pathman_partition_bounds
+	WHERE partition = p_partition::regclass;
+	DELETE FROM @extschema@.pathman_zone_maps
+	WHERE partition = p_partition::regclass;
+	PERFORM @extschema@.remove_global_index_partition(v_parent::regclass,
+													  p_partition::regclass);
+	EXECUTE format('DROP TRIGGER IF EXISTS zone_map_trigger ON %s', p_partition);
 
 	/* Invalidate cache */
-	PERFORM @extschema@.on_update_partitions(v_parent::regclass::oid);
+	PERFORM @extschema@.on_detach_partition(v_parent::regclass::oid,
+											p_partition::regclass::oid);
 
 	/* Release lock */
 	PERFORM @extschema@.release_partitions_lock();
@@ -964,6 +1035,117 @@ $$
 LANGUAGE plpgsql;
 
 
+/*
+ * Creates default partition. It takes rows which don't fit any existing
+ * partition so that inserts don't wait for new partitions to be created.
+ * Background worker then creates proper partitions and moves rows there.
+ */
+CREATE OR REPLACE FUNCTION @extschema@.create_default_partition(
+	p_relation TEXT)
+RETURNS TEXT AS
+$$
+DECLARE
+	v_child_relname TEXT;
+	v_namespace OID;
+	v_schema TEXT;
+	v_relname TEXT;
+BEGIN
+	p_relation := @extschema@.validate_relname(p_relation);
+
+	IF NOT EXISTS (SELECT * FROM @extschema@.pathman_config
+				   WHERE relname = p_relation AND parttype = 2) THEN
+		RAISE EXCEPTION 'Relation "%" isn''t partitioned by RANGE', p_relation;
+	END IF;
+
+	IF EXISTS (SELECT * FROM @extschema@.pathman_config
+			   WHERE relname = p_relation AND default_partition IS NOT NULL) THEN
+		RAISE EXCEPTION 'Relation "%" already has default partition', p_relation;
+	END IF;
+
+	SELECT relnamespace, nspname, relname || '_default'
+	INTO v_namespace, v_schema, v_relname
+	FROM pg_class JOIN pg_namespace ON pg_namespace.oid = relnamespace
+	WHERE pg_class.oid = p_relation::regclass;
+
+	/* Name would be truncated otherwise */
+	IF octet_length(v_relname) >= 64 THEN
+		RAISE EXCEPTION 'Name of default partition "%" is too long', v_relname;
+	END IF;
+
+	IF EXISTS (SELECT * FROM pg_class
+			   WHERE relnamespace = v_namespace AND relname = v_relname) THEN
+		RAISE EXCEPTION 'Relation "%.%" already exists', v_schema, v_relname;
+	END IF;
+
+	/* Quoted the same way as object_identity of dropped objects */
+	v_child_relname := format('%I.%I', v_schema, v_relname);
+
+	EXECUTE format('CREATE TABLE %s (LIKE %s INCLUDING ALL)'
+				   , v_child_relname
+				   , p_relation);
+
+	EXECUTE format('ALTER TABLE %s INHERIT %s'
+				   , v_child_relname
+				   , p_relation);
+	PERFORM @extschema@.add_global_index_partition(p_relation::regclass, v_child_relname::regclass);
+
+	UPDATE @extschema@.pathman_config SET default_partition = v_child_relname
+	WHERE relname = p_relation;
+
+	/* Invalidate cache */
+	PERFORM @extschema@.on_update_partitions(p_relation::regclass::oid);
+
+	RETURN v_child_relname;
+END
+$$
+LANGUAGE plpgsql;
+
+
+/*
+ * Drops default partition. Its rows are moved to RANGE partitions (which
+ * are created if needed) unless delete_data is true
+ */
+CREATE OR REPLACE FUNCTION @extschema@.drop_default_partition(
+	p_relation TEXT
+	, delete_data BOOLEAN DEFAULT FALSE)
+RETURNS TEXT AS
+$$
+DECLARE
+	v_child_relname TEXT;
+	v_rows INTEGER;
+BEGIN
+	p_relation := @extschema@.validate_relname(p_relation);
+
+	v_child_relname := default_partition FROM @extschema@.pathman_config
+					   WHERE relname = p_relation;
+
+	IF v_child_relname IS NULL THEN
+		RAISE EXCEPTION 'Relation "%" has no default partition', p_relation;
+	END IF;
+
+	/* Forget default partition so that insert trigger creates partitions */
+	UPDATE @extschema@.pathman_config SET default_partition = NULL
+	WHERE relname = p_relation;
+	PERFORM @extschema@.on_update_partitions(p_relation::regclass::oid);
+
+	IF NOT delete_data THEN
+		/* Insert trigger returns NULL, so deleted rows are counted */
+		EXECUTE format('WITH part_data AS (DELETE FROM %s RETURNING *),
+							 moved AS (INSERT INTO %s SELECT * FROM part_data)
+						SELECT count(*) FROM part_data'
+					   , v_child_relname
+					   , p_relation)
+		INTO v_rows;
+		RAISE NOTICE '% rows copied from %', v_rows, v_child_relname;
+	END IF;
+
+	EXECUTE format('DROP TABLE %s', v_child_relname);
+
+	RETURN v_child_relname;
+END
+$$
+LANGUAGE plpgsql;
+
 /*
  * Creates range partitioning insert trigger
  */
@@ -981,11 +1163,13 @@ DECLARE
 			v_part_relid OID;
 		BEGIN
 			IF TG_OP = ''INSERT'' THEN
-				IF NEW.%2$s IS NULL THEN
+				IF %2$s IS NULL THEN
 					RAISE EXCEPTION ''ERROR: NULL value in partitioning key'';
 				END IF;
-				v_part_relid := @extschema@.find_or_create_range_partition(TG_RELID, NEW.%2$s);
+				v_part_relid := @extschema@.find_or_create_range_partition(TG_RELID, %2$s);
 				IF NOT v_part_relid IS NULL THEN
+					/* Partition may be partitioned itself */
+					v_part_relid := @extschema@.find_leaf_partition(v_part_relid, NEW);
 					EXECUTE format(''INSERT INTO %%s SELECT $1.*'', v_part_relid::regclass)
 					USING NEW;
 				ELSE
@@ -1000,7 +1184,7 @@ DECLARE
 		BEFORE INSERT ON %s
 		FOR EACH ROW EXECUTE PROCEDURE %2$s_insert_trigger_func();';
 BEGIN
-	v_func := format(v_func, v_relation, v_attname);
+	v_func := format(v_func, v_relation, @extschema@.get_key_accessor(v_relation, v_attname));
 	v_trigger := format(v_trigger, @extschema@.get_schema_qualified_name(v_relation::regclass), v_relation);
 
 	EXECUTE v_func;
@@ -1028,7 +1212,7 @@ DECLARE
 			q TEXT;
 		BEGIN
 			old_oid := TG_RELID;
-			new_oid := @extschema@.find_or_create_range_partition(''%1$s''::regclass::oid, NEW.%2$s);
+			new_oid := @extschema@.find_or_create_range_partition(''%1$s''::regclass::oid, %2$s);
 			IF old_oid = new_oid THEN RETURN NEW; END IF;
 			q := format(''DELETE FROM %%s WHERE %4$s'', old_oid::regclass::text);
 			EXECUTE q USING %5$s;
@@ -1066,8 +1250,8 @@ BEGIN
 		   att_fmt;
 
 	attr := attname FROM @extschema@.pathman_config WHERE relname = relation;
-	EXECUTE format(func, relation, attr, 0, att_val_fmt,
-				   old_fields, att_fmt, new_fields);
+	EXECUTE format(func, relation, @extschema@.get_key_accessor(relation, attr), 0
+				   , att_val_fmt, old_fields, att_fmt, new_fields);
 	FOR rec in (SELECT * FROM pg_inherits WHERE inhparent = relation::regclass::oid)
 	LOOP
 		EXECUTE format(trigger
@@ -1143,84 +1327,248 @@ $$ LANGUAGE plpgsql;
 
 /*
  * Internal function used to create new partitions on insert or update trigger.
- * Invoked from C-function find_or_create_range_partition().
+ * Creates partitions for all the bounds passed at once and returns their
+ * oids in the same order. Invoked from C-function create_partitions().
  */
-CREATE OR REPLACE FUNCTION @extschema@.append_partitions_on_demand_internal(
+CREATE OR REPLACE FUNCTION @extschema@.create_range_partitions_internal(
 	p_relid OID
-	, p_new_value ANYELEMENT)
-RETURNS OID AS
+	, p_start_values ANYARRAY
+	, p_end_values ANYARRAY)
+RETURNS OID[] AS
 $$
 DECLARE
 	v_relation TEXT;
-	v_cnt INTEGER := 0;
-	i INTEGER := 0;
-	v_part TEXT;
-	v_interval TEXT;
-	v_attname TEXT;
-	v_min p_new_value%TYPE;
-	v_max p_new_value%TYPE;
-	v_cur_value p_new_value%TYPE;
-	v_next_value p_new_value%TYPE;
-	v_is_date BOOLEAN;
+	v_result OID[] := '{}';
 BEGIN
-	v_relation := @extschema@.validate_relname(p_relid::regclass::text);
+	v_relation := @extschema@.get_schema_qualified_name(p_relid::regclass, '.');
 
-	/* get attribute name and interval */
-	SELECT attname, range_interval INTO v_attname, v_interval
-	FROM @extschema@.pathman_config WHERE relname = v_relation;
+	FOR i IN 1..array_length(p_start_values, 1)
+	LOOP
+		v_result := array_append(v_result,
+			@extschema@.create_single_range_partition(v_relation
+													  , p_start_values[i]
+													  , p_end_values[i])::regclass::oid);
+	END LOOP;
 
-	v_min := @extschema@.get_min_range_value(p_relid::regclass::oid, p_new_value);
-	v_max := @extschema@.get_max_range_value(p_relid::regclass::oid, p_new_value);
+	RETURN v_result;
+END
+$$ LANGUAGE plpgsql;
 
-	v_is_date := @extschema@.is_date(pg_typeof(p_new_value)::regtype);
 
-	IF p_new_value >= v_max THEN
-		v_cur_value := v_max;
-		WHILE v_cur_value <= p_new_value AND i < 1000
-		LOOP
-			IF v_is_date THEN
-				v_next_value := v_cur_value + v_interval::interval;
-			ELSE
-				EXECUTE format('SELECT $1 + $2::%s', pg_typeof(p_new_value))
-				USING v_cur_value, v_interval
-				INTO v_next_value;
-			END IF;
+/*
+ * Creates RANGE partitioning by several columns. Rows are compared with
+ * partitions' bounds lexicographically; partitions are added with
+ * add_composite_range_partition()
+ */
+CREATE OR REPLACE FUNCTION @extschema@.create_composite_range_partitions(
+	relation TEXT
+	, attributes TEXT[])
+RETURNS VOID AS
+$$
+DECLARE
+	v_type TEXT;
+	i INTEGER;
+BEGIN
+	relation := @extschema@.validate_relname(relation);
 
-			v_part := @extschema@.create_single_range_partition(
-							@extschema@.get_schema_qualified_name(p_relid::regclass, '.')
-							, v_cur_value
-							, v_next_value);
-			i := i + 1;
-			v_cur_value := v_next_value;
-			RAISE NOTICE 'partition % created', v_part;
-		END LOOP;
-	ELSIF p_new_value <= v_min THEN
-		v_cur_value := v_min;
-		WHILE v_cur_value >= p_new_value AND i < 1000
-		LOOP
-			IF v_is_date THEN
-				v_next_value := v_cur_value - v_interval::interval;
-			ELSE
-				EXECUTE format('SELECT $1 - $2::%s', pg_typeof(p_new_value))
-				USING v_cur_value, v_interval
-				INTO v_next_value;
-			END IF;
+	IF coalesce(array_length(attributes, 1), 0) NOT BETWEEN 2 AND 4 THEN
+		RAISE EXCEPTION 'Composite key must consist of 2 to 4 columns';
+	END IF;
 
-			v_part := @extschema@.create_single_range_partition(
-							@extschema@.get_schema_qualified_name(p_relid::regclass, '.')
-							, v_next_value
-							, v_cur_value);
-			i := i + 1;
-			v_cur_value := v_next_value;
-			RAISE NOTICE 'partition % created', v_part;
-		END LOOP;
-	ELSE
-		RAISE NOTICE 'Not implemented yet';
+	FOR i IN array_lower(attributes, 1)..array_upper(attributes, 1)
+	LOOP
+		IF @extschema@.is_key_expression(relation::regclass, attributes[i]) THEN
+			RAISE EXCEPTION 'Composite key must consist of columns';
+		END IF;
+		attributes[i] := lower(attributes[i]);
+		PERFORM @extschema@.common_relation_checks(relation, attributes[i]);
+
+		v_type := @extschema@.get_attribute_type_name(relation, attributes[i]);
+		IF (SELECT typlen NOT BETWEEN 1 AND 8 FROM pg_type
+			WHERE oid = v_type::regtype) THEN
+			RAISE EXCEPTION 'Attribute type % is not supported in composite key', v_type;
+		END IF;
+	END LOOP;
+
+	/* Create sequence for child partitions names */
+	EXECUTE format('DROP SEQUENCE IF EXISTS %s_seq', relation);
+	EXECUTE format('CREATE SEQUENCE %s_seq START 1', relation);
+
+	/* Insert new entry to pathman config */
+	INSERT INTO @extschema@.pathman_config (relname, attname, parttype)
+	VALUES (relation, array_to_string(attributes, ','), 2);
+
+	/* Create triggers */
+	PERFORM @extschema@.create_composite_range_insert_trigger(relation);
+
+	/* Notify backend about changes */
+	PERFORM @extschema@.on_create_partitions(relation::regclass::oid);
+END
+$$ LANGUAGE plpgsql;
+
+/*
+ * Returns composite key values as literals casted to the key columns' types
+ */
+CREATE OR REPLACE FUNCTION @extschema@.get_composite_key_literals(
+	p_relation TEXT
+	, p_values TEXT[])
+RETURNS TEXT[] AS
+$$
+DECLARE
+	v_attnames TEXT[];
+	v_items TEXT[] := '{}';
+	i INTEGER;
+BEGIN
+	v_attnames := string_to_array(attname, ',') FROM @extschema@.pathman_config
+				  WHERE relname = p_relation;
+
+	IF array_length(p_values, 1) IS DISTINCT FROM array_length(v_attnames, 1) THEN
+		RAISE EXCEPTION 'Bound must contain a value for every key column';
 	END IF;
 
-	IF i > 0 THEN
-		RETURN v_part::regclass::oid;
+	FOR i IN 1..array_length(v_attnames, 1)
+	LOOP
+		v_items := array_append(v_items, format('%L::%s'
+							, p_values[i]
+							, @extschema@.get_attribute_type_name(p_relation, v_attnames[i])));
+	END LOOP;
+
+	RETURN v_items;
+END
+$$ LANGUAGE plpgsql;
+
+/*
+ * Adds RANGE partition for composite key bounds [p_start_values, p_end_values).
+ * Returns partition name
+ */
+CREATE OR REPLACE FUNCTION @extschema@.add_composite_range_partition(
+	relation TEXT
+	, p_start_values TEXT[]
+	, p_end_values TEXT[])
+RETURNS TEXT AS
+$$
+DECLARE
+	v_attnames TEXT[];
+	v_start TEXT;
+	v_end TEXT;
+	v_start_values TEXT[];
+	v_end_values TEXT[];
+	v_child_relname TEXT;
+	v_rec RECORD;
+	v_overlap BOOLEAN;
+BEGIN
+	relation := @extschema@.validate_relname(relation);
+
+	v_attnames := string_to_array(attname, ',') FROM @extschema@.pathman_config
+				  WHERE relname = relation AND parttype = 2;
+	IF coalesce(array_length(v_attnames, 1), 0) < 2 THEN
+		RAISE EXCEPTION 'Relation "%" isn''t partitioned by composite key', relation;
 	END IF;
-	RETURN NULL;
+
+	/* Wait for running inserts so that rows don't miss the new partition */
+	EXECUTE format('LOCK TABLE %s IN SHARE ROW EXCLUSIVE MODE', relation);
+
+	v_start := array_to_string(
+		@extschema@.get_composite_key_literals(relation, p_start_values), ', ');
+	v_end := array_to_string(
+		@extschema@.get_composite_key_literals(relation, p_end_values), ', ');
+
+	/* Bounds are stored in text representation of the key types */
+	EXECUTE format('SELECT ARRAY[%1$s]::TEXT[], ARRAY[%2$s]::TEXT[], ROW(%1$s) >= ROW(%2$s)'
+				   , v_start
+				   , v_end)
+	INTO v_start_values, v_end_values, v_overlap;
+
+	IF v_overlap THEN
+		RAISE EXCEPTION 'Lower bound must be less than upper bound';
+	END IF;
+
+	FOR v_rec IN (SELECT lower_bound, upper_bound
+				  FROM @extschema@.pathman_partition_bounds
+				  WHERE parent = relation::regclass)
+	LOOP
+		EXECUTE format('SELECT ROW(%s) < ROW(%s) AND ROW(%s) < ROW(%s)'
+					   , v_start
+					   , array_to_string(@extschema@.get_composite_key_literals(
+							relation, v_rec.upper_bound::TEXT[]), ', ')
+					   , array_to_string(@extschema@.get_composite_key_literals(
+							relation, v_rec.lower_bound::TEXT[]), ', ')
+					   , v_end)
+		INTO v_overlap;
+
+		IF v_overlap THEN
+			RAISE EXCEPTION 'Specified range overlaps with existing partitions';
+		END IF;
+	END LOOP;
+
+	v_child_relname := format('%s_%s'
+							  , relation
+							  , nextval(format('%s_seq', relation)));
+
+	EXECUTE format('CREATE TABLE %s (LIKE %s INCLUDING ALL)'
+				   , v_child_relname
+				   , relation);
+
+	EXECUTE format('ALTER TABLE %s INHERIT %s'
+				   , v_child_relname
+				   , relation);
+	PERFORM @extschema@.add_global_index_partition(relation::regclass, v_child_relname::regclass);
+
+	EXECUTE format('ALTER TABLE %s ADD CONSTRAINT %s_check CHECK (ROW(%3$s) >= ROW(%4$s) AND ROW(%3$s) < ROW(%5$s))'
+				   , v_child_relname
+				   , @extschema@.get_schema_qualified_name(v_child_relname::regclass)
+				   , array_to_string(v_attnames, ', ')
+				   , v_start
+				   , v_end);
+
+	INSERT INTO @extschema@.pathman_partition_bounds
+		(partition, parent, lower_bound, upper_bound)
+	VALUES (v_child_relname::regclass, relation::regclass
+			, v_start_values::TEXT, v_end_values::TEXT);
+
+	/* Notify backend about changes */
+	PERFORM @extschema@.on_update_partitions(relation::regclass::oid);
+
+	RETURN v_child_relname;
+END
+$$
+LANGUAGE plpgsql
+SET DateStyle = 'ISO';
+
+/*
+ * Creates composite RANGE partitioning insert trigger
+ */
+CREATE OR REPLACE FUNCTION @extschema@.create_composite_range_insert_trigger(
+	v_relation TEXT)
+RETURNS VOID AS
+$$
+DECLARE
+	v_func TEXT := '
+		CREATE OR REPLACE FUNCTION %s_insert_trigger_func()
+		RETURNS TRIGGER
+		AS $body$
+		DECLARE
+			v_part_relid OID;
+		BEGIN
+			/* Leaf partition is found at once by all the key columns */
+			v_part_relid := @extschema@.find_leaf_partition(TG_RELID, NEW);
+			IF v_part_relid = TG_RELID THEN
+				RAISE EXCEPTION ''ERROR: Cannot find partition'';
+			END IF;
+			EXECUTE format(''INSERT INTO %%s SELECT $1.*'', v_part_relid::regclass)
+			USING NEW;
+			RETURN NULL;
+		END
+		$body$ LANGUAGE plpgsql;';
+	v_trigger TEXT := '
+		CREATE TRIGGER %s_insert_trigger
+		BEFORE INSERT ON %s
+		FOR EACH ROW EXECUTE PROCEDURE %2$s_insert_trigger_func();';
+BEGIN
+	v_func := format(v_func, v_relation);
+	v_trigger := format(v_trigger, @extschema@.get_schema_qualified_name(v_relation::regclass), v_relation);
+
+	EXECUTE v_func;
+	EXECUTE v_trigger;
 END
 $$ LANGUAGE plpgsql;
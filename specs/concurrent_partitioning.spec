@@ -0,0 +1,34 @@
+setup
+{
+	CREATE EXTENSION pg_pathman;
+	CREATE TABLE range_rel(id INTEGER NOT NULL);
+	INSERT INTO range_rel SELECT generate_series(1, 10000);
+	SELECT create_range_partitions('range_rel', 'id', 1, 1000, 10, FALSE);
+	CREATE FUNCTION try_partition() RETURNS BOOLEAN AS $$
+	BEGIN
+		PERFORM partition_table_concurrently('range_rel', 10, 1.0, 2);
+		RETURN TRUE;
+	EXCEPTION WHEN others THEN
+		RETURN FALSE;
+	END
+	$$ LANGUAGE plpgsql;
+}
+
+teardown
+{
+	SELECT wait_concurrent_part_task('range_rel');
+	DROP FUNCTION try_partition();
+	DROP TABLE range_rel CASCADE;
+	DROP EXTENSION pg_pathman;
+}
+
+session "s1"
+step "s1_start" { SELECT try_partition(); }
+step "s1_stop" { SELECT stop_concurrent_part_task('range_rel'); }
+
+session "s2"
+step "s2_start" { SELECT try_partition(); }
+step "s2_tasks" { SELECT count(*) FROM pathman_concurrent_part_tasks WHERE relid = 'range_rel'::regclass; }
+
+# Relation is partitioned by a single set of workers, the second caller is refused
+permutation "s1_start" "s2_start" "s2_tasks" "s1_stop"
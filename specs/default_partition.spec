@@ -0,0 +1,30 @@
+setup
+{
+	CREATE EXTENSION pg_pathman;
+	CREATE TABLE range_rel(id INTEGER NOT NULL);
+	SELECT create_range_partitions('range_rel', 'id', 1, 100, 1);
+	SELECT create_default_partition('range_rel');
+	INSERT INTO range_rel VALUES (50);
+}
+
+teardown
+{
+	SELECT wait_concurrent_part_task('range_rel');
+	SELECT drop_default_partition('range_rel', TRUE);
+	SELECT drop_range_partitions('range_rel');
+	DROP TABLE range_rel CASCADE;
+	DROP EXTENSION pg_pathman;
+}
+
+session "s1"
+step "s1b" { BEGIN; }
+step "s1_insert_150" { INSERT INTO range_rel VALUES (150); }
+step "s1_sleep" { SELECT pg_sleep(2); }
+step "s1c" { COMMIT; }
+
+session "s2"
+step "s2_wait" { SELECT wait_concurrent_part_task('range_rel'); }
+step "s2_show" { SELECT tableoid::regclass, id FROM range_rel ORDER BY id; }
+
+# Worker doesn't see the row till the writer commits, so it has to wait for it
+permutation "s1b" "s1_insert_150" "s1_sleep" "s1c" "s2_wait" "s2_show"
@@ -0,0 +1,24 @@
+setup
+{
+	CREATE EXTENSION pg_pathman;
+	CREATE TABLE range_rel(id INTEGER NOT NULL);
+	SELECT create_range_partitions('range_rel', 'id', 1, 100, 1);
+}
+
+teardown
+{
+	SELECT drop_range_partitions('range_rel');
+	DROP TABLE range_rel CASCADE;
+	DROP EXTENSION pg_pathman;
+}
+
+session "s1"
+step "s1b" { BEGIN; }
+step "s1_append" { SELECT append_range_partition('range_rel') IS NOT NULL; }
+step "s1r" { ROLLBACK; }
+
+session "s2"
+step "s2_explain" { EXPLAIN (COSTS OFF) SELECT * FROM range_rel WHERE id > 50; }
+
+# Partition appended by aborted transaction disappears from the plans of others
+permutation "s2_explain" "s1b" "s1_append" "s1r" "s2_explain"
@@ -0,0 +1,40 @@
+setup
+{
+	CREATE EXTENSION pg_pathman;
+	CREATE TABLE zone_rel(id INTEGER NOT NULL, order_id INTEGER);
+	SELECT create_range_partitions('zone_rel', 'id', 1, 10, 2);
+	INSERT INTO zone_rel SELECT g, g FROM generate_series(1, 20) AS g;
+	SELECT add_zone_map('zone_rel', 'order_id');
+	ANALYZE zone_rel;
+}
+
+teardown
+{
+	SELECT drop_range_partitions('zone_rel');
+	DROP TABLE zone_rel CASCADE;
+	DROP EXTENSION pg_pathman;
+}
+
+session "s1"
+step "s1b" { BEGIN; }
+step "s1_insert_p1" { INSERT INTO zone_rel VALUES (5, 1000); }
+step "s1_insert_p2" { INSERT INTO zone_rel VALUES (15, 1000); }
+step "s1_count" { SELECT count(*) FROM zone_rel WHERE order_id > 1000; }
+step "s1_show_valid" { SELECT partition, is_zone_map_valid(parent, partition) AS valid FROM pathman_zone_maps ORDER BY partition::text; }
+step "s1c" { COMMIT; }
+
+session "s2"
+step "s2b" { BEGIN; }
+step "s2_insert_p1" { INSERT INTO zone_rel VALUES (6, 2000); }
+step "s2_insert_p2" { INSERT INTO zone_rel VALUES (16, 1000); }
+step "s2_refresh" { SELECT refresh_zone_maps('zone_rel'); }
+step "s2c" { COMMIT; }
+
+# Writers invalidate zone maps of the same partitions in opposite order
+permutation "s1b" "s2b" "s1_insert_p1" "s2_insert_p2" "s1_insert_p2" "s2_insert_p1" "s1c" "s2c" "s1_count" "s1_show_valid"
+
+# Refresh waits for the writer and includes its rows
+permutation "s1b" "s1_insert_p1" "s2_refresh" "s1c" "s1_count" "s1_show_valid"
+
+# Rows written after refresh in the same transaction keep the partition dirty
+permutation "s1_insert_p1" "s2b" "s2_refresh" "s2_insert_p1" "s2c" "s1_show_valid" "s1_count"
@@ -4,6 +4,10 @@ CREATE SCHEMA pathman;
 CREATE EXTENSION pg_pathman SCHEMA pathman;
 CREATE SCHEMA test;
 
+/* Lazy loading is set for the whole server only */
+SET pg_pathman.lazy_loading = ON;
+SHOW pg_pathman.lazy_loading;
+
 CREATE TABLE test.hash_rel (
 	id		SERIAL PRIMARY KEY,
 	value	INTEGER);
@@ -123,6 +127,8 @@ SELECT pathman.merge_range_partitions('test.range_rel_1', 'test.range_rel_' || c
 SELECT pathman.append_range_partition('test.num_range_rel');
 SELECT pathman.prepend_range_partition('test.num_range_rel');
 SELECT pathman.drop_range_partition('test.num_range_rel_7');
+SELECT partition, lower_bound, upper_bound FROM pathman.pathman_partition_bounds
+WHERE parent = 'test.num_range_rel'::regclass ORDER BY lower_bound::INT;
 
 SELECT pathman.append_range_partition('test.range_rel');
 SELECT pathman.prepend_range_partition('test.range_rel');
@@ -159,6 +165,276 @@ SELECT pathman.drop_hash_partitions('test.hash_rel', TRUE);
 SELECT COUNT(*) FROM ONLY test.hash_rel;
 DROP TABLE test.hash_rel CASCADE;
 
+/* HASH partitioning by TEXT key */
+CREATE TABLE test.hash_text (id SERIAL, val TEXT NOT NULL);
+INSERT INTO test.hash_text (val) SELECT md5(g::text) FROM generate_series(1, 100) AS g;
+SELECT pathman.create_hash_partitions('test.hash_text', 'val', 4);
+SELECT COUNT(*) FROM ONLY test.hash_text;
+CREATE OR REPLACE FUNCTION test.check_hash_text() RETURNS BOOLEAN AS $$
+DECLARE
+	v_val TEXT;
+	v_cnt INTEGER;
+BEGIN
+	FOR v_val IN SELECT val FROM test.hash_text
+	LOOP
+		EXECUTE format('SELECT COUNT(*) FROM test.hash_text WHERE val = %L', v_val) INTO v_cnt;
+		IF v_cnt != 1 THEN
+			RAISE EXCEPTION 'Row % was not found', v_val;
+		END IF;
+	END LOOP;
+	RETURN TRUE;
+END
+$$ LANGUAGE plpgsql;
+SELECT test.check_hash_text();
+/* Partitions created by old versions have no bounds */
+DELETE FROM pathman.pathman_partition_bounds WHERE parent = 'test.hash_text'::regclass;
+/* Double the number of partitions; rows are found while being moved */
+SELECT pathman.split_hash_partitions('test.hash_text');
+SELECT test.check_hash_text();
+SELECT pathman.wait_concurrent_part_task('test.hash_text');
+SELECT hash_split_pos FROM pathman.pathman_config WHERE relname = 'test.hash_text';
+/* Constraints of old partitions are validated after the split */
+SELECT COUNT(*) FROM pg_constraint c
+JOIN pg_inherits i ON i.inhrelid = c.conrelid
+WHERE i.inhparent = 'test.hash_text'::regclass AND c.contype = 'c' AND c.convalidated;
+SELECT COUNT(*) FROM pathman.pathman_partition_bounds WHERE parent = 'test.hash_text'::regclass;
+/* Constraints left by interrupted split are validated on resume */
+ALTER TABLE test.hash_text_0 ADD CHECK (pathman.get_hash(val, 8) = 0) NOT VALID;
+SELECT pathman.resume_hash_split('test.hash_text');
+SELECT pathman.resume_hash_split('test.hash_text');
+SELECT COUNT(*) FROM pg_constraint c
+JOIN pg_inherits i ON i.inhrelid = c.conrelid
+WHERE i.inhparent = 'test.hash_text'::regclass AND c.contype = 'c' AND NOT c.convalidated;
+SELECT COUNT(*) FROM test.hash_text;
+SELECT test.check_hash_text();
+SELECT pathman.drop_hash_partitions('test.hash_text', TRUE);
+DROP TABLE test.hash_text CASCADE;
+DROP FUNCTION test.check_hash_text();
+/* Partitions are pruned by hash of UUID and BIGINT keys */
+CREATE OR REPLACE FUNCTION test.scanned_partitions(p_query TEXT) RETURNS TEXT[] AS $$
+DECLARE
+	v_line TEXT;
+	v_result TEXT[] := '{}';
+BEGIN
+	FOR v_line IN EXECUTE 'EXPLAIN (COSTS OFF) ' || p_query
+	LOOP
+		IF v_line ~ 'Scan on ' THEN
+			v_result := v_result || substring(v_line from 'Scan on (\S+)');
+		END IF;
+	END LOOP;
+	RETURN v_result;
+END
+$$ LANGUAGE plpgsql;
+CREATE TABLE test.hash_uuid (id UUID NOT NULL);
+INSERT INTO test.hash_uuid SELECT md5(g::text)::uuid FROM generate_series(1, 20) AS g;
+SELECT pathman.create_hash_partitions('test.hash_uuid', 'id', 4);
+SELECT COUNT(*) FROM ONLY test.hash_uuid;
+SELECT COUNT(*) FROM test.hash_uuid h
+WHERE test.scanned_partitions(format('SELECT * FROM test.hash_uuid WHERE id = %L::uuid', id))
+	= ARRAY[(SELECT relname::text FROM pg_class WHERE oid = h.tableoid)];
+DROP TABLE test.hash_uuid CASCADE;
+CREATE TABLE test.hash_bigint (id BIGINT NOT NULL);
+INSERT INTO test.hash_bigint SELECT g FROM generate_series(1, 10) AS g;
+SELECT pathman.create_hash_partitions('test.hash_bigint', 'id', 3);
+EXPLAIN (COSTS OFF) SELECT * FROM test.hash_bigint WHERE id = 5::BIGINT;
+SELECT tableoid::regclass, id FROM test.hash_bigint WHERE id = 5::BIGINT;
+DROP TABLE test.hash_bigint CASCADE;
+DROP FUNCTION test.scanned_partitions(TEXT);
+
+/* LIST partitioning */
+CREATE TABLE test.list_rel (id SERIAL, region TEXT NOT NULL);
+INSERT INTO test.list_rel (region) SELECT (ARRAY['north', 'south', 'east'])[g % 3 + 1] FROM generate_series(1, 30) AS g;
+SELECT pathman.create_list_partitions('test.list_rel', 'region', ARRAY['north', 'south', 'east']);
+SELECT pathman.add_list_partition('test.list_rel', ARRAY['west', 'center']);
+SELECT pathman.add_list_partition('test.list_rel', ARRAY['east']);
+SELECT COUNT(*) FROM ONLY test.list_rel;
+INSERT INTO test.list_rel (region) VALUES ('west'), ('center');
+INSERT INTO test.list_rel (region) VALUES ('moon');
+EXPLAIN (COSTS OFF) SELECT * FROM test.list_rel WHERE region = 'south';
+EXPLAIN (COSTS OFF) SELECT * FROM test.list_rel WHERE region = 'west';
+EXPLAIN (COSTS OFF) SELECT * FROM test.list_rel WHERE region IN ('north', 'center');
+EXPLAIN (COSTS OFF) SELECT * FROM test.list_rel WHERE region <> 'south';
+SELECT COUNT(*) FROM test.list_rel WHERE region <> 'south';
+/* Values are copied out of shared cache */
+SELECT pathman.find_list_partition('test.list_rel'::regclass::oid, 'center'::TEXT)::regclass;
+SELECT pathman.find_list_partition('test.list_rel'::regclass::oid, 'moon'::TEXT)::regclass;
+/* Rows are moved to another partition when key changes */
+SELECT pathman.create_list_update_trigger('test.list_rel');
+UPDATE test.list_rel SET region = 'west' WHERE id = 1;
+SELECT tableoid::regclass, region FROM test.list_rel WHERE id = 1;
+/* Attached partition must not hold values of other partitions */
+CREATE TABLE test.list_rel_moon (LIKE test.list_rel);
+SELECT pathman.attach_list_partition('test.list_rel', 'test.list_rel_moon', ARRAY['moon', 'south']);
+SELECT pathman.attach_list_partition('test.list_rel', 'test.list_rel_moon', ARRAY['moon']);
+UPDATE test.list_rel SET region = 'moon' WHERE id = 1;
+SELECT tableoid::regclass, region FROM test.list_rel WHERE id = 1;
+SELECT pathman.drop_list_partitions('test.list_rel', TRUE);
+DROP TABLE test.list_rel CASCADE;
+/* Values are compared by the key type */
+CREATE TABLE test.list_num (val NUMERIC NOT NULL);
+SELECT pathman.create_list_partitions('test.list_num', 'val', ARRAY[1.0, 2.0]);
+SELECT pathman.add_list_partition('test.list_num', ARRAY[1.00]);
+DROP TABLE test.list_num CASCADE;
+/* Sub-partitioning */
+CREATE TABLE test.sub_rel (id INTEGER NOT NULL, dt DATE NOT NULL);
+SELECT pathman.create_range_partitions('test.sub_rel', 'dt', '2015-01-01'::DATE, '1 month'::INTERVAL, 2);
+SELECT pathman.create_hash_partitions('test.sub_rel_1', 'id', 2);
+SELECT pathman.create_range_partitions('test.sub_rel_2', 'id', 1, 50, 2);
+INSERT INTO test.sub_rel SELECT g, '2015-01-01'::DATE + g % 59 FROM generate_series(1, 100) AS g;
+SELECT COUNT(*) FROM ONLY test.sub_rel_1;
+SELECT COUNT(*) FROM test.sub_rel_2_1;
+EXPLAIN (COSTS OFF) SELECT * FROM test.sub_rel WHERE dt < '2015-02-01' AND id = 4;
+EXPLAIN (COSTS OFF) SELECT * FROM test.sub_rel WHERE dt >= '2015-02-01' AND id < 51;
+EXPLAIN (COSTS OFF) SELECT * FROM test.sub_rel WHERE id = 4;
+SELECT COUNT(*) FROM test.sub_rel WHERE id = 4;
+DROP TABLE test.sub_rel CASCADE;
+/* Sub-partitioning template is applied to partitions created later */
+CREATE TABLE test.tmpl_rel (id INTEGER NOT NULL, dt DATE NOT NULL);
+SELECT pathman.set_hash_subpartition_template('test.tmpl_rel', 'id', 2);
+SELECT pathman.create_range_partitions('test.tmpl_rel', 'dt', '2015-01-01'::DATE, '1 month'::INTERVAL, 1);
+SELECT pathman.append_range_partition('test.tmpl_rel');
+INSERT INTO test.tmpl_rel VALUES (1, '2015-03-15');
+SELECT COUNT(*) FROM pathman.pathman_config WHERE relname LIKE 'test.tmpl_rel_%';
+SELECT COUNT(*) FROM ONLY test.tmpl_rel_3;
+SELECT COUNT(*) FROM test.tmpl_rel WHERE id = 1;
+SELECT pathman.drop_subpartition_template('test.tmpl_rel');
+SELECT pathman.append_range_partition('test.tmpl_rel');
+SELECT COUNT(*) FROM pathman.pathman_config WHERE relname LIKE 'test.tmpl_rel_%';
+DROP TABLE test.tmpl_rel CASCADE;
+/* RANGE partitioning by composite key */
+CREATE TABLE test.comp_rel (tenant_id INTEGER NOT NULL, val INTEGER NOT NULL);
+SELECT pathman.create_composite_range_partitions('test.comp_rel', ARRAY['tenant_id', 'val']);
+SELECT pathman.add_composite_range_partition('test.comp_rel', ARRAY['1', '0'], ARRAY['1', '100']);
+SELECT pathman.add_composite_range_partition('test.comp_rel', ARRAY['1', '100'], ARRAY['2', '0']);
+SELECT pathman.add_composite_range_partition('test.comp_rel', ARRAY['2', '0'], ARRAY['3', '0']);
+SELECT pathman.add_composite_range_partition('test.comp_rel', ARRAY['2', '50'], ARRAY['4', '0']);
+INSERT INTO test.comp_rel SELECT g % 2 + 1, g FROM generate_series(1, 150) AS g;
+INSERT INTO test.comp_rel VALUES (3, 1);
+SELECT COUNT(*) FROM test.comp_rel_2;
+EXPLAIN (COSTS OFF) SELECT * FROM test.comp_rel WHERE tenant_id = 1;
+EXPLAIN (COSTS OFF) SELECT * FROM test.comp_rel WHERE tenant_id = 1 AND val >= 100;
+EXPLAIN (COSTS OFF) SELECT * FROM test.comp_rel WHERE tenant_id > 1;
+SELECT COUNT(*) FROM test.comp_rel WHERE tenant_id = 1 AND val >= 100;
+SELECT pathman.drop_range_partitions('test.comp_rel', TRUE);
+DROP TABLE test.comp_rel CASCADE;
+/* Partitioning by key expression */
+CREATE TABLE test.expr_rel (id SERIAL, dt TIMESTAMP NOT NULL);
+SELECT pathman.create_range_partitions('test.expr_rel', 'date_trunc(''month'', dt)', '2015-01-01'::TIMESTAMP, '1 month'::INTERVAL, 3);
+SELECT attname FROM pathman.pathman_config WHERE relname = 'test.expr_rel';
+INSERT INTO test.expr_rel (dt) SELECT '2015-01-15'::TIMESTAMP + g * '1 day'::INTERVAL FROM generate_series(0, 59) AS g;
+SELECT COUNT(*) FROM test.expr_rel_2;
+EXPLAIN (COSTS OFF) SELECT * FROM test.expr_rel WHERE date_trunc('month', dt) = '2015-02-01';
+EXPLAIN (COSTS OFF) SELECT * FROM test.expr_rel WHERE dt BETWEEN '2015-02-10' AND '2015-02-20';
+SELECT COUNT(*) FROM test.expr_rel WHERE dt BETWEEN '2015-02-10' AND '2015-02-20';
+/* Partitions are created while rows are routed, so cache changes mid-statement */
+INSERT INTO test.expr_rel (dt) SELECT '2015-01-15'::TIMESTAMP + g * '1 day'::INTERVAL FROM generate_series(60, 119) AS g;
+SELECT tableoid::regclass, COUNT(*) FROM test.expr_rel GROUP BY 1 ORDER BY 1;
+DROP TABLE test.expr_rel CASCADE;
+CREATE TABLE test.expr_hash (email TEXT NOT NULL);
+SELECT pathman.create_hash_partitions('test.expr_hash', 'email || random()', 3);
+SELECT pathman.create_hash_partitions('test.expr_hash', 'lower(email)', 3);
+INSERT INTO test.expr_hash VALUES ('Foo@example.com'), ('foo@example.com'), ('bar@example.com');
+SELECT COUNT(*), COUNT(DISTINCT tableoid) FROM test.expr_hash WHERE lower(email) = 'foo@example.com';
+SELECT pathman.create_list_partitions('test.expr_hash', 'lower(email)', ARRAY['a']);
+DROP TABLE test.expr_hash CASCADE;
+/* Key expression is kept schema-qualified */
+CREATE FUNCTION key_fn(INTEGER) RETURNS INTEGER AS 'BEGIN RETURN $1 / 10; END' LANGUAGE plpgsql IMMUTABLE;
+CREATE TABLE test.fn_rel (id INTEGER NOT NULL);
+SELECT pathman.create_hash_partitions('test.fn_rel', 'key_fn(id)', 3);
+SELECT attname FROM pathman.pathman_config WHERE relname = 'test.fn_rel';
+INSERT INTO test.fn_rel SELECT g FROM generate_series(1, 30) AS g;
+SELECT COUNT(*), COUNT(DISTINCT tableoid) FROM test.fn_rel WHERE key_fn(id) = 2;
+/* Relation whose key can't be parsed is skipped */
+UPDATE pathman.pathman_config SET attname = 'no_such_fn(id)' WHERE relname = 'test.fn_rel';
+SELECT pathman.on_update_partitions('test.fn_rel'::regclass::oid);
+DROP TABLE test.fn_rel CASCADE;
+DROP FUNCTION key_fn(INTEGER);
+CREATE TABLE test.zone_rel (id INTEGER NOT NULL, order_id INTEGER, note TEXT);
+SELECT pathman.create_range_partitions('test.zone_rel', 'id', 1, 10, 3);
+INSERT INTO test.zone_rel SELECT g, g * 10 FROM generate_series(1, 25) AS g;
+SELECT pathman.add_zone_map('test.zone_rel', 'note');
+SELECT pathman.add_zone_map('test.zone_rel', 'order_id');
+EXPLAIN (COSTS OFF) SELECT * FROM test.zone_rel WHERE order_id = 150;
+INSERT INTO test.zone_rel VALUES (5, 150);
+EXPLAIN (COSTS OFF) SELECT * FROM test.zone_rel WHERE order_id = 150;
+SELECT COUNT(*) FROM test.zone_rel WHERE order_id = 150;
+SELECT pathman.is_zone_map_valid('test.zone_rel', 'test.zone_rel_1');
+SELECT pathman.refresh_zone_maps('test.zone_rel');
+SELECT partition, min_value, max_value, is_empty, pathman.is_zone_map_valid(parent, partition) AS is_valid FROM pathman.pathman_zone_maps ORDER BY partition::text;
+EXPLAIN (COSTS OFF) SELECT * FROM test.zone_rel WHERE order_id > 200;
+SELECT pathman.drop_zone_map('test.zone_rel', 'order_id');
+EXPLAIN (COSTS OFF) SELECT * FROM test.zone_rel WHERE order_id > 200;
+DROP TABLE test.zone_rel CASCADE;
+/* Floats are stored without losing precision */
+CREATE TABLE test.zone_float (id INTEGER NOT NULL, x FLOAT8);
+SELECT pathman.create_range_partitions('test.zone_float', 'id', 1, 10, 2);
+INSERT INTO test.zone_float VALUES (1, 0.5), (2, 1.0000000000000002), (11, 0.25);
+SELECT pathman.add_zone_map('test.zone_float', 'x');
+EXPLAIN (COSTS OFF) SELECT * FROM test.zone_float WHERE x > 1;
+SELECT COUNT(*) FROM test.zone_float WHERE x > 1;
+DROP TABLE test.zone_float CASCADE;
+CREATE TABLE test.gidx_rel (id INTEGER NOT NULL, email TEXT);
+SELECT pathman.create_hash_partitions('test.gidx_rel', 'id', 3);
+INSERT INTO test.gidx_rel SELECT g, 'user' || g || '@example.com' FROM generate_series(1, 30) AS g;
+SELECT pathman.add_global_index('test.gidx_rel', 'email');
+SELECT COUNT(*) FROM test.gidx_rel_email_gidx;
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF) SELECT * FROM test.gidx_rel WHERE email = 'user7@example.com';
+SELECT * FROM test.gidx_rel WHERE email = 'user7@example.com';
+INSERT INTO test.gidx_rel VALUES (31, 'user7@example.com');
+UPDATE test.gidx_rel SET email = 'new7@example.com' WHERE id = 7;
+SELECT * FROM test.gidx_rel WHERE email = 'new7@example.com';
+SELECT COUNT(*) FROM test.gidx_rel WHERE email = 'user7@example.com';
+/* Values may be swapped by a single UPDATE */
+UPDATE test.gidx_rel SET email = CASE id WHEN 1 THEN 'user2@example.com' WHEN 2 THEN 'user1@example.com'
+	WHEN 4 THEN 'user10@example.com' ELSE 'user4@example.com' END WHERE id IN (1, 2, 4, 10);
+SELECT * FROM test.gidx_rel WHERE email = 'user1@example.com';
+SELECT * FROM test.gidx_rel WHERE email = 'user10@example.com';
+SELECT COUNT(*) FROM test.gidx_rel_email_gidx;
+DELETE FROM test.gidx_rel WHERE id = 7;
+SELECT COUNT(*) FROM test.gidx_rel_email_gidx;
+TRUNCATE test.gidx_rel_0;
+SELECT COUNT(*) FROM test.gidx_rel_email_gidx;
+INSERT INTO test.gidx_rel VALUES (3, 'user3@example.com');
+SELECT * FROM test.gidx_rel WHERE email = 'user3@example.com';
+/* Trigger names are quoted */
+ALTER TABLE test.gidx_rel ADD COLUMN "Login" TEXT;
+SELECT pathman.add_global_index('test.gidx_rel', 'Login');
+UPDATE test.gidx_rel SET "Login" = 'u' || id;
+SELECT id FROM test.gidx_rel WHERE "Login" = 'u5';
+SELECT pathman.drop_global_index('test.gidx_rel', 'Login');
+SELECT pathman.drop_global_index('test.gidx_rel', 'email');
+DROP TABLE test.gidx_rel CASCADE;
+CREATE TABLE test.key_set_rel (id INTEGER NOT NULL, val TEXT);
+SELECT pathman.create_range_partitions('test.key_set_rel', 'id', 1, 10, 4);
+INSERT INTO test.key_set_rel SELECT g, 'val' || g FROM generate_series(1, 40) AS g;
+CREATE TABLE test.key_set_dim (key INTEGER, attr TEXT);
+INSERT INTO test.key_set_dim VALUES (15, 'x'), (17, 'x'), (35, 'y');
+EXPLAIN (COSTS OFF) SELECT * FROM test.key_set_rel WHERE id IN (5, 25);
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF) SELECT * FROM test.key_set_rel WHERE id = ANY(ARRAY(SELECT key FROM test.key_set_dim WHERE attr = 'x'));
+SELECT * FROM test.key_set_rel WHERE id = ANY(ARRAY(SELECT key FROM test.key_set_dim WHERE attr = 'x'));
+/* Uncorrelated IN (SELECT ...) is pruned the same way */
+SELECT * FROM test.key_set_rel WHERE id IN (SELECT key FROM test.key_set_dim WHERE attr = 'x') ORDER BY id;
+SELECT * FROM test.key_set_rel r WHERE id IN (SELECT key FROM test.key_set_dim d WHERE d.attr = 'y' AND r.val = 'val35');
+DROP TABLE test.key_set_dim;
+DROP TABLE test.key_set_rel CASCADE;
+/* Paths are reused for partitions of similar size only */
+SET enable_seqscan = ON;
+CREATE TABLE test.tpl_rel (id INTEGER NOT NULL, val INTEGER);
+CREATE INDEX ON test.tpl_rel (val);
+SELECT pathman.create_range_partitions('test.tpl_rel', 'id', 1, 1000, 3);
+INSERT INTO test.tpl_rel SELECT g, CASE WHEN g > 2000 THEN 5 ELSE g END FROM generate_series(1000, 2999) AS g;
+ANALYZE test.tpl_rel_1;
+ANALYZE test.tpl_rel_2;
+ANALYZE test.tpl_rel_3;
+/* tpl_rel_3 would be scanned sequentially if it was planned separately */
+EXPLAIN (COSTS OFF) SELECT * FROM test.tpl_rel WHERE val = 5;
+EXPLAIN (COSTS OFF) SELECT * FROM test.tpl_rel WHERE val = 5 OR val = 6;
+SET pg_pathman.enable_template_paths = OFF;
+EXPLAIN (COSTS OFF) SELECT * FROM test.tpl_rel WHERE val = 5 OR val = 6;
+RESET pg_pathman.enable_template_paths;
+DROP TABLE test.tpl_rel CASCADE;
+SET enable_seqscan = OFF;
+
 SELECT pathman.drop_range_partitions('test.num_range_rel');
 DROP TABLE test.num_range_rel CASCADE;
 
@@ -180,6 +456,53 @@ SELECT * FROM test.range_rel WHERE dt = '2014-12-15';
 EXPLAIN (COSTS OFF) SELECT * FROM test.range_rel WHERE dt = '2015-03-15';
 SELECT * FROM test.range_rel WHERE dt = '2015-03-15';
 
+/* Fill the gap left by dropped partition */
+SELECT pathman.drop_range_partition('test.range_rel_8');
+INSERT INTO test.range_rel (dt) VALUES ('2015-03-15');
+EXPLAIN (COSTS OFF) SELECT * FROM test.range_rel WHERE dt = '2015-03-15';
+SELECT * FROM test.range_rel WHERE dt = '2015-03-15';
+/* Value is too far from existing partitions */
+INSERT INTO test.range_rel (dt) VALUES ('2100-01-01');
+SELECT COUNT(*) FROM pg_inherits WHERE inhparent = 'test.range_rel'::regclass;
+/* All partitions up to the value are created at once */
+CREATE TABLE test.auto_rel (id INTEGER NOT NULL);
+SELECT pathman.create_range_partitions('test.auto_rel', 'id', 1, 10, 1);
+INSERT INTO test.auto_rel VALUES (35);
+INSERT INTO test.auto_rel VALUES (-15);
+SELECT tableoid::regclass, id FROM test.auto_rel ORDER BY id;
+SELECT pathman.get_partition_range('test.auto_rel'::regclass::oid, c.oid, NULL::INTEGER)
+FROM pg_inherits i JOIN pg_class c ON c.oid = i.inhrelid
+WHERE i.inhparent = 'test.auto_rel'::regclass ORDER BY c.relname;
+DROP TABLE test.auto_rel CASCADE;
+/* BIGINT bounds stay ordered when partitions are added before the first one */
+CREATE TABLE test.bigint_rel (id BIGINT NOT NULL);
+SELECT pathman.create_range_partitions('test.bigint_rel', 'id', 4294967296, 10::BIGINT, 2);
+SELECT pathman.prepend_range_partition('test.bigint_rel');
+INSERT INTO test.bigint_rel VALUES (4294967266);
+SELECT tableoid::regclass, id FROM test.bigint_rel;
+SELECT pathman.get_range_by_idx('test.bigint_rel'::regclass::oid, 0, NULL::BIGINT);
+SELECT pathman.get_range_by_idx('test.bigint_rel'::regclass::oid, -1, NULL::BIGINT);
+DROP TABLE test.bigint_rel CASCADE;
+
+/* Default partition is always scanned */
+SELECT pathman.create_default_partition('test.range_rel');
+EXPLAIN (COSTS OFF) SELECT * FROM test.range_rel WHERE dt = '2015-03-15';
+/* Rows out of range go to default partition and are moved on drop */
+BEGIN;
+INSERT INTO test.range_rel (dt) VALUES ('2015-05-05'), ('2014-11-20');
+SELECT COUNT(*) FROM ONLY test.range_rel_default;
+SELECT pathman.drop_default_partition('test.range_rel');
+COMMIT;
+SELECT tableoid::regclass, dt FROM test.range_rel WHERE dt IN ('2015-05-05', '2014-11-20') ORDER BY dt;
+/* Name of default partition must not be taken */
+CREATE TABLE test.range_rel_default (id INTEGER);
+SELECT pathman.create_default_partition('test.range_rel');
+DROP TABLE test.range_rel_default;
+/* Dropped default partition is forgotten */
+SELECT pathman.create_default_partition('test.range_rel');
+DROP TABLE test.range_rel_default;
+SELECT default_partition FROM pathman.pathman_config WHERE relname = 'test.range_rel';
+
 DROP TABLE test.range_rel CASCADE;
 SELECT * FROM pathman.pathman_config;
 
@@ -195,6 +518,55 @@ SELECT pathman.check_overlap('test.num_range_rel'::regclass::oid, 3000, 3500);
 SELECT pathman.check_overlap('test.num_range_rel'::regclass::oid, 0, 999);
 SELECT pathman.check_overlap('test.num_range_rel'::regclass::oid, 0, 1000);
 SELECT pathman.check_overlap('test.num_range_rel'::regclass::oid, 0, 1001);
+SELECT pathman.get_min_range_value('test.num_range_rel'::regclass::oid, NULL::INTEGER);
+SELECT pathman.get_max_range_value('test.num_range_rel'::regclass::oid, NULL::INTEGER);
+SELECT pathman.get_range_by_idx('test.num_range_rel'::regclass::oid, 0, NULL::INTEGER);
+SELECT pathman.get_partition_range('test.num_range_rel'::regclass::oid, 'test.num_range_rel_2'::regclass::oid, NULL::INTEGER);
+/* Cache is reloaded by append, values must come from the new one */
+SELECT pathman.append_range_partition('test.num_range_rel');
+SELECT pathman.get_max_range_value('test.num_range_rel'::regclass::oid, NULL::INTEGER);
+SELECT pathman.get_range_by_idx('test.num_range_rel'::regclass::oid, -1, NULL::INTEGER);
+SELECT pathman.check_overlap('test.num_range_rel'::regclass::oid, 5500, 7000);
+/* Rows are moved by several workers in batches */
+CREATE TABLE test.conc_rel (id INTEGER NOT NULL, val TEXT);
+INSERT INTO test.conc_rel SELECT g, md5(g::text) FROM generate_series(1, 1000) AS g;
+SELECT pathman.create_range_partitions('test.conc_rel', 'id', 1, 100, 10, FALSE);
+SELECT pathman.partition_table_concurrently('test.conc_rel', 50, 0.5, 2);
+SELECT pathman.wait_concurrent_part_task('test.conc_rel');
+SELECT COUNT(*) FROM ONLY test.conc_rel;
+SELECT COUNT(*), COUNT(DISTINCT tableoid) FROM test.conc_rel;
+SELECT COUNT(*) FROM pathman.pathman_concurrent_part_tasks WHERE relid = 'test.conc_rel'::regclass;
+DROP TABLE test.conc_rel CASCADE;
+/* Reload of one relation keeps cache of the others */
+CREATE TABLE test.reload_a (id INTEGER NOT NULL);
+CREATE TABLE test.reload_b (id INTEGER NOT NULL);
+SELECT pathman.create_range_partitions('test.reload_a', 'id', 1, 10, 2, FALSE);
+SELECT pathman.create_range_partitions('test.reload_b', 'id', 1, 10, 2, FALSE);
+SELECT pathman.append_range_partition('test.reload_a');
+SELECT pathman.drop_range_partition('test.reload_b_2');
+SELECT pathman.get_range_by_idx('test.reload_a'::regclass::oid, -1, NULL::INTEGER);
+SELECT pathman.get_range_by_idx('test.reload_b'::regclass::oid, -1, NULL::INTEGER);
+/* Manual DDL and rolled back changes are noticed without explicit reload */
+DROP TABLE test.reload_a_3;
+SELECT pathman.get_range_by_idx('test.reload_a'::regclass::oid, -1, NULL::INTEGER);
+BEGIN;
+SELECT pathman.append_range_partition('test.reload_b');
+ROLLBACK;
+SELECT pathman.get_range_by_idx('test.reload_b'::regclass::oid, -1, NULL::INTEGER);
+/* Comparison functions are cached per type of constant */
+EXPLAIN (COSTS OFF) SELECT * FROM test.reload_a WHERE id = 15::BIGINT;
+EXPLAIN (COSTS OFF) SELECT * FROM test.reload_a WHERE id = 15::SMALLINT;
+/* Several partitioned relations in one query */
+INSERT INTO test.reload_a SELECT g FROM generate_series(1, 20) AS g;
+INSERT INTO test.reload_b SELECT g FROM generate_series(1, 10) AS g;
+SELECT COUNT(*) FROM test.reload_a a JOIN test.reload_b b ON a.id = b.id JOIN test.reload_a c ON c.id = b.id + 10;
+/* Rangesets of OR clauses are evaluated together */
+SELECT COUNT(*) FROM test.reload_a WHERE id IN (2, 3, 15) OR id > 18 OR (id < 5 AND id <> 3);
+SELECT COUNT(*) FROM test.reload_a WHERE (id < 5 OR id > 15) AND id <> 2;
+DROP TABLE test.reload_a CASCADE;
+DROP TABLE test.reload_b CASCADE;
+/* Cache is loaded on server start only if enabled */
+SHOW pg_pathman.prewarm;
 
 DROP EXTENSION pg_pathman;
 
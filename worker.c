@@ -7,6 +7,26 @@
 #include "access/xact.h"
 #include "utils/snapmgr.h"
 #include "utils/typcache.h"
+#include "utils/syscache.h"
+#include "utils/lsyscache.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+#include "catalog/pg_class.h"
+#include "access/htup_details.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/shmem.h"
+#include "storage/bufmgr.h"
+#include "storage/lmgr.h"
+#include "access/heapam.h"
+#include "utils/array.h"
+#include "utils/rel.h"
+#include "lib/stringinfo.h"
+#include "catalog/namespace.h"
+#include "parser/parse_coerce.h"
+#include "nodes/value.h"
+#include "utils/datum.h"
+#include "catalog/pg_database.h"
 
 /*-------------------------------------------------------------------------
  *
@@ -17,12 +37,42 @@
  * pass arguments to it (see PartitionArgs) and gather the result
  * (which is the new partition oid).
  *
+ * The module also provides concurrent partitioning workers. They move
+ * data from the parent relation to partitions in small batches, each in
+ * its own transaction, and publish their progress in shared memory
+ * (see ConcurrentPartSlot). Several workers may process disjoint ranges
+ * of the parent's heap in parallel.
+ *
+ * Finally, prewarm workers load the cache on server start so that the
+ * first queries don't have to do it.
+ *
  *-------------------------------------------------------------------------
  */
 
 static dsm_segment *segment;
 
 static void bg_worker_main(Datum main_arg);
+static void partition_data_bg_worker_main(Datum main_arg);
+static void free_concurrent_part_slot(int code, Datum arg);
+static void release_concurrent_part_slot(int code, Datum arg);
+static bool launch_part_workers(Oid relid, Oid source_relid, int batch_size,
+								double sleep_time, int workers, bool report_errors,
+								int hash_idx);
+static void worker_sleep(double seconds);
+static void wait_for_writers(Oid relid);
+static void prewarm_launcher_main(Datum main_arg);
+static void prewarm_bg_worker_main(Datum main_arg);
+static void route_tuples(Oid relid, HTAB *plans, SPITupleTable *tuptable, uint64 ntuples);
+static Datum make_tid_array(BlockNumber start, BlockNumber end);
+static char *make_hash_split_filter(ConcurrentPartSlot *slot);
+static Oid complete_hash_partition_split(Oid relid);
+static void validate_hash_partition_split(Oid partition);
+static Datum get_interval_datum(const char *interval_str, Oid interval_type);
+static void get_interval_op(Oid value_type, Oid interval_type, const char *opname,
+							FmgrInfo *op_func, Oid *cast_func);
+static bool is_date_type(Oid type);
+
+ConcurrentPartSlot *concurrent_part_slots = NULL;
 
 typedef struct PartitionArgs
 {
@@ -39,6 +89,25 @@ typedef struct PartitionArgs
 	bool	crashed;
 } PartitionArgs;
 
+/*
+ * Prepared INSERT statement for a partition (concurrent partitioning)
+ */
+typedef struct PartitionInsertPlan
+{
+	Oid			relid;
+	SPIPlanPtr	plan;
+} PartitionInsertPlan;
+
+/* Maximum number of partitions created on demand at once */
+#define MAX_PARTITIONS_ON_DEMAND 1000
+
+/* Parameters of the worker which drains default partition */
+#define DEFAULT_PARTITION_BATCH_SIZE 1000
+#define DEFAULT_PARTITION_SLEEP_TIME 1.0
+
+/* Upper limit of heap blocks processed in a single batch */
+#define MAX_BATCH_BLOCKS 256
+
 /*
  * Starts background worker that will create new partitions,
  * waits till it finishes the job and returns the result (new partition oid)
@@ -136,7 +205,7 @@ bg_worker_main(Datum main_arg)
 	PushActiveSnapshot(GetTransactionSnapshot());
 
 	/* Create partitions */
-	args->result = create_partitions(args->relid, PATHMAN_GET_DATUM(args->value, args->by_val), args->value_type, &args->crashed);
+	args->result = create_partitions(args->relid, PATHMAN_GET_DATUM(args->value, args->by_val), args->value_type, true, &args->crashed);
 
 	/* Cleanup */
 	SPI_finish();
@@ -147,53 +216,316 @@ bg_worker_main(Datum main_arg)
 }
 
 /*
- * Create partitions and return an OID of the partition that contain value
+ * Serializes creation of partitions of the relation on demand. Unlike
+ * LWLocks this lock may be held while partitions are being created and
+ * deadlocks involving it are detected. DDL never takes object locks on
+ * relations, so it doesn't interfere with locks taken by partition creation
+ * itself. The lock is released at the end of transaction or by
+ * unlock_partitions_creation()
+ */
+void
+lock_partitions_creation(Oid relid)
+{
+	LockDatabaseObject(RelationRelationId, relid, 0, ExclusiveLock);
+}
+
+void
+unlock_partitions_creation(Oid relid)
+{
+	UnlockDatabaseObject(RelationRelationId, relid, 0, ExclusiveLock);
+}
+
+/*
+ * Create partitions and return an OID of the partition that contain value.
+ * If value is greater or less than all existing partitions then partitions
+ * are appended or prepended with the interval step. If value falls into a
+ * gap between partitions then the single partition covering it is created.
+ * Bounds of all required partitions are computed here, then partitions are
+ * created by a single call to create_range_partitions_internal() and their
+ * bounds are appended to the shared RangeRelation without full reload.
+ *
+ * If lock_cache is false then the caller must hold load_config_lock
+ * exclusively. Otherwise the lock is only taken
+ * to read and to update the cache, it isn't held while partitions are created.
  */
 Oid
-create_partitions(Oid relid, Datum value, Oid value_type, bool *crashed)
+create_partitions(Oid relid, Datum value, Oid value_type, bool lock_cache,
+				  bool *crashed)
 {
 	int 		ret;
 	RangeEntry *ranges;
-	Datum		vals[2];
-	Oid			oids[] = {OIDOID, value_type};
-	bool		nulls[] = {false, false};
+	Datum		vals[3];
+	Oid			oids[3];
+	bool		nulls[] = {false, false, false};
 	char	   *sql;
 	bool		found;
-	int pos;
+	int			pos;
 	PartRelationInfo *prel;
 	RangeRelation	*rangerel;
-	FmgrInfo   cmp_func;
-	char *schema;
+	FmgrInfo   *cmp_func;
+	FmgrInfo   *bound_cmp_func;
+	char	   *schema;
+	char	   *interval_str;
+	Datum		interval;
+	Oid			interval_type;
+	FmgrInfo	op_func;
+	Oid			cast_func;
+	Datum	   *starts;
+	Datum	   *ends;
+	Datum	   *children;
+	int			nparts = 0;
+	int			nchildren;
+	int16		typlen;
+	bool		typbyval;
+	char		typalign;
+	Oid			atttype;
+	Oid			child_oid = InvalidOid;
+	RelationKey	key;
 
 	*crashed = false;
 	schema = get_extension_schema();
 
-	prel = get_pathman_relation_info(relid, NULL);
-	rangerel = get_pathman_range_relation(relid, NULL);
-	ranges = dsm_array_get_pointer(&rangerel->ranges);
+	if (lock_cache)
+		prel = lock_pathman_relation_info(relid, &rangerel, NULL);
+	else
+	{
+		prel = get_pathman_relation_info(relid, NULL);
+		rangerel = get_pathman_range_relation(relid, NULL);
+	}
+	if (prel != NULL)
+	{
+		atttype = prel->atttype;
+		found = (rangerel != NULL && rangerel->ranges.length > 0);
+		if (lock_cache)
+			LWLockRelease(pmstate->load_config_lock);
+	}
+	if (!prel || !found)
+		return 0;
+	found = false;
 
-	/* Comparison function */
-	cmp_func = *get_cmp_func(value_type, prel->atttype);
+	/* Comparison functions */
+	cmp_func = get_cmp_func(value_type, atttype);
+	bound_cmp_func = get_cmp_func(atttype, atttype);
+	get_typlenbyvalalign(atttype, &typlen, &typbyval, &typalign);
 
-	vals[0] = ObjectIdGetDatum(relid);
-	vals[1] = value;
+	key.dbid = MyDatabaseId;
+	key.relid = relid;
 
-	/* Perform PL procedure */
-	sql = psprintf("SELECT %s.append_partitions_on_demand_internal($1, $2)",
-				   schema);
 	PG_TRY();
 	{
-		ret = SPI_execute_with_args(sql, 2, oids, vals, nulls, false, 0);
-		if (ret > 0)
+		Datum	cur;
+		bool	append;
+		bool	prepend;
+		int		last;
+
+		/* Get partitioning interval */
+		sql = psprintf("SELECT range_interval FROM %s.pathman_config "
+					   "WHERE relname::regclass = $1::regclass", schema);
+		oids[0] = OIDOID;
+		vals[0] = ObjectIdGetDatum(relid);
+		ret = SPI_execute_with_args(sql, 1, oids, vals, nulls, true, 1);
+		if (ret != SPI_OK_SELECT || SPI_processed == 0)
+			elog(ERROR, "Unable to get interval for relation %u", relid);
+		interval_str = SPI_getvalue(SPI_tuptable->vals[0],
+									SPI_tuptable->tupdesc, 1);
+		if (interval_str == NULL)
+			elog(ERROR, "Interval for relation %u is not set", relid);
+
+		/* Dates are incremented by INTERVAL, other types by their own type */
+		interval_type = is_date_type(atttype) ? INTERVALOID : atttype;
+		interval = get_interval_datum(interval_str, interval_type);
+
+		/* Bounds are copied out of the cache, so it's unlocked before DDL */
+		if (lock_cache)
+		{
+			LWLockAcquire(pmstate->load_config_lock, LW_SHARED);
+			rangerel = pathman_hash_search(range_restrictions, &key, HASH_FIND, NULL);
+			if (rangerel == NULL || rangerel->ranges.length == 0)
+				elog(ERROR, "Relation %u has no RANGE partitions", relid);
+		}
+
+		/* Decide whether we should append, prepend or fill a gap */
+		ranges = dsm_array_get_pointer(&rangerel->ranges);
+		last = rangerel->ranges.length - 1;
+		append = DatumGetInt32(FunctionCall2(cmp_func, value,
+				PATHMAN_GET_DATUM(ranges[last].max, rangerel->by_val))) >= 0;
+		prepend = DatumGetInt32(FunctionCall2(cmp_func, value,
+				PATHMAN_GET_DATUM(ranges[0].min, rangerel->by_val))) < 0;
+
+		starts = palloc(sizeof(Datum) * MAX_PARTITIONS_ON_DEMAND);
+		ends = palloc(sizeof(Datum) * MAX_PARTITIONS_ON_DEMAND);
+
+		if (!append && !prepend)
+		{
+			int		lo = 0,
+					hi = last;
+			Datum	gap_end;
+			Datum	next;
+			int		steps = 0;
+
+			/*
+			 * Value falls into a gap between two partitions (e.g. after
+			 * partition has been dropped or detached). Find neighbours so
+			 * that ranges[lo].max <= value < ranges[hi].min
+			 */
+			while (hi - lo > 1)
+			{
+				int		mid = lo + (hi - lo) / 2;
+
+				if (DatumGetInt32(FunctionCall2(cmp_func, value,
+						PATHMAN_GET_DATUM(ranges[mid].min, rangerel->by_val))) < 0)
+					hi = mid;
+				else
+					lo = mid;
+			}
+			cur = datumCopy(PATHMAN_GET_DATUM(ranges[lo].max, rangerel->by_val),
+							typbyval, typlen);
+			gap_end = datumCopy(PATHMAN_GET_DATUM(ranges[hi].min, rangerel->by_val),
+								typbyval, typlen);
+
+			get_interval_op(atttype, interval_type, "+",
+							&op_func, &cast_func);
+
+			/* Align new partition to the interval counting from the left neighbour */
+			while (true)
+			{
+				next = FunctionCall2(&op_func, cur, interval);
+				if (OidIsValid(cast_func))
+					next = OidFunctionCall1(cast_func, next);
+
+				if (DatumGetInt32(FunctionCall2(bound_cmp_func, next, cur)) <= 0)
+					elog(ERROR, "Interval for relation %u must be positive", relid);
+
+				if (DatumGetInt32(FunctionCall2(cmp_func, value, next)) < 0)
+					break;
+				if (++steps >= MAX_PARTITIONS_ON_DEMAND)
+					elog(ERROR, "Value is too far from partitions of relation %u "
+						 "(more than %d intervals)", relid, MAX_PARTITIONS_ON_DEMAND);
+				cur = next;
+			}
+
+			/* New partition must not overlap the right neighbour */
+			starts[0] = cur;
+			ends[0] = DatumGetInt32(FunctionCall2(bound_cmp_func, next, gap_end)) > 0 ?
+				gap_end : next;
+			nparts = 1;
+		}
+		else
 		{
+			if (append)
+				cur = datumCopy(PATHMAN_GET_DATUM(ranges[last].max, rangerel->by_val),
+								typbyval, typlen);
+			else
+				cur = datumCopy(PATHMAN_GET_DATUM(ranges[0].min, rangerel->by_val),
+								typbyval, typlen);
+
+			get_interval_op(atttype, interval_type, append ? "+" : "-",
+							&op_func, &cast_func);
+
+			/* Compute bounds of new partitions */
+			while (nparts < MAX_PARTITIONS_ON_DEMAND &&
+				   (append ?
+					DatumGetInt32(FunctionCall2(cmp_func, value, cur)) >= 0 :
+					DatumGetInt32(FunctionCall2(cmp_func, value, cur)) < 0))
+			{
+				Datum	next = FunctionCall2(&op_func, cur, interval);
+
+				if (OidIsValid(cast_func))
+					next = OidFunctionCall1(cast_func, next);
+
+				/* Interval must move the bound in the right direction */
+				if (DatumGetInt32(FunctionCall2(bound_cmp_func, next, cur)) * (append ? 1 : -1) <= 0)
+					elog(ERROR, "Interval for relation %u must be positive", relid);
+
+				/* Keep partitions sorted in ascending order */
+				if (append)
+				{
+					starts[nparts] = cur;
+					ends[nparts] = next;
+				}
+				else
+				{
+					starts[MAX_PARTITIONS_ON_DEMAND - nparts - 1] = next;
+					ends[MAX_PARTITIONS_ON_DEMAND - nparts - 1] = cur;
+				}
+				nparts++;
+				cur = next;
+			}
+
+			/* Don't create partitions which wouldn't contain the value anyway */
+			if (nparts == MAX_PARTITIONS_ON_DEMAND &&
+				(append ?
+				 DatumGetInt32(FunctionCall2(cmp_func, value, cur)) >= 0 :
+				 DatumGetInt32(FunctionCall2(cmp_func, value, cur)) < 0))
+				elog(ERROR, "Value is too far from partitions of relation %u "
+					 "(more than %d intervals)", relid, MAX_PARTITIONS_ON_DEMAND);
+
+			if (!append)
+			{
+				starts += MAX_PARTITIONS_ON_DEMAND - nparts;
+				ends += MAX_PARTITIONS_ON_DEMAND - nparts;
+			}
+		}
+
+		if (lock_cache)
+			LWLockRelease(pmstate->load_config_lock);
+
+		if (nparts > 0)
+		{
+			ArrayType  *result;
+			bool		isnull;
+			bool	   *child_nulls;
+			int			i,
+						j;
+
+			/* Create all partitions at once */
+			oids[0] = OIDOID;
+			oids[1] = oids[2] = get_array_type(atttype);
+			vals[0] = ObjectIdGetDatum(relid);
+			vals[1] = PointerGetDatum(construct_array(starts, nparts, atttype,
+													  typlen, typbyval, typalign));
+			vals[2] = PointerGetDatum(construct_array(ends, nparts, atttype,
+													  typlen, typbyval, typalign));
+
+			sql = psprintf("SELECT %s.create_range_partitions_internal($1, $2, $3)",
+						   schema);
+			ret = SPI_execute_with_args(sql, 3, oids, vals, nulls, false, 0);
+			if (ret != SPI_OK_SELECT || SPI_processed == 0)
+				elog(ERROR, "Unable to create partitions for relation %u", relid);
+
+			result = DatumGetArrayTypeP(SPI_getbinval(SPI_tuptable->vals[0],
+													  SPI_tuptable->tupdesc,
+													  1, &isnull));
+			deconstruct_array(result, OIDOID, sizeof(Oid), true, 'i',
+							  &children, &child_nulls, &nchildren);
+			if (nchildren != nparts)
+				elog(ERROR, "Unexpected number of partitions created");
+
+			/* Skipped partitions are NULL; keep only the created ones */
+			for (i = 0, j = 0; i < nchildren; i++)
+			{
+				if (child_nulls[i])
+					continue;
+				children[j] = children[i];
+				starts[j] = starts[i];
+				ends[j] = ends[i];
+				j++;
+			}
+			nparts = j;
+
 			/* Update relation info */
-			free_dsm_array(&rangerel->ranges);
-			free_dsm_array(&prel->children);
-			load_check_constraints(relid, GetCatalogSnapshot(relid));
+			if (lock_cache)
+				LWLockAcquire(pmstate->load_config_lock, LW_EXCLUSIVE);
+			if (nparts > 0)
+				add_range_partitions(relid, children, starts, ends, nparts);
+			if (lock_cache)
+				LWLockRelease(pmstate->load_config_lock);
 		}
 	}
 	PG_CATCH();
 	{
+		if (lock_cache && LWLockHeldByMe(pmstate->load_config_lock))
+			LWLockRelease(pmstate->load_config_lock);
 		elog(WARNING, "Attempt to create new partitions failed");
 		if (crashed != NULL)
 			*crashed = true;
@@ -202,10 +534,1122 @@ create_partitions(Oid relid, Datum value, Oid value_type, bool *crashed)
 	PG_END_TRY();
 
 	/* Repeat binary search */
+	if (lock_cache)
+		LWLockAcquire(pmstate->load_config_lock, LW_SHARED);
+	rangerel = pathman_hash_search(range_restrictions, &key, HASH_FIND, NULL);
+	if (rangerel != NULL && rangerel->ranges.length > 0)
+	{
+		ranges = dsm_array_get_pointer(&rangerel->ranges);
+		pos = range_binary_search(rangerel, cmp_func, value, &found);
+		if (found)
+			child_oid = ranges[pos].child_oid;
+	}
+	if (lock_cache)
+		LWLockRelease(pmstate->load_config_lock);
+
+	return child_oid;
+}
+
+/*
+ * Converts interval string to Datum of the specified type
+ */
+static Datum
+get_interval_datum(const char *interval_str, Oid interval_type)
+{
+	Oid		typinput;
+	Oid		typioparam;
+
+	getTypeInputInfo(interval_type, &typinput, &typioparam);
+	return OidInputFunctionCall(typinput, (char *) interval_str, typioparam, -1);
+}
+
+/*
+ * Looks up operator 'value_type opname interval_type' and the function which
+ * casts the operator's result back to value_type (if needed)
+ */
+static void
+get_interval_op(Oid value_type, Oid interval_type, const char *opname,
+				FmgrInfo *op_func, Oid *cast_func)
+{
+	Oid		opid;
+	Oid		rettype;
+
+	opid = OpernameGetOprid(list_make1(makeString((char *) opname)),
+							value_type, interval_type);
+	if (!OidIsValid(opid))
+		elog(ERROR, "Operator %s(%s, %s) doesn't exist",
+			 opname, format_type_be(value_type), format_type_be(interval_type));
+
+	fmgr_info(get_opcode(opid), op_func);
+
+	*cast_func = InvalidOid;
+	rettype = get_op_rettype(opid);
+	if (rettype != value_type)
+	{
+		CoercionPathType ctype;
+
+		ctype = find_coercion_pathway(value_type, rettype,
+									  COERCION_EXPLICIT, cast_func);
+		if (ctype == COERCION_PATH_RELABELTYPE)
+			*cast_func = InvalidOid;
+		else if (ctype != COERCION_PATH_FUNC)
+			elog(ERROR, "Cannot cast %s to %s",
+				 format_type_be(rettype), format_type_be(value_type));
+	}
+}
+
+/*
+ * Checks if type is one of date types
+ */
+static bool
+is_date_type(Oid type)
+{
+	return type == DATEOID || type == TIMESTAMPOID || type == TIMESTAMPTZOID;
+}
+
+/*
+ * Amount of shared memory required for concurrent partitioning slots
+ */
+Size
+concurrent_part_slots_size(void)
+{
+	return MAXALIGN(sizeof(ConcurrentPartSlot) * PART_WORKER_SLOTS);
+}
+
+/*
+ * Initialize concurrent partitioning slots in shared memory
+ */
+void
+init_concurrent_part_slots(void)
+{
+	bool	found;
+	int		i;
+
+	concurrent_part_slots = ShmemInitStruct("pathman concurrent partitioning slots",
+											concurrent_part_slots_size(),
+											&found);
+	if (!found)
+	{
+		memset(concurrent_part_slots, 0, concurrent_part_slots_size());
+		for (i = 0; i < PART_WORKER_SLOTS; i++)
+			SpinLockInit(&concurrent_part_slots[i].mutex);
+	}
+}
+
+/*
+ * Starts background workers that move data from parent relation to its
+ * partitions. Unlike partition_data() it does not wait till the job is done.
+ */
+void
+start_concurrent_part_workers(Oid relid, int batch_size, double sleep_time, int workers)
+{
+	launch_part_workers(relid, relid, batch_size, sleep_time, workers, true, -1);
+}
+
+/*
+ * Starts background worker which moves rows from the default partition to
+ * proper partitions. If such worker is already running then it is asked to
+ * make one more pass. Returns false if worker couldn't be started.
+ */
+bool
+start_default_partition_worker(Oid relid, Oid default_oid)
+{
+	return launch_part_workers(relid, default_oid, DEFAULT_PARTITION_BATCH_SIZE,
+							   DEFAULT_PARTITION_SLEEP_TIME, 1, false, -1);
+}
+
+/*
+ * Starts background worker which moves rows of new HASH partitions out of
+ * the old ones while partitions are being split (see split_hash_partitions()).
+ * Old partitions are processed one by one starting from prel->split_pos.
+ * Returns false if partitions aren't being split
+ */
+bool
+start_hash_split_worker(Oid relid)
+{
+	PartRelationInfo   *prel;
+	Oid				   *children;
+	Oid					source_relid;
+	int					split_pos;
+
+	prel = lock_pathman_relation_info(relid, NULL, NULL);
+	if (prel == NULL)
+		return false;
+	if (prel->parttype != PT_HASH || prel->split_pos < 0 ||
+		prel->split_pos >= prel->children_count)
+	{
+		LWLockRelease(pmstate->load_config_lock);
+		return false;
+	}
+
+	children = dsm_array_get_pointer(&prel->children);
+	split_pos = prel->split_pos;
+	source_relid = children[split_pos];
+	LWLockRelease(pmstate->load_config_lock);
+
+	return launch_part_workers(relid, source_relid,
+							   DEFAULT_PARTITION_BATCH_SIZE,
+							   DEFAULT_PARTITION_SLEEP_TIME, 1, true,
+							   split_pos);
+}
+
+/*
+ * Starts background workers that move rows from source_relid (which is either
+ * the parent relation, its default partition or HASH partition number
+ * hash_idx being split) to partitions of relid. Heap of the source is split
+ * into equal ranges of blocks and every worker gets its own range. If
+ * report_errors is false then problems are only logged.
+ */
+static bool
+launch_part_workers(Oid relid, Oid source_relid, int batch_size,
+					double sleep_time, int workers, bool report_errors,
+					int hash_idx)
+{
+	Relation	rel;
+	BlockNumber	nblocks;
+	double		reltuples;
+	double		tuples_per_page;
+	int			batch_blocks;
+	int			slots[PART_WORKER_SLOTS];
+	int			nslots = 0;
+	int			i;
+
+	if (workers < 1 || workers > PART_WORKER_SLOTS)
+		elog(ERROR, "Number of workers must be between 1 and %d",
+			 PART_WORKER_SLOTS);
+
+	/* Heap size and estimated number of rows to move */
+	rel = heap_open(source_relid, AccessShareLock);
+	nblocks = RelationGetNumberOfBlocks(rel);
+	reltuples = rel->rd_rel->reltuples;
+	tuples_per_page = rel->rd_rel->relpages > 0 ?
+		reltuples / rel->rd_rel->relpages : 0;
+	heap_close(rel, AccessShareLock);
+
+	/* Number of blocks which contain approximately batch_size rows */
+	batch_blocks = tuples_per_page >= 1 ? (int) (batch_size / tuples_per_page) : 1;
+	batch_blocks = Max(Min(batch_blocks, MAX_BATCH_BLOCKS), 1);
+
+	/* Don't start more workers than there are blocks */
+	workers = Min(workers, Max(nblocks, 1));
+
+	/*
+	 * Check that relation isn't being partitioned right now and occupy free
+	 * slots in one pass, so that concurrent callers can't both pass the check
+	 */
+	LWLockAcquire(pmstate->part_slots_lock, LW_EXCLUSIVE);
+	for (i = 0; i < PART_WORKER_SLOTS; i++)
+	{
+		ConcurrentPartSlot *cur = &concurrent_part_slots[i];
+		bool				busy;
+
+		SpinLockAcquire(&cur->mutex);
+		busy = cur->worker_status != CPS_FREE &&
+			   cur->dbid == MyDatabaseId &&
+			   cur->source_relid == source_relid;
+		/* Running worker will make one more pass */
+		if (busy && !report_errors)
+			cur->pending = true;
+		SpinLockRelease(&cur->mutex);
+
+		if (busy)
+		{
+			LWLockRelease(pmstate->part_slots_lock);
+			if (report_errors)
+				elog(ERROR, "Relation %u is already being partitioned", relid);
+			return true;
+		}
+	}
+
+	for (i = 0; i < PART_WORKER_SLOTS && nslots < workers; i++)
+	{
+		ConcurrentPartSlot *cur = &concurrent_part_slots[i];
+
+		SpinLockAcquire(&cur->mutex);
+		if (cur->worker_status == CPS_FREE)
+		{
+			int		n = nslots;
+
+			cur->worker_status = CPS_WORKING;
+			cur->userid = GetUserId();
+			cur->pid = 0;
+			cur->dbid = MyDatabaseId;
+			cur->relid = relid;
+			cur->source_relid = source_relid;
+			cur->hash_idx = hash_idx;
+			cur->pending = false;
+			cur->batch_size = batch_size;
+			cur->sleep_time = sleep_time;
+			cur->start_block = (BlockNumber) ((uint64) nblocks * n / workers);
+			cur->end_block = (BlockNumber) ((uint64) nblocks * (n + 1) / workers);
+			cur->batch_blocks = batch_blocks;
+			cur->sweep = (n == workers - 1);
+			cur->total_rows = 0;
+			cur->estimated_rows = reltuples / workers;
+			cur->start_time = GetCurrentTimestamp();
+			slots[nslots++] = i;
+		}
+		SpinLockRelease(&cur->mutex);
+	}
+	LWLockRelease(pmstate->part_slots_lock);
+
+	if (nslots < workers)
+	{
+		for (i = 0; i < nslots; i++)
+			free_concurrent_part_slot(0, Int32GetDatum(slots[i]));
+		elog(report_errors ? ERROR : LOG,
+			 "No free slots for concurrent partitioning. "
+			 "Wait till other workers finish their jobs");
+		return false;
+	}
+
+	for (i = 0; i < nslots; i++)
+	{
+		BackgroundWorker		worker;
+		BackgroundWorkerHandle *worker_handle;
+
+		/* Initialize worker struct */
+		memset(&worker, 0, sizeof(worker));
+		snprintf(worker.bgw_name, BGW_MAXLEN, "pg_pathman partitioning worker");
+		worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
+			BGWORKER_BACKEND_DATABASE_CONNECTION;
+		worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+		worker.bgw_restart_time = BGW_NEVER_RESTART;
+		worker.bgw_main = partition_data_bg_worker_main;
+		worker.bgw_main_arg = Int32GetDatum(slots[i]);
+		worker.bgw_notify_pid = MyProcPid;
+
+		/* Start dynamic worker and leave it alone */
+		if (!RegisterDynamicBackgroundWorker(&worker, &worker_handle))
+		{
+			int		j;
+
+			/* Stop workers which have already been started */
+			for (j = 0; j < nslots; j++)
+			{
+				ConcurrentPartSlot *cur = &concurrent_part_slots[slots[j]];
+
+				if (j >= i)
+				{
+					free_concurrent_part_slot(0, Int32GetDatum(slots[j]));
+					continue;
+				}
+
+				SpinLockAcquire(&cur->mutex);
+				if (cur->worker_status == CPS_WORKING)
+					cur->worker_status = CPS_STOPPING;
+				SpinLockRelease(&cur->mutex);
+			}
+			elog(report_errors ? ERROR : LOG,
+				 "Unable to create background worker for pg_pathman. "
+				 "Consider increasing max_worker_processes");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Returns prepared plan which inserts a row into the specified relation.
+ * Plans are cached for the whole life of the worker
+ */
+static SPIPlanPtr
+get_insert_plan(HTAB *plans, Oid relid, TupleDesc tupdesc)
+{
+	PartitionInsertPlan *entry;
+	bool		found;
+
+	entry = hash_search(plans, &relid, HASH_ENTER, &found);
+	if (!found)
+	{
+		StringInfoData	cols;
+		StringInfoData	params;
+		Oid			   *argtypes;
+		char		   *sql;
+		int				i;
+
+		initStringInfo(&cols);
+		initStringInfo(&params);
+		argtypes = palloc(sizeof(Oid) * tupdesc->natts);
+
+		for (i = 0; i < tupdesc->natts; i++)
+		{
+			appendStringInfo(&cols, "%s%s", i > 0 ? ", " : "",
+							 quote_identifier(NameStr(tupdesc->attrs[i]->attname)));
+			appendStringInfo(&params, "%s$%d", i > 0 ? ", " : "", i + 1);
+			argtypes[i] = tupdesc->attrs[i]->atttypid;
+		}
+
+		sql = psprintf("INSERT INTO %s (%s) VALUES (%s)",
+					   quote_qualified_identifier(
+							get_namespace_name(get_rel_namespace(relid)),
+							get_rel_name(relid)),
+					   cols.data, params.data);
+
+		entry->plan = SPI_prepare(sql, tupdesc->natts, argtypes);
+		if (entry->plan == NULL)
+		{
+			hash_search(plans, &relid, HASH_REMOVE, NULL);
+			elog(ERROR, "pg_pathman worker: failed to prepare \"%s\"", sql);
+		}
+		SPI_keepplan(entry->plan);
+	}
+
+	return entry->plan;
+}
+
+/*
+ * Returns RANGE partition for the value. Creates new partitions if needed.
+ * Returns InvalidOid if relation has no RANGE partitions at all
+ */
+static Oid
+get_or_create_range_partition(Oid relid, FmgrInfo *cmp_func, Datum value,
+							  Oid value_type)
+{
+	PartRelationInfo *prel;
+	RangeRelation *rangerel = NULL;
+	RelationKey key;
+	RangeEntry *ranges;
+	Oid			child_oid = InvalidOid;
+	bool		crashed = false;
+	bool		found = false;
+	int			pos;
+
+	prel = lock_pathman_relation_info(relid, &rangerel, NULL);
+	if (prel == NULL)
+		return InvalidOid;
+	/* There is nothing to append new partitions to without any ranges */
+	if (rangerel == NULL || rangerel->ranges.length == 0)
+	{
+		LWLockRelease(pmstate->load_config_lock);
+		return InvalidOid;
+	}
 	ranges = dsm_array_get_pointer(&rangerel->ranges);
-	pos = range_binary_search(rangerel, &cmp_func, value, &found);
+	pos = range_binary_search(rangerel, cmp_func, value, &found);
 	if (found)
-		return ranges[pos].child_oid;
+		child_oid = ranges[pos].child_oid;
+	LWLockRelease(pmstate->load_config_lock);
+
+	if (found)
+		return child_oid;
+
+	/*
+	 * New partitions are visible in the cache before this transaction
+	 * commits, so keep others from creating partitions till then
+	 */
+	lock_partitions_creation(relid);
+
+	/* Check if someone else has already created partition */
+	LWLockAcquire(pmstate->load_config_lock, LW_SHARED);
+	key.dbid = MyDatabaseId;
+	key.relid = relid;
+	rangerel = pathman_hash_search(range_restrictions, &key, HASH_FIND, NULL);
+	if (rangerel != NULL && rangerel->ranges.length > 0)
+	{
+		ranges = dsm_array_get_pointer(&rangerel->ranges);
+		pos = range_binary_search(rangerel, cmp_func, value, &found);
+		if (found)
+			child_oid = ranges[pos].child_oid;
+	}
+	LWLockRelease(pmstate->load_config_lock);
+
+	/* Cache is locked only to read and update it, not during DDL */
+	if (!found)
+		child_oid = create_partitions(relid, value, value_type, true, &crashed);
+
+	if (!OidIsValid(child_oid))
+		elog(ERROR, "pg_pathman worker: unable to create partition for relation %u",
+			 relid);
+
+	return child_oid;
+}
+
+/*
+ * Inserts rows returned by the DELETE query directly into partitions (leaf
+ * ones if partitions are partitioned themselves). Missing RANGE partitions are
+ * created right here. Rows which can't be routed are inserted into the parent,
+ * so that the insert trigger would report an error
+ */
+static void
+route_tuples(Oid relid, HTAB *plans, SPITupleTable *tuptable, uint64 ntuples)
+{
+	TupleDesc			tupdesc = tuptable->tupdesc;
+	PartRelationInfo   *prel;
+	ListRelation	   *listrel = NULL;
+	FmgrInfo		   *cmp_func = NULL;
+	Oid					value_type = InvalidOid;
+	Datum			   *values;
+	char			   *nulls;
+	int					attnum;
+	PartType			parttype;
+	Oid					atttype;
+	bool				has_key_expr;
+	int					keys_count;
+	uint64				i;
+
+	/*
+	 * Copy what's needed out of the shared cache: it may be reloaded by the
+	 * insert trigger or by partition creation while rows are inserted
+	 */
+	prel = lock_pathman_relation_info(relid, NULL, NULL);
+	if (prel == NULL)
+		elog(ERROR, "Relation %u isn't partitioned by pg_pathman", relid);
+	attnum = prel->attnum;
+	parttype = prel->parttype;
+	atttype = prel->atttype;
+	has_key_expr = prel->has_key_expr;
+	keys_count = prel->keys_count;
+	LWLockRelease(pmstate->load_config_lock);
+
+	/* RETURNING * skips dropped columns so attnum may differ from parent's */
+	attnum = SPI_fnumber(tupdesc, get_attname(relid, attnum));
+	if (attnum <= 0)
+		elog(ERROR, "pg_pathman worker: partitioning key not found");
+
+	if (parttype == PT_RANGE)
+	{
+		value_type = has_key_expr ? atttype : SPI_gettypeid(tupdesc, attnum);
+		cmp_func = get_cmp_func(value_type, atttype);
+	}
+
+	values = palloc(sizeof(Datum) * tupdesc->natts);
+	nulls = palloc(sizeof(char) * tupdesc->natts);
+
+	for (i = 0; i < ntuples; i++)
+	{
+		HeapTuple	tuple = tuptable->vals[i];
+		Oid			child_oid = relid;
+		Datum		value;
+		bool		isnull;
+		int			j;
+
+		if (has_key_expr)
+			isnull = !get_partitioning_key(relid, tuple, tupdesc, &value);
+		else
+			value = SPI_getbinval(tuple, tupdesc, attnum, &isnull);
+		if (!isnull && parttype == PT_RANGE)
+		{
+			if (keys_count > 1)
+				child_oid = find_leaf_partition(relid, tuple, tupdesc);
+			else
+			{
+				child_oid = get_or_create_range_partition(relid, cmp_func,
+														  value, value_type);
+				if (!OidIsValid(child_oid))
+					child_oid = relid;
+			}
+		}
+		else if (!isnull &&
+				 (prel = lock_pathman_relation_info(relid, NULL, &listrel)) != NULL)
+		{
+			Oid	   *children = dsm_array_get_pointer(&prel->children);
+
+			if (prel->parttype == PT_HASH && prel->children_count > 0)
+			{
+				int		hash = get_hash_part_idx(value, prel->atttype,
+												 prel->children_count);
+
+				if (hash >= 0)
+					child_oid = children[hash];
+			}
+			else if (prel->parttype == PT_LIST && listrel != NULL)
+			{
+				int		idx;
+
+				idx = list_partition_lookup(dsm_array_get_pointer(&listrel->map),
+											listrel->map.length,
+											dsm_array_get_pointer(&listrel->values),
+											listrel->by_val, prel->atttype, value);
+				if (idx >= 0)
+					child_oid = children[idx];
+			}
+			LWLockRelease(pmstate->load_config_lock);
+		}
+
+		if (!isnull)
+		{
+
+			/* Partition may be partitioned itself */
+			if (child_oid != relid)
+				child_oid = find_leaf_partition(child_oid, tuple, tupdesc);
+		}
+
+		for (j = 0; j < tupdesc->natts; j++)
+		{
+			values[j] = SPI_getbinval(tuple, tupdesc, j + 1, &isnull);
+			nulls[j] = isnull ? 'n' : ' ';
+		}
+
+		if (SPI_execute_plan(get_insert_plan(plans, child_oid, tupdesc),
+							 values, nulls, false, 0) != SPI_OK_INSERT)
+			elog(ERROR, "pg_pathman worker: failed to insert row into %u",
+				 child_oid);
+	}
+
+	pfree(values);
+	pfree(nulls);
+}
+
+/*
+ * Builds tid[] which covers all possible tuples of blocks [start, end)
+ */
+static Datum
+make_tid_array(BlockNumber start, BlockNumber end)
+{
+	int				count = (end - start) * MaxHeapTuplesPerPage;
+	ItemPointer		tids = palloc(sizeof(ItemPointerData) * count);
+	Datum		   *elems = palloc(sizeof(Datum) * count);
+	BlockNumber		blkno;
+	OffsetNumber	off;
+	int				i = 0;
+
+	for (blkno = start; blkno < end; blkno++)
+		for (off = FirstOffsetNumber; off <= MaxHeapTuplesPerPage; off++)
+		{
+			ItemPointerSet(&tids[i], blkno, off);
+			elems[i] = PointerGetDatum(&tids[i]);
+			i++;
+		}
+
+	return PointerGetDatum(construct_array(elems, count, TIDOID,
+										   sizeof(ItemPointerData), false, 's'));
+}
+
+/*
+ * Returns condition which selects rows to be moved out of the old HASH
+ * partition being split, or an empty string for other sources
+ */
+static char *
+make_hash_split_filter(ConcurrentPartSlot *slot)
+{
+	PartRelationInfo   *prel;
+	int					children_count;
+
+	if (slot->hash_idx < 0)
+		return "";
+
+	prel = lock_pathman_relation_info(slot->relid, NULL, NULL);
+	if (prel == NULL)
+		elog(ERROR, "Relation %u isn't partitioned by pg_pathman", slot->relid);
+	children_count = prel->children_count;
+	LWLockRelease(pmstate->load_config_lock);
+
+	return psprintf(" AND %s.get_hash(%s, %d) <> %d",
+					quote_identifier(get_extension_schema()),
+					deparse_partitioning_key(slot->relid),
+					children_count, slot->hash_idx);
+}
+
+/*
+ * Old HASH partition doesn't contain rows of the new one anymore. Updates its
+ * constraint and the split position (see complete_hash_partition_split() in
+ * hash.sql). Returns the next partition to process or InvalidOid if the split
+ * is finished
+ */
+static Oid
+complete_hash_partition_split(Oid relid)
+{
+	Oid		argtypes[1] = { OIDOID };
+	Datum	args[1];
+	Datum	result;
+	bool	isnull;
+
+	args[0] = ObjectIdGetDatum(relid);
+	if (SPI_execute_with_args(
+			psprintf("SELECT %s.complete_hash_partition_split($1)",
+					 quote_identifier(get_extension_schema())),
+			1, argtypes, args, NULL, false, 1) != SPI_OK_SELECT)
+		elog(ERROR, "pg_pathman worker: failed to complete split of partition");
+
+	result = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc,
+						   1, &isnull);
+	return isnull ? InvalidOid : DatumGetObjectId(result);
+}
+
+/*
+ * Validates constraints of the old HASH partitions added by
+ * complete_hash_partition_split(). Runs in its own transaction, so the
+ * partition is only locked exclusively while the constraint is added
+ */
+static void
+validate_hash_partition_split(Oid relid)
+{
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+	validate_hash_split_constraints(relid);
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+}
+
+/*
+ * Validates constraints left NOT VALID by HASH partitions split (which may
+ * have been interrupted). Returns the number of validated constraints
+ */
+int
+validate_hash_split_constraints(Oid relid)
+{
+	Oid		argtypes[1] = { OIDOID };
+	Datum	args[1];
+	Datum	result;
+	bool	isnull;
+
+	SPI_connect();
+
+	args[0] = ObjectIdGetDatum(relid);
+	if (SPI_execute_with_args(
+			psprintf("SELECT %s.validate_hash_partition_split($1)",
+					 quote_identifier(get_extension_schema())),
+			1, argtypes, args, NULL, false, 1) != SPI_OK_SELECT)
+		elog(ERROR, "pg_pathman: failed to validate split partitions");
+
+	result = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc,
+						   1, &isnull);
+
+	SPI_finish();
+
+	return isnull ? 0 : DatumGetInt32(result);
+}
+
+/*
+ * Concurrent partitioning worker routine. Moves rows from its range of heap
+ * blocks to partitions in batches of about slot->batch_size rows, one
+ * transaction per batch. Rows are routed directly into partitions (see
+ * route_tuples()). Locked rows are skipped and retried later. Sweeping
+ * worker then moves the rest of the rows in batches of slot->batch_size.
+ * While HASH partitions are being split the worker goes through the old
+ * partitions one by one and moves only rows of the new partitions.
+ */
+static void
+partition_data_bg_worker_main(Datum main_arg)
+{
+	int					slot_idx = DatumGetInt32(main_arg);
+	ConcurrentPartSlot *slot = &concurrent_part_slots[slot_idx];
+	SPIPlanPtr			range_plan = NULL;
+	SPIPlanPtr			check_plan = NULL;
+	SPIPlanPtr			sweep_plan = NULL;
+	SPIPlanPtr			sweep_check_plan = NULL;
+	HTAB			   *insert_plans;
+	HASHCTL				ctl;
+	BlockNumber			blkno;
+	bool				finished = false;
+	bool				writers_waited = false;
+	uint64				total_rows = 0;
+
+	/* Free the slot whatever happens to the worker */
+	before_shmem_exit(release_concurrent_part_slot, main_arg);
+
+	BackgroundWorkerUnblockSignals();
+
+	/* Create resource owner */
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, "PartitionDataWorker");
+
+	SpinLockAcquire(&slot->mutex);
+	slot->pid = MyProcPid;
+	SpinLockRelease(&slot->mutex);
+
+	BackgroundWorkerInitializeConnectionByOid(slot->dbid, slot->userid);
+
+	/* Insert plans for partitions */
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(Oid);
+	ctl.entrysize = sizeof(PartitionInsertPlan);
+	insert_plans = hash_create("pg_pathman insert plans", 128, &ctl,
+							   HASH_ELEM | HASH_BLOBS);
+
+	blkno = slot->start_block;
+	while (!finished)
+	{
+		Oid			argtypes[1];
+		Datum		args[1];
+		bool		sweeping = (blkno >= slot->end_block);
+		BlockNumber	next_blkno = blkno;
+		uint64		rows;
+		bool		locked_rows = false;
+		bool		stop;
+		Oid			next_source = InvalidOid;
+		bool		partition_split = false;
+		BlockNumber	next_nblocks = 0;
+
+		/* Range is done and the rest is up to the sweeping worker */
+		if (sweeping && !slot->sweep)
+			break;
+
+		StartTransactionCommand();
+
+		/* Wait till split_hash_partitions() which has started us commits */
+		if (slot->hash_idx >= 0)
+			LockRelationOid(slot->relid, RowExclusiveLock);
+
+		SPI_connect();
+		PushActiveSnapshot(GetTransactionSnapshot());
+
+		/* Source relation (e.g. default partition) may have been dropped */
+		if (range_plan == NULL && get_rel_name(slot->source_relid) == NULL)
+		{
+			SPI_finish();
+			PopActiveSnapshot();
+			CommitTransactionCommand();
+			break;
+		}
+
+		/* Prepare queries once; they have to outlive the transaction */
+		if (range_plan == NULL)
+		{
+			char   *relname;
+			char   *filter;
+
+			argtypes[0] = get_array_type(TIDOID);
+			relname = quote_qualified_identifier(
+							get_namespace_name(get_rel_namespace(slot->source_relid)),
+							get_rel_name(slot->source_relid));
+			filter = make_hash_split_filter(slot);
+
+			range_plan = SPI_prepare(
+				psprintf("DELETE FROM ONLY %1$s WHERE ctid = ANY(ARRAY("
+						 "SELECT ctid FROM ONLY %1$s WHERE ctid = ANY($1)%2$s "
+						 "FOR UPDATE SKIP LOCKED)) RETURNING *", relname, filter),
+				1, argtypes);
+			check_plan = SPI_prepare(
+				psprintf("SELECT 1 FROM ONLY %s WHERE ctid = ANY($1)%s LIMIT 1",
+						 relname, filter),
+				1, argtypes);
+			sweep_plan = SPI_prepare(
+				psprintf("DELETE FROM ONLY %1$s WHERE ctid = ANY(ARRAY("
+						 "SELECT ctid FROM ONLY %1$s WHERE true%3$s LIMIT %2$d "
+						 "FOR UPDATE SKIP LOCKED)) RETURNING *",
+						 relname, slot->batch_size, filter),
+				0, NULL);
+			sweep_check_plan = SPI_prepare(
+				psprintf("SELECT 1 FROM ONLY %s WHERE true%s LIMIT 1",
+						 relname, filter),
+				0, NULL);
+
+			if (!range_plan || !check_plan || !sweep_plan || !sweep_check_plan)
+				elog(ERROR, "pg_pathman worker: failed to prepare queries");
+
+			SPI_keepplan(range_plan);
+			SPI_keepplan(check_plan);
+			SPI_keepplan(sweep_plan);
+			SPI_keepplan(sweep_check_plan);
+		}
+
+		if (!sweeping)
+		{
+			next_blkno = Min(blkno + slot->batch_blocks, slot->end_block);
+			args[0] = make_tid_array(blkno, next_blkno);
+
+			SPI_execute_plan(range_plan, args, NULL, false, 0);
+			rows = SPI_processed;
+			route_tuples(slot->relid, insert_plans, SPI_tuptable, rows);
+
+			/* Rows which are still there are locked by someone else */
+			SPI_execute_plan(check_plan, args, NULL, false, 1);
+			locked_rows = (SPI_processed > 0);
+		}
+		else
+		{
+			SPI_execute_plan(sweep_plan, NULL, NULL, false, 0);
+			rows = SPI_processed;
+			route_tuples(slot->relid, insert_plans, SPI_tuptable, rows);
+
+			/* Nothing was moved. Check whether there are locked rows left */
+			if (rows == 0)
+			{
+				SPI_execute_plan(sweep_check_plan, NULL, NULL, false, 1);
+				finished = (SPI_processed == 0);
+				locked_rows = !finished;
+			}
+
+			/* Old HASH partition is done, proceed to the next one */
+			if (finished && slot->hash_idx >= 0)
+			{
+				partition_split = true;
+				next_source = complete_hash_partition_split(slot->relid);
+				if (OidIsValid(next_source))
+				{
+					Relation	rel = heap_open(next_source, AccessShareLock);
+
+					next_nblocks = RelationGetNumberOfBlocks(rel);
+					heap_close(rel, AccessShareLock);
+				}
+			}
+		}
+
+		SPI_finish();
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+
+		if (partition_split)
+			validate_hash_partition_split(slot->relid);
+
+		/*
+		 * Rows of transactions which put them into default partition and
+		 * haven't committed yet are invisible to us. Wait for them and make
+		 * one more pass; anyone who writes later will ask for a new one
+		 */
+		if (finished && !writers_waited && slot->hash_idx < 0 &&
+			slot->source_relid != slot->relid)
+		{
+			wait_for_writers(slot->source_relid);
+			writers_waited = true;
+			finished = false;
+		}
+
+		/* Go to the next blocks only if current ones are done */
+		if (!locked_rows)
+			blkno = next_blkno;
+
+		/* Queries have to be prepared for the next partition */
+		if (OidIsValid(next_source))
+		{
+			SPI_freeplan(range_plan);
+			SPI_freeplan(check_plan);
+			SPI_freeplan(sweep_plan);
+			SPI_freeplan(sweep_check_plan);
+			range_plan = NULL;
+			blkno = 0;
+			finished = false;
+		}
+
+		SpinLockAcquire(&slot->mutex);
+		if (OidIsValid(next_source))
+		{
+			slot->source_relid = next_source;
+			slot->hash_idx++;
+			slot->start_block = 0;
+			slot->end_block = next_nblocks;
+		}
+		slot->total_rows += rows;
+		total_rows = slot->total_rows;
+		stop = (slot->worker_status == CPS_STOPPING);
+		if (finished && !stop)
+		{
+			if (slot->pending)
+			{
+				/* Someone has asked for one more pass */
+				slot->pending = false;
+				finished = false;
+				writers_waited = false;
+				locked_rows = true;
+			}
+			else
+			{
+				/*
+				 * Release the slot right here so that nobody could set
+				 * pending flag after we've checked it
+				 */
+				slot->worker_status = CPS_FREE;
+				slot->pid = 0;
+			}
+		}
+		SpinLockRelease(&slot->mutex);
+
+		if (stop)
+			break;
+
+		/* Rows are locked by someone else; wait a little */
+		if (locked_rows)
+			worker_sleep(slot->sleep_time);
+	}
+
+	elog(LOG, "pg_pathman worker: " UINT64_FORMAT " rows have been moved "
+			  "to partitions of relation %u", total_rows, slot->relid);
+}
+
+/*
+ * Waits till all transactions which are writing into the relation finish
+ */
+static void
+wait_for_writers(Oid relid)
+{
+	LOCKTAG		tag;
+
+	StartTransactionCommand();
+	SET_LOCKTAG_RELATION(tag, MyDatabaseId, relid);
+	WaitForLockers(tag, ShareLock);
+	CommitTransactionCommand();
+}
+
+/*
+ * Waits for the specified number of seconds
+ */
+static void
+worker_sleep(double seconds)
+{
+	int rc;
+
+	rc = WaitLatch(MyLatch,
+				   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+				   (long) (seconds * 1000L));
+	ResetLatch(MyLatch);
+
+	if (rc & WL_POSTMASTER_DEATH)
+		proc_exit(1);
+}
+
+/*
+ * Releases concurrent partitioning slot
+ */
+static void
+free_concurrent_part_slot(int code, Datum arg)
+{
+	ConcurrentPartSlot *slot = &concurrent_part_slots[DatumGetInt32(arg)];
+
+	SpinLockAcquire(&slot->mutex);
+	slot->worker_status = CPS_FREE;
+	SpinLockRelease(&slot->mutex);
+}
+
+/*
+ * Releases concurrent partitioning slot on worker's exit unless it has
+ * already been released (and probably occupied by another worker)
+ */
+static void
+release_concurrent_part_slot(int code, Datum arg)
+{
+	ConcurrentPartSlot *slot = &concurrent_part_slots[DatumGetInt32(arg)];
+
+	SpinLockAcquire(&slot->mutex);
+	if (slot->pid == MyProcPid)
+	{
+		slot->worker_status = CPS_FREE;
+		slot->pid = 0;
+	}
+	SpinLockRelease(&slot->mutex);
+}
+
+
+/*
+ * Registers prewarm launcher. Must be called from _PG_init()
+ */
+void
+register_prewarm_worker(void)
+{
+	BackgroundWorker	worker;
+
+	if (!pathman_prewarm)
+		return;
+
+	memset(&worker, 0, sizeof(worker));
+	snprintf(worker.bgw_name, BGW_MAXLEN, "pg_pathman prewarm launcher");
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
+		BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time = BGW_NEVER_RESTART;
+	worker.bgw_main = prewarm_launcher_main;
+	worker.bgw_main_arg = (Datum) 0;
+	worker.bgw_notify_pid = 0;
+
+	RegisterBackgroundWorker(&worker);
+}
+
+/*
+ * Prewarm launcher. Starts a worker for each database listed in
+ * pg_pathman.prewarm_databases (or for every database which allows
+ * connections if the list is empty). Databases are processed one by one
+ * since all of them would serialize on dsm_init_lock anyway
+ */
+static void
+prewarm_launcher_main(Datum main_arg)
+{
+	List		   *databases = NIL;
+	ListCell	   *lc;
+	MemoryContext	oldcontext = CurrentMemoryContext;
+
+	BackgroundWorkerUnblockSignals();
+
+	if (pathman_prewarm_databases != NULL && *pathman_prewarm_databases != '\0')
+	{
+		char *rawstring = pstrdup(pathman_prewarm_databases);
+
+		if (!SplitIdentifierString(rawstring, ',', &databases))
+			elog(ERROR, "pg_pathman: invalid list syntax in parameter "
+						"\"pg_pathman.prewarm_databases\"");
+	}
+	else
+	{
+		Relation		rel;
+		HeapScanDesc	scan;
+		HeapTuple		tuple;
+
+		/* Connect to shared catalogs only */
+		BackgroundWorkerInitializeConnection(NULL, NULL);
+		StartTransactionCommand();
+
+		rel = heap_open(DatabaseRelationId, AccessShareLock);
+		scan = heap_beginscan_catalog(rel, 0, NULL);
+		while ((tuple = heap_getnext(scan, ForwardScanDirection)) != NULL)
+		{
+			Form_pg_database db = (Form_pg_database) GETSTRUCT(tuple);
+			MemoryContext	txncontext;
+
+			if (!db->datallowconn || db->datistemplate)
+				continue;
+
+			/* The list must survive the transaction */
+			txncontext = MemoryContextSwitchTo(oldcontext);
+			databases = lappend(databases, pstrdup(NameStr(db->datname)));
+			MemoryContextSwitchTo(txncontext);
+		}
+		heap_endscan(scan);
+		heap_close(rel, AccessShareLock);
+
+		CommitTransactionCommand();
+	}
+
+	foreach(lc, databases)
+	{
+		char				   *dbname = (char *) lfirst(lc);
+		BackgroundWorker		worker;
+		BackgroundWorkerHandle *worker_handle;
+
+		memset(&worker, 0, sizeof(worker));
+		snprintf(worker.bgw_name, BGW_MAXLEN, "pg_pathman prewarm worker");
+		worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
+			BGWORKER_BACKEND_DATABASE_CONNECTION;
+		worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+		worker.bgw_restart_time = BGW_NEVER_RESTART;
+		worker.bgw_main = prewarm_bg_worker_main;
+		worker.bgw_main_arg = (Datum) 0;
+		worker.bgw_notify_pid = MyProcPid;
+		strlcpy(worker.bgw_extra, dbname, BGW_EXTRALEN);
+
+		if (!RegisterDynamicBackgroundWorker(&worker, &worker_handle))
+		{
+			elog(WARNING, "pg_pathman: could not start prewarm worker for database \"%s\"",
+				 dbname);
+			continue;
+		}
+		WaitForBackgroundWorkerShutdown(worker_handle);
+	}
+}
+
+/*
+ * Loads the cache for a single database. Database name is passed in
+ * bgw_extra
+ */
+static void
+prewarm_bg_worker_main(Datum main_arg)
+{
+	char	dbname[BGW_EXTRALEN];
+
+	BackgroundWorkerUnblockSignals();
+
+	/* Create resource owner */
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, "PrewarmWorker");
+
+	strlcpy(dbname, MyBgworkerEntry->bgw_extra, BGW_EXTRALEN);
+	BackgroundWorkerInitializeConnection(dbname, NULL);
+
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	if (initialization_needed)
+		load_config();
+
+	PopActiveSnapshot();
+	CommitTransactionCommand();
 
-	return 0;
+	elog(LOG, "pg_pathman: cache for database \"%s\" has been loaded", dbname);
 }